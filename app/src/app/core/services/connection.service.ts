@@ -71,6 +71,11 @@ export interface HotkeyEvent {
   timestamp: number;
 }
 
+// Binary midi_note frame format negotiated with the firmware (hello message)
+const NOTE_FRAME_VERSION = 1;
+const NOTE_FRAME_HEADER_SIZE = 4;
+const NOTE_FRAME_RECORD_SIZE = 8;
+
 @Injectable({
   providedIn: 'root'
 })
@@ -158,11 +163,14 @@ export class ConnectionService {
 
     try {
       this.ws = new WebSocket(wsUrl);
+      this.ws.binaryType = 'arraybuffer';
 
       this.ws.onopen = () => {
         console.log('WebSocket connected');
         this._connected.set(true);
         this.reconnectAttempts = 0;
+        // Opt in to binary midi_note frames; old firmware ignores unknown types
+        this.send('hello', { binary_notes: NOTE_FRAME_VERSION });
         this.requestStatus();
       };
 
@@ -177,7 +185,11 @@ export class ConnectionService {
       };
 
       this.ws.onmessage = (event) => {
-        this.handleMessage(event.data);
+        if (event.data instanceof ArrayBuffer) {
+          this.handleBinaryMessage(event.data);
+        } else {
+          this.handleMessage(event.data);
+        }
       };
     } catch (error) {
       console.error('Failed to connect:', error);
@@ -298,6 +310,52 @@ export class ConnectionService {
     this.send('play_note', { note, velocity, on });
   }
 
+  // Binary midi_note frame: 4-byte header ('P', 'N', version, count)
+  // followed by 8-byte records (note, velocity, flags, source, timeUs LE)
+  private handleBinaryMessage(data: ArrayBuffer): void {
+    const view = new DataView(data);
+    if (view.byteLength < NOTE_FRAME_HEADER_SIZE ||
+        view.getUint8(0) !== 0x50 || view.getUint8(1) !== 0x4e ||
+        view.getUint8(2) !== NOTE_FRAME_VERSION) {
+      console.warn('Unknown binary frame, ignoring');
+      return;
+    }
+
+    const count = view.getUint8(3);
+    for (let i = 0; i < count; i++) {
+      const offset = NOTE_FRAME_HEADER_SIZE + i * NOTE_FRAME_RECORD_SIZE;
+      if (offset + NOTE_FRAME_RECORD_SIZE > view.byteLength) break;
+      const flags = view.getUint8(offset + 2);
+      this.applyMidiNote(view.getUint8(offset), view.getUint8(offset + 1), (flags & 0x01) !== 0);
+    }
+  }
+
+  private applyMidiNote(note: number, velocity: number, on: boolean): void {
+    // Debug: log received MIDI note
+    console.log('[MIDI] Received:', on ? 'NOTE ON' : 'NOTE OFF',
+      'note=' + note, 'vel=' + velocity);
+
+    const midiNote: MidiNote = {
+      note,
+      velocity,
+      on,
+      timestamp: Date.now()
+    };
+    this._lastMidiNote.set(midiNote);
+
+    // Update active notes set
+    const notes = new Set(this._activeNotes());
+    if (midiNote.on) {
+      notes.add(midiNote.note);
+    } else {
+      notes.delete(midiNote.note);
+    }
+    this._activeNotes.set(notes);
+
+    // Debug: log active notes count
+    console.log('[MIDI] Active notes:', notes.size);
+  }
+
   private handleMessage(data: string): void {
     try {
       const message = JSON.parse(data);
@@ -360,29 +418,7 @@ export class ConnectionService {
           break;
 
         case 'midi_note':
-          // Debug: log received MIDI note
-          console.log('[MIDI] Received:', message.on ? 'NOTE ON' : 'NOTE OFF',
-            'note=' + message.note, 'vel=' + message.velocity);
-
-          const midiNote: MidiNote = {
-            note: message.note,
-            velocity: message.velocity,
-            on: message.on,
-            timestamp: Date.now()
-          };
-          this._lastMidiNote.set(midiNote);
-
-          // Update active notes set
-          const notes = new Set(this._activeNotes());
-          if (midiNote.on) {
-            notes.add(midiNote.note);
-          } else {
-            notes.delete(midiNote.note);
-          }
-          this._activeNotes.set(notes);
-
-          // Debug: log active notes count
-          console.log('[MIDI] Active notes:', notes.size);
+          this.applyMidiNote(message.note, message.velocity, message.on);
           break;
 
         case 'calibration_step':
@@ -435,6 +471,10 @@ export class ConnectionService {
           });
           break;
 
+        case 'hello':
+          console.log('Binary note frames:', message.binary_notes ? 'on' : 'off');
+          break;
+
         case 'error':
           console.error('Controller error:', message.message);
           break;
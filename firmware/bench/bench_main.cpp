@@ -0,0 +1,585 @@
+// Native microbenchmarks for the render path (env:native).
+//
+//   pio run -e native -t exec                 # all benchmarks
+//   .pio/build/native/program fade 5000       # name filter, iterations
+//
+// Every result is one JSON object per line on stdout, e.g.
+//   {"bench":"update","scenario":"point/chords","iterations":2000,
+//    "mean_ns":812,"median_ns":790,"p95_ns":1020,"min_ns":701,"max_ns":4410}
+// Time is virtual (native::nowUs) so effects advance exactly one fade step
+// per iteration; only the measured call is timed on the host clock.
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <chrono>
+#include <vector>
+#include "config.h"
+#include "led_controller.h"
+#include "hotkey_handler.h"
+#include "midi_event_ring.h"
+#include "pixel_kernels.h"
+#include "output_stage.h"
+#include "power_budget.h"
+
+// Play/pause hotkey is routed to the app in main.cpp
+void onHotkeyPlayPause() {}
+
+// Reaches the private effect steps of LEDController
+class LEDControllerBench {
+public:
+    static void fade(LEDController& c) { c.fade(); }
+    static void updateSplash(LEDController& c) { c.updateSplash(); }
+    static void animate(LEDController& c, uint8_t animation) {
+        c._animationOffset += c._animationSpeed / 10;
+        switch (animation) {
+            case 0: c.animateRainbow(); break;
+            case 1: c.animateSineWave(); break;
+            default: c.animateSparkle(); break;
+        }
+    }
+};
+
+// ============== Timing ==============
+
+typedef std::chrono::steady_clock Clock;
+
+static const char* g_filter = nullptr;
+static uint32_t g_iterations = 2000;
+
+struct Samples {
+    std::vector<uint32_t> ns;
+
+    void reserve(uint32_t n) { ns.clear(); ns.reserve(n); }
+    void add(Clock::time_point start, Clock::time_point end) {
+        ns.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+};
+
+static bool selected(const char* bench, const char* scenario) {
+    if (g_filter == nullptr) return true;
+    char name[96];
+    snprintf(name, sizeof(name), "%s/%s", bench, scenario);
+    return strstr(name, g_filter) != nullptr;
+}
+
+static void report(const char* bench, const char* scenario, Samples& s) {
+    if (s.ns.empty()) return;
+    std::sort(s.ns.begin(), s.ns.end());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < s.ns.size(); i++) sum += s.ns[i];
+    size_t n = s.ns.size();
+    printf("{\"bench\":\"%s\",\"scenario\":\"%s\",\"iterations\":%u,"
+           "\"mean_ns\":%llu,\"median_ns\":%u,\"p95_ns\":%u,\"min_ns\":%u,\"max_ns\":%u}\n",
+           bench, scenario, (unsigned)n, (unsigned long long)(sum / n),
+           s.ns[n / 2], s.ns[(n * 95) / 100], s.ns[0], s.ns[n - 1]);
+    fflush(stdout);
+}
+
+// ============== Scripted note loads ==============
+
+// One fade step of virtual time per frame so every update() does work
+static const uint32_t FRAME_MS = 20;
+static const uint8_t LOWEST_NOTE = 21;  // A0
+
+struct Load {
+    const char* name;
+    void (*step)(LEDController& c, uint32_t frame);
+};
+
+static void loadIdle(LEDController&, uint32_t) {}
+
+// Ten keys held down for the whole run
+static void loadHeld(LEDController& c, uint32_t frame) {
+    if (frame != 0) return;
+    static const uint8_t NOTES[] = { 36, 43, 48, 52, 55, 60, 64, 67, 72, 76 };
+    for (uint8_t i = 0; i < sizeof(NOTES); i++) c.noteOn(NOTES[i], 90);
+}
+
+// One note per frame over four octaves, each released on the next frame
+static void loadArpeggio(LEDController& c, uint32_t frame) {
+    static const uint8_t STEPS[] = { 0, 4, 7, 12, 16, 19, 24, 28, 31, 36, 31, 28, 24, 19, 16, 12, 7, 4 };
+    const uint8_t count = sizeof(STEPS);
+    if (frame > 0) c.noteOff(36 + STEPS[(frame - 1) % count]);
+    c.noteOn(36 + STEPS[frame % count], 60 + (frame * 7) % 60);
+}
+
+// A ten-note chord every 10 frames at a moving position
+static void loadChords(LEDController& c, uint32_t frame) {
+    static uint8_t base = LOWEST_NOTE;
+    if (frame % 10 != 0) return;
+    if (frame > 0) {
+        for (uint8_t i = 0; i < 10; i++) c.noteOff(base + i * 2);
+    }
+    base = LOWEST_NOTE + (frame / 10 * 13) % 70;
+    for (uint8_t i = 0; i < 10; i++) c.noteOn(base + i * 2, 100);
+}
+
+// Fast upward run; every key stays lit for four frames, so many LEDs fade at once
+static void loadGlissando(LEDController& c, uint32_t frame) {
+    if (frame >= 4) c.noteOff(LOWEST_NOTE + (frame - 4) % NUM_PIANO_KEYS);
+    c.noteOn(LOWEST_NOTE + frame % NUM_PIANO_KEYS, 110);
+}
+
+static const Load LOADS[] = {
+    { "idle",      loadIdle },
+    { "held10",    loadHeld },
+    { "arpeggio",  loadArpeggio },
+    { "chords",    loadChords },
+    { "glissando", loadGlissando },
+};
+static const uint8_t LOAD_COUNT = sizeof(LOADS) / sizeof(LOADS[0]);
+
+// ============== Controller configurations ==============
+
+struct Config {
+    const char* name;
+    void (*apply)(LEDController& c);
+};
+
+static void configPoint(LEDController& c) {
+    c.setMode(MODE_FREE_PLAY);
+}
+
+static void configSplash(LEDController& c) {
+    c.setMode(MODE_FREE_PLAY);
+    c.setSplashEnabled(true);
+}
+
+static void configBackground(LEDController& c) {
+    c.setMode(MODE_FREE_PLAY);
+    c.setBackgroundEnabled(true);
+    c.setBackgroundColor(160, 255, 40);
+}
+
+static void configLearning(LEDController& c) {
+    static const uint8_t EXPECTED[] = { 60, 64, 67 };
+    c.setMode(MODE_LEARNING);
+    c.setExpectedNotes(EXPECTED, sizeof(EXPECTED));
+}
+
+static const Config CONFIGS[] = {
+    { "point",      configPoint },
+    { "splash",     configSplash },
+    { "background", configBackground },
+    { "learning",   configLearning },
+};
+static const uint8_t CONFIG_COUNT = sizeof(CONFIGS) / sizeof(CONFIGS[0]);
+
+static LEDController* makeController(const Config& config) {
+    native::nowUs = 0;
+    srand(1);
+    LEDController* c = new LEDController();
+    c->begin();
+    config.apply(*c);
+    c->update();
+    c->show();
+    return c;
+}
+
+// ============== Benchmarks ==============
+
+enum Target { TARGET_UPDATE, TARGET_FRAME, TARGET_FADE, TARGET_SPLASH };
+
+// Scripted load untimed, then one timed call per frame
+static void benchLoad(const char* bench, Target target, const Config& config, const Load& load) {
+    char scenario[64];
+    snprintf(scenario, sizeof(scenario), "%s/%s", config.name, load.name);
+    if (!selected(bench, scenario)) return;
+
+    LEDController* c = makeController(config);
+    Samples s;
+    s.reserve(g_iterations);
+    const uint32_t warmup = g_iterations / 10;
+
+    for (uint32_t frame = 0; frame < warmup + g_iterations; frame++) {
+        native::advanceMs(FRAME_MS);
+        load.step(*c, frame);
+
+        Clock::time_point start = Clock::now();
+        switch (target) {
+            case TARGET_UPDATE: c->update(); break;
+            case TARGET_FRAME:  c->update(); c->show(); break;
+            case TARGET_FADE:   LEDControllerBench::fade(*c); break;
+            case TARGET_SPLASH: LEDControllerBench::updateSplash(*c); break;
+        }
+        Clock::time_point end = Clock::now();
+
+        if (frame >= warmup) s.add(start, end);
+        if (target == TARGET_FADE || target == TARGET_SPLASH) c->show();
+    }
+
+    report(bench, scenario, s);
+    delete c;
+}
+
+// Cost of applying one note-on, keys released untimed so the set stays realistic
+static void benchNoteOn(const Config& config) {
+    if (!selected("noteOn", config.name)) return;
+
+    LEDController* c = makeController(config);
+    Samples s;
+    s.reserve(g_iterations);
+
+    for (uint32_t i = 0; i < g_iterations; i++) {
+        uint8_t note = LOWEST_NOTE + (i * 37) % NUM_PIANO_KEYS;
+        native::advanceMs(5);
+
+        Clock::time_point start = Clock::now();
+        c->noteOn(note, 40 + (i * 11) % 87);
+        Clock::time_point end = Clock::now();
+        s.add(start, end);
+
+        if (i >= 8) c->noteOff(LOWEST_NOTE + ((i - 8) * 37) % NUM_PIANO_KEYS);
+        if (i % 4 == 0) c->update();
+    }
+
+    report("noteOn", config.name, s);
+    delete c;
+}
+
+static void benchAmbient() {
+    static const char* NAMES[] = { "rainbow", "sine", "sparkle" };
+
+    for (uint8_t animation = 0; animation < 3; animation++) {
+        if (!selected("ambient", NAMES[animation])) continue;
+
+        LEDController* c = makeController(CONFIGS[0]);
+        c->setMode(MODE_AMBIENT);
+        c->setAmbientAnimation(animation);
+        Samples s;
+        s.reserve(g_iterations);
+
+        for (uint32_t i = 0; i < g_iterations; i++) {
+            native::advanceMs(FRAME_MS);
+
+            Clock::time_point start = Clock::now();
+            LEDControllerBench::animate(*c, animation);
+            Clock::time_point end = Clock::now();
+            s.add(start, end);
+
+            c->show();
+        }
+
+        report("ambient", NAMES[animation], s);
+        delete c;
+    }
+}
+
+// Per-event cost of the hotkey path: ordinary notes (filtered out) and a
+// full A0+B0 combo that changes the colour
+static void benchHotkeys() {
+    LEDController* c = makeController(CONFIGS[0]);
+    ledController = c;
+
+    if (selected("hotkey", "passthrough")) {
+        HotkeyHandler handler;
+        Samples s;
+        s.reserve(g_iterations);
+
+        for (uint32_t i = 0; i < g_iterations; i++) {
+            native::advanceMs(5);
+            MidiEvent ev;
+            ev.timeUs = (uint32_t)native::nowUs;
+            ev.source = MIDI_SOURCE_USB;
+            ev.status = (i & 1) ? 0x80 : 0x90;
+            ev.data1 = 30 + (i / 2) % 60;
+            ev.data2 = (i & 1) ? 0 : 100;
+
+            Clock::time_point start = Clock::now();
+            handler.handleEvent(ev);
+            Clock::time_point end = Clock::now();
+            s.add(start, end);
+        }
+
+        report("hotkey", "passthrough", s);
+    }
+
+    if (selected("hotkey", "combo_color")) {
+        HotkeyHandler handler;
+        Samples s;
+        uint32_t rounds = g_iterations / 10 + 1;
+        s.reserve(rounds);
+
+        for (uint32_t i = 0; i < rounds; i++) {
+            MidiEvent ev;
+            ev.source = MIDI_SOURCE_USB;
+            ev.data2 = 100;
+            ev.status = 0x90;
+
+            ev.timeUs = (uint32_t)native::nowUs;
+            ev.data1 = HOTKEY_A0;
+            handler.handleEvent(ev);
+            ev.data1 = HOTKEY_B0;
+            handler.handleEvent(ev);
+
+            native::advanceMs(600);
+            ev.timeUs = (uint32_t)native::nowUs;
+            ev.data1 = (i & 1) ? HOTKEY_COLOR_A4 : HOTKEY_COLOR_C4;
+
+            Clock::time_point start = Clock::now();
+            handler.handleEvent(ev);
+            Clock::time_point end = Clock::now();
+            s.add(start, end);
+
+            ev.status = 0x80;
+            ev.data2 = 0;
+            ev.data1 = HOTKEY_A0;
+            handler.handleEvent(ev);
+            ev.data1 = HOTKEY_B0;
+            handler.handleEvent(ev);
+        }
+
+        report("hotkey", "combo_color", s);
+    }
+
+    ledController = nullptr;
+    delete c;
+}
+
+// ============== Pixel kernels ==============
+
+// Packed kernels against their scalar FastLED reference on the default
+// strip and on a long one. Output must match byte for byte before timing.
+static const uint16_t KERNEL_LONG_STRIP = 1024;
+static const uint8_t KERNEL_REPS = 16;     // Calls per sample, reported per call
+
+enum Kernel : uint8_t { K_FADE, K_SCALE, K_BLEND, K_ADD, K_MAX, K_COUNT };
+static const char* KERNEL_NAMES[K_COUNT] = { "fadeToBlack", "scale", "blendToward", "add", "max" };
+
+static void runKernel(Kernel k, bool packed, CRGB* dst, const CRGB* src, uint16_t count) {
+    const CRGB color(200, 40, 120);
+    switch (k) {
+        case K_FADE:  packed ? fadeToBlackSpan(dst, count, 20) : fadeToBlackSpanScalar(dst, count, 20); break;
+        case K_SCALE: packed ? scaleSpan(dst, count, 180) : scaleSpanScalar(dst, count, 180); break;
+        case K_BLEND: packed ? blendTowardSpan(dst, count, color, 64) : blendTowardSpanScalar(dst, count, color, 64); break;
+        case K_ADD:   packed ? addSpan(dst, src, count) : addSpanScalar(dst, src, count); break;
+        default:      packed ? maxSpan(dst, src, count) : maxSpanScalar(dst, src, count); break;
+    }
+}
+
+static void benchKernels() {
+    static const uint16_t LENGTHS[] = { LED_DEFAULT_COUNT, KERNEL_LONG_STRIP };
+
+    alignas(4) static CRGB input[KERNEL_LONG_STRIP];
+    alignas(4) static CRGB source[KERNEL_LONG_STRIP];
+    alignas(4) static CRGB work[KERNEL_LONG_STRIP];
+    alignas(4) static CRGB reference[KERNEL_LONG_STRIP];
+    for (uint16_t i = 0; i < KERNEL_LONG_STRIP; i++) {
+        input[i] = CRGB(random(256), random(256), random(256));
+        source[i] = CRGB(random(256), random(256), random(256));
+    }
+
+    for (uint8_t k = 0; k < K_COUNT; k++) {
+        for (uint8_t l = 0; l < 2; l++) {
+            uint16_t count = LENGTHS[l];
+
+            memcpy(work, input, sizeof(work));
+            memcpy(reference, input, sizeof(reference));
+            runKernel((Kernel)k, true, work, source, count);
+            runKernel((Kernel)k, false, reference, source, count);
+            if (memcmp(work, reference, count * sizeof(CRGB)) != 0) {
+                fprintf(stderr, "kernel %s/%u: packed output differs from scalar\n", KERNEL_NAMES[k], count);
+                exit(1);
+            }
+
+            for (uint8_t packed = 0; packed < 2; packed++) {
+                char scenario[48];
+                snprintf(scenario, sizeof(scenario), "%s/%u/%s", KERNEL_NAMES[k], count, packed ? "packed" : "scalar");
+                if (!selected("kernel", scenario)) continue;
+
+                Samples s;
+                s.reserve(g_iterations);
+                for (uint32_t i = 0; i < g_iterations; i++) {
+                    memcpy(work, input, count * sizeof(CRGB));
+
+                    Clock::time_point start = Clock::now();
+                    for (uint8_t r = 0; r < KERNEL_REPS; r++) {
+                        runKernel((Kernel)k, packed, work, source, count);
+                    }
+                    Clock::time_point end = Clock::now();
+                    s.add(start, end);
+                    s.ns.back() /= KERNEL_REPS;
+                }
+                report("kernel", scenario, s);
+            }
+        }
+    }
+}
+
+// ============== Output stage ==============
+
+// Per-frame cost of the output tables against FastLED's brightness scaling
+// (scale8 per channel, what the wire path did before). Checked first:
+// neutral tables equal scale8, and 256 dithered frames add up to the exact
+// 8.8 value, i.e. dithering loses nothing.
+static void checkOutputStage(const CRGB* input, uint16_t count) {
+    const uint8_t brightness = LED_BRIGHTNESS;
+    OutputStage stage;
+    stage.setBrightness(brightness);
+
+    static CRGB out[KERNEL_LONG_STRIP];
+    static CRGB reference[KERNEL_LONG_STRIP];
+    memcpy(reference, input, count * sizeof(CRGB));
+    scaleSpanScalar(reference, count, brightness);
+    stage.apply(input, out, 0, count - 1);
+    if (memcmp(out, reference, count * sizeof(CRGB)) != 0) {
+        fprintf(stderr, "output/%u: neutral tables differ from scale8\n", count);
+        exit(1);
+    }
+
+    static uint32_t sums[KERNEL_LONG_STRIP][3];
+    memset(sums, 0, sizeof(sums));
+    stage.setDither(true);
+    for (uint16_t frame = 0; frame < 256; frame++) {
+        stage.applyDithered(input, out, count);
+        for (uint16_t i = 0; i < count; i++) {
+            for (uint8_t ch = 0; ch < 3; ch++) sums[i][ch] += out[i].raw[ch];
+        }
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        for (uint8_t ch = 0; ch < 3; ch++) {
+            if (sums[i][ch] != (uint32_t)input[i].raw[ch] * (brightness + 1)) {
+                fprintf(stderr, "output/%u: dithered average of pixel %u is off\n", count, i);
+                exit(1);
+            }
+        }
+    }
+}
+
+static void benchOutput() {
+    static const uint16_t LENGTHS[] = { LED_DEFAULT_COUNT, KERNEL_LONG_STRIP };
+    static const char* MODES[] = { "scale8", "lut", "dither" };
+
+    alignas(4) static CRGB input[KERNEL_LONG_STRIP];
+    alignas(4) static CRGB out[KERNEL_LONG_STRIP];
+    for (uint16_t i = 0; i < KERNEL_LONG_STRIP; i++) {
+        input[i] = CRGB(random(256), random(256), random(256));
+    }
+
+    for (uint8_t l = 0; l < 2; l++) {
+        uint16_t count = LENGTHS[l];
+        checkOutputStage(input, count);
+
+        // Typical WS2812B calibration - the table contents do not change the cost
+        OutputStage stage;
+        stage.setBrightness(LED_BRIGHTNESS);
+        stage.setGamma(2.2f);
+        stage.setWhiteBalance(CRGB(255, 176, 240));
+
+        for (uint8_t m = 0; m < 3; m++) {
+            char scenario[48];
+            snprintf(scenario, sizeof(scenario), "%u/%s", count, MODES[m]);
+            if (!selected("output", scenario)) continue;
+
+            stage.setDither(m == 2);
+            Samples s;
+            s.reserve(g_iterations);
+            for (uint32_t i = 0; i < g_iterations; i++) {
+                if (m == 0) memcpy(out, input, count * sizeof(CRGB));
+
+                Clock::time_point start = Clock::now();
+                for (uint8_t r = 0; r < KERNEL_REPS; r++) {
+                    switch (m) {
+                        case 0:  scaleSpanScalar(out, count, LED_BRIGHTNESS); break;
+                        case 1:  stage.apply(input, out, 0, count - 1); break;
+                        default: stage.applyDithered(input, out, count); break;
+                    }
+                }
+                Clock::time_point end = Clock::now();
+                s.add(start, end);
+                s.ns.back() /= KERNEL_REPS;
+            }
+            report("output", scenario, s);
+        }
+    }
+}
+
+// ============== Power budget ==============
+
+// Current estimate per frame: FastLED's full-buffer scan (what
+// setMaxPowerInVoltsAndMilliamps did on every show()) against re-costing
+// the changed range and solving the budget. The changed range is a 24-LED
+// span moving along the strip, about a chord with splash.
+static const uint16_t POWER_CHANGED_SPAN = 24;
+
+static uint32_t fullScanMa(const CRGB* px, uint16_t count) {
+    uint32_t units = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        units += px[i].r * POWER_RED_MA + px[i].g * POWER_GREEN_MA + px[i].b * POWER_BLUE_MA;
+    }
+    return (units + (uint32_t)count * POWER_IDLE_MA * 255) / 255;
+}
+
+static void benchPower() {
+    static const uint16_t LENGTHS[] = { LED_DEFAULT_COUNT, LED_MAX_COUNT };
+    static CRGB wire[LED_MAX_COUNT];
+    static volatile uint32_t sink;
+
+    for (uint8_t l = 0; l < 2; l++) {
+        uint16_t count = LENGTHS[l];
+        LedLayout layout = LedLayout::defaults();
+        layout.segments[0].count = count;
+        PowerConfig config = PowerConfig::defaults(layout);
+        PowerBudget power;
+        power.configure(config, count);
+
+        for (uint16_t i = 0; i < count; i++) wire[i] = CRGB(random(256), random(256), random(256));
+        power.account(wire, 0, count - 1);
+        if (power.getEstimatedMa() != fullScanMa(wire, count)) {
+            fprintf(stderr, "power/%u: estimate differs from a full scan\n", count);
+            exit(1);
+        }
+
+        for (uint8_t incremental = 0; incremental < 2; incremental++) {
+            char scenario[48];
+            snprintf(scenario, sizeof(scenario), "%u/%s", count, incremental ? "incremental" : "full_scan");
+            if (!selected("power", scenario)) continue;
+
+            Samples s;
+            s.reserve(g_iterations);
+            for (uint32_t i = 0; i < g_iterations; i++) {
+                uint16_t first = (i * 7) % (count - POWER_CHANGED_SPAN);
+                uint16_t last = first + POWER_CHANGED_SPAN - 1;
+                for (uint16_t p = first; p <= last; p++) wire[p] = CRGB(random(256), random(256), random(256));
+
+                Clock::time_point start = Clock::now();
+                if (incremental) {
+                    power.account(wire, first, last);
+                    sink = power.solve();
+                } else {
+                    sink = fullScanMa(wire, count);
+                }
+                Clock::time_point end = Clock::now();
+                s.add(start, end);
+                if (!incremental) power.account(wire, first, last);
+            }
+            report("power", scenario, s);
+        }
+    }
+    (void)sink;     // Stored only so the timed calls are not optimised out
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "all") != 0) g_filter = argv[1];
+    if (argc > 2) g_iterations = (uint32_t)max(1L, atol(argv[2]));
+
+    for (uint8_t cfg = 0; cfg < CONFIG_COUNT; cfg++) {
+        for (uint8_t l = 0; l < LOAD_COUNT; l++) {
+            benchLoad("update", TARGET_UPDATE, CONFIGS[cfg], LOADS[l]);
+            benchLoad("frame", TARGET_FRAME, CONFIGS[cfg], LOADS[l]);
+            benchLoad("fade", TARGET_FADE, CONFIGS[cfg], LOADS[l]);
+        }
+    }
+    for (uint8_t l = 0; l < LOAD_COUNT; l++) {
+        benchLoad("updateSplash", TARGET_SPLASH, CONFIGS[1], LOADS[l]);
+    }
+    for (uint8_t cfg = 0; cfg < CONFIG_COUNT; cfg++) {
+        benchNoteOn(CONFIGS[cfg]);
+    }
+    benchAmbient();
+    benchHotkeys();
+    benchKernels();
+    benchOutput();
+    benchPower();
+    return 0;
+}
@@ -2,21 +2,115 @@
 #define PIANORA_CONFIG_H
 
 // ============== Hardware Pins ==============
-#define LED_PIN             18      // WS2812B data pin
+#define LED_DEFAULT_PIN     18      // WS2812B data pin of the default single-strip layout
 #define USB_DP_PIN          20      // USB D+ (native ESP32-S3)
 #define USB_DM_PIN          19      // USB D- (native ESP32-S3)
 
 // ============== LED Configuration ==============
-#define NUM_LEDS            176     // 88 keys * 2 LEDs per key
+#define LED_MAX_COUNT       600     // Buffer capacity - all segments together
+#define LED_DEFAULT_COUNT   176     // 88 keys * 2 LEDs per key, used until a layout is stored
+#define LED_MAX_SEGMENTS    4       // Strips on their own pins (ESP32-S3 has 4 RMT TX channels)
 #define NUM_PIANO_KEYS      88
 #define LEDS_PER_KEY        2
 #define LED_BRIGHTNESS      76      // Default brightness 30% (0-255)
-#define LED_MAX_POWER_MW    5000    // Max power in milliwatts
+#define LED_MAX_POWER_MW    5000    // Supply budget in milliwatts (default PowerConfig total)
+#define LED_KEEPALIVE_MS    0       // Re-push an unchanged frame every N ms (0 = off)
+
+// Pins a segment may be wired to. FastLED takes the pin as a template
+// argument, so every entry instantiates one controller type. Strapping
+// pins, USB (19/20) and the octal flash/PSRAM pins (26-37) are left out.
+#define LED_SEGMENT_PINS(X) X(18) X(4) X(5) X(6) X(7) X(15) X(16) X(17)
+
+// ============== Output Stage ==============
+// Gamma and white balance of the strip, folded into the per-channel output
+// tables together with brightness. The defaults reproduce plain brightness
+// scaling; typical WS2812B strips look right around gamma 2.2 with white
+// balance 255/176/240 (FastLED TypicalLEDStrip).
+#define OUTPUT_DEFAULT_GAMMA    1.0f    // 1.0 = linear
+#define OUTPUT_MIN_GAMMA        1.0f
+#define OUTPUT_MAX_GAMMA        3.0f
+#define OUTPUT_DEFAULT_WHITE_R  255
+#define OUTPUT_DEFAULT_WHITE_G  255
+#define OUTPUT_DEFAULT_WHITE_B  255
+#define OUTPUT_DEFAULT_DITHER   false   // Temporal dithering - pushes every frame while lit
+
+// ============== Power Budget ==============
+// WS2812B draw per channel at full scale and per dark LED (FastLED's model)
+#define POWER_SUPPLY_VOLTS      5
+#define POWER_RED_MA            16
+#define POWER_GREEN_MA          11
+#define POWER_BLUE_MA           15
+#define POWER_IDLE_MA           1
+#define POWER_MAX_ZONES         8       // Supply points with a budget of their own
+
+// ============== Settings Storage ==============
+#define SETTINGS_NVS_NAMESPACE "pianora"    // NVS is readable before LittleFS is mounted
+
+// ============== Render Task ==============
+#define RENDER_TASK_CORE        1       // Core the render task is pinned to
+#define RENDER_TASK_PRIORITY    3       // Below the USB tasks, above housekeeping
+#define RENDER_TASK_STACK       4096    // Bytes
+#define RENDER_DEFAULT_FPS      60      // Frames per second
+#define RENDER_MIN_FPS          10
+#define RENDER_MAX_FPS          200
+#define RENDER_LATENCY_MAX_NOTES 32     // Key presses per frame whose latency is recorded
 
 // ============== MIDI Configuration ==============
 #define LOWEST_MIDI_NOTE    21      // A0
 #define HIGHEST_MIDI_NOTE   108     // C8
 #define MAX_VELOCITY        127
+#define MIDI_EVENT_RING_SIZE 256    // Events between USB callback and stages (power of 2)
+
+// ============== Logging ==============
+#define LOG_LVL_NONE        0
+#define LOG_LVL_ERROR       1
+#define LOG_LVL_WARN        2
+#define LOG_LVL_INFO        3
+#define LOG_LVL_DEBUG       4       // Per-note messages
+#define LOG_LVL_TRACE       5
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL   LOG_LVL_INFO    // Anything more verbose is compiled out
+#endif
+#define LOG_DEFAULT_LEVEL   LOG_LVL_INFO    // Runtime level (set_log_level)
+#define LOG_RING_SIZE       128     // Records (power of 2)
+#define LOG_MAX_ARGS        4       // Integer/static-string arguments per record
+#define LOG_TASK_CORE       0
+#define LOG_TASK_PRIORITY   1       // Below housekeeping - only runs when nothing else does
+#define LOG_TASK_STACK      3072
+#define LOG_DRAIN_INTERVAL_MS 20
+
+// ============== Tasks ==============
+// Every task blocks on its own event source; loop() is not used.
+// The render task is configured in its own section above.
+#define USB_LIB_TASK_CORE       1       // usb_host_lib_handle_events() - attach/detach
+#define USB_LIB_TASK_PRIORITY   5
+#define USB_LIB_TASK_STACK      3072
+#define USB_CLIENT_TASK_CORE    1       // Client events and MIDI IN transfer callbacks
+#define USB_CLIENT_TASK_PRIORITY 4
+#define USB_CLIENT_TASK_STACK   4096
+#define HOUSEKEEPING_TASK_CORE  0       // Hotkey + network stages, periodic chores
+#define HOUSEKEEPING_TASK_PRIORITY 2
+#define HOUSEKEEPING_TASK_STACK 6144
+#define HOUSEKEEPING_INTERVAL_MS 100    // Chores tick: WS cleanup, rate gauge, uptime log
+
+// ============== Boot ==============
+#define BOOT_ANIMATION_STEP_MS  6       // Boot wave advances one LED per step (~1.2 s)
+#define NET_BOOT_TASK_CORE      0       // WiFi/LittleFS/web server bring-up runs here
+#define NET_BOOT_TASK_PRIORITY  1
+#define NET_BOOT_TASK_STACK     6144
+
+// ============== Metrics ==============
+#define METRICS_MAX_ENTRIES 48      // Registered metric families (/api/metrics)
+#define METRICS_MAX_BUCKETS 16      // Bounds per histogram, +Inf is implicit
+
+// ============== WebSocket ==============
+#define WS_MAX_CLIENTS      8       // Same as ESPAsyncWebServer's DEFAULT_MAX_WS_CLIENTS
+#define WS_MAX_MESSAGE_SIZE 8192    // Largest command reassembled from fragments (bulk lesson/song loads)
+#define WS_NOTE_FRAME_VERSION 1     // Binary midi_note frame format (see ws_note_stream.h)
+#define WS_NOTE_BATCH_MS    10      // Coalesce notes for this long before sending (0 = per note)
+#define WS_NOTE_BATCH_MAX_MS 50
+#define WS_NOTE_BATCH_MAX   32      // Records per frame - a full batch is flushed early
 
 // ============== Feature Flags ==============
 #define USE_ELEGANT_OTA     1
@@ -34,7 +128,8 @@ enum LEDMode {
     MODE_AMBIENT = 5,       // Decorative effects
     MODE_LEARNING = 6,      // Learning mode hints
     MODE_DEMO = 7,          // Auto-play demos
-    MODE_KIDS_RAINBOW = 8   // Kids mode - rainbow by octave
+    MODE_KIDS_RAINBOW = 8,  // Kids mode - rainbow by octave
+    MODE_GAME = 9           // Falling notes game
 };
 
 // ============== Default Settings ==============
@@ -43,39 +138,88 @@ enum LEDMode {
 #define DEFAULT_SATURATION  0       // White (no color) for default
 
 // ============== USB MIDI Buffers ==============
-#define MIDI_IN_BUFFERS     8       // Number of IN transfer buffers
+#define MIDI_IN_BUFFERS     8       // Most IN transfers the driver can keep in flight
+#define USB_MIDI_IN_TRANSFERS 4     // IN transfers in flight by default (1..MIDI_IN_BUFFERS)
+#define USB_MIDI_TRANSFER_SIZE 64   // Bytes per IN transfer (full-speed bulk max packet)
+#define USB_MIDI_CLIENT_EVENTS 5    // Client event queue depth (attach/detach)
 
 // ============== Calibration ==============
+#define CALIBRATION_FILE        "/calibration.json"     // Key map in LittleFS
+#define CALIBRATION_TIMEOUT_MS  120000  // A session without input ends (adjustments are kept)
+
 enum CalibrationState {
     CALIB_IDLE = 0,
-    CALIB_WAIT_FIRST_KEY = 1,
-    CALIB_WAIT_LAST_KEY = 2,
-    CALIB_COMPLETE = 3
+    CALIB_WAIT_FIRST_KEY = 1,   // Quick: press the lowest key
+    CALIB_WAIT_LAST_KEY = 2,    // Quick: press the highest key
+    CALIB_COMPLETE = 3,
+    CALIB_ADJUST_SPAN = 4,      // Quick: lowest key shrinks, highest key stretches the span
+    CALIB_SELECT_KEY = 5        // Detailed: press a key, the app moves its LED
+};
+
+enum CalibrationType : uint8_t {
+    CALIB_TYPE_NONE = 0,        // Factory table
+    CALIB_TYPE_QUICK = 1,       // Interpolated between the first and last key
+    CALIB_TYPE_DETAILED = 2     // LED set per key
 };
 
 struct CalibrationData {
+    uint8_t type;           // CalibrationType
     uint8_t firstNote;      // MIDI note number of first (lowest) key
     uint8_t lastNote;       // MIDI note number of last (highest) key
-    uint8_t firstLed;       // LED index for first key
-    uint8_t lastLed;        // LED index for last key
+    uint16_t firstLed;      // LED index for first key (key segment)
+    uint16_t lastLed;       // LED index for last key
     bool calibrated;        // Has calibration been done?
 };
 
 // ============== Recording ==============
-#define MAX_RECORDING_NOTES 1000    // ~5 minutes of playing
-#define RECORDING_TIMEOUT_MS 300000 // 5 minutes max
+// Events stream to LittleFS as they are played - length is limited by free space only
+#define RECORDER_DIR            "/recordings"   // One file per recording: <id>.rec
+#define RECORDER_BLOCK_SIZE     1024    // Bytes per RAM block; two blocks alternate
+#define RECORDER_FLUSH_MS       2000    // A partial block is written after this long
+#define RECORDER_TASK_CORE      0       // Block writer
+#define RECORDER_TASK_PRIORITY  1       // Below housekeeping - flash writes may take a while
+#define RECORDER_TASK_STACK     4096
 
-struct RecordedNote {
-    uint32_t timestamp;     // Milliseconds from recording start
-    uint8_t note;           // MIDI note number
-    uint8_t velocity;       // 0 = note off, 1-127 = note on
-};
+// ============== Song Player ==============
+// Standard MIDI Files played on the device; play_song looks in the upload
+// directory first, then in the app's built-in songs
+#define PLAYER_SONG_DIR         "/songs"
+#define PLAYER_BUILTIN_DIR      "/assets/midi/builtin"
+#define PLAYER_MAX_NAME         48      // File name length, without directory
+#define PLAYER_MAX_TRACKS       16      // Type 1 tracks merged; further tracks are ignored
+#define PLAYER_TRACK_BUFFER     64      // Read-ahead bytes per track
+#define PLAYER_QUEUE_SIZE       64      // Timed note events ahead of the timer (power of 2)
+#define PLAYER_DEFAULT_SPEED    100     // Tempo in percent
+#define PLAYER_MIN_SPEED        25
+#define PLAYER_MAX_SPEED        200
+#define PLAYER_TASK_CORE        0       // File reading and parsing; the timer emits the notes
+#define PLAYER_TASK_PRIORITY    2
+#define PLAYER_TASK_STACK       4096
 
-struct RecordingState {
-    bool isRecording;
-    uint32_t startTime;
-    uint16_t noteCount;
-    RecordedNote notes[MAX_RECORDING_NOTES];
-};
+// ============== Lesson Follower ==============
+// Learning mode lesson held on the device; the cursor moves on correct input
+#define LESSON_MAX_STEPS        1024    // Chords/single notes of one lesson
+#define LESSON_MAX_NOTES        4096    // Notes over all steps
+#define LESSON_MAX_LOOKAHEAD    3       // Upcoming steps lit behind the current one
+#define LESSON_DEFAULT_LOOKAHEAD 1
+#define LESSON_REPORT_QUEUE     16      // Progress/error reports waiting for the network stage
+
+// ============== Game Mode ==============
+// Falling notes: the song's notes are preloaded, hits are judged on the device
+#define GAME_MAX_NOTES          2048    // Notes of one song
+#define GAME_WINDOW_SIZE        64      // Notes on the strip at once (power of two)
+#define GAME_DEFAULT_SPEED      5       // Fall speed 1-10
+#define GAME_FALL_SLOWEST_MS    4000    // Look-ahead at speed 1
+#define GAME_FALL_FASTEST_MS    800     // Look-ahead at speed 10
+#define GAME_MIN_LOOKAHEAD_MS   300     // Range of an explicit look_ahead_ms
+#define GAME_MAX_LOOKAHEAD_MS   10000
+#define GAME_FALL_SPAN          16      // LEDs a note travels to reach its key
+#define GAME_HIT_EASY_MS        150     // Hit window either side of the note
+#define GAME_HIT_MEDIUM_MS      100
+#define GAME_HIT_HARD_MS        60
+#define GAME_FLASH_MS           250     // Hit/miss flash on the key
+#define GAME_COMBO_STEP         10      // Hits in a row per multiplier step
+#define GAME_MAX_MULTIPLIER     4
+#define GAME_REPORT_QUEUE       32      // Hit/miss reports waiting for the network stage
 
 #endif // PIANORA_CONFIG_H
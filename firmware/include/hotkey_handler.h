@@ -41,30 +41,46 @@
 #define HOTKEY_HUE_BLUE   160
 #define HOTKEY_HUE_VIOLET 192
 
+struct MidiEvent;
+
+// Tracks the A0+B0 activation combo from the event stream.
+// Every pipeline stage that must hide hotkey presses (render, network, hotkey
+// execution itself) owns one and feeds it the same events, so they all agree
+// without sharing state across tasks. Hold time is measured on the event
+// timestamps, not on when the stage happens to drain the ring.
+class HotkeyFilter {
+public:
+    HotkeyFilter();
+
+    // Returns true if the event is a hotkey action press (swallow it)
+    bool filter(const MidiEvent& ev);
+
+private:
+    static const uint32_t HOLD_TIME_US = 500000;  // Keys must be held for at least 500ms
+
+    bool _a0Down;
+    bool _b0Down;
+    uint32_t _a0DownUs;
+    uint32_t _b0DownUs;
+};
+
 class HotkeyHandler {
 public:
     HotkeyHandler();
 
-    // Call on every MIDI note event
-    void noteOn(uint8_t note, uint8_t velocity);
-    void noteOff(uint8_t note);
-
-    // Check if current note combination triggers a hotkey
-    // Returns true if hotkey was activated (caller should suppress normal LED behavior)
-    bool checkHotkey();
+    // Call on every MIDI event drained from the ring
+    // Returns true if a hotkey was executed
+    bool handleEvent(const MidiEvent& ev);
 
-    // Check if a note is part of activation combo (A1 or B1)
-    bool isActivationNote(uint8_t note);
+    // Check if a note is part of activation combo (A0 or B0)
+    static bool isActivationNote(uint8_t note);
 
 private:
-    static const uint8_t MAX_PRESSED = 10;
-    static const uint32_t HOLD_TIME_MS = 500;  // Keys must be held for at least 500ms
+    HotkeyFilter _filter;
 
-    uint8_t _pressedNotes[MAX_PRESSED];
-    uint32_t _pressedTimes[MAX_PRESSED];
-    uint8_t _pressedCount;
+    static const uint16_t FEEDBACK_SHORT_MS = 150;  // Confirmation / colour
+    static const uint16_t FEEDBACK_LONG_MS = 200;   // Level indicators (brightness, wave width)
 
-    bool isActivationPressed();
     void executeHotkey(uint8_t actionNote);
     uint8_t getHueForNote(uint8_t note);
     void flashConfirmation();
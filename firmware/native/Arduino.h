@@ -0,0 +1,84 @@
+#ifndef PIANORA_NATIVE_ARDUINO_H
+#define PIANORA_NATIVE_ARDUINO_H
+
+// Minimal Arduino core shim for the native (host) build.
+// Only what LEDController / HotkeyHandler touch is provided; time is
+// virtual and advanced explicitly by the benchmark driver.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+namespace native {
+extern uint64_t nowUs;              // Virtual clock, microseconds
+inline void advanceUs(uint64_t us) { nowUs += us; }
+inline void advanceMs(uint32_t ms) { nowUs += (uint64_t)ms * 1000; }
+}
+
+inline unsigned long millis() { return (unsigned long)(native::nowUs / 1000); }
+inline unsigned long micros() { return (unsigned long)native::nowUs; }
+inline void delay(unsigned long ms) { native::advanceMs(ms); }
+inline void yield() {}
+
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) {
+    return howsmall >= howbig ? howsmall : howsmall + rand() % (howbig - howsmall);
+}
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[256];
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        if (len < 0) return 0;
+        return write((const uint8_t*)buffer, min((size_t)len, sizeof(buffer) - 1));
+    }
+};
+
+// Serial goes to stderr so benchmark output on stdout stays machine-readable
+class NativeSerial {
+public:
+    void begin(unsigned long) {}
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, fmt);
+        int len = vfprintf(stderr, fmt, args);
+        va_end(args);
+        return len;
+    }
+    void print(const char* s) { fputs(s, stderr); }
+    void println(const char* s = "") { fprintf(stderr, "%s\n", s); }
+};
+extern NativeSerial Serial;
+
+struct NativeEsp {
+    uint32_t getCycleCount() const;     // Host nanoseconds, truncated
+    uint32_t getFreeHeap() const { return 0; }
+};
+extern NativeEsp ESP;
+
+#endif // PIANORA_NATIVE_ARDUINO_H
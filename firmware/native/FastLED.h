@@ -0,0 +1,247 @@
+#ifndef PIANORA_NATIVE_FASTLED_H
+#define PIANORA_NATIVE_FASTLED_H
+
+// Minimal FastLED shim for the native (host) build.
+// Pixel math (scale8, blend8, nscale8, nblend) follows FastLED 3.7 with
+// FASTLED_SCALE8_FIXED / FASTLED_BLEND_FIXED so results are bit-identical
+// to the device. show() only captures the frame; nothing is driven.
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t fract8;
+
+#define DISABLE_DITHER 0x00
+#define BINARY_DITHER  0x01
+
+inline uint8_t scale8(uint8_t i, fract8 scale) {
+    return (uint8_t)(((uint16_t)i * (1 + (uint16_t)scale)) >> 8);
+}
+
+inline uint8_t scale8_video(uint8_t i, fract8 scale) {
+    return (uint8_t)((((int)i * (int)scale) >> 8) + ((i && scale) ? 1 : 0));
+}
+
+inline uint8_t qadd8(uint8_t i, uint8_t j) {
+    unsigned t = i + j;
+    return t > 255 ? 255 : (uint8_t)t;
+}
+
+inline uint8_t qsub8(uint8_t i, uint8_t j) {
+    return i > j ? (uint8_t)(i - j) : 0;
+}
+
+inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB) {
+    uint16_t amountOfA = 255 - amountOfB;
+    uint16_t partial = (uint16_t)(a * amountOfA);
+    partial += a;
+    partial += (uint16_t)(b * amountOfB);
+    partial += b;
+    return (uint8_t)(partial >> 8);
+}
+
+inline uint8_t sin8(uint8_t theta) {
+    static const uint8_t b_m16_interleave[] = { 0, 49, 49, 41, 90, 27, 117, 10 };
+    uint8_t offset = theta;
+    if (theta & 0x40) offset = (uint8_t)255 - offset;
+    offset &= 0x3F;
+    uint8_t secoffset = offset & 0x0F;
+    if (theta & 0x40) ++secoffset;
+    uint8_t section = offset >> 4;
+    uint8_t s2 = section * 2;
+    const uint8_t* p = b_m16_interleave + s2;
+    uint8_t b = *p++;
+    uint8_t m16 = *p;
+    uint8_t mx = (uint8_t)((m16 * secoffset) >> 4);
+    int8_t y = (int8_t)(mx + b);
+    if (theta & 0x80) y = -y;
+    y += 128;
+    return (uint8_t)y;
+}
+
+struct CHSV {
+    union {
+        struct {
+            union { uint8_t hue; uint8_t h; };
+            union { uint8_t saturation; uint8_t sat; uint8_t s; };
+            union { uint8_t value; uint8_t val; uint8_t v; };
+        };
+        uint8_t raw[3];
+    };
+    CHSV() : h(0), s(0), v(0) {}
+    CHSV(uint8_t ih, uint8_t is, uint8_t iv) : h(ih), s(is), v(iv) {}
+};
+
+struct CRGB;
+void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb);
+
+struct CRGB {
+    union {
+        struct {
+            union { uint8_t r; uint8_t red; };
+            union { uint8_t g; uint8_t green; };
+            union { uint8_t b; uint8_t blue; };
+        };
+        uint8_t raw[3];
+    };
+
+    CRGB() : r(0), g(0), b(0) {}
+    CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    CRGB(uint32_t colorcode)
+        : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+    CRGB(const CHSV& hsv) { hsv2rgb_rainbow(hsv, *this); }
+
+    CRGB& operator=(const CHSV& hsv) { hsv2rgb_rainbow(hsv, *this); return *this; }
+
+    uint8_t& operator[](uint8_t x) { return raw[x]; }
+    const uint8_t& operator[](uint8_t x) const { return raw[x]; }
+
+    CRGB& nscale8(uint8_t scaledown) {
+        uint16_t scale_fixed = scaledown + 1;
+        r = (uint8_t)((r * scale_fixed) >> 8);
+        g = (uint8_t)((g * scale_fixed) >> 8);
+        b = (uint8_t)((b * scale_fixed) >> 8);
+        return *this;
+    }
+    CRGB& fadeToBlackBy(uint8_t fadefactor) { return nscale8(255 - fadefactor); }
+
+    uint8_t getLuma() const {
+        return (uint8_t)(scale8(r, 54) + scale8(g, 183) + scale8(b, 18));
+    }
+
+    CRGB& operator+=(const CRGB& rhs) {
+        r = qadd8(r, rhs.r); g = qadd8(g, rhs.g); b = qadd8(b, rhs.b);
+        return *this;
+    }
+
+    explicit operator bool() const { return r || g || b; }
+
+    enum HTMLColorCode { Black = 0x000000, White = 0xFFFFFF, Red = 0xFF0000, Green = 0x008000, Blue = 0x0000FF };
+};
+
+inline bool operator==(const CRGB& a, const CRGB& b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+inline bool operator!=(const CRGB& a, const CRGB& b) { return !(a == b); }
+
+inline void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb) {
+    // Piecewise-linear six-sector conversion. Not FastLED's exact rainbow
+    // table, but deterministic and close enough for profiling.
+    uint8_t region = hsv.h / 43;
+    uint8_t remainder = (uint8_t)((hsv.h - region * 43) * 6);
+    uint8_t p = scale8(hsv.v, 255 - hsv.s);
+    uint8_t q = scale8(hsv.v, 255 - scale8(hsv.s, remainder));
+    uint8_t t = scale8(hsv.v, 255 - scale8(hsv.s, 255 - remainder));
+    switch (region) {
+        case 0:  rgb = CRGB(hsv.v, t, p); break;
+        case 1:  rgb = CRGB(q, hsv.v, p); break;
+        case 2:  rgb = CRGB(p, hsv.v, t); break;
+        case 3:  rgb = CRGB(p, q, hsv.v); break;
+        case 4:  rgb = CRGB(t, p, hsv.v); break;
+        default: rgb = CRGB(hsv.v, p, q); break;
+    }
+}
+
+inline CHSV rgb2hsv_approximate(const CRGB& rgb) {
+    uint8_t mx = rgb.r > rgb.g ? (rgb.r > rgb.b ? rgb.r : rgb.b) : (rgb.g > rgb.b ? rgb.g : rgb.b);
+    uint8_t mn = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
+    if (mx == 0) return CHSV(0, 0, 0);
+    uint8_t delta = mx - mn;
+    uint8_t s = (uint8_t)((255 * delta) / mx);
+    if (delta == 0) return CHSV(0, 0, mx);
+    int h;
+    if (mx == rgb.r)      h = 0 + 43 * (rgb.g - rgb.b) / delta;
+    else if (mx == rgb.g) h = 85 + 43 * (rgb.b - rgb.r) / delta;
+    else                  h = 171 + 43 * (rgb.r - rgb.g) / delta;
+    return CHSV((uint8_t)h, s, mx);
+}
+
+inline CRGB& nblend(CRGB& existing, const CRGB& overlay, fract8 amountOfOverlay) {
+    if (amountOfOverlay == 0) return existing;
+    if (amountOfOverlay == 255) { existing = overlay; return existing; }
+    existing.r = blend8(existing.r, overlay.r, amountOfOverlay);
+    existing.g = blend8(existing.g, overlay.g, amountOfOverlay);
+    existing.b = blend8(existing.b, overlay.b, amountOfOverlay);
+    return existing;
+}
+
+inline void fill_solid(CRGB* leds, int numToFill, const CRGB& color) {
+    for (int i = 0; i < numToFill; i++) leds[i] = color;
+}
+
+// Chipset / colour-order tags accepted by addLeds<>()
+struct WS2812B {};
+enum EOrder { RGB = 0012, GRB = 0102 };
+
+class CNativeLEDController {
+public:
+    CNativeLEDController& setCorrection(uint32_t) { return *this; }
+    CNativeLEDController& setDither(uint8_t) { return *this; }
+};
+
+class CFastLED {
+public:
+    template <typename CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    CNativeLEDController& addLeds(CRGB* data, int nLeds, int offset = 0) {
+        // Re-registering a pin replaces it (the bench creates many controllers)
+        for (int c = 0; c < _numControllers; c++) {
+            if (_pins[c] == DATA_PIN) {
+                _data[c] = data + offset;
+                _count[c] = nLeds;
+                return _controller;
+            }
+        }
+        if (_numControllers < MAX_CONTROLLERS) {
+            _data[_numControllers] = data + offset;
+            _count[_numControllers] = nLeds;
+            _pins[_numControllers] = DATA_PIN;
+            _numControllers++;
+        }
+        return _controller;
+    }
+
+    void setBrightness(uint8_t scale) { _brightness = scale; }
+    uint8_t getBrightness() const { return _brightness; }
+    void setMaxPowerInVoltsAndMilliamps(uint8_t, uint32_t) {}
+    void setDither(uint8_t) {}
+    void setCorrection(uint32_t) {}
+
+    // Capture-only: counts frames, keeps a copy of the strips end to end
+    // in registration order as they would go on the wire (global
+    // brightness applied like FastLED's scale8, no dithering)
+    void show() {
+        _shows++;
+        int captured = 0;
+        for (int c = 0; c < _numControllers && captured < CAPTURE_MAX; c++) {
+            int n = _count[c] < CAPTURE_MAX - captured ? _count[c] : CAPTURE_MAX - captured;
+            for (int i = 0; i < n; i++) {
+                const CRGB& px = _data[c][i];
+                _captured[captured + i] = CRGB(scale8(px.r, _brightness), scale8(px.g, _brightness), scale8(px.b, _brightness));
+            }
+            captured += n;
+        }
+    }
+    void clear(bool writeData = false) {
+        for (int c = 0; c < _numControllers; c++) fill_solid(_data[c], _count[c], CRGB(0, 0, 0));
+        if (writeData) show();
+    }
+
+    uint32_t showCount() const { return _shows; }
+    void resetShowCount() { _shows = 0; }
+    const CRGB* captured() const { return _captured; }
+    int controllerCount() const { return _numControllers; }
+
+private:
+    static const int MAX_CONTROLLERS = 8;
+    static const int CAPTURE_MAX = 1024;
+    CRGB* _data[MAX_CONTROLLERS] = {};
+    int _count[MAX_CONTROLLERS] = {};
+    uint8_t _pins[MAX_CONTROLLERS] = {};
+    int _numControllers = 0;
+    uint8_t _brightness = 255;
+    uint32_t _shows = 0;
+    CRGB _captured[CAPTURE_MAX];
+    CNativeLEDController _controller;
+};
+
+extern CFastLED FastLED;
+
+#endif // PIANORA_NATIVE_FASTLED_H
@@ -0,0 +1,17 @@
+#ifndef PIANORA_NATIVE_PREFERENCES_H
+#define PIANORA_NATIVE_PREFERENCES_H
+
+#include <Arduino.h>
+
+// No NVS on the host: the namespace never opens, so stored settings fall
+// back to their defaults and nothing is written
+class Preferences {
+public:
+    bool begin(const char*, bool = false) { return false; }
+    void end() {}
+    size_t getBytesLength(const char*) { return 0; }
+    size_t getBytes(const char*, void*, size_t) { return 0; }
+    size_t putBytes(const char*, const void*, size_t) { return 0; }
+};
+
+#endif // PIANORA_NATIVE_PREFERENCES_H
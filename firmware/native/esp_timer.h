@@ -0,0 +1,9 @@
+#ifndef PIANORA_NATIVE_ESP_TIMER_H
+#define PIANORA_NATIVE_ESP_TIMER_H
+
+#include <Arduino.h>
+
+// Same virtual clock as micros()
+inline int64_t esp_timer_get_time() { return (int64_t)native::nowUs; }
+
+#endif // PIANORA_NATIVE_ESP_TIMER_H
@@ -0,0 +1,29 @@
+#ifndef PIANORA_NATIVE_FREERTOS_H
+#define PIANORA_NATIVE_FREERTOS_H
+
+// FreeRTOS shim for the native build. There is no scheduler on the host:
+// task creation fails, so RenderTask/LogRing never start and the benchmark
+// drives the code directly from main().
+
+#include <Arduino.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdPASS          1
+#define pdFAIL          0
+#define pdTRUE          1
+#define pdFALSE         0
+#define portMAX_DELAY   ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux))
+#define portEXIT_CRITICAL_SAFE(mux) ((void)(mux))
+
+#endif // PIANORA_NATIVE_FREERTOS_H
@@ -0,0 +1,16 @@
+#ifndef PIANORA_NATIVE_SEMPHR_H
+#define PIANORA_NATIVE_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+// Single-threaded host: a mutex is a non-null token that is always free
+typedef void* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    static int token;
+    return &token;
+}
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t) { return pdTRUE; }
+
+#endif // PIANORA_NATIVE_SEMPHR_H
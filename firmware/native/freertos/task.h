@@ -0,0 +1,25 @@
+#ifndef PIANORA_NATIVE_TASK_H
+#define PIANORA_NATIVE_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*,
+                                          UBaseType_t, TaskHandle_t*, BaseType_t) {
+    return pdFAIL;
+}
+
+inline TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+inline void vTaskDelay(TickType_t ticks) { native::advanceMs(ticks); }
+inline void vTaskDelayUntil(TickType_t* lastWake, TickType_t period) {
+    *lastWake += period;
+    if (*lastWake > xTaskGetTickCount()) native::advanceMs(*lastWake - xTaskGetTickCount());
+}
+
+// Nothing else runs on the host - a wait would never be woken
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+
+#endif // PIANORA_NATIVE_TASK_H
@@ -0,0 +1,15 @@
+#include <Arduino.h>
+#include <FastLED.h>
+#include <chrono>
+
+// Globals the Arduino core and FastLED provide on the device
+
+uint64_t native::nowUs = 0;
+NativeSerial Serial;
+NativeEsp ESP;
+CFastLED FastLED;
+
+uint32_t NativeEsp::getCycleCount() const {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,37 @@
+#include "boot_timeline.h"
+#include <esp_timer.h>
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+BootTimeline* bootTimeline = nullptr;
+
+BootTimeline::BootTimeline() {
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        _us[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void BootTimeline::mark(BootPhase phase) {
+    if (phase >= BOOT_PHASE_COUNT) return;
+    if (_us[phase].load(std::memory_order_relaxed) != 0) return;
+
+    // Never 0 - that means "not reached"
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    uint32_t expected = 0;
+    _us[phase].compare_exchange_strong(expected, now ? now : 1, std::memory_order_relaxed);
+}
+
+bool BootTimeline::reached(BootPhase phase) const {
+    return getUs(phase) != 0;
+}
+
+uint32_t BootTimeline::getUs(BootPhase phase) const {
+    return phase < BOOT_PHASE_COUNT ? _us[phase].load(std::memory_order_relaxed) : 0;
+}
+
+const char* BootTimeline::name(BootPhase phase) {
+    static const char* NAMES[BOOT_PHASE_COUNT] = {
+        "setup", "leds", "usb_host", "render", "usb_device",
+        "first_note", "first_light", "fs", "wifi", "web"
+    };
+    return phase < BOOT_PHASE_COUNT ? NAMES[phase] : "?";
+}
@@ -0,0 +1,42 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Milestones of a boot, in the order they normally happen. MIDI-critical
+// phases come first; the network ones complete in the background.
+enum BootPhase : uint8_t {
+    BOOT_SETUP = 0,         // setup() entered
+    BOOT_LEDS,              // Strip initialised
+    BOOT_USB_HOST,          // USB host installed, client registered
+    BOOT_RENDER,            // Render task running - MIDI ready
+    BOOT_USB_DEVICE,        // MIDI device enumerated and streaming
+    BOOT_FIRST_NOTE,        // First key event from the device
+    BOOT_FIRST_LIGHT,       // First frame with a key press latched
+    BOOT_FS,                // LittleFS mounted
+    BOOT_WIFI,              // STA connected or AP started
+    BOOT_WEB,               // HTTP/WebSocket server listening
+    BOOT_PHASE_COUNT
+};
+
+// Time since power-on (esp_timer, us) at which each phase was first
+// reached. mark() only keeps the first time, so it is safe to call on
+// every event and from any task.
+class BootTimeline {
+public:
+    BootTimeline();
+
+    void mark(BootPhase phase);
+    bool reached(BootPhase phase) const;
+    uint32_t getUs(BootPhase phase) const;     // 0 if not reached
+
+    static const char* name(BootPhase phase);
+
+private:
+    std::atomic<uint32_t> _us[BOOT_PHASE_COUNT];
+};
+
+extern BootTimeline* bootTimeline;
+
+#endif // BOOT_TIMELINE_H
@@ -0,0 +1,445 @@
+#include "calibration.h"
+#include <LittleFS.h>
+#include "led_controller.h"
+#include "render_task.h"
+#include "midi_event_ring.h"
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+Calibration* calibration = nullptr;
+
+static const uint8_t STORE_VERSION = 1;
+static const char* STORE_TEMP = CALIBRATION_FILE ".tmp";
+
+// Session markers in the overlay layer
+static const CRGB MARKER_SPAN_END(0, 0, 90);        // Quick: first and last LED of the span
+static const CRGB MARKER_SELECTED(70, 70, 70);      // Detailed: LED of the selected key
+
+static const char* const STEP_NAMES[] = {
+    "idle", "first_key", "last_key", "complete", "adjust", "select_key"
+};
+static const char* const STEP_MESSAGES[] = {
+    "Not calibrating",
+    "Press the lowest key",
+    "Press the highest key",
+    "Calibration saved",
+    "Lowest key: one LED less, highest key: one LED more",
+    "Press a key, then move its LED"
+};
+static const char* const TYPE_NAMES[] = { "factory", "quick", "detailed" };
+
+Calibration::Calibration()
+    : _state(CALIB_IDLE)
+    , _map(KeyMap::factory(LED_DEFAULT_COUNT))
+    , _previous(_map)
+    , _unsaved(false)
+    , _savedInSession(false)
+    , _selectedNote(0)
+    , _lastInputMs(0)
+{
+    memset(&_data, 0, sizeof(_data));
+    memset(&_previousData, 0, sizeof(_previousData));
+}
+
+bool Calibration::begin() {
+    KeyMap map;
+    CalibrationData data;
+    if (!load(map, data)) return false;
+
+    RenderLock lock;
+    if (!map.isValid(ledController->getKeyLedCount())) {
+        // The strip layout changed since - keep the factory map until recalibrated
+        LOG_W("Calibration: stored map does not fit %u key LEDs", ledController->getKeyLedCount());
+        return false;
+    }
+    _map = map;
+    _data = data;
+    ledController->setKeyMap(_map);
+    return true;
+}
+
+// ============== State ==============
+
+bool Calibration::isActive() const {
+    return _state == CALIB_WAIT_FIRST_KEY || _state == CALIB_WAIT_LAST_KEY
+        || _state == CALIB_ADJUST_SPAN || _state == CALIB_SELECT_KEY;
+}
+
+bool Calibration::isCalibrated() const {
+    return _data.calibrated;
+}
+
+CalibrationState Calibration::getState() const {
+    return _state;
+}
+
+const CalibrationData& Calibration::getData() const {
+    return _data;
+}
+
+void Calibration::start(CalibrationType type) {
+    RenderLock lock;
+
+    // Restarting a session keeps the map from before the first one
+    if (!isActive()) {
+        _previous = ledController->getKeyMap();
+        _previousData = _data;
+        _savedInSession = false;
+    }
+    _map = ledController->getKeyMap();
+    _unsaved = false;
+    _selectedNote = 0;
+    _lastInputMs = millis();
+    ledController->stopBootAnimation();
+
+    if (type == CALIB_TYPE_DETAILED) {
+        _data.type = CALIB_TYPE_DETAILED;
+        _state = CALIB_SELECT_KEY;
+    } else {
+        // The span starts at LED 0 and ends where the current map ends
+        uint16_t last = 0;
+        for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+            if (_map.led[key] != KeyMap::NONE && _map.led[key] > last) last = _map.led[key];
+        }
+        _data.type = CALIB_TYPE_QUICK;
+        _data.firstLed = 0;
+        _data.lastLed = last > 0 ? last : ledController->getKeyLedCount() - 1;
+        _state = CALIB_WAIT_FIRST_KEY;
+    }
+    drawMarkers();
+}
+
+bool Calibration::finish() {
+    if (!isActive()) return false;
+    RenderLock lock;
+
+    // Quick session that never got both keys - nothing to keep
+    if (_state == CALIB_WAIT_FIRST_KEY || _state == CALIB_WAIT_LAST_KEY) {
+        cancel();
+        return false;
+    }
+
+    if (_data.type == CALIB_TYPE_DETAILED) {
+        // Summary of the per-key map: lowest and highest mapped key
+        _data.firstNote = 0;
+        for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+            if (_map.led[key] == KeyMap::NONE) continue;
+            if (_data.firstNote == 0) {
+                _data.firstNote = key + LOWEST_MIDI_NOTE;
+                _data.firstLed = _map.led[key];
+            }
+            _data.lastNote = key + LOWEST_MIDI_NOTE;
+            _data.lastLed = _map.led[key];
+        }
+        _data.calibrated = true;
+    }
+
+    bool ok = !_unsaved || save();
+    _state = CALIB_COMPLETE;
+    _selectedNote = 0;
+    drawMarkers();
+    return ok;
+}
+
+void Calibration::cancel() {
+    if (!isActive()) return;
+    RenderLock lock;
+
+    _map = _previous;
+    _data = _previousData;
+    ledController->setKeyMap(_map);
+    // A quick session stores the map as soon as it has both keys - put the old one back
+    if (_savedInSession) {
+        if (_data.calibrated) {
+            save();
+        } else {
+            LittleFS.remove(CALIBRATION_FILE);
+        }
+    }
+    _unsaved = false;
+    _state = CALIB_IDLE;
+    drawMarkers();
+}
+
+bool Calibration::reset() {
+    RenderLock lock;
+
+    _map = KeyMap::factory(ledController->getKeyLedCount());
+    memset(&_data, 0, sizeof(_data));
+    ledController->setKeyMap(_map);
+    _unsaved = false;
+    _state = CALIB_IDLE;
+    drawMarkers();
+    return !LittleFS.exists(CALIBRATION_FILE) || LittleFS.remove(CALIBRATION_FILE);
+}
+
+// ============== Input ==============
+
+bool Calibration::handleEvent(const MidiEvent& ev) {
+    if (!isActive() || !ev.isNoteOn()) return false;
+    uint8_t note = ev.data1;
+    if (note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return false;
+
+    RenderLock lock;
+    _lastInputMs = millis();
+
+    switch (_state) {
+        case CALIB_WAIT_FIRST_KEY:
+            setFirstNote(note);
+            return true;
+
+        case CALIB_WAIT_LAST_KEY:
+            return setLastNote(note);
+
+        case CALIB_ADJUST_SPAN:
+            // Any other key just plays, showing where it landed
+            if (note == _data.firstNote) {
+                setSpanEnd((int32_t)_data.lastLed - 1);
+                return true;
+            }
+            if (note == _data.lastNote) {
+                setSpanEnd((int32_t)_data.lastLed + 1);
+                return true;
+            }
+            return false;
+
+        case CALIB_SELECT_KEY:
+            _selectedNote = note;
+            drawMarkers();
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool Calibration::inputNote(uint8_t note) {
+    if (!isActive() || note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return false;
+
+    RenderLock lock;
+    _lastInputMs = millis();
+
+    switch (_state) {
+        case CALIB_WAIT_FIRST_KEY:
+            setFirstNote(note);
+            return true;
+
+        case CALIB_WAIT_LAST_KEY:
+            // The app reports the first key again after we moved on
+            return note != _data.firstNote && setLastNote(note);
+
+        case CALIB_SELECT_KEY:
+            _selectedNote = note;
+            drawMarkers();
+            return true;
+
+        default:
+            return false;   // Both keys are known - a confirmation from the app
+    }
+}
+
+bool Calibration::inputLed(uint8_t note, uint16_t led) {
+    if (!isActive() || note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return false;
+
+    RenderLock lock;
+    uint16_t keyLeds = ledController->getKeyLedCount();
+    if (led != KeyMap::NONE && led >= keyLeds) return false;
+    _lastInputMs = millis();
+
+    if (_state == CALIB_ADJUST_SPAN) {
+        if (led == KeyMap::NONE) return false;
+        if (note == _data.firstNote && led < _data.lastLed) {
+            _data.firstLed = led;
+            setSpanEnd(_data.lastLed);
+            return true;
+        }
+        if (note == _data.lastNote && led > _data.firstLed) {
+            setSpanEnd(led);
+            return true;
+        }
+        return false;
+    }
+
+    if (_state != CALIB_SELECT_KEY) return false;
+    _selectedNote = note;
+    _map.led[note - LOWEST_MIDI_NOTE] = led;
+    _unsaved = true;
+    apply();
+    return true;
+}
+
+bool Calibration::inputDelta(int16_t delta) {
+    if (!isActive() || delta == 0) return false;
+
+    RenderLock lock;
+    _lastInputMs = millis();
+
+    if (_state == CALIB_ADJUST_SPAN) {
+        setSpanEnd((int32_t)_data.lastLed + delta);
+        return true;
+    }
+    if (_state != CALIB_SELECT_KEY || _selectedNote == 0) return false;
+
+    uint16_t& led = _map.led[_selectedNote - LOWEST_MIDI_NOTE];
+    if (led == KeyMap::NONE) return false;
+    led = constrain((int32_t)led + delta, 0, (int32_t)ledController->getKeyLedCount() - 1);
+    _unsaved = true;
+    apply();
+    return true;
+}
+
+bool Calibration::poll() {
+    if (!isActive() || millis() - _lastInputMs < CALIBRATION_TIMEOUT_MS) return false;
+
+    LOG_I("Calibration: no input, session closed");
+    if (_state == CALIB_ADJUST_SPAN || _state == CALIB_SELECT_KEY) {
+        finish();
+    } else {
+        cancel();
+    }
+    return true;
+}
+
+// ============== Quick Calibration ==============
+
+void Calibration::setFirstNote(uint8_t note) {
+    _data.firstNote = note;
+    _state = CALIB_WAIT_LAST_KEY;
+    drawMarkers();
+}
+
+bool Calibration::setLastNote(uint8_t note) {
+    if (note <= _data.firstNote) return false;   // Must be to the right of the first key
+
+    _data.lastNote = note;
+    _data.calibrated = true;
+    _state = CALIB_ADJUST_SPAN;
+    setSpanEnd(_data.lastLed);
+
+    // Stored right away - the app never sends more than the two keys
+    if (save()) _unsaved = false;
+    return true;
+}
+
+void Calibration::setSpanEnd(int32_t lastLed) {
+    // At least one LED per key gap, never past the key segment
+    int32_t minLed = _data.firstLed + 1;
+    int32_t maxLed = ledController->getKeyLedCount() - 1;
+    _data.lastLed = constrain(lastLed, minLed, maxLed);
+
+    _map = KeyMap::interpolate(_data.firstNote, _data.lastNote, _data.firstLed, _data.lastLed);
+    _unsaved = true;
+    apply();
+}
+
+// ============== Helpers ==============
+
+void Calibration::apply() {
+    ledController->setKeyMap(_map);
+    drawMarkers();
+}
+
+void Calibration::drawMarkers() {
+    ledController->showColor(CRGB::Black);     // Clears the overlay layer
+    if (!isActive()) return;
+
+    if (_state == CALIB_SELECT_KEY) {
+        int16_t led = _selectedNote ? ledController->noteToLed(_selectedNote) : -1;
+        if (led >= 0) ledController->setLedDirect(led, MARKER_SELECTED);
+        return;
+    }
+
+    // Span ends are key segment indices; the strip may be mounted reversed
+    uint16_t keyLeds = ledController->getKeyLedCount();
+    bool reversed = ledController->isReversed();
+    uint16_t ends[] = { _data.firstLed, _data.lastLed };
+    for (uint8_t i = 0; i < 2; i++) {
+        ledController->setLedDirect(reversed ? keyLeds - 1 - ends[i] : ends[i], MARKER_SPAN_END);
+    }
+}
+
+void Calibration::fillStep(JsonObject out) const {
+    out["step"] = STEP_NAMES[_state];
+    out["message"] = STEP_MESSAGES[_state];
+    out["calibration_type"] = TYPE_NAMES[_data.type];
+    out["calibrated"] = _data.calibrated;
+    if (_data.firstNote) {
+        out["first_note"] = _data.firstNote;
+        out["first_led"] = _data.firstLed;
+    }
+    if (_data.lastNote) {
+        out["last_note"] = _data.lastNote;
+        out["last_led"] = _data.lastLed;
+        out["span"] = _data.lastLed - _data.firstLed + 1;
+    }
+    if (_selectedNote) {
+        out["selected_note"] = _selectedNote;
+        uint16_t led = _map.ledFor(_selectedNote);
+        out["selected_led"] = led == KeyMap::NONE ? -1 : (int32_t)led;
+    }
+    out["unsaved"] = _unsaved;
+}
+
+// ============== Storage ==============
+
+bool Calibration::save() {
+    JsonDocument doc;
+    doc["version"] = STORE_VERSION;
+    doc["type"] = _data.type;
+    doc["first_note"] = _data.firstNote;
+    doc["last_note"] = _data.lastNote;
+    doc["first_led"] = _data.firstLed;
+    doc["last_led"] = _data.lastLed;
+    doc["key_leds"] = ledController->getKeyLedCount();
+    JsonArray leds = doc["leds"].to<JsonArray>();
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        leds.add(_map.led[key] == KeyMap::NONE ? -1 : (int32_t)_map.led[key]);
+    }
+
+    // Written aside and renamed, so a power cut never leaves half a map
+    File file = LittleFS.open(STORE_TEMP, "w");
+    if (!file) {
+        LOG_E("Calibration: cannot write " CALIBRATION_FILE);
+        return false;
+    }
+    size_t written = serializeJson(doc, file);
+    file.close();
+    if (written == 0 || !LittleFS.rename(STORE_TEMP, CALIBRATION_FILE)) {
+        LittleFS.remove(STORE_TEMP);
+        LOG_E("Calibration: cannot write " CALIBRATION_FILE);
+        return false;
+    }
+
+    _savedInSession = true;
+    LOG_I("Calibration: saved (%u..%u -> LED %u..%u)", _data.firstNote, _data.lastNote, _data.firstLed, _data.lastLed);
+    return true;
+}
+
+bool Calibration::load(KeyMap& map, CalibrationData& data) {
+    if (!LittleFS.exists(CALIBRATION_FILE)) return false;
+
+    File file = LittleFS.open(CALIBRATION_FILE, "r");
+    if (!file) return false;
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, file);
+    file.close();
+
+    JsonArrayConst leds = doc["leds"].as<JsonArrayConst>();
+    if (err || (doc["version"] | 0) != STORE_VERSION || leds.size() != NUM_PIANO_KEYS) {
+        LOG_W("Calibration: " CALIBRATION_FILE " unreadable, factory map");
+        return false;
+    }
+
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        int32_t led = leds[key] | -1;
+        map.led[key] = led < 0 ? KeyMap::NONE : (uint16_t)led;
+    }
+    data.type = doc["type"] | (uint8_t)CALIB_TYPE_QUICK;
+    if (data.type > CALIB_TYPE_DETAILED) data.type = CALIB_TYPE_QUICK;
+    data.firstNote = doc["first_note"] | 0;
+    data.lastNote = doc["last_note"] | 0;
+    data.firstLed = doc["first_led"] | 0;
+    data.lastLed = doc["last_led"] | 0;
+    data.calibrated = true;
+    return true;
+}
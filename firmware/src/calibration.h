@@ -0,0 +1,82 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "key_map.h"
+
+struct MidiEvent;
+
+// Note-to-LED calibration on the device (SPECIFICATION.md 1.3).
+//
+// Quick: press the lowest key, then the highest; the keys in between are
+// spread evenly over the span, which starts at LED 0. The map is applied
+// and stored right away, then the session stays in CALIB_ADJUST_SPAN:
+// every press of the lowest key shrinks the span by one LED, every press
+// of the highest key stretches it.
+//
+// Detailed: start from the current map; a key press selects that key and
+// the app places its LED (calibration_input {led} / {delta}).
+//
+// Every change is applied to LEDController at once, so played keys light
+// where they will after saving. finish() stores the map in LittleFS,
+// cancel() restores the map the session started from. Methods take
+// RenderLock themselves; call them from one task at a time (the WebSocket
+// handlers and the hotkey stage both run under RenderLock anyway).
+class Calibration {
+public:
+    Calibration();
+
+    // Load the stored map (LittleFS must be mounted) and apply it
+    bool begin();
+
+    bool isActive() const;          // A session is running
+    bool isCalibrated() const;      // A stored map is in use
+    CalibrationState getState() const;
+    const CalibrationData& getData() const;
+
+    void start(CalibrationType type);
+    bool finish();                  // Store the map and end the session
+    void cancel();                  // Back to the map before start()
+    bool reset();                   // Factory table, stored map removed
+
+    // Piano key press during a session (hotkey stage). Returns true if the step changed.
+    bool handleEvent(const MidiEvent& ev);
+
+    // App input. A note confirms the first/last key of a quick session
+    // (the app reports the keys it saw too - repeats are ignored) or selects
+    // a key in a detailed one; led places the key, delta nudges it.
+    bool inputNote(uint8_t note);
+    bool inputLed(uint8_t note, uint16_t led);
+    bool inputDelta(int16_t delta);
+
+    // End a session that saw no input for CALIBRATION_TIMEOUT_MS
+    bool poll();
+
+    // calibration_step message body
+    void fillStep(JsonObject out) const;
+
+private:
+    CalibrationState _state;
+    CalibrationData _data;
+    KeyMap _map;                // Being edited
+    KeyMap _previous;           // Restored by cancel()
+    CalibrationData _previousData;
+    bool _unsaved;
+    bool _savedInSession;       // cancel() has to rewrite the stored map
+    uint8_t _selectedNote;      // Detailed: key being placed, 0 = none
+    unsigned long _lastInputMs;
+
+    void setFirstNote(uint8_t note);
+    bool setLastNote(uint8_t note);
+    void setSpanEnd(int32_t lastLed);
+    void apply();               // _map to LEDController, markers redrawn
+    void drawMarkers();
+    bool save();
+    bool load(KeyMap& map, CalibrationData& data);
+};
+
+extern Calibration* calibration;
+
+#endif // CALIBRATION_H
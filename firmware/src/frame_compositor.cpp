@@ -0,0 +1,255 @@
+#include "frame_compositor.h"
+#include "pixel_kernels.h"
+
+// fadeActive() switches to one packed pass over the lit range once at
+// least 1 pixel in FADE_SPAN_DENSITY of that range is lit
+static const uint8_t FADE_SPAN_DENSITY = 4;
+
+// ============== FrameLayer ==============
+
+FrameLayer::FrameLayer()
+    : _length(LED_MAX_COUNT)
+    , _mode(BLEND_REPLACE)
+    , _alpha(255)
+    , _visible(true)
+    , _dirty(false)
+    , _dirtyFirst(0)
+    , _dirtyLast(0)
+{
+    fill_solid(_pixels, LED_MAX_COUNT, CRGB::Black);
+}
+
+void FrameLayer::configure(BlendMode mode, uint8_t alpha) {
+    _mode = mode;
+    _alpha = alpha;
+    markDirty(0, _length - 1);
+}
+
+BlendMode FrameLayer::getBlendMode() const {
+    return _mode;
+}
+
+uint8_t FrameLayer::getAlpha() const {
+    return _alpha;
+}
+
+void FrameLayer::setVisible(bool visible) {
+    if (visible != _visible) {
+        _visible = visible;
+        markDirty(0, _length - 1);
+    }
+}
+
+bool FrameLayer::isVisible() const {
+    return _visible;
+}
+
+void FrameLayer::setLength(uint16_t length) {
+    // Nothing past the new length is composited any more
+    clear();
+    _length = constrain(length, 1, LED_MAX_COUNT);
+    _dirty = false;
+    markDirty(0, _length - 1);
+}
+
+uint16_t FrameLayer::getLength() const {
+    return _length;
+}
+
+const CRGB& FrameLayer::getPixel(uint16_t index) const {
+    return _pixels[index];
+}
+
+const CRGB* FrameLayer::getPixels() const {
+    return _pixels;
+}
+
+void FrameLayer::setPixel(uint16_t index, const CRGB& color) {
+    if (index >= _length || _pixels[index] == color) return;
+
+    _pixels[index] = color;
+    _active.add(index);
+    markDirty(index, index);
+}
+
+bool FrameLayer::fadePixel(uint16_t index, uint8_t amount) {
+    CRGB color = _pixels[index];
+    color.fadeToBlackBy(amount);
+    if (color == _pixels[index]) return false;
+
+    _pixels[index] = color;
+    markDirty(index, index);
+    return true;
+}
+
+void FrameLayer::fadeActive(uint8_t amount) {
+    uint16_t lit = _active.size();
+    if (lit == 0) return;
+
+    uint16_t first = _length - 1;
+    uint16_t last = 0;
+    for (uint16_t slot = 0; slot < lit; slot++) {
+        uint16_t i = _active[slot];
+        if (i < first) first = i;
+        if (i > last) last = i;
+    }
+
+    uint16_t span = last - first + 1;
+    if ((uint32_t)lit * FADE_SPAN_DENSITY >= span) {
+        // Pixels in the range but outside the set are black and stay black
+        fadeToBlackSpan(_pixels + first, span, amount);
+        markDirty(first, last);
+    } else {
+        for (uint16_t slot = 0; slot < lit; slot++) {
+            fadePixel(_active[slot], amount);
+        }
+    }
+
+    // Backwards, because remove() swaps the last member into the hole
+    for (int16_t slot = lit - 1; slot >= 0; slot--) {
+        uint16_t i = _active[slot];
+        if (!_pixels[i]) _active.remove(i);
+    }
+}
+
+void FrameLayer::fill(const CRGB& color) {
+    for (uint16_t i = 0; i < _length; i++) {
+        setPixel(i, color);
+    }
+}
+
+void FrameLayer::clear() {
+    // Only lit pixels can be non-black
+    for (int16_t slot = _active.size() - 1; slot >= 0; slot--) {
+        uint16_t i = _active[slot];
+        if (_pixels[i]) {
+            _pixels[i] = CRGB::Black;
+            markDirty(i, i);
+        }
+    }
+    _active.clear();
+}
+
+SparseLedSet<LED_MAX_COUNT>& FrameLayer::active() {
+    return _active;
+}
+
+const SparseLedSet<LED_MAX_COUNT>& FrameLayer::active() const {
+    return _active;
+}
+
+bool FrameLayer::isDirty() const {
+    return _dirty;
+}
+
+uint16_t FrameLayer::getDirtyFirst() const {
+    return _dirtyFirst;
+}
+
+uint16_t FrameLayer::getDirtyLast() const {
+    return _dirtyLast;
+}
+
+void FrameLayer::markDirty(uint16_t first, uint16_t last) {
+    if (!_dirty) {
+        _dirty = true;
+        _dirtyFirst = first;
+        _dirtyLast = last;
+    } else {
+        if (first < _dirtyFirst) _dirtyFirst = first;
+        if (last > _dirtyLast) _dirtyLast = last;
+    }
+}
+
+void FrameLayer::clearDirty() {
+    _dirty = false;
+}
+
+// ============== FrameCompositor ==============
+
+FrameCompositor::FrameCompositor() {
+}
+
+FrameLayer& FrameCompositor::layer(LayerId id) {
+    return _layers[id];
+}
+
+const FrameLayer& FrameCompositor::layer(LayerId id) const {
+    return _layers[id];
+}
+
+void FrameCompositor::setLength(uint16_t length) {
+    for (uint8_t l = 0; l < LAYER_COUNT; l++) {
+        _layers[l].setLength(length);
+    }
+}
+
+uint16_t FrameCompositor::getLength() const {
+    return _layers[0].getLength();
+}
+
+// Black source pixels are transparent in REPLACE and ALPHA, and a no-op
+// for MAX and ADD anyway
+void FrameCompositor::blendSpan(CRGB* dst, const CRGB* src, uint16_t count, BlendMode mode, uint8_t alpha) {
+    switch (mode) {
+        case BLEND_REPLACE:
+            for (uint16_t i = 0; i < count; i++) {
+                if (src[i]) dst[i] = src[i];
+            }
+            break;
+
+        case BLEND_MAX:
+            maxSpan(dst, src, count);
+            break;
+
+        case BLEND_ADD:
+            addSpan(dst, src, count);
+            break;
+
+        case BLEND_ALPHA:
+            for (uint16_t i = 0; i < count; i++) {
+                if (src[i]) nblend(dst[i], src[i], alpha);
+            }
+            break;
+    }
+}
+
+bool FrameCompositor::compose(CRGB* out, uint16_t& changedFirst, uint16_t& changedLast) {
+    // Union of the dirty ranges - everything outside it is unchanged
+    bool any = false;
+    uint16_t first = LED_MAX_COUNT - 1;
+    uint16_t last = 0;
+    for (uint8_t l = 0; l < LAYER_COUNT; l++) {
+        if (!_layers[l].isDirty()) continue;
+        any = true;
+        if (_layers[l].getDirtyFirst() < first) first = _layers[l].getDirtyFirst();
+        if (_layers[l].getDirtyLast() > last) last = _layers[l].getDirtyLast();
+        _layers[l].clearDirty();
+    }
+    if (!any) return false;
+
+    // Layer by layer over the whole range, so MAX/ADD run as packed spans.
+    // _frame and the layers share alignment, keeping the kernels on words.
+    uint16_t count = last - first + 1;
+    CRGB* frame = _frame + first;
+    memset((void*)frame, 0, count * sizeof(CRGB));
+    for (uint8_t l = 0; l < LAYER_COUNT; l++) {
+        const FrameLayer& layer = _layers[l];
+        // Non-black pixels are always in the active set - an empty layer is all black
+        if (!layer.isVisible() || layer.active().size() == 0) continue;
+        blendSpan(frame, layer.getPixels() + first, count, layer.getBlendMode(), layer.getAlpha());
+    }
+
+    bool changed = false;
+    for (uint16_t i = 0; i < count; i++) {
+        if (out[first + i] != frame[i]) {
+            out[first + i] = frame[i];
+            if (!changed) {
+                changed = true;
+                changedFirst = first + i;
+            }
+            changedLast = first + i;
+        }
+    }
+    return changed;
+}
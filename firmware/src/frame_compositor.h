@@ -0,0 +1,97 @@
+#ifndef FRAME_COMPOSITOR_H
+#define FRAME_COMPOSITOR_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include "config.h"
+#include "sparse_led_set.h"
+
+// How a layer is combined with what is underneath it
+enum BlendMode : uint8_t {
+    BLEND_REPLACE = 0,  // Non-black pixels overwrite, black is transparent
+    BLEND_MAX = 1,      // Per-channel maximum
+    BLEND_ADD = 2,      // Per-channel saturating add
+    BLEND_ALPHA = 3     // Non-black pixels blended with the layer alpha
+};
+
+// One full-strip layer. Writes track the changed LED range (for the
+// compositor) and the set of pixels that may still change under a fade
+// (for effects), so neither has to walk the whole strip.
+class FrameLayer {
+public:
+    FrameLayer();
+
+    void configure(BlendMode mode, uint8_t alpha = 255);
+    BlendMode getBlendMode() const;
+    uint8_t getAlpha() const;
+
+    void setVisible(bool visible);
+    bool isVisible() const;
+
+    // LEDs in use (up to LED_MAX_COUNT); pixels past it are never written
+    void setLength(uint16_t length);
+    uint16_t getLength() const;
+
+    const CRGB& getPixel(uint16_t index) const;
+    const CRGB* getPixels() const;                    // getLength() pixels, 4-byte aligned
+    void setPixel(uint16_t index, const CRGB& color);
+    bool fadePixel(uint16_t index, uint8_t amount);   // Returns true if it changed
+    void fadeActive(uint8_t amount);                  // Fade every active pixel, drop the black ones
+    void fill(const CRGB& color);
+    void clear();
+
+    // Pixels written since they last settled (see fadePixel())
+    SparseLedSet<LED_MAX_COUNT>& active();
+    const SparseLedSet<LED_MAX_COUNT>& active() const;
+
+    bool isDirty() const;
+    uint16_t getDirtyFirst() const;
+    uint16_t getDirtyLast() const;
+    void markDirty(uint16_t first, uint16_t last);
+    void clearDirty();
+
+private:
+    alignas(4) CRGB _pixels[LED_MAX_COUNT];    // Aligned for the packed kernels
+    SparseLedSet<LED_MAX_COUNT> _active;
+    uint16_t _length;
+    BlendMode _mode;
+    uint8_t _alpha;
+    bool _visible;
+    bool _dirty;
+    uint16_t _dirtyFirst;
+    uint16_t _dirtyLast;
+};
+
+// Stacks the layers bottom to top and composites only the LED range that
+// changed in any of them since the previous compose().
+class FrameCompositor {
+public:
+    enum LayerId {
+        LAYER_BACKGROUND = 0,   // Background colour / ambient animations
+        LAYER_KEYS,             // Pressed and fading keys
+        LAYER_SPLASH,           // Splash waves
+        LAYER_GUIDE,            // Learning mode guides
+        LAYER_OVERLAY,          // Feedback drawn on top of everything
+        LAYER_COUNT
+    };
+
+    FrameCompositor();
+
+    FrameLayer& layer(LayerId id);
+    const FrameLayer& layer(LayerId id) const;
+
+    // Strip length of every layer - clears them all
+    void setLength(uint16_t length);
+    uint16_t getLength() const;
+
+    // Composite into out; returns true and the changed range if any pixel changed
+    bool compose(CRGB* out, uint16_t& changedFirst, uint16_t& changedLast);
+
+private:
+    FrameLayer _layers[LAYER_COUNT];
+    alignas(4) CRGB _frame[LED_MAX_COUNT];     // Composited span before it is compared to out
+
+    static void blendSpan(CRGB* dst, const CRGB* src, uint16_t count, BlendMode mode, uint8_t alpha);
+};
+
+#endif // FRAME_COMPOSITOR_H
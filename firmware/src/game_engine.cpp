@@ -0,0 +1,352 @@
+#include "game_engine.h"
+#include "led_controller.h"
+#include "render_task.h"
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+GameEngine* gameEngine = nullptr;
+
+static_assert((GAME_WINDOW_SIZE & (GAME_WINDOW_SIZE - 1)) == 0 && GAME_WINDOW_SIZE <= 128,
+              "GAME_WINDOW_SIZE must be a power of two up to 128");
+
+static const uint16_t HIT_WINDOW_MS[] = {GAME_HIT_EASY_MS, GAME_HIT_MEDIUM_MS, GAME_HIT_HARD_MS};
+static const char* const DIFFICULTY_NAMES[] = {"easy", "medium", "hard"};
+
+// Points for a hit before the multiplier
+static const uint16_t POINTS_PERFECT = 100;
+static const uint16_t POINTS_GOOD = 50;
+
+GameEngine::GameEngine()
+    : _noteCount(0)
+    , _active(false)
+    , _difficulty(GAME_MEDIUM)
+    , _lookAheadMs(0)
+    , _lookAheadUs(0)
+    , _hitWindowUs(0)
+    , _originUs(0)
+    , _next(0)
+    , _windowHead(0)
+    , _windowCount(0)
+    , _score(0)
+    , _combo(0)
+    , _maxCombo(0)
+    , _hits(0)
+    , _perfect(0)
+    , _misses(0)
+    , _wrong(0)
+    , _reportHead(0)
+    , _reportCount(0)
+{
+    _lookAheadMs = speedToLookAhead(GAME_DEFAULT_SPEED);
+}
+
+GameDifficulty GameEngine::parseDifficulty(const char* difficulty) {
+    if (difficulty && strcmp(difficulty, "easy") == 0) return GAME_EASY;
+    if (difficulty && strcmp(difficulty, "hard") == 0) return GAME_HARD;
+    return GAME_MEDIUM;
+}
+
+uint16_t GameEngine::speedToLookAhead(uint8_t speed) {
+    speed = constrain(speed, 1, 10);
+    return GAME_FALL_SLOWEST_MS - (uint32_t)(speed - 1) * (GAME_FALL_SLOWEST_MS - GAME_FALL_FASTEST_MS) / 9;
+}
+
+// ============== Song ==============
+
+void GameEngine::clear() {
+    RenderLock lock;
+    stop();
+    _noteCount = 0;
+}
+
+bool GameEngine::addNote(uint32_t timeMs, uint8_t note) {
+    RenderLock lock;
+    if (_noteCount == GAME_MAX_NOTES || note > 127) return false;
+    // Song time in us has to fit the signed 32-bit clock (~35 min)
+    if (timeMs > INT32_MAX / 1000 - GAME_MAX_LOOKAHEAD_MS) return false;
+    if (_noteCount > 0 && timeMs < _timeMs[_noteCount - 1]) return false;
+
+    _timeMs[_noteCount] = timeMs;
+    _notes[_noteCount] = note;
+    _noteCount++;
+    return true;
+}
+
+uint16_t GameEngine::getNoteCount() const {
+    return _noteCount;
+}
+
+// ============== Session ==============
+
+bool GameEngine::start(GameDifficulty difficulty, uint16_t lookAheadMs) {
+    RenderLock lock;
+    if (_noteCount == 0 || !midiEvents) return false;
+
+    _difficulty = difficulty <= GAME_HARD ? difficulty : GAME_MEDIUM;
+    _lookAheadMs = constrain(lookAheadMs, GAME_MIN_LOOKAHEAD_MS, GAME_MAX_LOOKAHEAD_MS);
+    _lookAheadUs = (int32_t)_lookAheadMs * 1000;
+    _hitWindowUs = (int32_t)HIT_WINDOW_MS[_difficulty] * 1000;
+    // The first note at 0 ms falls the whole way
+    _originUs = MidiEventRing::now() + _lookAheadUs;
+    _next = 0;
+    _windowHead = 0;
+    _windowCount = 0;
+    _score = 0;
+    _combo = 0;
+    _maxCombo = 0;
+    _hits = 0;
+    _perfect = 0;
+    _misses = 0;
+    _wrong = 0;
+    _reportHead = 0;
+    _reportCount = 0;
+    _hotkeys = HotkeyFilter();
+    midiEvents->attach(_reader);    // Only what is played from now on
+    _active = true;
+
+    ledController->setMode(MODE_GAME);
+    LOG_I("Game: %u notes, %s, %u ms fall", _noteCount, DIFFICULTY_NAMES[_difficulty], _lookAheadMs);
+    return true;
+}
+
+void GameEngine::stop() {
+    RenderLock lock;
+    if (!_active) return;
+    _active = false;
+    ledController->clearGameNotes();
+}
+
+bool GameEngine::isActive() const {
+    return _active;
+}
+
+// ============== Frame ==============
+
+bool GameEngine::frameEntry(void* arg) {
+    return static_cast<GameEngine*>(arg)->frame();
+}
+
+bool GameEngine::frame() {
+    if (!_active) return false;
+    if (ledController->getMode() != MODE_GAME) {
+        // Another mode chosen by the app or a hotkey ends the game; the
+        // mode change already redrew the guide layer
+        _active = false;
+        return false;
+    }
+
+    // Judge on the transfer timestamps - how late this frame runs does not matter
+    MidiEvent ev;
+    while (midiEvents->pop(_reader, ev)) {
+        if (ev.source == MIDI_SOURCE_APP) continue;
+        if (_hotkeys.filter(ev)) continue;
+        if (ev.isNoteOn()) judge(ev.data1, songTime(ev.timeUs));
+    }
+
+    int32_t nowUs = songTime(MidiEventRing::now());
+    feed(nowUs);
+    draw(nowUs);
+
+    if (_next == _noteCount && _windowCount == 0) finish();
+    return true;
+}
+
+int32_t GameEngine::songTime(uint32_t eventUs) const {
+    // Wraps with the event clock; a song is far shorter than the 71 min period
+    return (int32_t)(eventUs - _originUs);
+}
+
+void GameEngine::judge(uint8_t note, int32_t atUs) {
+    // Oldest pending note of that key inside its window; the ring is in time
+    // order, so nothing past the first note too far ahead can match
+    for (uint8_t i = 0; i < _windowCount; i++) {
+        Falling& f = _window[(_windowHead + i) & WINDOW_MASK];
+        if (f.atUs - _hitWindowUs > atUs) break;
+        if (f.state != JUDGE_PENDING || f.note != note) continue;
+
+        int32_t offsetUs = atUs - f.atUs;
+        if (offsetUs > _hitWindowUs) continue;
+
+        bool perfect = abs(offsetUs) * 3 <= _hitWindowUs;
+        f.state = JUDGE_HIT;
+        f.judgedUs = atUs;
+        _hits++;
+        if (perfect) _perfect++;
+        _combo++;
+        if (_combo > _maxCombo) _maxCombo = _combo;
+        uint16_t points = (perfect ? POINTS_PERFECT : POINTS_GOOD) * getMultiplier();
+        _score += points;
+
+        Report& report = queueReport(REPORT_HIT, note);
+        report.perfect = perfect;
+        report.offsetMs = offsetUs / 1000;
+        report.points = points;
+        return;
+    }
+
+    // Nothing due on that key: breaks the combo
+    _wrong++;
+    _combo = 0;
+    queueReport(REPORT_WRONG_NOTE, note);
+}
+
+uint8_t GameEngine::getMultiplier() const {
+    return min(1 + _combo / GAME_COMBO_STEP, GAME_MAX_MULTIPLIER);
+}
+
+void GameEngine::feed(int32_t nowUs) {
+    // Notes reaching the look-ahead window join the ring in time order. A
+    // full ring holds the rest back; they enter part of the way down.
+    while (_next < _noteCount && _windowCount < GAME_WINDOW_SIZE) {
+        int32_t atUs = (int32_t)_timeMs[_next] * 1000;
+        if (atUs - _lookAheadUs > nowUs) break;
+
+        Falling& f = _window[(_windowHead + _windowCount) & WINDOW_MASK];
+        f.atUs = atUs;
+        f.judgedUs = 0;
+        f.note = _notes[_next];
+        f.state = JUDGE_PENDING;
+        _windowCount++;
+        _next++;
+    }
+}
+
+void GameEngine::draw(int32_t nowUs) {
+    const int32_t flashUs = GAME_FLASH_MS * 1000L;
+
+    // Misses first: a note is missed once its window has passed
+    for (uint8_t i = 0; i < _windowCount; i++) {
+        Falling& f = _window[(_windowHead + i) & WINDOW_MASK];
+        if (f.atUs > nowUs) break;
+        if (f.state == JUDGE_PENDING && nowUs - f.atUs > _hitWindowUs) {
+            f.state = JUDGE_MISS;
+            f.judgedUs = f.atUs + _hitWindowUs;
+            _misses++;
+            _combo = 0;
+            queueReport(REPORT_MISS, f.note);
+        }
+    }
+
+    // Judged notes leave once their flash is over. A front note still
+    // falling keeps the ones behind it - at most a hit window plus a flash.
+    while (_windowCount > 0) {
+        const Falling& f = _window[_windowHead];
+        if (f.state == JUDGE_PENDING || nowUs - f.judgedUs < flashUs) break;
+        _windowHead = (_windowHead + 1) & WINDOW_MASK;
+        _windowCount--;
+    }
+
+    // Farthest first, so the nearest note wins where two overlap
+    ledController->clearGameNotes();
+    for (int16_t i = _windowCount - 1; i >= 0; i--) {
+        const Falling& f = _window[(_windowHead + i) & WINDOW_MASK];
+        if (f.state == JUDGE_PENDING) {
+            int32_t remaining = max(f.atUs - nowUs, (int32_t)0);
+            uint8_t distance = (int64_t)remaining * GAME_FALL_SPAN / _lookAheadUs;
+            // Dim at the top of the fall, full brightness on the key
+            uint8_t value = 255 - (int64_t)min(remaining, _lookAheadUs) * 191 / _lookAheadUs;
+            ledController->drawFallingNote(f.note, distance, value);
+        } else {
+            int32_t since = max(nowUs - f.judgedUs, (int32_t)0);
+            if (since >= flashUs) continue;     // Waiting behind a note still falling
+            uint8_t value = 255 - (int64_t)since * 255 / flashUs;
+            ledController->drawJudgedNote(f.note, f.state == JUDGE_HIT, value);
+        }
+    }
+}
+
+void GameEngine::finish() {
+    _active = false;
+    ledController->clearGameNotes();
+    queueReport(REPORT_COMPLETE);
+    LOG_I("Game: complete, score %u, %u/%u hits", _score, _hits, _noteCount);
+}
+
+uint8_t GameEngine::getStars() const {
+    uint32_t accuracy = _noteCount > 0 ? (uint32_t)_hits * 100 / _noteCount : 0;
+    if (accuracy >= 90 && _perfect * 2 >= _hits) return 3;
+    if (accuracy >= 75) return 2;
+    if (accuracy >= 50) return 1;
+    return 0;
+}
+
+// ============== Reports ==============
+
+GameEngine::Report& GameEngine::queueReport(ReportType type, uint8_t note) {
+    // Full: the oldest goes, the newest state matters most
+    if (_reportCount == GAME_REPORT_QUEUE) {
+        _reportHead = (_reportHead + 1) % GAME_REPORT_QUEUE;
+        _reportCount--;
+    }
+    Report& report = _reports[(_reportHead + _reportCount) % GAME_REPORT_QUEUE];
+    report.type = type;
+    report.note = note;
+    report.perfect = false;
+    report.multiplier = getMultiplier();
+    report.offsetMs = 0;
+    report.points = 0;
+    report.combo = _combo;
+    report.score = _score;
+    _reportCount++;
+    return report;
+}
+
+bool GameEngine::nextReport(JsonObject out) {
+    if (_reportCount == 0) return false;   // Checked again under the lock
+
+    RenderLock lock;
+    if (_reportCount == 0) return false;
+    Report report = _reports[_reportHead];
+    _reportHead = (_reportHead + 1) % GAME_REPORT_QUEUE;
+    _reportCount--;
+
+    switch (report.type) {
+        case REPORT_HIT:
+            out["type"] = "game_hit";
+            out["note"] = report.note;
+            out["grade"] = report.perfect ? "perfect" : "good";
+            out["offset_ms"] = report.offsetMs;
+            out["points"] = report.points;
+            break;
+        case REPORT_MISS:
+            out["type"] = "game_miss";
+            out["note"] = report.note;
+            break;
+        case REPORT_WRONG_NOTE:
+            out["type"] = "game_wrong";
+            out["note"] = report.note;
+            break;
+        case REPORT_COMPLETE:
+            // Sent once the session is over - the totals no longer change
+            out["type"] = "game_complete";
+            out["notes"] = _noteCount;
+            out["hits"] = _hits;
+            out["perfect"] = _perfect;
+            out["misses"] = _misses;
+            out["wrong"] = _wrong;
+            out["max_combo"] = _maxCombo;
+            out["accuracy"] = _noteCount > 0 ? (uint32_t)_hits * 100 / _noteCount : 0;
+            out["stars"] = getStars();
+            break;
+    }
+    out["score"] = report.score;
+    out["combo"] = report.combo;
+    out["multiplier"] = report.multiplier;
+    return true;
+}
+
+void GameEngine::fillStatus(JsonObject out) const {
+    out["active"] = _active;
+    out["notes"] = _noteCount;
+    out["difficulty"] = DIFFICULTY_NAMES[_difficulty];
+    out["look_ahead_ms"] = _lookAheadMs;
+    out["hit_window_ms"] = HIT_WINDOW_MS[_difficulty];
+    out["score"] = _score;
+    out["combo"] = _combo;
+    out["max_combo"] = _maxCombo;
+    out["multiplier"] = getMultiplier();
+    out["hits"] = _hits;
+    out["perfect"] = _perfect;
+    out["misses"] = _misses;
+    out["wrong"] = _wrong;
+}
@@ -0,0 +1,147 @@
+#ifndef GAME_ENGINE_H
+#define GAME_ENGINE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "midi_event_ring.h"
+#include "../include/hotkey_handler.h"
+
+enum GameDifficulty : uint8_t {
+    GAME_EASY = 0,
+    GAME_MEDIUM = 1,
+    GAME_HARD = 2
+};
+
+// Falling-notes game (SPECIFICATION.md 2.6).
+//
+// The app loads the song's notes once, in time order, and starts the game.
+// Every note appears GAME_FALL_SPAN LEDs to both sides of its key one
+// look-ahead window before it is due and closes in on the key, reaching it
+// at the note's time. Hits are judged on the device against the timestamp
+// the note got on the MIDI path, so neither the frame rate nor WiFi moves
+// the judgement: a note struck within the difficulty's window scores
+// (perfect in its inner third), one let through the window is a miss.
+// Hits in a row build a combo that raises the score multiplier.
+//
+// Notes enter a time-sorted ring as they reach the look-ahead window and
+// leave it once judged and their flash is over, so a frame only touches
+// the notes on the strip however long the song is.
+//
+// The engine runs as a frame hook of the render task (frameEntry()), one
+// more consumer of the event ring; hits, misses and the end of the song
+// are queued as reports for the network stage. Methods called from other
+// tasks take RenderLock themselves.
+class GameEngine {
+public:
+    GameEngine();
+
+    // Song content. A WebSocket message is at most WS_MAX_MESSAGE_SIZE
+    // bytes - about 600 notes in the compact form, half that as objects -
+    // so a song may come in pieces: clear() then add notes in time order.
+    // addNote() fails once GAME_MAX_NOTES are used.
+    void clear();
+    bool addNote(uint32_t timeMs, uint8_t note);
+    uint16_t getNoteCount() const;
+
+    // Start (or restart) from the first note; switches the LEDs to game mode.
+    // lookAheadMs is the fall time, clamped to GAME_MIN/MAX_LOOKAHEAD_MS.
+    bool start(GameDifficulty difficulty, uint16_t lookAheadMs);
+    void stop();
+    bool isActive() const;
+
+    // Render task, under RenderLock: judge, expire and draw. Returns true
+    // while the game animates.
+    static bool frameEntry(void* arg);
+    bool frame();
+
+    // Next report for the app as a complete message, false if none
+    bool nextReport(JsonObject out);
+
+    void fillStatus(JsonObject out) const;
+
+    static GameDifficulty parseDifficulty(const char* difficulty);
+    static uint16_t speedToLookAhead(uint8_t speed);    // Fall speed 1-10
+
+private:
+    enum Judgement : uint8_t {
+        JUDGE_PENDING = 0,
+        JUDGE_HIT,
+        JUDGE_MISS
+    };
+
+    // A note on the strip; times are song time in us
+    struct Falling {
+        int32_t atUs;
+        int32_t judgedUs;
+        uint8_t note;
+        Judgement state;
+    };
+
+    enum ReportType : uint8_t {
+        REPORT_HIT = 0,
+        REPORT_MISS,
+        REPORT_WRONG_NOTE,
+        REPORT_COMPLETE
+    };
+
+    struct Report {
+        ReportType type;
+        uint8_t note;
+        bool perfect;
+        uint8_t multiplier;
+        int16_t offsetMs;       // Struck minus due, negative = early
+        uint16_t points;
+        uint16_t combo;
+        uint32_t score;
+    };
+
+    static const uint8_t WINDOW_MASK = GAME_WINDOW_SIZE - 1;
+
+    // Song - time order
+    uint32_t _timeMs[GAME_MAX_NOTES];
+    uint8_t _notes[GAME_MAX_NOTES];
+    uint16_t _noteCount;
+
+    // Session
+    bool _active;
+    GameDifficulty _difficulty;
+    uint16_t _lookAheadMs;
+    int32_t _lookAheadUs;
+    int32_t _hitWindowUs;
+    uint32_t _originUs;         // Event time of song time 0
+    uint16_t _next;             // First note not in the window yet
+    MidiEventRing::Reader _reader;
+    HotkeyFilter _hotkeys;
+
+    // Notes on the strip, oldest first
+    Falling _window[GAME_WINDOW_SIZE];
+    uint8_t _windowHead;
+    uint8_t _windowCount;
+
+    // Score
+    uint32_t _score;
+    uint16_t _combo;
+    uint16_t _maxCombo;
+    uint16_t _hits;
+    uint16_t _perfect;
+    uint16_t _misses;
+    uint32_t _wrong;
+
+    Report _reports[GAME_REPORT_QUEUE];
+    uint8_t _reportHead;
+    uint8_t _reportCount;
+
+    int32_t songTime(uint32_t eventUs) const;
+    uint8_t getMultiplier() const;
+    void judge(uint8_t note, int32_t atUs);
+    void feed(int32_t nowUs);
+    void draw(int32_t nowUs);
+    void finish();
+    uint8_t getStars() const;
+    Report& queueReport(ReportType type, uint8_t note = 0);
+};
+
+extern GameEngine* gameEngine;
+
+#endif // GAME_ENGINE_H
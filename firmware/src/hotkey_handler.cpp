@@ -1,77 +1,60 @@
 #include "hotkey_handler.h"
 #include "led_controller.h"
+#include "render_task.h"
+#include "midi_event_ring.h"
 
 // Global pointer - initialized in setup() to avoid static initialization issues
 HotkeyHandler* hotkeyHandler = nullptr;
 
-HotkeyHandler::HotkeyHandler() : _pressedCount(0) {
-    memset(_pressedNotes, 0, sizeof(_pressedNotes));
-    memset(_pressedTimes, 0, sizeof(_pressedTimes));
+HotkeyFilter::HotkeyFilter()
+    : _a0Down(false)
+    , _b0Down(false)
+    , _a0DownUs(0)
+    , _b0DownUs(0)
+{
 }
 
-void HotkeyHandler::noteOn(uint8_t note, uint8_t velocity) {
-    // Check if already in list
-    for (uint8_t i = 0; i < _pressedCount; i++) {
-        if (_pressedNotes[i] == note) {
-            return;  // Already pressed
-        }
-    }
+bool HotkeyFilter::filter(const MidiEvent& ev) {
+    uint8_t note = ev.data1;
 
-    // Add to pressed list
-    if (_pressedCount < MAX_PRESSED) {
-        _pressedNotes[_pressedCount] = note;
-        _pressedTimes[_pressedCount] = millis();
-        _pressedCount++;
+    if (ev.isNoteOff()) {
+        if (note == HOTKEY_A0) _a0Down = false;
+        if (note == HOTKEY_B0) _b0Down = false;
+        return false;
     }
-}
+    if (!ev.isNoteOn()) return false;
 
-void HotkeyHandler::noteOff(uint8_t note) {
-    // Remove from pressed list
-    for (uint8_t i = 0; i < _pressedCount; i++) {
-        if (_pressedNotes[i] == note) {
-            // Shift remaining notes
-            for (uint8_t j = i; j < _pressedCount - 1; j++) {
-                _pressedNotes[j] = _pressedNotes[j + 1];
-                _pressedTimes[j] = _pressedTimes[j + 1];
-            }
-            _pressedCount--;
-            break;
-        }
+    // Repeated note-ons keep the original press time
+    if (note == HOTKEY_A0) {
+        if (!_a0Down) _a0DownUs = ev.timeUs;
+        _a0Down = true;
+        return false;
+    }
+    if (note == HOTKEY_B0) {
+        if (!_b0Down) _b0DownUs = ev.timeUs;
+        _b0Down = true;
+        return false;
     }
-}
 
-bool HotkeyHandler::isActivationNote(uint8_t note) {
-    return (note == HOTKEY_A0 || note == HOTKEY_B0);
+    // Any other key is an action key once both activation keys are held long enough
+    return _a0Down && _b0Down
+        && (ev.timeUs - _a0DownUs) >= HOLD_TIME_US
+        && (ev.timeUs - _b0DownUs) >= HOLD_TIME_US;
 }
 
-bool HotkeyHandler::isActivationPressed() {
-    bool hasA0 = false, hasB0 = false;
-    uint32_t now = millis();
-
-    for (uint8_t i = 0; i < _pressedCount; i++) {
-        // Check if key has been held long enough
-        if (now - _pressedTimes[i] >= HOLD_TIME_MS) {
-            if (_pressedNotes[i] == HOTKEY_A0) hasA0 = true;
-            if (_pressedNotes[i] == HOTKEY_B0) hasB0 = true;
-        }
-    }
-
-    return hasA0 && hasB0;
+HotkeyHandler::HotkeyHandler() {
 }
 
-bool HotkeyHandler::checkHotkey() {
-    if (!isActivationPressed()) return false;
+bool HotkeyHandler::handleEvent(const MidiEvent& ev) {
+    if (!_filter.filter(ev)) return false;
 
-    // Look for action key (any key that's not A0 or B0)
-    for (uint8_t i = 0; i < _pressedCount; i++) {
-        uint8_t note = _pressedNotes[i];
+    RenderLock lock;  // Hotkeys change LEDController state the render task is using
+    executeHotkey(ev.data1);
+    return true;
+}
 
-        if (note != HOTKEY_A0 && note != HOTKEY_B0) {
-            executeHotkey(note);
-            return true;
-        }
-    }
-    return false;
+bool HotkeyHandler::isActivationNote(uint8_t note) {
+    return (note == HOTKEY_A0 || note == HOTKEY_B0);
 }
 
 uint8_t HotkeyHandler::getHueForNote(uint8_t note) {
@@ -87,15 +70,13 @@ uint8_t HotkeyHandler::getHueForNote(uint8_t note) {
     }
 }
 
+// Feedback is drawn as a timed overlay: the render task composites it over
+// the keys and removes it, so nothing here waits or clears the key display.
+// Callers hold RenderLock (handleEvent()).
+
 void HotkeyHandler::flashConfirmation() {
     // Flash first 5 LEDs green at 30% brightness (less harsh on eyes)
-    ledController->blackout();
-    for (int i = 0; i < 5; i++) {
-        ledController->setLedDirect(i, CHSV(96, 255, 76));  // Green, 30% brightness
-    }
-    FastLED.show();
-    delay(150);
-    ledController->blackout();
+    ledController->showFeedback(0, 5, 1, CHSV(96, 255, 76), FEEDBACK_SHORT_MS);
 }
 
 void HotkeyHandler::flashBrightnessLevel() {
@@ -107,26 +88,14 @@ void HotkeyHandler::flashBrightnessLevel() {
     uint8_t ledCount = (brightness * 20 + 127) / 255;  // Округление
     if (brightness > 0 && ledCount == 0) ledCount = 1;  // Минимум 1 диод если яркость > 0
 
-    ledController->blackout();
-    for (uint8_t i = 0; i < ledCount; i++) {
-        ledController->setLedDirect(i, CHSV(96, 255, 76));  // Зелёный, 30% яркости
-    }
-    FastLED.show();
-    delay(200);
-    ledController->blackout();
+    ledController->showFeedback(0, ledCount, 1, CHSV(96, 255, 76), FEEDBACK_LONG_MS);  // Зелёный, 30% яркости
 }
 
 void HotkeyHandler::flashWaveWidth() {
     // Показать ширину волны количеством диодов (1-6)
     uint8_t width = ledController->getWaveStaticWidth();
 
-    ledController->blackout();
-    for (uint8_t i = 0; i < width; i++) {
-        ledController->setLedDirect(i, CHSV(160, 255, 76));  // Голубой, 30% яркости
-    }
-    FastLED.show();
-    delay(200);
-    ledController->blackout();
+    ledController->showFeedback(0, width, 1, CHSV(160, 255, 76), FEEDBACK_LONG_MS);  // Голубой, 30% яркости
 }
 
 void HotkeyHandler::executeHotkey(uint8_t actionNote) {
@@ -223,13 +192,7 @@ void HotkeyHandler::executeHotkey(uint8_t actionNote) {
                 if (hue != 255) {
                     ledController->setHue(hue);
                     // Show the new color on first 5 LEDs at 30% brightness
-                    ledController->blackout();
-                    for (int i = 0; i < 5; i++) {
-                        ledController->setLedDirect(i, CHSV(hue, 255, 76));
-                    }
-                    FastLED.show();
-                    delay(150);
-                    ledController->blackout();
+                    ledController->showFeedback(0, 5, 1, CHSV(hue, 255, 76), FEEDBACK_SHORT_MS);
                 }
             }
             break;
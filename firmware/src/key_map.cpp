@@ -0,0 +1,62 @@
+#include "key_map.h"
+
+// Note to LED mapping table - custom calibrated for this LED strip configuration
+// (LED_DEFAULT_COUNT LEDs above the keys)
+static const uint8_t NOTE_TO_LED[NUM_PIANO_KEYS] = {
+    // Octave 0: A0, A#0, B0
+    0,    2,    4,
+    // Octave 1: C1, C#1, D1, D#1, E1, F1, F#1, G1, G#1, A1, A#1, B1
+    6,    8,   10,   12,   14,   16,   18,   20,   22,   24,   26,   28,
+    // Octave 2: C2, C#2, D2, D#2, E2, F2, F#2, G2, G#2, A2, A#2, B2
+    30,   32,   34,   36,   38,   40,   42,   44,   46,   48,   50,   52,
+    // Octave 3: C3, C#3, D3, D#3, E3, F3, F#3, G3, G#3, A3, A#3, B3
+    54,   56,   58,   60,   62,   64,   66,   68,   70,   72,   74,   76,
+    // Octave 4: C4, C#4, D4, D#4, E4, F4, F#4, G4, G#4, A4, A#4, B4
+    78,   80,   82,   84,   86,   88,   90,   92,   94,   96,   98,   99,
+    // Octave 5: C5, C#5, D5, D#5, E5, F5, F#5, G5, G#5, A5, A#5, B5
+    101,  103,  105,  107,  109,  111,  113,  115,  117,  119,  121,  123,
+    // Octave 6: C6, C#6, D6, D#6, E6, F6, F#6, G6, G#6, A6, A#6, B6
+    125,  127,  129,  131,  133,  135,  137,  139,  141,  143,  145,  147,
+    // Octave 7: C7, C#7, D7, D#7, E7, F7, F#7, G7, G#7, A7, A#7, B7
+    149,  151,  153,  155,  157,  159,  161,  163,  165,  167,  169,  171,
+    // Octave 8: C8
+    174
+};
+
+KeyMap KeyMap::factory(uint16_t keyLeds) {
+    KeyMap map;
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        map.led[key] = (uint32_t)NOTE_TO_LED[key] * keyLeds / LED_DEFAULT_COUNT;
+    }
+    return map;
+}
+
+KeyMap KeyMap::interpolate(uint8_t firstNote, uint8_t lastNote, uint16_t firstLed, uint16_t lastLed) {
+    KeyMap map;
+    int32_t keys = lastNote - firstNote;
+    int32_t leds = (int32_t)lastLed - firstLed;     // Negative if the span runs backwards
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        uint8_t note = key + LOWEST_MIDI_NOTE;
+        if (note < firstNote || note > lastNote) {
+            map.led[key] = NONE;
+            continue;
+        }
+        // Rounded to the nearest LED, symmetric for both directions
+        int32_t step = (note - firstNote) * leds;
+        int32_t offset = keys > 0 ? (step + (step >= 0 ? keys / 2 : -keys / 2)) / keys : 0;
+        map.led[key] = firstLed + offset;
+    }
+    return map;
+}
+
+bool KeyMap::isValid(uint16_t keyLeds) const {
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        if (led[key] != NONE && led[key] >= keyLeds) return false;
+    }
+    return true;
+}
+
+uint16_t KeyMap::ledFor(uint8_t note) const {
+    if (note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return NONE;
+    return led[note - LOWEST_MIDI_NOTE];
+}
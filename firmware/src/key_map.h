@@ -0,0 +1,27 @@
+#ifndef KEY_MAP_H
+#define KEY_MAP_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Which LED of the key segment sits above each piano key (key index =
+// MIDI note - LOWEST_MIDI_NOTE). Indices run from the start of the
+// segment as wired; strip reversal is applied by LEDController when it
+// builds its lookup tables, so a map stays valid if the strip is flipped.
+struct KeyMap {
+    static const uint16_t NONE = 0xFFFF;    // Key without an LED (not on this keyboard)
+
+    uint16_t led[NUM_PIANO_KEYS];
+
+    // Factory table for LED_DEFAULT_COUNT LEDs, scaled onto keyLeds
+    static KeyMap factory(uint16_t keyLeds);
+
+    // Quick calibration: firstNote..lastNote spread evenly over
+    // firstLed..lastLed, keys outside the range dark
+    static KeyMap interpolate(uint8_t firstNote, uint8_t lastNote, uint16_t firstLed, uint16_t lastLed);
+
+    bool isValid(uint16_t keyLeds) const;   // Every mapped LED inside the key segment
+    uint16_t ledFor(uint8_t note) const;    // NONE outside the piano range
+};
+
+#endif // KEY_MAP_H
@@ -3,30 +3,32 @@
 // Global pointer - initialized in setup() to avoid static initialization issues
 LEDController* ledController = nullptr;
 
-// Note to LED mapping table - custom calibrated for this LED strip configuration
-const uint8_t NOTE_TO_LED[88] = {
-    // Octave 0: A0, A#0, B0
-    0,    2,    4,
-    // Octave 1: C1, C#1, D1, D#1, E1, F1, F#1, G1, G#1, A1, A#1, B1
-    6,    8,   10,   12,   14,   16,   18,   20,   22,   24,   26,   28,
-    // Octave 2: C2, C#2, D2, D#2, E2, F2, F#2, G2, G#2, A2, A#2, B2
-    30,   32,   34,   36,   38,   40,   42,   44,   46,   48,   50,   52,
-    // Octave 3: C3, C#3, D3, D#3, E3, F3, F#3, G3, G#3, A3, A#3, B3
-    54,   56,   58,   60,   62,   64,   66,   68,   70,   72,   74,   76,
-    // Octave 4: C4, C#4, D4, D#4, E4, F4, F#4, G4, G#4, A4, A#4, B4
-    78,   80,   82,   84,   86,   88,   90,   92,   94,   96,   98,   99,
-    // Octave 5: C5, C#5, D5, D#5, E5, F5, F#5, G5, G#5, A5, A#5, B5
-    101,  103,  105,  107,  109,  111,  113,  115,  117,  119,  121,  123,
-    // Octave 6: C6, C#6, D6, D#6, E6, F6, F#6, G6, G#6, A6, A#6, B6
-    125,  127,  129,  131,  133,  135,  137,  139,  141,  143,  145,  147,
-    // Octave 7: C7, C#7, D7, D#7, E7, F7, F#7, G7, G#7, A7, A#7, B7
-    149,  151,  153,  155,  157,  159,  161,  163,  165,  167,  169,  171,
-    // Octave 8: C8
-    174
+// FastLED.show() for 176 WS2812B is ~5.3 ms of wire time plus overhead.
+// Segments go out in parallel, so the longest one sets the time.
+static const uint32_t SHOW_TIME_BUCKETS_US[] = {
+    500, 1000, 2000, 4000, 5000, 5500, 6000, 7000, 8000, 12000, 20000
 };
 
+// FastLED needs the data pin at compile time - one case per LED_SEGMENT_PINS entry
+static bool addSegmentLeds(uint8_t pin, CRGB* leds, uint16_t count) {
+    switch (pin) {
+#define LED_ADD_CASE(p) case p: FastLED.addLeds<WS2812B, p, GRB>(leds, count); return true;
+        LED_SEGMENT_PINS(LED_ADD_CASE)
+#undef LED_ADD_CASE
+        default:
+            return false;
+    }
+}
+
 LEDController::LEDController()
     : _enabled(true)
+    , _layout(LedLayout::defaults())
+    , _ledCount(LED_DEFAULT_COUNT)
+    , _keyLedCount(LED_DEFAULT_COUNT)
+    , _keyMap(KeyMap::factory(LED_DEFAULT_COUNT))
+    , _ditherPending(false)
+    , _bgStale(true)
+    , _guideStale(true)
     , _mode(MODE_FREE_PLAY)
     , _brightness(76)   // 30% brightness by default
     , _hue(0)
@@ -37,7 +39,7 @@ LEDController::LEDController()
     , _leftColor(0, 255, 255)    // Red
     , _rightColor(160, 255, 255) // Cyan
     , _randomHue(0)
-    , _expectedCount(0)
+    , _guideStepCount(0)
     , _guideColor(42, 255, 255)   // Golden yellow (hue 42)
     , _successColor(96, 255, 255) // Green (hue 96)
     , _errorColor(0, 255, 255)    // Red (hue 0)
@@ -52,6 +54,20 @@ LEDController::LEDController()
     , _splashEnabled(false)
     , _waveVelocityMode(false)
     , _waveStaticWidth(3)
+    , _dirty(true)
+    , _dirtyFirst(0)
+    , _dirtyLast(LED_DEFAULT_COUNT - 1)
+    , _lastPushFirst(0)
+    , _lastPushLast(0)
+    , _keepAliveMs(LED_KEEPALIVE_MS)
+    , _lastPushTime(0)
+    , _framesPushed(0)
+    , _framesSkipped(0)
+    , _fadeCycles(0)
+    , _showTime(SHOW_TIME_BUCKETS_US, sizeof(SHOW_TIME_BUCKETS_US) / sizeof(uint32_t))
+    , _bootAnimActive(false)
+    , _bootAnimStart(0)
+    , _bootAnimPos(0)
     , _lastFadeTime(0)
     , _ambientAnimation(0)     // Default: Rainbow
     , _animationSpeed(50)      // Medium speed
@@ -60,28 +76,68 @@ LEDController::LEDController()
     memset(_keysOn, 0, sizeof(_keysOn));
     memset(_keyVelocity, 0, sizeof(_keyVelocity));
     memset(_keyHue, 0, sizeof(_keyHue));
-    memset(_expectedNotes, 0, sizeof(_expectedNotes));
+    _expected.clear();
     memset(_splashes, 0, sizeof(_splashes));
-}
-
-void LEDController::begin() {
-    // Initialize FastLED
-    FastLED.addLeds<WS2812B, LED_PIN, GRB>(_leds, NUM_LEDS);
-    FastLED.setBrightness(_brightness);
-    FastLED.setMaxPowerInVoltsAndMilliamps(5, LED_MAX_POWER_MW);
+    memset(&_feedback, 0, sizeof(_feedback));
+    fill_solid(_leds, LED_MAX_COUNT, CRGB::Black);
+    fill_solid(_corrected, LED_MAX_COUNT, CRGB::Black);
+    fill_solid(_wire, LED_MAX_COUNT, CRGB::Black);
+
+    // Layer stack, bottom to top. Keys and splash use MAX so a fading key
+    // settles onto the background instead of punching a dark hole in it.
+    layer(FrameCompositor::LAYER_BACKGROUND).configure(BLEND_REPLACE);
+    layer(FrameCompositor::LAYER_KEYS).configure(BLEND_MAX);
+    layer(FrameCompositor::LAYER_SPLASH).configure(BLEND_MAX);
+    layer(FrameCompositor::LAYER_GUIDE).configure(BLEND_REPLACE);
+    layer(FrameCompositor::LAYER_OVERLAY).configure(BLEND_REPLACE);
+
+    _compositor.setLength(_ledCount);
+    rebuildLedMap();
+    refreshLayers();
+}
+
+void LEDController::begin(const LedLayout& layout) {
+    // A bad stored layout must not leave the keys dark
+    _layout = layout.isValid() ? layout : LedLayout::defaults();
+    _ledCount = _layout.totalLeds();
+    _keyLedCount = _layout.segments[0].count;
+    _keyMap = KeyMap::factory(_keyLedCount);   // A calibrated map is applied once LittleFS is up
+    _compositor.setLength(_ledCount);
+    _power.configure(PowerConfig::defaults(_layout), _ledCount);
+    rebuildLedMap();
+    markAllDirty();
+
+    // One controller per segment, each on its own RMT channel. FastLED.show()
+    // starts every channel before it waits, so the segments go out in parallel.
+    for (uint8_t s = 0; s < _layout.segmentCount; s++) {
+        addSegmentLeds(_layout.segments[s].pin, _wire + _layout.segmentStart(s), _layout.segments[s].count);
+    }
+    // Brightness is folded into the output tables and the current limit is
+    // PowerBudget's - FastLED sends the wire buffer as it is
+    _output.setBrightness(_brightness);
+    FastLED.setBrightness(255);
+    // Idle frames are not pushed, so FastLED's temporal dithering would freeze
+    // on a random phase - OutputStage dithers instead and keeps pushing while it does
+    FastLED.setDither(DISABLE_DITHER);
 
     // Start with all LEDs off
     blackout();
+    show();
 }
 
 void LEDController::update() {
     unsigned long now = millis();
 
+    expireFeedback(now);
+    if (_bootAnimActive) {
+        advanceBootAnimation(now);
+    }
+
     // Fade effect
     if (now - _lastFadeTime >= FADE_INTERVAL) {
         _lastFadeTime = now;
 
-        // Handle ambient mode animations
+        // Handle ambient mode animations (drawn into the background layer)
         if (_mode == MODE_AMBIENT) {
             updateAmbient();
         } else {
@@ -91,31 +147,143 @@ void LEDController::update() {
             if (_splashEnabled) {
                 updateSplash();
             }
-
-            // In learning mode, show guide color for expected notes that aren't pressed
-            if (_mode == MODE_LEARNING && _expectedCount > 0) {
-                for (uint8_t i = 0; i < _expectedCount; i++) {
-                    uint8_t midiNote = _expectedNotes[i];
-                    if (midiNote >= LOWEST_MIDI_NOTE && midiNote <= HIGHEST_MIDI_NOTE) {
-                        uint8_t keyIndex = midiNote - LOWEST_MIDI_NOTE;
-                        // Only show guide if key is not currently pressed
-                        if (!_keysOn[keyIndex]) {
-                            // Use noteToLed mapping for guide LEDs
-                            int16_t ledIndex = noteToLed(midiNote);
-                            if (ledIndex >= 0 && ledIndex < NUM_LEDS) {
-                                _leds[ledIndex] = CHSV(_guideColor.h, _guideColor.s, _guideColor.v);
-                            }
-                        }
-                    }
-                }
-            }
         }
+    }
+
+    // Background and guide only change on settings/notes, not per frame
+    refreshLayers();
+}
+
+void LEDController::show() {
+    // Composite the layers; only the range that changed in any of them is touched
+    uint16_t first, last;
+    if (_compositor.compose(_leds, first, last)) {
+        markDirty(first, last);
+    }
+
+    // A dithered frame differs from the previous one everywhere
+    if (_ditherPending) {
+        markAllDirty();
+    }
+
+    unsigned long now = millis();
+    bool keepAliveDue = _keepAliveMs > 0 && (now - _lastPushTime) >= _keepAliveMs;
+
+    if (!_dirty && !keepAliveDue) {
+        _framesSkipped++;
+        return;
+    }
+
+    // Output tables and current estimate over the changed range only
+    if (_output.isDithering()) {
+        _ditherPending = _output.applyDithered(_leds, _corrected, _ledCount);
+        _power.account(_corrected, 0, _ledCount - 1);
+    } else if (_dirty) {
+        _output.apply(_leds, _corrected, _dirtyFirst, _dirtyLast);
+        _power.account(_corrected, _dirtyFirst, _dirtyLast);
+    }
 
-        FastLED.show();
+    // New limit factors rescale the whole strip, otherwise the changed range
+    if (_power.solve()) {
+        markAllDirty();
     }
+    if (_dirty) {
+        _power.limit(_corrected, _wire, _dirtyFirst, _dirtyLast);
+    }
+
+    uint32_t start = micros();
+    FastLED.show();
+    _showTime.observe(micros() - start);
+    _framesPushed++;
+    _lastPushTime = now;
+    _lastPushFirst = _dirty ? _dirtyFirst : 0;
+    _lastPushLast = _dirty ? _dirtyLast : 0;
+    _dirty = false;
+}
+
+// ============== Dirty Tracking ==============
+
+bool LEDController::isDirty() const {
+    return _dirty;
+}
+
+void LEDController::markAllDirty() {
+    _dirty = true;
+    _dirtyFirst = 0;
+    _dirtyLast = _ledCount - 1;
+}
+
+void LEDController::markDirty(uint16_t first, uint16_t last) {
+    if (!_dirty) {
+        _dirty = true;
+        _dirtyFirst = first;
+        _dirtyLast = last;
+    } else {
+        if (first < _dirtyFirst) _dirtyFirst = first;
+        if (last > _dirtyLast) _dirtyLast = last;
+    }
+}
+
+void LEDController::setKeepAliveMs(uint16_t ms) {
+    _keepAliveMs = ms;
+}
+
+uint16_t LEDController::getKeepAliveMs() const {
+    return _keepAliveMs;
+}
+
+uint32_t LEDController::getFramesPushed() const {
+    return _framesPushed;
+}
+
+uint32_t LEDController::getFramesSkipped() const {
+    return _framesSkipped;
+}
+
+uint16_t LEDController::getLastPushFirst() const {
+    return _lastPushFirst;
+}
+
+uint16_t LEDController::getLastPushLast() const {
+    return _lastPushLast;
+}
+
+uint16_t LEDController::getActiveLedCount() const {
+    return _compositor.layer(FrameCompositor::LAYER_KEYS).active().size()
+         + _compositor.layer(FrameCompositor::LAYER_SPLASH).active().size();
+}
+
+bool LEDController::isAnimating() const {
+    if (_dirty || _ditherPending || _bootAnimActive || _feedback.active || _mode == MODE_AMBIENT) return true;
+    if (getActiveLedCount() > 0) return true;
+    for (uint8_t i = 0; i < MAX_SPLASHES; i++) {
+        if (_splashes[i].active) return true;
+    }
+    return false;
+}
+
+uint32_t LEDController::getLastFadeCycles() const {
+    return _fadeCycles;
+}
+
+const MetricHistogram& LEDController::getShowTimeHistogram() const {
+    return _showTime;
+}
+
+const LedLayout& LEDController::getLayout() const {
+    return _layout;
+}
+
+uint16_t LEDController::getLedCount() const {
+    return _ledCount;
+}
+
+uint16_t LEDController::getKeyLedCount() const {
+    return _keyLedCount;
 }
 
 void LEDController::noteOn(uint8_t note, uint8_t velocity) {
+    stopBootAnimation();    // The first note ends the boot animation
     if (!_enabled) return;  // Skip if LEDs are disabled
     if (note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return;
     if (velocity == 0) {
@@ -126,6 +294,7 @@ void LEDController::noteOn(uint8_t note, uint8_t velocity) {
     uint8_t keyIndex = mapNoteToKeyIndex(note);
     _keysOn[keyIndex] = true;
     _keyVelocity[keyIndex] = velocity;
+    if (_mode == MODE_LEARNING) _guideStale = true;  // Guide hides under pressed keys
 
     // Chord detection for hue shift
     if (_hueShiftEnabled) {
@@ -149,13 +318,14 @@ void LEDController::noteOn(uint8_t note, uint8_t velocity) {
 
     CRGB color = getColorForKey(keyIndex, velocity);
     setKeyLEDs(keyIndex, color);
+    if (_mode != MODE_AMBIENT && _noteToLed[keyIndex] >= 0) {
+        _power.setProtected(_noteToLed[keyIndex], true);
+    }
 
     // Add splash effect if enabled
     if (_splashEnabled) {
         addSplash(keyIndex, velocity);
     }
-
-    FastLED.show();
 }
 
 void LEDController::noteOff(uint8_t note) {
@@ -164,17 +334,35 @@ void LEDController::noteOff(uint8_t note) {
     uint8_t keyIndex = mapNoteToKeyIndex(note);
     _keysOn[keyIndex] = false;
     _keyVelocity[keyIndex] = 0;
-    // LEDs will fade out naturally via fade()
+    if (_mode == MODE_LEARNING) _guideStale = true;
+    // LEDs will fade out naturally via fade(), limited like any other pixel
+    int16_t led = _noteToLed[keyIndex];
+    if (led >= 0) {
+        _power.setProtected(led, false);
+        if (_power.isLimiting()) markDirty(led, led);   // Its limit factor changes
+    }
 }
 
 void LEDController::allNotesOff() {
     memset(_keysOn, 0, sizeof(_keysOn));
     memset(_keyVelocity, 0, sizeof(_keyVelocity));
+    _power.clearProtected();
     blackout();
 }
 
 void LEDController::setMode(LEDMode mode) {
+    if (mode != _mode) {
+        if (mode == MODE_AMBIENT) {
+            // Ambient owns the whole strip - drop whatever the keys left behind
+            layer(FrameCompositor::LAYER_KEYS).clear();
+            layer(FrameCompositor::LAYER_SPLASH).clear();
+        }
+        _bgStale = true;     // Ambient draws into the background layer
+        _guideStale = true;
+    }
+    bool ambientChanged = (mode == MODE_AMBIENT) != (_mode == MODE_AMBIENT);
     _mode = mode;
+    if (ambientChanged) syncProtection();   // Keys are hidden in ambient
     // When changing to random mode, pick a new random hue
     if (_mode == MODE_RANDOM) {
         _randomHue = random(256);
@@ -186,14 +374,66 @@ LEDMode LEDController::getMode() const {
 }
 
 void LEDController::setBrightness(uint8_t brightness) {
+    if (_output.setBrightness(brightness)) {
+        markAllDirty();  // Global scale changes every pixel on the wire
+    }
     _brightness = brightness;
-    FastLED.setBrightness(_brightness);
 }
 
 uint8_t LEDController::getBrightness() const {
     return _brightness;
 }
 
+void LEDController::setGamma(float gamma) {
+    if (_output.setGamma(gamma)) {
+        markAllDirty();
+    }
+}
+
+float LEDController::getGamma() const {
+    return _output.getGamma();
+}
+
+void LEDController::setWhiteBalance(const CRGB& balance) {
+    if (_output.setWhiteBalance(balance)) {
+        markAllDirty();
+    }
+}
+
+const CRGB& LEDController::getWhiteBalance() const {
+    return _output.getWhiteBalance();
+}
+
+void LEDController::setDither(bool enabled) {
+    if (enabled != _output.isDithering()) {
+        _output.setDither(enabled);
+        _ditherPending = false;
+        markAllDirty();  // Re-send without the last dither threshold
+    }
+}
+
+bool LEDController::isDithering() const {
+    return _output.isDithering();
+}
+
+uint32_t LEDController::getOutputRebuilds() const {
+    return _output.getRebuildCount();
+}
+
+bool LEDController::setPowerConfig(const PowerConfig& config) {
+    if (!config.isValid(_ledCount)) return false;
+
+    // Zones moved - cost the whole strip again
+    _power.configure(config, _ledCount);
+    _power.account(_corrected, 0, _ledCount - 1);
+    syncProtection();
+    return true;
+}
+
+const PowerBudget& LEDController::getPowerBudget() const {
+    return _power;
+}
+
 void LEDController::setHue(uint8_t hue) {
     _hue = hue;
 }
@@ -211,7 +451,10 @@ void LEDController::setFadeRate(uint8_t rate) {
 }
 
 void LEDController::setReversed(bool reversed) {
-    _reversed = reversed;
+    if (reversed != _reversed) {
+        _reversed = reversed;
+        rebuildLedMap();
+    }
 }
 
 bool LEDController::isReversed() const {
@@ -233,53 +476,110 @@ void LEDController::setRightColor(uint8_t hue, uint8_t sat, uint8_t val) {
 }
 
 void LEDController::blackout() {
-    fill_solid(_leds, NUM_LEDS, CRGB::Black);
-    FastLED.show();
+    layer(FrameCompositor::LAYER_KEYS).clear();
+    layer(FrameCompositor::LAYER_SPLASH).clear();
+    layer(FrameCompositor::LAYER_OVERLAY).clear();
+    _feedback.active = false;
 }
 
 void LEDController::showColor(CRGB color) {
-    fill_solid(_leds, NUM_LEDS, color);
-    FastLED.show();
+    FrameLayer& overlay = layer(FrameCompositor::LAYER_OVERLAY);
+    if (color) {
+        overlay.fill(color);
+    } else {
+        overlay.clear();
+    }
 }
 
-void LEDController::playStartupAnimation() {
-    // Rainbow wave animation - one direction only (faster startup)
-    const uint8_t WAVE_WIDTH = 20;  // Width of the wave
-    const uint8_t ANIMATION_DELAY = 6;  // Faster speed
+// ============== Boot Animation ==============
 
-    // Wave going right only
-    for (int16_t pos = -WAVE_WIDTH; pos <= NUM_LEDS; pos++) {
-        fill_solid(_leds, NUM_LEDS, CRGB::Black);
+void LEDController::startBootAnimation() {
+    _bootAnimStart = millis();
+    _bootAnimPos = INT16_MIN;
+    _bootAnimActive = true;
+}
 
-        for (int16_t i = 0; i < WAVE_WIDTH; i++) {
-            int16_t ledIndex = pos + i;
-            if (ledIndex >= 0 && ledIndex < NUM_LEDS) {
-                // Rainbow gradient within the wave
-                uint8_t hue = (i * 256 / WAVE_WIDTH);
-                uint8_t brightness = sin8((i * 255) / WAVE_WIDTH);  // Fade at edges
-                _leds[ledIndex] = CHSV(hue, 255, brightness);
-            }
-        }
-        FastLED.show();
-        delay(ANIMATION_DELAY);
-        yield();  // Feed watchdog to prevent reset
+void LEDController::stopBootAnimation() {
+    if (!_bootAnimActive) return;
+    _bootAnimActive = false;
+    layer(FrameCompositor::LAYER_OVERLAY).clear();
+}
+
+bool LEDController::isBootAnimationActive() const {
+    return _bootAnimActive;
+}
+
+void LEDController::advanceBootAnimation(unsigned long now) {
+    // Rainbow wave going right, one LED per BOOT_ANIMATION_STEP_MS.
+    // Position follows the clock, so a slow frame skips ahead instead of stretching it.
+    const int16_t WAVE_WIDTH = 20;  // Width of the wave
+
+    int16_t pos = (int16_t)((now - _bootAnimStart) / BOOT_ANIMATION_STEP_MS) - WAVE_WIDTH;
+    if (pos == _bootAnimPos) return;
+    _bootAnimPos = pos;
+
+    FrameLayer& overlay = layer(FrameCompositor::LAYER_OVERLAY);
+    overlay.clear();
+    if (pos > _ledCount) {
+        _bootAnimActive = false;
+        return;
     }
 
-    // End with all LEDs off
-    blackout();
+    for (int16_t i = 0; i < WAVE_WIDTH; i++) {
+        int16_t ledIndex = pos + i;
+        if (ledIndex >= 0 && ledIndex < _ledCount) {
+            // Rainbow gradient within the wave
+            uint8_t hue = (i * 256 / WAVE_WIDTH);
+            uint8_t brightness = sin8((i * 255) / WAVE_WIDTH);  // Fade at edges
+            overlay.setPixel(ledIndex, CHSV(hue, 255, brightness));
+        }
+    }
 }
 
 void LEDController::flashDisconnect() {
-    // Тускло вспыхнуть чётными диодами один раз при отключении USB
-    blackout();
+    // Клавиши, зажатые в момент отключения, уже не получат note off
+    allNotesOff();
+
+    // Тускло вспыхнуть чётными диодами (0, 2, 4, 6...) один раз при отключении USB
+    showFeedback(0, _ledCount / 2, 2, CHSV(0, 0, 40), 150);  // Белый цвет, ~15% яркости
+}
 
-    // Зажигаем только чётные диоды (0, 2, 4, 6...) с тусклой яркостью
-    for (uint16_t i = 0; i < NUM_LEDS; i += 2) {
-        _leds[i] = CHSV(0, 0, 40);  // Белый цвет, ~15% яркости
+// ============== Feedback ==============
+
+void LEDController::showFeedback(uint16_t first, uint16_t count, uint8_t step, CRGB color, uint16_t durationMs) {
+    // Remove the previous feedback before drawing over it
+    if (_feedback.active) {
+        drawFeedback(CRGB::Black);
+    }
+
+    _feedback.first = first;
+    _feedback.count = count;
+    _feedback.step = step > 0 ? step : 1;
+    _feedback.until = millis() + durationMs;
+    _feedback.active = count > 0;
+
+    if (_feedback.active) {
+        drawFeedback(color);
+    }
+}
+
+bool LEDController::isFeedbackActive() const {
+    return _feedback.active;
+}
+
+void LEDController::drawFeedback(CRGB color) {
+    FrameLayer& overlay = layer(FrameCompositor::LAYER_OVERLAY);
+    uint16_t index = _feedback.first;
+    for (uint16_t i = 0; i < _feedback.count && index < _ledCount; i++, index += _feedback.step) {
+        overlay.setPixel(index, color);     // Black is transparent - keys show through again
+    }
+}
+
+void LEDController::expireFeedback(unsigned long now) {
+    if (_feedback.active && (long)(now - _feedback.until) >= 0) {
+        drawFeedback(CRGB::Black);
+        _feedback.active = false;
     }
-    FastLED.show();
-    delay(150);
-    blackout();
 }
 
 // ============== Private Methods ==============
@@ -297,27 +597,119 @@ void LEDController::setKeyLEDs(uint8_t keyIndex, CRGB color) {
     // Используем noteToLed() для единообразного маппинга в обоих режимах
     // В splash режиме волна расходится от этой точки через updateSplash()
     int16_t ledIndex = noteToLed(keyIndex + LOWEST_MIDI_NOTE);
-    if (ledIndex >= 0 && ledIndex < NUM_LEDS) {
-        _leds[ledIndex] = color;
+    if (ledIndex >= 0 && ledIndex < _ledCount) {
+        layer(FrameCompositor::LAYER_KEYS).setPixel(ledIndex, color);
     }
 }
 
 void LEDController::setLedDirect(uint16_t index, CRGB color) {
-    if (index < NUM_LEDS) {
-        _leds[index] = color;
+    if (index < _ledCount) {
+        layer(FrameCompositor::LAYER_OVERLAY).setPixel(index, color);
+    }
+}
+
+FrameLayer& LEDController::layer(FrameCompositor::LayerId id) {
+    return _compositor.layer(id);
+}
+
+void LEDController::refreshLayers() {
+    bool ambient = _mode == MODE_AMBIENT;
+    layer(FrameCompositor::LAYER_KEYS).setVisible(!ambient);
+    layer(FrameCompositor::LAYER_SPLASH).setVisible(!ambient);
+    layer(FrameCompositor::LAYER_GUIDE).setVisible(_mode == MODE_LEARNING || _mode == MODE_GAME);
+
+    if (_bgStale) {
+        _bgStale = false;
+        drawBackground();
+    }
+    if (_guideStale) {
+        _guideStale = false;
+        drawGuide();
+    }
+}
+
+void LEDController::drawBackground() {
+    if (_mode == MODE_AMBIENT) return;  // Ambient animations own this layer
+
+    FrameLayer& bg = layer(FrameCompositor::LAYER_BACKGROUND);
+    bg.clear();
+    if (!_bgEnabled) return;
+
+    // Point режим - фон только под диодами клавиш, splash - под всей лентой
+    CRGB color = CHSV(_bgColor.h, _bgColor.s, _bgBrightness);
+    for (uint16_t i = 0; i < _ledCount; i++) {
+        if (_splashEnabled || _ledToKey[i] != KEY_NONE) {
+            bg.setPixel(i, color);
+        }
+    }
+}
+
+void LEDController::drawGuide() {
+    FrameLayer& guide = layer(FrameCompositor::LAYER_GUIDE);
+    guide.clear();
+    if (_mode != MODE_LEARNING) return;
+
+    // Guide color for notes that aren't pressed, halved per look-ahead step.
+    // Nearest step last, so it wins where steps share a key.
+    for (int8_t step = _guideStepCount - 1; step >= 0; step--) {
+        CRGB color = CHSV(_guideColor.h, _guideColor.s, _guideColor.v >> step);
+        const NoteSet& notes = _guideSteps[step];
+        for (int16_t midiNote = notes.next(LOWEST_MIDI_NOTE);
+             midiNote >= 0 && midiNote <= HIGHEST_MIDI_NOTE;
+             midiNote = notes.next(midiNote + 1)) {
+            if (_keysOn[midiNote - LOWEST_MIDI_NOTE]) continue;
+
+            int16_t ledIndex = noteToLed(midiNote);
+            if (ledIndex >= 0 && ledIndex < _ledCount) {
+                guide.setPixel(ledIndex, color);
+            }
+        }
+    }
+}
+
+void LEDController::rebuildLedMap() {
+    // Forward and inverse tables with the strip direction baked in
+    memset(_ledToKey, KEY_NONE, sizeof(_ledToKey));
+    for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+        uint16_t led = _keyMap.led[key];
+        if (led == KeyMap::NONE || led >= _keyLedCount) {
+            _noteToLed[key] = -1;
+            continue;
+        }
+        _noteToLed[key] = _reversed ? _keyLedCount - 1 - led : led;
+        _ledToKey[_noteToLed[key]] = key;
     }
+    // Background and guide follow the key positions
+    _bgStale = true;
+    _guideStale = true;
+    syncProtection();
+}
+
+void LEDController::syncProtection() {
+    _power.clearProtected();
+    if (_mode != MODE_AMBIENT) {
+        for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
+            if (_keysOn[key] && _noteToLed[key] >= 0) _power.setProtected(_noteToLed[key], true);
+        }
+    }
+    // Under the limit moving pixels between classes changes nothing; over it
+    // the factors shift without any pixel changing
+    if (_power.isLimiting()) markAllDirty();
 }
 
 int16_t LEDController::noteToLed(uint8_t note) {
-    // Map MIDI note to LED index using calibrated lookup table
+    // Map MIDI note to LED index - one read, the key map is folded in by rebuildLedMap()
     if (note < LOWEST_MIDI_NOTE || note > HIGHEST_MIDI_NOTE) return -1;
-    uint8_t keyIndex = note - LOWEST_MIDI_NOTE;  // 0-87
-    int16_t ledIndex = NOTE_TO_LED[keyIndex];
-    // Reverse if needed
-    if (_reversed && ledIndex >= 0) {
-        ledIndex = NUM_LEDS - 1 - ledIndex;
-    }
-    return ledIndex;
+    return _noteToLed[note - LOWEST_MIDI_NOTE];
+}
+
+void LEDController::setKeyMap(const KeyMap& map) {
+    _keyMap = map.isValid(_keyLedCount) ? map : KeyMap::factory(_keyLedCount);
+    rebuildLedMap();
+}
+
+const KeyMap& LEDController::getKeyMap() const {
+    return _keyMap;
 }
 
 CRGB LEDController::getColorForKey(uint8_t keyIndex, uint8_t velocity) {
@@ -361,17 +753,7 @@ CRGB LEDController::getColorForKey(uint8_t keyIndex, uint8_t velocity) {
             break;
 
         case MODE_LEARNING: {
-            // Check if this key is in expected notes
-            uint8_t midiNote = keyIndex + LOWEST_MIDI_NOTE;
-            bool isExpected = false;
-            for (uint8_t i = 0; i < _expectedCount; i++) {
-                if (_expectedNotes[i] == midiNote) {
-                    isExpected = true;
-                    break;
-                }
-            }
-
-            if (isExpected) {
+            if (_expected.contains(keyIndex + LOWEST_MIDI_NOTE)) {
                 // Correct note pressed - show success color
                 return CHSV(_successColor.h, _successColor.s, _successColor.v);
             } else {
@@ -407,49 +789,34 @@ CRGB LEDController::getColorForKey(uint8_t keyIndex, uint8_t velocity) {
 }
 
 void LEDController::fade() {
-    // Only fade LEDs for keys that are not pressed
-    CRGB targetColor = CRGB::Black;
-    if (_bgEnabled) {
-        // Fade toward background color instead of black
-        targetColor = CHSV(_bgColor.h, _bgColor.s, _bgBrightness);
+    uint32_t startCycles = ESP.getCycleCount();
+
+    // Released keys fade to black; the background layer shows through them
+    fadeLayer(layer(FrameCompositor::LAYER_KEYS), true);
+    fadeLayer(layer(FrameCompositor::LAYER_SPLASH), false);
+
+    _fadeCycles = ESP.getCycleCount() - startCycles;
+}
+
+void LEDController::fadeLayer(FrameLayer& target, bool holdPressedKeys) {
+    if (!holdPressedKeys) {
+        target.fadeActive(_fadeRate);
+        return;
     }
 
-    if (_splashEnabled) {
-        // В splash режиме затухаем ВСЕ диоды равномерно (волна использует диоды вне маппинга)
-        // Пропускаем только диоды нажатых клавиш
-        for (uint16_t i = 0; i < NUM_LEDS; i++) {
-            // Проверяем, принадлежит ли диод нажатой клавише
-            bool isKeyLed = false;
-            for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
-                if (_keysOn[key]) {
-                    int16_t keyLed = noteToLed(key + LOWEST_MIDI_NOTE);
-                    if (keyLed == (int16_t)i) {
-                        isKeyLed = true;
-                        break;
-                    }
-                }
-            }
-            if (!isKeyLed) {
-                if (_bgEnabled) {
-                    _leds[i] = nblend(_leds[i], targetColor, _fadeRate);
-                } else {
-                    _leds[i].fadeToBlackBy(_fadeRate);
-                }
-            }
+    // Walk only lit pixels; a pixel leaves the set once it reaches black.
+    // Backwards, because remove() swaps the last member into the hole.
+    SparseLedSet<LED_MAX_COUNT>& lit = target.active();
+    for (int16_t slot = lit.size() - 1; slot >= 0; slot--) {
+        uint16_t i = lit[slot];
+
+        uint8_t key = _ledToKey[i];
+        if (key != KEY_NONE && _keysOn[key]) {
+            continue;  // Held key keeps its colour
         }
-    } else {
-        // Point режим - затухаем только диоды клавиш через маппинг
-        for (uint8_t key = 0; key < NUM_PIANO_KEYS; key++) {
-            if (!_keysOn[key]) {
-                int16_t ledIndex = noteToLed(key + LOWEST_MIDI_NOTE);
-                if (ledIndex >= 0 && ledIndex < NUM_LEDS) {
-                    if (_bgEnabled) {
-                        _leds[ledIndex] = nblend(_leds[ledIndex], targetColor, _fadeRate);
-                    } else {
-                        _leds[ledIndex].fadeToBlackBy(_fadeRate);
-                    }
-                }
-            }
+        target.fadePixel(i, _fadeRate);
+        if (!target.getPixel(i)) {
+            lit.remove(i);
         }
     }
 }
@@ -457,8 +824,11 @@ void LEDController::fade() {
 // ============== Splash Effect ==============
 
 void LEDController::setSplashEnabled(bool enabled) {
+    if (enabled != _splashEnabled) {
+        _bgStale = true;  // Background covers the whole strip only in splash mode
+    }
     _splashEnabled = enabled;
-    // Clear all splashes when disabling
+    // Clear all splashes when disabling (lit pixels fade out on their own)
     if (!enabled) {
         memset(_splashes, 0, sizeof(_splashes));
     }
@@ -545,7 +915,7 @@ void LEDController::updateSplash() {
         // Draw splash: center brightest, edges dimmer
         for (int8_t offset = -(int8_t)splash.width; offset <= (int8_t)splash.width; offset++) {
             int16_t ledIndex = centerLED + offset;
-            if (ledIndex < 0 || ledIndex >= NUM_LEDS) continue;
+            if (ledIndex < 0 || ledIndex >= _keyLedCount) continue;    // Waves stay above the keys
 
             // Calculate brightness falloff from center
             uint8_t distance = abs(offset);
@@ -554,10 +924,12 @@ void LEDController::updateSplash() {
 
             CHSV color(splash.hue, 255, ledBrightness);
 
-            // Additive blending: keep brighter value
+            // Additive blending: keep brighter value (against other waves;
+            // keys are merged by the compositor)
             CRGB newColor = color;
-            if (_leds[ledIndex].getLuma() < newColor.getLuma()) {
-                _leds[ledIndex] = newColor;
+            FrameLayer& splashLayer = layer(FrameCompositor::LAYER_SPLASH);
+            if (splashLayer.getPixel(ledIndex).getLuma() < newColor.getLuma()) {
+                splashLayer.setPixel(ledIndex, newColor);
             }
         }
     }
@@ -575,7 +947,7 @@ void LEDController::adjustBrightness(int16_t delta) {
 
 void LEDController::cycleMode() {
     // Cycle through main modes: Free Play -> Velocity -> Split -> Random -> Visualizer -> Ambient -> Kids Rainbow
-    // Skip Learning and Demo modes (those are app-controlled)
+    // Skip Learning, Demo and Game modes (those are app-controlled)
     LEDMode modes[] = {MODE_FREE_PLAY, MODE_VELOCITY, MODE_SPLIT, MODE_RANDOM, MODE_VISUALIZER, MODE_AMBIENT, MODE_KIDS_RAINBOW};
     const int numModes = sizeof(modes) / sizeof(modes[0]);
 
@@ -605,19 +977,36 @@ bool LEDController::isEnabled() const {
 // ============== Learning Mode ==============
 
 void LEDController::setExpectedNotes(const uint8_t* notes, uint8_t count) {
-    _expectedCount = min(count, MAX_EXPECTED_NOTES);
-    for (uint8_t i = 0; i < _expectedCount; i++) {
-        _expectedNotes[i] = notes[i];
+    NoteSet set;
+    set.clear();
+    for (uint8_t i = 0; i < count; i++) {
+        if (notes[i] < 128) set.add(notes[i]);
+    }
+    setExpectedNotes(set);
+}
+
+void LEDController::setExpectedNotes(const NoteSet& notes) {
+    setGuide(notes, &notes, 1);
+}
+
+void LEDController::setGuide(const NoteSet& expected, const NoteSet* steps, uint8_t count) {
+    _expected = expected;
+    _guideStepCount = min(count, (uint8_t)(LESSON_MAX_LOOKAHEAD + 1));
+    for (uint8_t i = 0; i < _guideStepCount; i++) {
+        _guideSteps[i] = steps[i];
     }
+    _guideStale = true;
 }
 
 void LEDController::clearExpectedNotes() {
-    _expectedCount = 0;
-    memset(_expectedNotes, 0, sizeof(_expectedNotes));
+    _expected.clear();
+    _guideStepCount = 0;
+    _guideStale = true;
 }
 
 void LEDController::setGuideColor(uint8_t hue, uint8_t sat, uint8_t val) {
     _guideColor = CHSV(hue, sat, val);
+    _guideStale = true;
 }
 
 void LEDController::setSuccessColor(uint8_t hue, uint8_t sat, uint8_t val) {
@@ -628,14 +1017,36 @@ void LEDController::setErrorColor(uint8_t hue, uint8_t sat, uint8_t val) {
     _errorColor = CHSV(hue, sat, val);
 }
 
+// ============== Game Mode ==============
+
+void LEDController::clearGameNotes() {
+    layer(FrameCompositor::LAYER_GUIDE).clear();
+}
+
+void LEDController::drawFallingNote(uint8_t note, uint8_t distance, uint8_t value) {
+    int16_t ledIndex = noteToLed(note);
+    if (ledIndex < 0) return;
+
+    FrameLayer& guide = layer(FrameCompositor::LAYER_GUIDE);
+    CRGB color = CHSV(_guideColor.h, _guideColor.s, scale8(_guideColor.v, value));
+    // Both sides close in on the key; only the key segment is used
+    if (ledIndex >= distance) guide.setPixel(ledIndex - distance, color);
+    if (ledIndex + distance < _keyLedCount) guide.setPixel(ledIndex + distance, color);
+}
+
+void LEDController::drawJudgedNote(uint8_t note, bool hit, uint8_t value) {
+    int16_t ledIndex = noteToLed(note);
+    if (ledIndex < 0) return;
+
+    const CHSV& base = hit ? _successColor : _errorColor;
+    layer(FrameCompositor::LAYER_GUIDE).setPixel(ledIndex, CHSV(base.h, base.s, scale8(base.v, value)));
+}
+
 // ============== Background Layer ==============
 
 void LEDController::setBackgroundEnabled(bool enabled) {
     _bgEnabled = enabled;
-    if (!enabled) {
-        // Fade to black when disabling background
-        blackout();
-    }
+    _bgStale = true;
 }
 
 bool LEDController::isBackgroundEnabled() const {
@@ -644,10 +1055,12 @@ bool LEDController::isBackgroundEnabled() const {
 
 void LEDController::setBackgroundColor(uint8_t hue, uint8_t sat, uint8_t val) {
     _bgColor = CHSV(hue, sat, val);
+    _bgStale = true;
 }
 
 void LEDController::setBackgroundBrightness(uint8_t brightness) {
     _bgBrightness = brightness;
+    _bgStale = true;
 }
 
 // ============== Hue Shift / Chord Detection ==============
@@ -713,40 +1126,42 @@ void LEDController::updateAmbient() {
 }
 
 void LEDController::animateRainbow() {
+    FrameLayer& bg = layer(FrameCompositor::LAYER_BACKGROUND);
     // Moving rainbow across all LEDs
-    for (uint16_t i = 0; i < NUM_LEDS; i++) {
+    for (uint16_t i = 0; i < _ledCount; i++) {
         // Calculate hue based on position and animation offset
-        uint8_t hue = (i * 256 / NUM_LEDS) + _animationOffset;
-        _leds[i] = CHSV(hue, 255, 255);
+        uint8_t hue = (i * 256 / _ledCount) + _animationOffset;
+        bg.setPixel(i, CHSV(hue, 255, 255));
     }
 }
 
 void LEDController::animateSineWave() {
+    FrameLayer& bg = layer(FrameCompositor::LAYER_BACKGROUND);
     // Pulsing brightness wave across the strip
-    for (uint16_t i = 0; i < NUM_LEDS; i++) {
+    for (uint16_t i = 0; i < _ledCount; i++) {
         // Calculate phase for this LED
-        uint8_t phase = (i * 256 / NUM_LEDS) + _animationOffset;
+        uint8_t phase = (i * 256 / _ledCount) + _animationOffset;
         // Use sine wave for brightness (sin8 returns 0-255)
         uint8_t brightness = sin8(phase);
-        _leds[i] = CHSV(_hue, _saturation, brightness);
+        bg.setPixel(i, CHSV(_hue, _saturation, brightness));
     }
 }
 
 void LEDController::animateSparkle() {
-    // Fade all LEDs slightly first
-    for (uint16_t i = 0; i < NUM_LEDS; i++) {
-        _leds[i].fadeToBlackBy(30);
-    }
+    FrameLayer& bg = layer(FrameCompositor::LAYER_BACKGROUND);
+
+    // Fade lit LEDs slightly first
+    bg.fadeActive(30);
 
     // Add random sparkles based on speed
     uint8_t numSparkles = _animationSpeed / 25 + 1;
     for (uint8_t s = 0; s < numSparkles; s++) {
-        uint16_t pos = random(NUM_LEDS);
+        uint16_t pos = random(_ledCount);
         // Random sparkle with current hue or white
         if (random(2) == 0) {
-            _leds[pos] = CHSV(_hue, _saturation, 255);
+            bg.setPixel(pos, CHSV(_hue, _saturation, 255));
         } else {
-            _leds[pos] = CRGB::White;
+            bg.setPixel(pos, CRGB::White);
         }
     }
 }
@@ -4,13 +4,44 @@
 #include <Arduino.h>
 #include <FastLED.h>
 #include "config.h"
+#include "frame_compositor.h"
+#include "output_stage.h"
+#include "power_budget.h"
+#include "led_layout.h"
+#include "key_map.h"
+#include "metrics.h"
+#include "note_set.h"
 
 class LEDController {
+    friend class LEDControllerBench;    // bench/ drives the private effect steps
+
 public:
     LEDController();
 
-    void begin();
-    void update();  // Call in loop() for animations/fading
+    // Registers one FastLED controller per segment; an invalid layout falls
+    // back to the defaults. Once only - FastLED cannot drop controllers.
+    void begin(const LedLayout& layout = LedLayout::defaults());
+    void update();  // Call once per frame (RenderTask) for animations/fading
+    void show();    // Push the frame buffer if it changed (or keep-alive is due)
+
+    // Dirty tracking / push statistics
+    bool isDirty() const;
+    void markAllDirty();                    // Force the next show() to push
+    void setKeepAliveMs(uint16_t ms);       // Periodic refresh of an unchanged frame, 0 = off
+    uint16_t getKeepAliveMs() const;
+    uint32_t getFramesPushed() const;
+    uint32_t getFramesSkipped() const;
+    uint16_t getLastPushFirst() const;      // LED range that changed in the last push
+    uint16_t getLastPushLast() const;
+    uint16_t getActiveLedCount() const;     // Lit LEDs in the fading layers
+    bool isAnimating() const;               // Next update() may change the frame
+    uint32_t getLastFadeCycles() const;     // CPU cycles spent in the last fade()
+    const MetricHistogram& getShowTimeHistogram() const;   // FastLED.show() duration, us
+
+    // Strip layout (see LedLayout)
+    const LedLayout& getLayout() const;
+    uint16_t getLedCount() const;           // All segments
+    uint16_t getKeyLedCount() const;        // Segment 0, above the keys
 
     // MIDI event handlers
     void noteOn(uint8_t note, uint8_t velocity);
@@ -25,6 +56,19 @@ public:
     void setBrightness(uint8_t brightness);
     uint8_t getBrightness() const;
 
+    // Output stage (see OutputStage) - colour calibration of the strip itself
+    void setGamma(float gamma);
+    float getGamma() const;
+    void setWhiteBalance(const CRGB& balance);
+    const CRGB& getWhiteBalance() const;
+    void setDither(bool enabled);           // Temporal dithering, for high frame rates
+    bool isDithering() const;
+    uint32_t getOutputRebuilds() const;     // Output table rebuilds since boot
+
+    // Current limits (see PowerBudget); false if the zones do not fit the strip
+    bool setPowerConfig(const PowerConfig& config);
+    const PowerBudget& getPowerBudget() const;
+
     void setHue(uint8_t hue);
     uint8_t getHue() const;
 
@@ -40,13 +84,25 @@ public:
     void setLeftColor(uint8_t hue, uint8_t sat, uint8_t val);
     void setRightColor(uint8_t hue, uint8_t sat, uint8_t val);
 
-    // Utility
-    void blackout();
-    void showColor(CRGB color);
-    void playStartupAnimation();  // Rainbow wave on boot
-    void flashDisconnect();       // Вспышка чётных диодов при отключении USB
-    void setLedDirect(uint16_t index, CRGB color);  // Direct LED access
-    int16_t noteToLed(uint8_t note);  // Map MIDI note to LED index
+    // Utility (layers only - composited and pushed by the next frame)
+    void blackout();                 // Clear keys, splash and overlay layers
+    void showColor(CRGB color);      // Fill the overlay layer
+    void startBootAnimation();    // Rainbow wave on boot, drawn by update(); ends on the first note
+    void stopBootAnimation();
+    bool isBootAnimationActive() const;
+    void flashDisconnect();       // Вспышка чётных диодов при отключении USB (hold RenderLock)
+
+    // Timed feedback in the overlay layer: count LEDs from first, every step-th,
+    // removed by update() after durationMs. Keys stay visible around it; a new
+    // feedback replaces the current one. Never blocks (hold RenderLock).
+    void showFeedback(uint16_t first, uint16_t count, uint8_t step, CRGB color, uint16_t durationMs);
+    bool isFeedbackActive() const;
+    void setLedDirect(uint16_t index, CRGB color);  // Overlay layer pixel
+    int16_t noteToLed(uint8_t note);  // Map MIDI note to LED index, -1 if the key has none
+
+    // Key map of the key segment (calibration); an invalid map falls back to the factory table
+    void setKeyMap(const KeyMap& map);
+    const KeyMap& getKeyMap() const;
 
     // Splash mode
     void setSplashEnabled(bool enabled);
@@ -67,11 +123,24 @@ public:
 
     // Learning mode
     void setExpectedNotes(const uint8_t* notes, uint8_t count);
+    void setExpectedNotes(const NoteSet& notes);
+    // Lesson guides: expected decides the success/error colour of pressed keys,
+    // steps[0] lights the keys still to press and steps[1..] the look-ahead,
+    // each step dimmer (up to LESSON_MAX_LOOKAHEAD of them)
+    void setGuide(const NoteSet& expected, const NoteSet* steps, uint8_t count);
     void clearExpectedNotes();
     void setGuideColor(uint8_t hue, uint8_t sat, uint8_t val);
     void setSuccessColor(uint8_t hue, uint8_t sat, uint8_t val);
     void setErrorColor(uint8_t hue, uint8_t sat, uint8_t val);
 
+    // Game mode (see GameEngine): redrawn into the guide layer every frame.
+    // A falling note is a pair of LEDs distance away on both sides of its
+    // key, in the guide colour; a judged note flashes on the key in the
+    // success or error colour.
+    void clearGameNotes();
+    void drawFallingNote(uint8_t note, uint8_t distance, uint8_t value);
+    void drawJudgedNote(uint8_t note, bool hit, uint8_t value);
+
     // Background layer
     void setBackgroundEnabled(bool enabled);
     bool isBackgroundEnabled() const;
@@ -92,7 +161,19 @@ public:
 
 private:
     bool _enabled;
-    CRGB _leds[NUM_LEDS];
+    LedLayout _layout;
+    uint16_t _ledCount;                 // LEDs in use, all segments end to end
+    uint16_t _keyLedCount;              // Segment 0 - notes map onto these
+    KeyMap _keyMap;                     // As calibrated, unreversed
+    CRGB _leds[LED_MAX_COUNT];          // Composited frame, before the output stage
+    CRGB _corrected[LED_MAX_COUNT];     // After the output stage, before the current limit
+    CRGB _wire[LED_MAX_COUNT];          // Current-limited, segments registered with FastLED
+    FrameCompositor _compositor;
+    OutputStage _output;
+    PowerBudget _power;
+    bool _ditherPending;                // Dithered output still moves - push the next frame too
+    bool _bgStale;                      // Background layer needs recomputing
+    bool _guideStale;                   // Guide layer needs recomputing
     bool _keysOn[NUM_PIANO_KEYS];
     uint8_t _keyVelocity[NUM_PIANO_KEYS];
     uint8_t _keyHue[NUM_PIANO_KEYS];
@@ -113,9 +194,9 @@ private:
     uint8_t _randomHue;
 
     // Learning mode
-    static const uint8_t MAX_EXPECTED_NOTES = 10;
-    uint8_t _expectedNotes[MAX_EXPECTED_NOTES];
-    uint8_t _expectedCount;
+    NoteSet _expected;                  // Pressed keys in here are correct
+    NoteSet _guideSteps[LESSON_MAX_LOOKAHEAD + 1];
+    uint8_t _guideStepCount;
     CHSV _guideColor;    // Color for notes to be pressed (golden)
     CHSV _successColor;  // Color for correctly pressed notes (green)
     CHSV _errorColor;    // Color for wrong notes (red)
@@ -149,6 +230,39 @@ private:
     bool _waveVelocityMode;     // true = velocity-based width, false = static width
     uint8_t _waveStaticWidth;   // 1-6 для static режима
 
+    // Dirty tracking - changed output LED range since the last push
+    bool _dirty;
+    uint16_t _dirtyFirst;
+    uint16_t _dirtyLast;
+    uint16_t _lastPushFirst;
+    uint16_t _lastPushLast;
+    uint16_t _keepAliveMs;
+    unsigned long _lastPushTime;
+    uint32_t _framesPushed;
+    uint32_t _framesSkipped;
+
+    // Inverse mapping so per-frame work scales with lit LEDs, not strip length
+    static const uint8_t KEY_NONE = 0xFF;
+    int16_t _noteToLed[NUM_PIANO_KEYS];     // _keyMap with reversal applied, -1 if unmapped
+    uint8_t _ledToKey[LED_MAX_COUNT];       // Inverse of noteToLed(), KEY_NONE if unmapped
+    uint32_t _fadeCycles;
+    MetricHistogram _showTime;
+
+    // Timed overlay feedback (hotkeys, USB disconnect)
+    struct Feedback {
+        uint16_t first;
+        uint16_t count;
+        uint8_t step;
+        unsigned long until;    // millis() when it expires
+        bool active;
+    };
+    Feedback _feedback;
+
+    // Boot animation (overlay layer)
+    bool _bootAnimActive;
+    unsigned long _bootAnimStart;
+    int16_t _bootAnimPos;
+
     // Timing
     unsigned long _lastFadeTime;
     static const unsigned long FADE_INTERVAL = 20;  // ms
@@ -159,10 +273,21 @@ private:
     uint8_t _animationOffset;     // Current animation position/phase
 
     // Helper methods
+    FrameLayer& layer(FrameCompositor::LayerId id);
+    void markDirty(uint16_t first, uint16_t last);
+    void rebuildLedMap();
+    void syncProtection();      // Held keys keep their brightness under the current limit
+    void refreshLayers();       // Visibility + recompute stale derived layers
+    void drawFeedback(CRGB color);
+    void expireFeedback(unsigned long now);
+    void advanceBootAnimation(unsigned long now);
+    void drawBackground();
+    void drawGuide();
     uint8_t mapNoteToKeyIndex(uint8_t midiNote);
     void setKeyLEDs(uint8_t keyIndex, CRGB color);
     CRGB getColorForKey(uint8_t keyIndex, uint8_t velocity);
     void fade();
+    void fadeLayer(FrameLayer& layer, bool holdPressedKeys);
 
     // Splash helpers
     void addSplash(uint8_t keyIndex, uint8_t velocity);
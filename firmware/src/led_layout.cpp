@@ -0,0 +1,78 @@
+#include "led_layout.h"
+#include <Preferences.h>
+
+static const char* LAYOUT_KEY = "led_layout";
+
+// ============== LedLayout ==============
+
+LedLayout LedLayout::defaults() {
+    LedLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.segmentCount = 1;
+    layout.segments[0].pin = LED_DEFAULT_PIN;
+    layout.segments[0].count = LED_DEFAULT_COUNT;
+    return layout;
+}
+
+uint16_t LedLayout::totalLeds() const {
+    return segmentStart(segmentCount);
+}
+
+uint16_t LedLayout::segmentStart(uint8_t segment) const {
+    uint16_t start = 0;
+    for (uint8_t s = 0; s < segment && s < segmentCount; s++) {
+        start += segments[s].count;
+    }
+    return start;
+}
+
+bool LedLayout::isValid() const {
+    if (segmentCount == 0 || segmentCount > LED_MAX_SEGMENTS) return false;
+
+    uint32_t total = 0;
+    for (uint8_t s = 0; s < segmentCount; s++) {
+        if (segments[s].count == 0 || !isLedSegmentPin(segments[s].pin)) return false;
+        for (uint8_t other = 0; other < s; other++) {
+            if (segments[other].pin == segments[s].pin) return false;
+        }
+        total += segments[s].count;
+    }
+    return total <= LED_MAX_COUNT;
+}
+
+bool isLedSegmentPin(uint8_t pin) {
+    switch (pin) {
+#define LED_PIN_CASE(p) case p:
+        LED_SEGMENT_PINS(LED_PIN_CASE)
+#undef LED_PIN_CASE
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ============== Storage ==============
+
+bool loadLedLayout(LedLayout& layout) {
+    Preferences prefs;
+    bool ok = false;
+    if (prefs.begin(SETTINGS_NVS_NAMESPACE, true)) {
+        // A size mismatch is a layout written by a build with another LED_MAX_SEGMENTS
+        ok = prefs.getBytesLength(LAYOUT_KEY) == sizeof(LedLayout)
+            && prefs.getBytes(LAYOUT_KEY, &layout, sizeof(LedLayout)) == sizeof(LedLayout)
+            && layout.isValid();
+        prefs.end();
+    }
+    if (!ok) layout = LedLayout::defaults();
+    return ok;
+}
+
+bool saveLedLayout(const LedLayout& layout) {
+    if (!layout.isValid()) return false;
+
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NVS_NAMESPACE, false)) return false;
+    bool ok = prefs.putBytes(LAYOUT_KEY, &layout, sizeof(LedLayout)) == sizeof(LedLayout);
+    prefs.end();
+    return ok;
+}
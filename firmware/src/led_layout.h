@@ -0,0 +1,39 @@
+#ifndef LED_LAYOUT_H
+#define LED_LAYOUT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// One physical strip: its data pin and the LEDs chained on it
+struct LedSegment {
+    uint8_t pin;
+    uint16_t count;
+};
+
+// Strips behind the LED index space. Segments are laid end to end in
+// order: segment 0 starts at LED 0 and runs above the keys (the note
+// mapping lives there), the others - fallboard, music desk - follow it.
+// Every segment gets its own FastLED controller and RMT channel, so all
+// of them are clocked out at once and a frame takes as long as the
+// longest segment, not the sum.
+struct LedLayout {
+    uint8_t segmentCount;
+    LedSegment segments[LED_MAX_SEGMENTS];
+
+    static LedLayout defaults();    // One LED_DEFAULT_COUNT strip on LED_DEFAULT_PIN
+
+    uint16_t totalLeds() const;
+    uint16_t segmentStart(uint8_t segment) const;
+
+    // 1..LED_MAX_SEGMENTS non-empty segments on distinct LED_SEGMENT_PINS,
+    // LED_MAX_COUNT in total
+    bool isValid() const;
+};
+
+bool isLedSegmentPin(uint8_t pin);
+
+// Stored in NVS. load returns false and the defaults if nothing valid is stored.
+bool loadLedLayout(LedLayout& layout);
+bool saveLedLayout(const LedLayout& layout);
+
+#endif // LED_LAYOUT_H
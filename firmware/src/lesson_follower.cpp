@@ -0,0 +1,272 @@
+#include "lesson_follower.h"
+#include "led_controller.h"
+#include "render_task.h"
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+LessonFollower* lessonFollower = nullptr;
+
+LessonFollower::LessonFollower()
+    : _stepCount(0)
+    , _noteCount(0)
+    , _active(false)
+    , _hands(LESSON_HANDS_BOTH)
+    , _lookAhead(LESSON_DEFAULT_LOOKAHEAD)
+    , _step(0)
+    , _startMs(0)
+    , _correct(0)
+    , _wrong(0)
+    , _reportHead(0)
+    , _reportCount(0)
+{
+    _stepNotes.clear();
+    _remaining.clear();
+    _otherHand.clear();
+}
+
+LessonHands LessonFollower::parseHands(const char* hands) {
+    if (hands && strcmp(hands, "left") == 0) return LESSON_HANDS_LEFT;
+    if (hands && strcmp(hands, "right") == 0) return LESSON_HANDS_RIGHT;
+    return LESSON_HANDS_BOTH;
+}
+
+// ============== Lesson ==============
+
+void LessonFollower::clear() {
+    RenderLock lock;
+    stop();
+    _stepCount = 0;
+    _noteCount = 0;
+}
+
+bool LessonFollower::addStep(uint32_t timeMs, const uint8_t* left, uint8_t leftCount,
+                             const uint8_t* right, uint8_t rightCount) {
+    RenderLock lock;
+    uint16_t count = leftCount + rightCount;
+    if (_stepCount == LESSON_MAX_STEPS || count > 255 || _noteCount + count > LESSON_MAX_NOTES) return false;
+    if (_stepCount > 0 && timeMs < _steps[_stepCount - 1].timeMs) return false;
+
+    Step& step = _steps[_stepCount];
+    step.timeMs = timeMs;
+    step.firstNote = _noteCount;
+    step.count = 0;
+    for (uint8_t i = 0; i < leftCount; i++) {
+        if (left[i] < 128) _notes[_noteCount + step.count++] = left[i] | LEFT_HAND;
+    }
+    for (uint8_t i = 0; i < rightCount; i++) {
+        if (right[i] < 128) _notes[_noteCount + step.count++] = right[i];
+    }
+    _noteCount += step.count;
+    _stepCount++;
+    return true;
+}
+
+uint16_t LessonFollower::getStepCount() const {
+    return _stepCount;
+}
+
+// ============== Session ==============
+
+bool LessonFollower::start(LessonHands hands, uint8_t lookAhead, uint16_t fromStep) {
+    RenderLock lock;
+    if (fromStep >= _stepCount || !midiEvents) return false;
+
+    _hands = hands;
+    _lookAhead = min(lookAhead, (uint8_t)LESSON_MAX_LOOKAHEAD);
+    _correct = 0;
+    _wrong = 0;
+    _startMs = millis();
+    _reportHead = 0;
+    _reportCount = 0;
+    _hotkeys = HotkeyFilter();
+    midiEvents->attach(_reader);    // Only what is played from now on
+    _active = true;
+
+    ledController->setMode(MODE_LEARNING);
+    enterStep(fromStep);
+    LOG_I("Lesson: %u steps, from step %u", _stepCount, fromStep);
+    return true;
+}
+
+void LessonFollower::stop() {
+    RenderLock lock;
+    if (!_active) return;
+    _active = false;
+    ledController->clearExpectedNotes();
+}
+
+bool LessonFollower::seek(uint16_t step) {
+    RenderLock lock;
+    if (!_active || step >= _stepCount) return false;
+    enterStep(step);
+    return true;
+}
+
+bool LessonFollower::isActive() const {
+    return _active;
+}
+
+// ============== Matching ==============
+
+void LessonFollower::poll() {
+    if (!_active) return;
+    if (ledController->getMode() != MODE_LEARNING) {
+        // Another mode chosen by the app or a hotkey ends the lesson
+        RenderLock lock;
+        if (_active && ledController->getMode() != MODE_LEARNING) {
+            stop();
+            queueReport(REPORT_STOPPED);
+            LOG_I("Lesson: stopped by a mode change at step %u", _step);
+        }
+        return;
+    }
+    // Nothing new - no lock, no frame
+    if (midiEvents->pending(_reader) == 0) return;
+
+    RenderLock lock;
+    MidiEvent ev;
+    while (_active && midiEvents->pop(_reader, ev)) {
+        if (ev.source == MIDI_SOURCE_APP) continue;
+        if (_hotkeys.filter(ev)) continue;
+        if (ev.isNoteOn()) handleNoteOn(ev.data1);
+    }
+}
+
+void LessonFollower::handleNoteOn(uint8_t note) {
+    if (_remaining.contains(note)) {
+        _remaining.remove(note);
+        _correct++;
+        if (_remaining.isEmpty()) {
+            enterStep(_step + 1);
+        } else {
+            applyGuide();
+        }
+    } else if (!_stepNotes.contains(note)) {
+        // Struck again or the other hand's note is fine, anything else is wrong
+        _wrong++;
+        queueReport(REPORT_WRONG_NOTE, note);
+    }
+}
+
+void LessonFollower::enterStep(uint16_t step) {
+    NoteSet required;
+    while (step < _stepCount) {
+        stepNotes(step, _stepNotes, required);
+        if (!required.isEmpty()) break;
+        step++;     // Only the other hand plays here
+    }
+    _step = step;
+
+    if (step >= _stepCount) {
+        _active = false;
+        ledController->clearExpectedNotes();
+        queueReport(REPORT_COMPLETE);
+        LOG_I("Lesson: complete, %u correct, %u wrong", _correct, _wrong);
+        return;
+    }
+
+    _remaining = required;
+    _otherHand = _stepNotes;
+    for (int16_t note = required.next(0); note >= 0; note = required.next(note + 1)) {
+        _otherHand.remove(note);
+    }
+    queueReport(REPORT_PROGRESS);
+    applyGuide();
+}
+
+void LessonFollower::stepNotes(uint16_t step, NoteSet& all, NoteSet& required) const {
+    all.clear();
+    required.clear();
+    const Step& s = _steps[step];
+    for (uint8_t i = 0; i < s.count; i++) {
+        uint8_t stored = _notes[s.firstNote + i];
+        uint8_t note = stored & ~LEFT_HAND;
+        bool left = stored & LEFT_HAND;
+        all.add(note);
+        if (_hands == LESSON_HANDS_BOTH || left == (_hands == LESSON_HANDS_LEFT)) {
+            required.add(note);
+        }
+    }
+}
+
+// Current step: what is still to strike plus the other hand; then the look-ahead
+void LessonFollower::applyGuide() {
+    NoteSet guides[LESSON_MAX_LOOKAHEAD + 1];
+    NoteSet required;
+    guides[0] = _remaining;
+    guides[0].merge(_otherHand);
+    uint8_t count = 1;
+    for (uint16_t s = _step + 1; s < _stepCount && count <= _lookAhead; s++) {
+        stepNotes(s, guides[count++], required);
+    }
+    ledController->setGuide(_stepNotes, guides, count);
+}
+
+// ============== Reports ==============
+
+void LessonFollower::queueReport(ReportType type, uint8_t note) {
+    // Full: the oldest goes, the newest state matters most
+    if (_reportCount == LESSON_REPORT_QUEUE) {
+        _reportHead = (_reportHead + 1) % LESSON_REPORT_QUEUE;
+        _reportCount--;
+    }
+    Report& report = _reports[(_reportHead + _reportCount) % LESSON_REPORT_QUEUE];
+    report.type = type;
+    report.note = note;
+    report.step = _step;
+    report.elapsedMs = millis() - _startMs;
+    report.correct = _correct;
+    report.wrong = _wrong;
+    _reportCount++;
+}
+
+bool LessonFollower::nextReport(JsonObject out) {
+    if (_reportCount == 0) return false;   // Checked again under the lock
+
+    RenderLock lock;
+    if (_reportCount == 0) return false;
+    Report report = _reports[_reportHead];
+    _reportHead = (_reportHead + 1) % LESSON_REPORT_QUEUE;
+    _reportCount--;
+
+    switch (report.type) {
+        case REPORT_PROGRESS:
+            out["type"] = "lesson_progress";
+            out["step"] = report.step;
+            out["steps"] = _stepCount;
+            out["time_ms"] = report.step < _stepCount ? _steps[report.step].timeMs : 0;
+            break;
+        case REPORT_WRONG_NOTE:
+            out["type"] = "lesson_error";
+            out["step"] = report.step;
+            out["note"] = report.note;
+            break;
+        case REPORT_STOPPED:
+            out["type"] = "lesson_stopped";
+            out["step"] = report.step;
+            out["steps"] = _stepCount;
+            break;
+        case REPORT_COMPLETE:
+            out["type"] = "lesson_complete";
+            out["steps"] = _stepCount;
+            out["accuracy"] = report.correct + report.wrong > 0
+                ? report.correct * 100 / (report.correct + report.wrong) : 100;
+            break;
+    }
+    out["elapsed_ms"] = report.elapsedMs;
+    out["correct"] = report.correct;
+    out["wrong"] = report.wrong;
+    return true;
+}
+
+void LessonFollower::fillStatus(JsonObject out) const {
+    static const char* const HANDS[] = {"both", "left", "right"};
+    out["active"] = _active;
+    out["step"] = _step;
+    out["steps"] = _stepCount;
+    out["notes"] = _noteCount;
+    out["hands"] = HANDS[_hands];
+    out["look_ahead"] = _lookAhead;
+    out["correct"] = _correct;
+    out["wrong"] = _wrong;
+}
@@ -0,0 +1,123 @@
+#ifndef LESSON_FOLLOWER_H
+#define LESSON_FOLLOWER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "note_set.h"
+#include "midi_event_ring.h"
+#include "../include/hotkey_handler.h"
+
+enum LessonHands : uint8_t {
+    LESSON_HANDS_BOTH = 0,
+    LESSON_HANDS_LEFT = 1,      // Right-hand notes are shown, not required
+    LESSON_HANDS_RIGHT = 2
+};
+
+// Learning mode lesson followed on the device (SPECIFICATION.md 2.2).
+//
+// The app loads the whole lesson once - steps of notes per hand with
+// their time in the piece - and starts it. From then on the follower is
+// one more consumer of the event ring, drained by the housekeeping task:
+// a step is done when every required note was struck since it became
+// current, in any order, and the guides move to the next step at once,
+// without waiting for the app. The current step lights at full guide
+// brightness, the look-ahead steps dimmer behind it.
+//
+// Progress, wrong notes and the end of the lesson are queued as reports
+// and sent to the app by the network stage. Notes of the hand not being
+// practised are shown but neither required nor wrong; steps with only
+// such notes are passed over. Choosing another LED mode ends the lesson
+// (lesson_stopped), as it ends a game.
+//
+// Methods take RenderLock themselves (they change the guide layer); call
+// them from one task at a time - the WebSocket handlers run under
+// RenderLock, poll() and nextReport() on the housekeeping task.
+class LessonFollower {
+public:
+    LessonFollower();
+
+    // Lesson content. A WebSocket message is at most WS_MAX_MESSAGE_SIZE
+    // bytes - about 300 steps in the compact form - so a lesson may come in
+    // pieces: clear() then add steps in time order.
+    // addStep() fails once LESSON_MAX_STEPS / LESSON_MAX_NOTES are used.
+    void clear();
+    bool addStep(uint32_t timeMs, const uint8_t* left, uint8_t leftCount,
+                 const uint8_t* right, uint8_t rightCount);
+    uint16_t getStepCount() const;
+
+    // Start (or restart) at a step; switches the LEDs to learning mode
+    bool start(LessonHands hands, uint8_t lookAhead, uint16_t fromStep = 0);
+    void stop();
+    bool seek(uint16_t step);
+    bool isActive() const;
+
+    // Housekeeping task: match played notes against the current step
+    void poll();
+
+    // Next report for the app as a complete message, false if none
+    bool nextReport(JsonObject out);
+
+    void fillStatus(JsonObject out) const;
+
+    static LessonHands parseHands(const char* hands);
+
+private:
+    static const uint8_t LEFT_HAND = 0x80;      // Flag on stored notes
+
+    struct Step {
+        uint32_t timeMs;
+        uint16_t firstNote;     // Into _notes
+        uint8_t count;
+    };
+
+    enum ReportType : uint8_t {
+        REPORT_PROGRESS = 0,
+        REPORT_WRONG_NOTE,
+        REPORT_COMPLETE,
+        REPORT_STOPPED          // Left learning mode before the end
+    };
+
+    struct Report {
+        ReportType type;
+        uint8_t note;
+        uint16_t step;
+        uint32_t elapsedMs;     // Since start()
+        uint32_t correct;       // Counts at the time
+        uint32_t wrong;
+    };
+
+    // Lesson
+    Step _steps[LESSON_MAX_STEPS];
+    uint8_t _notes[LESSON_MAX_NOTES];
+    uint16_t _stepCount;
+    uint16_t _noteCount;
+
+    // Session
+    bool _active;
+    LessonHands _hands;
+    uint8_t _lookAhead;
+    uint16_t _step;
+    NoteSet _stepNotes;         // Both hands
+    NoteSet _remaining;         // Required and not struck yet
+    NoteSet _otherHand;         // Shown, not required
+    uint32_t _startMs;
+    uint32_t _correct;
+    uint32_t _wrong;
+    MidiEventRing::Reader _reader;
+    HotkeyFilter _hotkeys;
+
+    Report _reports[LESSON_REPORT_QUEUE];
+    uint8_t _reportHead;
+    uint8_t _reportCount;
+
+    void handleNoteOn(uint8_t note);
+    void enterStep(uint16_t step);      // First step from there with required notes
+    void stepNotes(uint16_t step, NoteSet& all, NoteSet& required) const;
+    void applyGuide();
+    void queueReport(ReportType type, uint8_t note = 0);
+};
+
+extern LessonFollower* lessonFollower;
+
+#endif // LESSON_FOLLOWER_H
@@ -0,0 +1,156 @@
+#include "log_ring.h"
+#include <esp_timer.h>
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+LogRing* logRing = nullptr;
+
+LogRing::LogRing()
+    : _head(0)
+    , _level(LOG_DEFAULT_LEVEL)
+    , _task(nullptr)
+{
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+        _slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+    attach(_drain);
+}
+
+bool LogRing::startDrain() {
+    if (_task != nullptr) return true;
+    BaseType_t ok = xTaskCreatePinnedToCore(
+        taskEntry, "log", LOG_TASK_STACK, this,
+        LOG_TASK_PRIORITY, &_task, LOG_TASK_CORE);
+    return ok == pdPASS;
+}
+
+// ============== Level ==============
+
+void LogRing::setLevel(uint8_t level) {
+    _level.store(min(level, (uint8_t)LOG_LVL_TRACE), std::memory_order_relaxed);
+}
+
+uint8_t LogRing::getLevel() const {
+    return _level.load(std::memory_order_relaxed);
+}
+
+bool LogRing::enabled(uint8_t level) const {
+    return level <= _level.load(std::memory_order_relaxed);
+}
+
+// ============== Producer ==============
+
+void LogRing::writeRecord(uint8_t level, const char* fmt, const uintptr_t* args, uint8_t argc) {
+    // Reserve a slot; fetch_add keeps this lock-free with several producers
+    uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[index & MASK];
+
+    // Mark the slot as being written, then publish with index + 1
+    slot.seq.store(index, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store((uint32_t)esp_timer_get_time(), std::memory_order_relaxed);
+    slot.fmt.store(fmt, std::memory_order_relaxed);
+    for (uint8_t i = 0; i < argc; i++) {
+        slot.args[i].store(args[i], std::memory_order_relaxed);
+    }
+    slot.meta.store(level | (argc << 4), std::memory_order_relaxed);
+    slot.seq.store(index + 1, std::memory_order_release);
+}
+
+// ============== Consumer ==============
+
+void LogRing::attach(Reader& reader) const {
+    reader._tail = _head.load(std::memory_order_acquire);
+    reader._overruns = 0;
+}
+
+void LogRing::rewind(Reader& reader, uint32_t count) const {
+    uint32_t head = _head.load(std::memory_order_acquire);
+    if (count > LOG_RING_SIZE) count = LOG_RING_SIZE;
+    if (count > head) count = head;
+    reader._tail = head - count;
+    reader._overruns = 0;
+}
+
+bool LogRing::pop(Reader& reader, LogRecord& record) const {
+    for (;;) {
+        uint32_t tail = reader._tail;
+        const Slot& slot = _slots[tail & MASK];
+
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == tail + 1) {
+            record.timeUs = slot.time.load(std::memory_order_relaxed);
+            record.fmt = slot.fmt.load(std::memory_order_relaxed);
+            uint8_t meta = slot.meta.load(std::memory_order_relaxed);
+            record.level = meta & 0x0F;
+            record.argc = meta >> 4;
+            for (uint8_t i = 0; i < LOG_MAX_ARGS; i++) {
+                record.args[i] = i < record.argc ? slot.args[i].load(std::memory_order_relaxed) : 0;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq) {
+                reader._tail = tail + 1;
+                return true;
+            }
+            // Overwritten while we were copying - fall through and resync
+        }
+
+        uint32_t head = _head.load(std::memory_order_acquire);
+        uint32_t behind = head - tail;
+        if (behind == 0 || behind > 0x80000000UL) {
+            return false;   // Nothing new
+        }
+        if (behind <= LOG_RING_SIZE) {
+            return false;   // Reserved but not yet published - try next time
+        }
+
+        // Lapped by the writers: skip to the oldest record still in the ring
+        reader._overruns += behind - LOG_RING_SIZE;
+        reader._tail = head - LOG_RING_SIZE;
+    }
+}
+
+char LogRing::levelChar(uint8_t level) {
+    static const char LEVELS[] = "-EWIDT";
+    return level <= LOG_LVL_TRACE ? LEVELS[level] : '?';
+}
+
+size_t LogRing::format(const LogRecord& record, char* buffer, size_t size) {
+    int len = snprintf(buffer, size, record.fmt ? record.fmt : "",
+                       record.args[0], record.args[1], record.args[2], record.args[3]);
+    if (len < 0) len = 0;
+    return (size_t)len < size ? (size_t)len : size - 1;
+}
+
+uint32_t LogRing::getWritten() const {
+    return _head.load(std::memory_order_relaxed);
+}
+
+uint32_t LogRing::getDropped() const {
+    return _drain.getOverruns();
+}
+
+// ============== Drain Task ==============
+
+void LogRing::taskEntry(void* arg) {
+    static_cast<LogRing*>(arg)->drain();
+}
+
+void LogRing::drain() {
+    char line[160];
+    uint32_t reportedDrops = 0;
+
+    for (;;) {
+        LogRecord record;
+        while (pop(_drain, record)) {
+            if (_drain.getOverruns() != reportedDrops) {
+                Serial.printf("[log] %u records dropped\n", _drain.getOverruns() - reportedDrops);
+                reportedDrops = _drain.getOverruns();
+            }
+            format(record, line, sizeof(line));
+            Serial.printf("[%6u.%03u] %c %s\n",
+                          record.timeUs / 1000000, (record.timeUs / 1000) % 1000,
+                          levelChar(record.level), line);
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+#include "config.h"
+
+// One log line as stored: the format string is not expanded until the
+// drain task (or /api/log) reads the record, so writing one costs a few
+// stores. Arguments must be integers or pointers to strings that outlive
+// the record (literals) - nothing is copied.
+struct LogRecord {
+    uint32_t timeUs;
+    const char* fmt;
+    uintptr_t args[LOG_MAX_ARGS];
+    uint8_t level;
+    uint8_t argc;
+};
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0,
+              "LOG_RING_SIZE must be a power of two");
+
+// Lock-free broadcast ring of log records, same scheme as MidiEventRing:
+// writers never block and overwrite the oldest record when a reader falls
+// a full ring behind. A low-priority task drains it to Serial.
+class LogRing {
+public:
+    class Reader {
+    public:
+        Reader() : _tail(0), _overruns(0) {}
+        uint32_t getOverruns() const { return _overruns; }
+
+    private:
+        friend class LogRing;
+        uint32_t _tail;
+        uint32_t _overruns;
+    };
+
+    LogRing();
+
+    bool startDrain();      // Serial output task; records queue up until then
+
+    void setLevel(uint8_t level);
+    uint8_t getLevel() const;
+    bool enabled(uint8_t level) const;
+
+    template <typename... Args>
+    void write(uint8_t level, const char* fmt, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+        const uintptr_t packed[LOG_MAX_ARGS + 1] = { toArg(args)... };
+        writeRecord(level, fmt, packed, sizeof...(Args));
+    }
+
+    // Consumer side - each Reader must only be used from one task
+    void attach(Reader& reader) const;                      // Start at the current head
+    void rewind(Reader& reader, uint32_t count) const;      // Start count records back
+    bool pop(Reader& reader, LogRecord& record) const;
+
+    static size_t format(const LogRecord& record, char* buffer, size_t size);
+    static char levelChar(uint8_t level);
+
+    uint32_t getWritten() const;
+    uint32_t getDropped() const;    // Records the drain task never saw
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;          // Index + 1 when valid, index while writing
+        std::atomic<uint32_t> time;
+        std::atomic<const char*> fmt;
+        std::atomic<uintptr_t> args[LOG_MAX_ARGS];
+        std::atomic<uint8_t> meta;          // level | argc << 4
+    };
+
+    static const uint32_t MASK = LOG_RING_SIZE - 1;
+
+    Slot _slots[LOG_RING_SIZE];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint8_t> _level;
+
+    Reader _drain;
+    TaskHandle_t _task;
+
+    template <typename T>
+    static uintptr_t toArg(T value) {
+        static_assert(!std::is_floating_point<T>::value,
+                      "Log arguments are stored as integers - scale floats first");
+        return (uintptr_t)value;
+    }
+
+    void writeRecord(uint8_t level, const char* fmt, const uintptr_t* args, uint8_t argc);
+
+    static void taskEntry(void* arg);
+    void drain();
+};
+
+extern LogRing* logRing;
+
+// Levels above LOG_COMPILE_LEVEL vanish at compile time; the rest are
+// checked against the runtime level before anything is written.
+#define LOG_AT(level, fmt, ...) \
+    do { \
+        if ((level) <= LOG_COMPILE_LEVEL && logRing && logRing->enabled(level)) { \
+            logRing->write((level), fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_E(fmt, ...) LOG_AT(LOG_LVL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_W(fmt, ...) LOG_AT(LOG_LVL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_I(fmt, ...) LOG_AT(LOG_LVL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_D(fmt, ...) LOG_AT(LOG_LVL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_T(fmt, ...) LOG_AT(LOG_LVL_TRACE, fmt, ##__VA_ARGS__)
+
+#endif // LOG_RING_H
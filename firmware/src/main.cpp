@@ -10,13 +10,24 @@
 #include <ArduinoJson.h>
 #include <FastLED.h>
 #include <NimBLEDevice.h>
-#include <usb/usb_host.h>
+#include <memory>
 
 #include "led_controller.h"
+#include "render_task.h"
+#include "midi_event_ring.h"
+#include "ws_note_stream.h"
+#include "ws_commands.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "boot_timeline.h"
+#include "usb_midi.h"
+#include "calibration.h"
+#include "recorder.h"
+#include "song_player.h"
+#include "lesson_follower.h"
+#include "game_engine.h"
 #include "../include/hotkey_handler.h"
 
-#define MIDI_IN_BUFFERS 4
-
 // WiFi Configuration
 #define WIFI_STA_SSID     "RT-GPON-F060_EXT"
 #define WIFI_STA_PASSWORD "Q579EY7q"
@@ -26,25 +37,31 @@
 #define WIFI_CONNECT_TIMEOUT_MS 10000
 
 bool wifiIsAP = false;
+volatile bool networkReady = false;     // Web server listening - set by networkBootTask
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
-// USB Host state
-usb_host_client_handle_t usbClientHandle = nullptr;
-usb_device_handle_t usbDeviceHandle = nullptr;
-usb_transfer_t* midiInTransfer[MIDI_IN_BUFFERS] = {nullptr};
-uint8_t midiInterfaceNum = 0;
-uint8_t midiInEndpoint = 0;
-uint16_t midiInMaxPacket = 64;
-bool usbDeviceConnected = false;
-bool usbMidiReady = false;
-
-// Forward declarations
-void onUsbDeviceConnected(uint8_t address);
-void onUsbDeviceDisconnected();
-void midiTransferCallback(usb_transfer_t* transfer);
-void processMidiPacket(uint8_t* data, size_t length);
+// Pipeline stages draining the MIDI event ring in the housekeeping task
+MidiEventRing::Reader hotkeyReader;
+MidiEventRing::Reader networkReader;
+HotkeyFilter networkHotkeys;    // Hotkey action presses are not sent to the app
+
+// Metrics updated outside the modules that own a registry entry
+MetricGauge midiEventsPerSecond;
+
+// Housekeeping: chores tick lateness, and USB transfer to network stage
+static const uint32_t HOUSEKEEPING_BUCKETS_US[] = {
+    100, 250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+MetricHistogram housekeepingJitter(HOUSEKEEPING_BUCKETS_US, sizeof(HOUSEKEEPING_BUCKETS_US) / sizeof(uint32_t));
+MetricHistogram eventDispatchDelay(HOUSEKEEPING_BUCKETS_US, sizeof(HOUSEKEEPING_BUCKETS_US) / sizeof(uint32_t));
+
+// The USB callback notifies the housekeeping task
+TaskHandle_t housekeepingTaskHandle = nullptr;
+
+// Pending reboot requested by a command (0 = none), millis() deadline
+volatile uint32_t restartAtMs = 0;
 
 // Hotkey callback
 void onHotkeyPlayPause() {
@@ -57,25 +74,38 @@ void onHotkeyPlayPause() {
     String json;
     serializeJson(doc, json);
     ws.textAll(json);
-    Serial.println("Hotkey: Play/Pause");
+    LOG_I("Hotkey: Play/Pause");
 }
 
 // ============== WebSocket ==============
 
+// Boot milestones in ms since power-on, phases not reached yet are omitted
+void fillBootTimeline(JsonObject out) {
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        BootPhase phase = (BootPhase)i;
+        if (bootTimeline->reached(phase)) {
+            out[BootTimeline::name(phase)] = bootTimeline->getUs(phase) / 1000;
+        }
+    }
+}
+
 void sendStatusToClients() {
+    if (!networkReady) return;  // WiFi not up yet - nobody to tell
+
     JsonDocument doc;
     doc["type"] = "status";
     // Angular ожидает данные напрямую, без вложенного payload
     doc["version"] = FW_VERSION;
-    doc["midi_connected"] = usbMidiReady;  // Angular ожидает midi_connected
+    doc["midi_connected"] = usbMidi && usbMidi->isReady();  // Angular ожидает midi_connected
     doc["ble_connected"] = false;  // TODO: реализовать BLE MIDI
     doc["mode"] = ledController ? (int)ledController->getMode() : 0;
     doc["brightness"] = ledController ? ledController->getBrightness() : 128;
-    doc["calibrated"] = true;  // TODO: реализовать калибровку
+    doc["calibrated"] = calibration && calibration->isCalibrated();
     doc["ws_clients"] = ws.count();
     doc["free_heap"] = ESP.getFreeHeap();
-    doc["is_recording"] = false;  // TODO: реализовать запись
-    doc["recording_notes"] = 0;
+    doc["is_recording"] = recorder && recorder->isRecording();
+    doc["recording_notes"] = recorder ? recorder->getNoteCount() : 0;
+    if (songPlayer) fillSongPlayer(doc["song"].to<JsonObject>(), *songPlayer);
 
     // WiFi информация
     JsonObject wifi = doc["wifi"].to<JsonObject>();
@@ -92,19 +122,22 @@ void sendStatusToClients() {
     features["elegant_ota"] = false;  // TODO: добавить OTA
     features["ble_midi"] = true;
     features["wifi_sta"] = true;
+    features["binary_notes"] = WS_NOTE_FRAME_VERSION;
+
+    fillBootTimeline(doc["boot_ms"].to<JsonObject>());
 
     String json;
     serializeJson(doc, json);
     ws.textAll(json);
 }
 
-void sendNoteToClients(uint8_t note, uint8_t velocity, bool isOn) {
+void sendCalibrationStep() {
+    if (!networkReady || !calibration) return;
+
     JsonDocument doc;
-    doc["type"] = "midi_note";
-    // Angular ожидает данные напрямую, без вложенного payload
-    doc["note"] = note;
-    doc["velocity"] = velocity;
-    doc["on"] = isOn;
+    JsonObject root = doc.to<JsonObject>();
+    root["type"] = "calibration_step";
+    calibration->fillStep(root);
 
     String json;
     serializeJson(doc, json);
@@ -115,249 +148,18 @@ void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
                AwsEventType type, void* arg, uint8_t* data, size_t len) {
     switch (type) {
         case WS_EVT_CONNECT:
-            Serial.printf("WS: Client #%u connected\n", client->id());
+            LOG_I("WS: Client #%u connected", client->id());
+            if (noteStream) noteStream->onConnect(client->id());
             sendStatusToClients();
             break;
         case WS_EVT_DISCONNECT:
-            Serial.printf("WS: Client #%u disconnected\n", client->id());
+            LOG_I("WS: Client #%u disconnected", client->id());
+            if (noteStream) noteStream->onDisconnect(client->id());
+            if (wsCommands) wsCommands->onDisconnect(client->id());
             break;
-        case WS_EVT_DATA: {
-            AwsFrameInfo* info = (AwsFrameInfo*)arg;
-            if (info->opcode == WS_TEXT) {
-                data[len] = 0;
-                JsonDocument doc;
-                if (!deserializeJson(doc, (char*)data)) {
-                    const char* msgType = doc["type"];
-
-                    if (msgType && strcmp(msgType, "get_status") == 0) {
-                        sendStatusToClients();
-                    }
-                    else if (msgType && strcmp(msgType, "set_brightness") == 0) {
-                        uint8_t brightness = doc["payload"]["value"] | 128;
-                        if (ledController) ledController->setBrightness(brightness);
-                        sendStatusToClients();
-                    }
-                    else if (msgType && strcmp(msgType, "set_mode") == 0) {
-                        // Поддержка обоих форматов: { mode } и { value }
-                        JsonObject payload = doc["payload"];
-                        uint8_t mode = payload.containsKey("mode")
-                            ? (uint8_t)payload["mode"]
-                            : (uint8_t)(payload["value"] | 0);
-                        if (ledController) ledController->setMode((LEDMode)mode);
-                        sendStatusToClients();
-                    }
-                    else if (msgType && strcmp(msgType, "set_hue") == 0) {
-                        uint8_t hue = doc["payload"]["value"] | 0;
-                        if (ledController) ledController->setHue(hue);
-                        sendStatusToClients();
-                    }
-                    else if (msgType && strcmp(msgType, "set_saturation") == 0) {
-                        uint8_t sat = doc["payload"]["value"] | 255;
-                        if (ledController) ledController->setSaturation(sat);
-                    }
-                    else if (msgType && strcmp(msgType, "set_fade_rate") == 0) {
-                        uint8_t rate = doc["payload"]["value"] | 15;
-                        if (ledController) ledController->setFadeRate(rate);
-                    }
-                    else if (msgType && strcmp(msgType, "set_splash") == 0) {
-                        bool enabled = doc["payload"]["enabled"] | false;
-                        if (ledController) ledController->setSplashEnabled(enabled);
-                    }
-                    else if (msgType && strcmp(msgType, "set_expected_notes") == 0) {
-                        // Learning mode - set expected notes
-                        JsonArray notes = doc["payload"]["notes"];
-                        if (ledController && notes) {
-                            uint8_t noteArray[10];
-                            uint8_t count = 0;
-                            for (JsonVariant v : notes) {
-                                if (count < 10) {
-                                    noteArray[count++] = v.as<uint8_t>();
-                                }
-                            }
-                            ledController->setExpectedNotes(noteArray, count);
-                        }
-                    }
-                    else if (msgType && strcmp(msgType, "clear_expected_notes") == 0) {
-                        if (ledController) ledController->clearExpectedNotes();
-                    }
-                    // Воспроизведение ноты из приложения (режим Demo/Learning)
-                    else if (msgType && strcmp(msgType, "play_note") == 0) {
-                        JsonObject payload = doc["payload"];
-                        uint8_t note = payload["note"] | 0;
-                        uint8_t velocity = payload["velocity"] | 100;
-                        bool on = payload["on"] | true;
-
-                        if (ledController) {
-                            if (on && velocity > 0) {
-                                ledController->noteOn(note, velocity);
-                            } else {
-                                ledController->noteOff(note);
-                            }
-                        }
-                    }
-                    else if (msgType && strcmp(msgType, "set_split") == 0) {
-                        // Support both camelCase (Angular) and snake_case naming
-                        JsonObject payload = doc["payload"];
-
-                        // Split position: accept "splitPoint" or "position"
-                        if (payload.containsKey("splitPoint")) {
-                            if (ledController) ledController->setSplitPosition(payload["splitPoint"]);
-                        } else if (payload.containsKey("position")) {
-                            if (ledController) ledController->setSplitPosition(payload["position"]);
-                        }
-
-                        // Left color: accept "leftHue/leftSat" or "left_hue/left_sat"
-                        if (payload.containsKey("leftHue") || payload.containsKey("left_hue")) {
-                            uint8_t h = payload.containsKey("leftHue") ? (uint8_t)payload["leftHue"] : (uint8_t)payload["left_hue"];
-                            uint8_t s = payload.containsKey("leftSat") ? (uint8_t)payload["leftSat"] :
-                                       (payload.containsKey("left_sat") ? (uint8_t)payload["left_sat"] : 255);
-                            uint8_t v = payload.containsKey("leftVal") ? (uint8_t)payload["leftVal"] :
-                                       (payload.containsKey("left_val") ? (uint8_t)payload["left_val"] : 255);
-                            if (ledController) ledController->setLeftColor(h, s, v);
-                        }
-
-                        // Right color: accept "rightHue/rightSat" or "right_hue/right_sat"
-                        if (payload.containsKey("rightHue") || payload.containsKey("right_hue")) {
-                            uint8_t h = payload.containsKey("rightHue") ? (uint8_t)payload["rightHue"] : (uint8_t)payload["right_hue"];
-                            uint8_t s = payload.containsKey("rightSat") ? (uint8_t)payload["rightSat"] :
-                                       (payload.containsKey("right_sat") ? (uint8_t)payload["right_sat"] : 255);
-                            uint8_t v = payload.containsKey("rightVal") ? (uint8_t)payload["rightVal"] :
-                                       (payload.containsKey("right_val") ? (uint8_t)payload["right_val"] : 255);
-                            if (ledController) ledController->setRightColor(h, s, v);
-                        }
-                    }
-                    else if (msgType && strcmp(msgType, "set_background") == 0) {
-                        JsonObject payload = doc["payload"];
-                        bool enabled = payload["enabled"] | false;
-                        if (ledController) {
-                            ledController->setBackgroundEnabled(enabled);
-                            if (payload.containsKey("hue")) {
-                                uint8_t h = payload["hue"];
-                                // Accept "saturation" (Angular) or "sat" (legacy)
-                                uint8_t s = payload.containsKey("saturation") ? (uint8_t)payload["saturation"] :
-                                           (payload.containsKey("sat") ? (uint8_t)payload["sat"] : 255);
-                                uint8_t v = payload.containsKey("val") ? (uint8_t)payload["val"] : 32;
-                                ledController->setBackgroundColor(h, s, v);
-                            }
-                            if (payload.containsKey("brightness")) {
-                                ledController->setBackgroundBrightness(payload["brightness"]);
-                            }
-                        }
-                    }
-                    else if (msgType && strcmp(msgType, "set_hue_shift") == 0) {
-                        bool enabled = doc["payload"]["enabled"] | false;
-                        if (ledController) {
-                            ledController->setHueShiftEnabled(enabled);
-                            if (doc["payload"].containsKey("amount")) {
-                                ledController->setHueShiftAmount(doc["payload"]["amount"]);
-                            }
-                            if (doc["payload"].containsKey("window_ms")) {
-                                ledController->setChordWindowMs(doc["payload"]["window_ms"]);
-                            }
-                        }
-                    }
-                    else if (msgType && strcmp(msgType, "set_ambient") == 0) {
-                        uint8_t anim = doc["payload"]["animation"] | 0;
-                        uint8_t speed = doc["payload"]["speed"] | 50;
-                        if (ledController) {
-                            ledController->setAmbientAnimation(anim);
-                            ledController->setAnimationSpeed(speed);
-                        }
-                    }
-                    // Universal settings handler - accepts multiple parameters at once
-                    else if (msgType && strcmp(msgType, "set_settings") == 0) {
-                        JsonObject payload = doc["payload"];
-                        if (ledController && !payload.isNull()) {
-                            // Brightness (0-255)
-                            if (payload.containsKey("brightness")) {
-                                ledController->setBrightness(payload["brightness"]);
-                            }
-                            // Hue (0-255)
-                            if (payload.containsKey("hue")) {
-                                ledController->setHue(payload["hue"]);
-                            }
-                            // Saturation (0-255)
-                            if (payload.containsKey("saturation")) {
-                                ledController->setSaturation(payload["saturation"]);
-                            }
-                            // Fade rate (0-255) - поддержка fadeRate и fadeTime
-                            if (payload.containsKey("fadeRate")) {
-                                ledController->setFadeRate(payload["fadeRate"]);
-                            } else if (payload.containsKey("fadeTime")) {
-                                // Angular отправляет fadeTime в мс, конвертируем в fade rate
-                                // fadeTime 0-2000 → fadeRate 255-0 (инвертировано)
-                                uint16_t fadeTime = payload["fadeTime"];
-                                uint8_t fadeRate = fadeTime > 0 ? 255 - min((int)(fadeTime / 8), 255) : 255;
-                                ledController->setFadeRate(fadeRate);
-                            }
-                            // Splash/wave effect - поддержка splashEnabled и waveEnabled
-                            if (payload.containsKey("splashEnabled")) {
-                                ledController->setSplashEnabled(payload["splashEnabled"]);
-                            } else if (payload.containsKey("waveEnabled")) {
-                                ledController->setSplashEnabled(payload["waveEnabled"]);
-                            }
-                            // Wave width (если поддерживается)
-                            if (payload.containsKey("waveWidth")) {
-                                // TODO: добавить setWaveWidth в ledController
-                            }
-                            // Mode (0-8)
-                            if (payload.containsKey("mode")) {
-                                ledController->setMode((LEDMode)(uint8_t)payload["mode"]);
-                            }
-                            // Color as RGB array [r, g, b] - convert to HSV
-                            if (payload.containsKey("color")) {
-                                JsonArray color = payload["color"];
-                                if (color && color.size() >= 3) {
-                                    uint8_t r = color[0];
-                                    uint8_t g = color[1];
-                                    uint8_t b = color[2];
-                                    // Convert RGB to HSV and set hue/saturation
-                                    CRGB rgb(r, g, b);
-                                    CHSV hsv = rgb2hsv_approximate(rgb);
-                                    ledController->setHue(hsv.hue);
-                                    ledController->setSaturation(hsv.sat);
-                                }
-                            }
-                            // Split settings
-                            if (payload.containsKey("splitPoint")) {
-                                ledController->setSplitPosition(payload["splitPoint"]);
-                            }
-                            if (payload.containsKey("splitLeftColor")) {
-                                JsonArray c = payload["splitLeftColor"];
-                                if (c && c.size() >= 3) {
-                                    CRGB rgb(c[0], c[1], c[2]);
-                                    CHSV hsv = rgb2hsv_approximate(rgb);
-                                    ledController->setLeftColor(hsv.hue, hsv.sat, hsv.val);
-                                }
-                            }
-                            if (payload.containsKey("splitRightColor")) {
-                                JsonArray c = payload["splitRightColor"];
-                                if (c && c.size() >= 3) {
-                                    CRGB rgb(c[0], c[1], c[2]);
-                                    CHSV hsv = rgb2hsv_approximate(rgb);
-                                    ledController->setRightColor(hsv.hue, hsv.sat, hsv.val);
-                                }
-                            }
-                        }
-                        sendStatusToClients();
-                    }
-                    // LED configuration (count, direction)
-                    else if (msgType && strcmp(msgType, "set_led_config") == 0) {
-                        JsonObject payload = doc["payload"];
-                        if (ledController && !payload.isNull()) {
-                            if (payload.containsKey("reversed")) {
-                                ledController->setReversed(payload["reversed"]);
-                            }
-                            if (payload.containsKey("brightness")) {
-                                ledController->setBrightness(payload["brightness"]);
-                            }
-                        }
-                        sendStatusToClients();
-                    }
-                }
-            }
+        case WS_EVT_DATA:
+            if (wsCommands) wsCommands->handleData(client, (AwsFrameInfo*)arg, data, len);
             break;
-        }
         default:
             break;
     }
@@ -365,286 +167,503 @@ void onWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client,
 
 // ============== USB MIDI ==============
 
-void usbClientCallback(const usb_host_client_event_msg_t* msg, void* arg) {
-    switch (msg->event) {
-        case USB_HOST_CLIENT_EVENT_NEW_DEV:
-            Serial.printf("USB: New device at address %d\n", msg->new_dev.address);
-            onUsbDeviceConnected(msg->new_dev.address);
-            break;
-        case USB_HOST_CLIENT_EVENT_DEV_GONE:
-            Serial.println("USB: Device disconnected");
-            onUsbDeviceDisconnected();
-            break;
-    }
+// USB client task: the driver pushed events - both consumers sleep until then
+void onUsbMidiEvents() {
+    if (renderTask) renderTask->wake();
+    if (housekeepingTaskHandle) xTaskNotifyGive(housekeepingTaskHandle);
 }
 
-void midiTransferCallback(usb_transfer_t* transfer) {
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && transfer->actual_num_bytes > 0) {
-        processMidiPacket(transfer->data_buffer, transfer->actual_num_bytes);
-    }
-    if (usbMidiReady) {
-        usb_host_transfer_submit(transfer);
+// USB client task: a MIDI device started or stopped streaming
+void onUsbMidiConnection(bool connected) {
+    if (connected) {
+        bootTimeline->mark(BOOT_USB_DEVICE);
+        if (ledController) {
+            RenderLock lock;
+            ledController->blackout();
+        }
+    } else if (ledController) {
+        RenderLock lock;
+        ledController->flashDisconnect();
     }
+    sendStatusToClients();
 }
 
-void processMidiPacket(uint8_t* data, size_t length) {
-    for (size_t i = 0; i + 4 <= length; i += 4) {
-        uint8_t cin = data[i] & 0x0F;
-        uint8_t status = data[i + 1];
-        uint8_t note = data[i + 2];
-        uint8_t velocity = data[i + 3];
-
-        if (cin == 0 && status == 0) continue;
-
-        uint8_t msgType = status & 0xF0;
-
-        if (msgType == 0x90 && velocity > 0) {
-            // Note On
-            if (hotkeyHandler) {
-                hotkeyHandler->noteOn(note, velocity);
-                if (hotkeyHandler->checkHotkey()) {
-                    // Hotkey activated, don't process as normal note
-                    continue;
-                }
-            }
-
-            if (ledController) {
-                ledController->noteOn(note, velocity);
-            }
-            sendNoteToClients(note, velocity, true);
-            Serial.printf("Note ON:  %3d vel=%3d\n", note, velocity);
-
-        } else if (msgType == 0x80 || (msgType == 0x90 && velocity == 0)) {
-            // Note Off
-            if (hotkeyHandler) {
-                hotkeyHandler->noteOff(note);
-            }
-
-            if (ledController) {
-                ledController->noteOff(note);
-            }
-            sendNoteToClients(note, 0, false);
-            Serial.printf("Note OFF: %3d\n", note);
+// Hotkey stage: detect A0+B0 combos and execute them. During calibration
+// the keys answer the calibration steps instead (A0/C8 are steps too).
+void processHotkeyEvents() {
+    MidiEvent ev;
+    bool stepChanged = false;
+    while (midiEvents->pop(hotkeyReader, ev)) {
+        if (ev.source == MIDI_SOURCE_APP) continue;
+        if (calibration && calibration->isActive()) {
+            stepChanged |= calibration->handleEvent(ev);
+            continue;
         }
+        if (hotkeyHandler) hotkeyHandler->handleEvent(ev);
     }
+    if (stepChanged) sendCalibrationStep();
 }
 
-// ============== USB Device Handling ==============
-
-void onUsbDeviceConnected(uint8_t address) {
-    Serial.print("USB: Opening device... ");
-    esp_err_t err = usb_host_device_open(usbClientHandle, address, &usbDeviceHandle);
-    if (err != ESP_OK) {
-        Serial.printf("FAIL (%d)\n", err);
-        return;
-    }
-    Serial.println("OK");
-
-    const usb_device_desc_t* devDesc;
-    usb_host_get_device_descriptor(usbDeviceHandle, &devDesc);
-    Serial.printf("USB: VID=0x%04X PID=0x%04X\n", devDesc->idVendor, devDesc->idProduct);
-
-    const usb_config_desc_t* configDesc;
-    err = usb_host_get_active_config_descriptor(usbDeviceHandle, &configDesc);
-    if (err != ESP_OK) {
-        Serial.println("USB: Failed to get config descriptor");
-        return;
-    }
-
-    const uint8_t* p = &configDesc->val[0];
-    int offset = 0;
-    bool foundMidi = false;
-
-    while (offset < configDesc->wTotalLength) {
-        uint8_t bLength = p[0];
-        uint8_t bDescType = p[1];
-        if (bLength == 0) break;
-
-        if (bDescType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
-            uint8_t bInterfaceNum = p[2];
-            uint8_t bInterfaceClass = p[5];
-            uint8_t bInterfaceSubClass = p[6];
-
-            if (bInterfaceClass == 0x01 && bInterfaceSubClass == 0x03) {
-                Serial.printf("USB: MIDI interface #%d\n", bInterfaceNum);
-                midiInterfaceNum = bInterfaceNum;
-                foundMidi = true;
-
-                err = usb_host_interface_claim(usbClientHandle, usbDeviceHandle, bInterfaceNum, 0);
-                if (err != ESP_OK) {
-                    Serial.printf("USB: Claim interface FAIL (%d)\n", err);
-                } else {
-                    Serial.println("USB: Interface claimed OK");
-                }
-            }
+// Network stage: forward played notes to the app
+void processNetworkEvents() {
+    MidiEvent ev;
+    while (midiEvents->pop(networkReader, ev)) {
+        if (ev.source == MIDI_SOURCE_APP) continue;
+        if (ev.source == MIDI_SOURCE_USB) eventDispatchDelay.observe(MidiEventRing::now() - ev.timeUs);
+        if (networkHotkeys.filter(ev)) continue;
+
+        if (ev.isNoteOn()) {
+            if (noteStream) noteStream->queueNote(ev);
+            LOG_D("Note ON:  %3d vel=%3d", ev.data1, ev.data2);
+        } else if (ev.isNoteOff()) {
+            if (noteStream) noteStream->queueNote(ev);
+            LOG_D("Note OFF: %3d", ev.data1);
         }
-        else if (bDescType == USB_B_DESCRIPTOR_TYPE_ENDPOINT && foundMidi) {
-            uint8_t bEndpointAddr = p[2];
-            uint8_t bmAttributes = p[3];
-            uint16_t wMaxPacket = p[4] | (p[5] << 8);
-
-            if ((bmAttributes & 0x03) == 0x02 && (bEndpointAddr & 0x80)) {
-                midiInEndpoint = bEndpointAddr;
-                midiInMaxPacket = wMaxPacket;
-                Serial.printf("USB: MIDI IN endpoint 0x%02X, maxPacket=%d\n", bEndpointAddr, wMaxPacket);
-            }
-        }
-
-        offset += bLength;
-        p += bLength;
     }
 
-    if (!foundMidi || midiInEndpoint == 0) {
-        Serial.println("USB: No MIDI endpoint found");
-        usbDeviceConnected = true;
-        sendStatusToClients();
-        return;
-    }
+    // Send the batch once its window has passed
+    if (noteStream) noteStream->poll();
+}
 
-    Serial.print("USB: Setting up transfers... ");
-    for (int i = 0; i < MIDI_IN_BUFFERS; i++) {
-        err = usb_host_transfer_alloc(midiInMaxPacket, 0, &midiInTransfer[i]);
-        if (err != ESP_OK) {
-            Serial.printf("FAIL alloc %d (%d)\n", i, err);
-            continue;
-        }
-        midiInTransfer[i]->device_handle = usbDeviceHandle;
-        midiInTransfer[i]->bEndpointAddress = midiInEndpoint;
-        midiInTransfer[i]->callback = midiTransferCallback;
-        midiInTransfer[i]->context = nullptr;
-        midiInTransfer[i]->num_bytes = midiInMaxPacket;
-
-        err = usb_host_transfer_submit(midiInTransfer[i]);
-        if (err != ESP_OK) {
-            Serial.printf("FAIL submit %d (%d)\n", i, err);
-        }
+// Lesson stage: the follower moves its cursor on played notes, the app
+// hears about progress and wrong notes right after
+void processLessonEvents() {
+    if (!lessonFollower) return;
+    lessonFollower->poll();
+    for (;;) {
+        JsonDocument doc;
+        if (!lessonFollower->nextReport(doc.to<JsonObject>())) break;
+        if (!networkReady) continue;
+        String json;
+        serializeJson(doc, json);
+        ws.textAll(json);
     }
-    Serial.println("OK");
+}
 
-    usbMidiReady = true;
-    usbDeviceConnected = true;
+// Game stage: hits and misses are judged in the render task, the app hears
+// about them from here
+void processGameEvents() {
+    if (!gameEngine) return;
+    for (;;) {
+        JsonDocument doc;
+        if (!gameEngine->nextReport(doc.to<JsonObject>())) break;
+        if (!networkReady) continue;
+        String json;
+        serializeJson(doc, json);
+        ws.textAll(json);
+    }
+}
 
-    if (ledController) ledController->blackout();
-    Serial.println("USB: MIDI ready!");
-    sendStatusToClients();
+// Recording stage: the recorder drains its own reader while recording
+void processRecorderEvents() {
+    if (recorder) recorder->poll();
 }
 
-void onUsbDeviceDisconnected() {
-    usbMidiReady = false;
+// ============== Metrics ==============
 
-    for (int i = 0; i < MIDI_IN_BUFFERS; i++) {
-        if (midiInTransfer[i] != nullptr) {
-            usb_host_transfer_free(midiInTransfer[i]);
-            midiInTransfer[i] = nullptr;
-        }
+// One sample per connected WebSocket client: messages waiting to be sent
+void collectWsQueueDepth(Print& out, const char* name) {
+    for (AsyncWebSocketClient& client : ws.getClients()) {
+        out.printf("%s{client=\"%u\"} %u\n", name, client.id(), (unsigned)client.queueLen());
     }
+}
 
-    if (usbDeviceHandle != nullptr) {
-        usb_host_interface_release(usbClientHandle, usbDeviceHandle, midiInterfaceNum);
-        usb_host_device_close(usbClientHandle, usbDeviceHandle);
-        usbDeviceHandle = nullptr;
+void collectBootPhases(Print& out, const char* name) {
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        BootPhase phase = (BootPhase)i;
+        if (bootTimeline->reached(phase)) {
+            out.printf("%s{phase=\"%s\"} %u\n", name, BootTimeline::name(phase), bootTimeline->getUs(phase));
+        }
     }
-
-    usbDeviceConnected = false;
-    midiInEndpoint = 0;
-
-    if (ledController) ledController->flashDisconnect();
-    sendStatusToClients();
 }
 
-// ============== Setup ==============
-
-void setup() {
-    Serial.begin(115200);
-    delay(2000);
-
-    Serial.println("\n\n========================================");
-    Serial.printf("  Pianora TEST 11 - Full Features\n");
-    Serial.println("========================================\n");
-
-    // 1. LED Controller
-    Serial.print("1. LED Controller... ");
-    ledController = new LEDController();
-    ledController->begin();
-    Serial.println("OK");
-
-    // 2. Hotkey Handler
-    Serial.print("2. Hotkey Handler... ");
-    hotkeyHandler = new HotkeyHandler();
-    Serial.println("OK");
+void collectBuildInfo(Print& out, const char* name) {
+    out.printf("%s{version=\"%s\"} 1\n", name, FW_VERSION);
+}
 
-    // 3. NimBLE (init only)
-    Serial.print("3. NimBLE... ");
-    NimBLEDevice::init("Pianora");
-    Serial.println("OK");
+void registerMetrics() {
+    metrics->addCollector("pianora_build_info", "Firmware version", METRIC_GAUGE, collectBuildInfo);
+    metrics->addGauge("pianora_uptime_seconds", "Seconds since boot",
+        []() -> uint32_t { return millis() / 1000; });
+    metrics->addCollector("pianora_boot_phase_us", "Time from power-on to each boot milestone", METRIC_GAUGE, collectBootPhases);
+
+    // MIDI input
+    metrics->addCounter("pianora_midi_events_total", "MIDI events pushed into the event ring",
+        []() -> uint32_t { return midiEvents->getPushed(); });
+    metrics->addGauge("pianora_midi_events_per_second", "MIDI events over the last second", &midiEventsPerSecond);
+    metrics->addCounter("pianora_usb_transfers_total", "USB MIDI IN transfers completed",
+        []() -> uint32_t { return usbMidi->getTransferCount(); });
+    metrics->addCounter("pianora_usb_transfer_errors_total", "USB MIDI IN transfers that failed",
+        []() -> uint32_t { return usbMidi->getTransferErrorCount(); });
+    metrics->addCounter("pianora_usb_resubmit_errors_total", "USB MIDI IN transfers that could not be resubmitted",
+        []() -> uint32_t { return usbMidi->getResubmitErrorCount(); });
+    metrics->addCounter("pianora_usb_stalls_total", "USB MIDI IN endpoint stalls cleared",
+        []() -> uint32_t { return usbMidi->getStallCount(); });
+    metrics->addCounter("pianora_usb_midi_filtered_total", "USB MIDI messages dropped by the forward/cable masks",
+        []() -> uint32_t { return usbMidi->getFilteredCount(); });
+    metrics->addCounter("pianora_usb_midi_sysex_total", "USB MIDI SysEx messages skipped",
+        []() -> uint32_t { return usbMidi->getSysExCount(); });
+    metrics->addCounter("pianora_usb_midi_malformed_total", "USB MIDI packets with an inconsistent CIN",
+        []() -> uint32_t { return usbMidi->getMalformedCount(); });
+    metrics->addCounter("pianora_usb_connects_total", "USB MIDI devices that started streaming",
+        []() -> uint32_t { return usbMidi->getConnectCount(); });
+    metrics->addGauge("pianora_usb_midi_ready", "USB MIDI device streaming",
+        []() -> uint32_t { return usbMidi->isReady() ? 1 : 0; });
+
+    // Render
+    metrics->addHistogram("pianora_render_frame_us", "Render frame compute time", &renderTask->getFrameTimeHistogram());
+    metrics->addHistogram("pianora_led_show_us", "FastLED.show() duration", &ledController->getShowTimeHistogram());
+    metrics->addHistogram("pianora_key_to_light_us", "USB transfer completion to LED latch per key press", &renderTask->getLatencyHistogram());
+    metrics->addCounter("pianora_render_frames_total", "Frames rendered",
+        []() -> uint32_t { return renderTask->getFrameCount(); });
+    metrics->addCounter("pianora_render_overruns_total", "Frames over the frame budget",
+        []() -> uint32_t { return renderTask->getOverrunCount(); });
+    metrics->addCounter("pianora_render_dropped_events_total", "Events overwritten before the render stage read them",
+        []() -> uint32_t { return renderTask->getDroppedEvents(); });
+    metrics->addCounter("pianora_led_frames_pushed_total", "Frames sent to the strip",
+        []() -> uint32_t { return ledController->getFramesPushed(); });
+    metrics->addCounter("pianora_led_frames_skipped_total", "Unchanged frames not sent",
+        []() -> uint32_t { return ledController->getFramesSkipped(); });
+    metrics->addGauge("pianora_led_current_ma", "Estimated strip current before the limit",
+        []() -> uint32_t { return ledController->getPowerBudget().getEstimatedMa(); });
+    metrics->addGauge("pianora_led_limited_current_ma", "Estimated strip current after the limit",
+        []() -> uint32_t { return ledController->getPowerBudget().getLimitedMa(); });
+    metrics->addCounter("pianora_led_limited_frames_total", "Frames scaled down to stay inside the power budget",
+        []() -> uint32_t { return ledController->getPowerBudget().getLimitedFrames(); });
+
+    // Housekeeping
+    metrics->addHistogram("pianora_housekeeping_jitter_us", "Housekeeping chores tick lateness", &housekeepingJitter);
+    metrics->addHistogram("pianora_event_dispatch_us", "USB transfer completion to the network stage", &eventDispatchDelay);
+
+    // Network
+    metrics->addGauge("pianora_ws_clients", "Connected WebSocket clients",
+        []() -> uint32_t { return ws.count(); });
+    metrics->addCollector("pianora_ws_queue_depth", "Messages queued per WebSocket client", METRIC_GAUGE, collectWsQueueDepth);
+    metrics->addCounter("pianora_ws_notes_sent_total", "Notes sent to the app",
+        []() -> uint32_t { return noteStream->getNotesSent(); });
+    metrics->addCounter("pianora_ws_commands_total", "WebSocket commands handled",
+        []() -> uint32_t { return wsCommands->getCommandCount(); });
+    metrics->addCounter("pianora_recorder_bytes_written_total", "Recorded bytes stored in LittleFS",
+        []() -> uint32_t { return recorder->getBytesWritten(); });
+    metrics->addCounter("pianora_recorder_dropped_events_total", "Events not recorded because the writer fell behind",
+        []() -> uint32_t { return recorder->getDroppedEvents(); });
+
+    // Song player
+    metrics->addHistogram("pianora_song_note_lateness_us", "Song notes sent after their time",
+        &songPlayer->getLatenessHistogram());
+    metrics->addCounter("pianora_song_notes_played_total", "Song notes played",
+        []() -> uint32_t { return songPlayer->getNotesPlayed(); });
+    metrics->addCounter("pianora_song_underruns_total", "Times the song queue ran empty before the parser",
+        []() -> uint32_t { return songPlayer->getUnderruns(); });
+    metrics->addCounter("pianora_log_dropped_total", "Log records lost before reaching Serial",
+        []() -> uint32_t { return logRing->getDropped(); });
+
+    // Memory
+    metrics->addGauge("pianora_heap_free_bytes", "Free heap",
+        []() -> uint32_t { return ESP.getFreeHeap(); });
+    metrics->addGauge("pianora_heap_min_free_bytes", "Lowest free heap since boot",
+        []() -> uint32_t { return ESP.getMinFreeHeap(); });
+    metrics->addGauge("pianora_heap_max_alloc_bytes", "Largest allocatable block",
+        []() -> uint32_t { return ESP.getMaxAllocHeap(); });
+}
 
-    // 4. LittleFS
-    Serial.print("4. LittleFS... ");
-    if (!LittleFS.begin(false)) {
-        Serial.println("Mount failed, formatting...");
-        if (!LittleFS.begin(true)) {
-            Serial.println("FAIL even after format!");
-        }
-    }
-    Serial.printf("OK (Total: %u, Used: %u)\n", LittleFS.totalBytes(), LittleFS.usedBytes());
+// ============== Network Bring-up ==============
 
-    // 5. WiFi - try Station first, fallback to AP
-    Serial.println("5. WiFi Setup...");
+// Station first, AP as fallback - can take WIFI_CONNECT_ATTEMPTS * WIFI_CONNECT_TIMEOUT_MS
+void connectWiFi() {
     WiFi.mode(WIFI_STA);
 
     bool connected = false;
     for (int attempt = 1; attempt <= WIFI_CONNECT_ATTEMPTS; attempt++) {
-        Serial.printf("   Connecting to '%s' (attempt %d/%d)...\n",
-                      WIFI_STA_SSID, attempt, WIFI_CONNECT_ATTEMPTS);
+        LOG_I("WiFi: Connecting to '%s' (attempt %d/%d)", WIFI_STA_SSID, attempt, WIFI_CONNECT_ATTEMPTS);
 
         WiFi.begin(WIFI_STA_SSID, WIFI_STA_PASSWORD);
 
         uint32_t startTime = millis();
         while (WiFi.status() != WL_CONNECTED &&
                (millis() - startTime) < WIFI_CONNECT_TIMEOUT_MS) {
-            delay(500);
-            Serial.print(".");
+            delay(100);
         }
-        Serial.println();
 
         if (WiFi.status() == WL_CONNECTED) {
             connected = true;
             break;
         }
 
-        Serial.println("   Failed!");
+        LOG_W("WiFi: Attempt %d failed", attempt);
         WiFi.disconnect();
     }
 
     if (connected) {
         wifiIsAP = false;
-        Serial.printf("   Connected! IP: %s\n", WiFi.localIP().toString().c_str());
+        // Log arguments are stored, not copied - no temporary strings
+        IPAddress ip = WiFi.localIP();
+        LOG_I("WiFi: Connected, IP %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
     } else {
-        Serial.println("   Starting AP mode...");
         WiFi.mode(WIFI_AP);
         WiFi.softAP(WIFI_AP_SSID, WIFI_AP_PASSWORD);
         wifiIsAP = true;
-        Serial.printf("   AP started: %s / %s\n", WIFI_AP_SSID, WIFI_AP_PASSWORD);
-        Serial.printf("   IP: %s\n", WiFi.softAPIP().toString().c_str());
+        IPAddress ip = WiFi.softAPIP();
+        LOG_I("WiFi: AP '" WIFI_AP_SSID "' started, IP %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
     }
+}
 
-    // 6. WebSocket + WebServer
-    Serial.print("6. WebSocket + WebServer... ");
+void startWebServer() {
     ws.onEvent(onWsEvent);
     server.addHandler(&ws);
 
     // API endpoints
     server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest* request) {
         JsonDocument doc;
-        doc["usb_connected"] = usbDeviceConnected;
-        doc["usb_midi_ready"] = usbMidiReady;
+        doc["usb_connected"] = usbMidi && usbMidi->isConnected();
+        doc["usb_midi_ready"] = usbMidi && usbMidi->isReady();
         doc["brightness"] = ledController ? ledController->getBrightness() : 128;
         doc["mode"] = ledController ? (int)ledController->getMode() : 0;
         doc["heap"] = ESP.getFreeHeap();
         doc["version"] = FW_VERSION;
         doc["wifi_mode"] = wifiIsAP ? "AP" : "STA";
         doc["ip"] = wifiIsAP ? WiFi.softAPIP().toString() : WiFi.localIP().toString();
-        doc["led_count"] = NUM_LEDS;
+        doc["led_count"] = ledController ? ledController->getLedCount() : 0;
+        if (ledController) fillLedLayout(doc["led_segments"].to<JsonArray>(), ledController->getLayout());
+        fillBootTimeline(doc["boot_ms"].to<JsonObject>());
+
+        if (ledController) fillPowerBudget(doc["power"].to<JsonObject>(), ledController->getPowerBudget());
+
+        if (calibration) {
+            const CalibrationData& data = calibration->getData();
+            JsonObject calib = doc["calibration"].to<JsonObject>();
+            calib["calibrated"] = data.calibrated;
+            calib["active"] = calibration->isActive();
+            calib["first_note"] = data.firstNote;
+            calib["last_note"] = data.lastNote;
+            calib["first_led"] = data.firstLed;
+            calib["last_led"] = data.lastLed;
+        }
+
+        if (recorder) {
+            JsonObject rec = doc["recording"].to<JsonObject>();
+            rec["active"] = recorder->isRecording();
+            rec["id"] = recorder->getCurrentId();
+            rec["events"] = recorder->getEventCount();
+            rec["notes"] = recorder->getNoteCount();
+            rec["duration_ms"] = recorder->getDurationMs();
+            rec["dropped"] = recorder->getDroppedEvents();
+        }
+
+        if (lessonFollower) lessonFollower->fillStatus(doc["lesson"].to<JsonObject>());
+        if (gameEngine) gameEngine->fillStatus(doc["game"].to<JsonObject>());
+
+        if (songPlayer) {
+            JsonObject song = doc["song"].to<JsonObject>();
+            fillSongPlayer(song, *songPlayer);
+            song["notes_played"] = songPlayer->getNotesPlayed();
+            song["underruns"] = songPlayer->getUnderruns();
+        }
+
+        if (noteStream) {
+            JsonObject notes = doc["ws_notes"].to<JsonObject>();
+            notes["binary_clients"] = noteStream->getBinaryClientCount();
+            notes["binary_frames"] = noteStream->getBinaryFramesSent();
+            notes["json_messages"] = noteStream->getJsonMessagesSent();
+            notes["batch_ms"] = noteStream->getBatchWindowMs();
+            notes["batches"] = noteStream->getBatchesSent();
+            notes["notes"] = noteStream->getNotesSent();
+            notes["full_batches"] = noteStream->getFullBatches();
+        }
+
+        JsonObject log = doc["log"].to<JsonObject>();
+        log["level"] = logRing->getLevel();
+        log["compile_level"] = LOG_COMPILE_LEVEL;
+        log["written"] = logRing->getWritten();
+        log["dropped"] = logRing->getDropped();
+
+        if (wsCommands) {
+            JsonObject cmds = doc["ws_commands"].to<JsonObject>();
+            cmds["handled"] = wsCommands->getCommandCount();
+            cmds["unknown"] = wsCommands->getUnknownCount();
+            cmds["parse_errors"] = wsCommands->getParseErrors();
+            cmds["oversized"] = wsCommands->getOversizedCount();
+        }
+
+        if (renderTask) {
+            JsonObject render = doc["render"].to<JsonObject>();
+            render["fps"] = renderTask->getFrameRate();
+            render["budget_us"] = renderTask->getFrameBudgetUs();
+            render["last_us"] = renderTask->getLastFrameUs();
+            render["avg_us"] = renderTask->getAvgFrameUs();
+            render["max_us"] = renderTask->getMaxFrameUs();
+            render["frames"] = renderTask->getFrameCount();
+            render["overruns"] = renderTask->getOverrunCount();
+            render["dropped_events"] = renderTask->getDroppedEvents();
+            render["frames_pushed"] = ledController->getFramesPushed();
+            render["frames_skipped"] = ledController->getFramesSkipped();
+            render["keepalive_ms"] = ledController->getKeepAliveMs();
+            render["active_leds"] = ledController->getActiveLedCount();
+            render["fade_cycles"] = ledController->getLastFadeCycles();
+
+            JsonObject output = render["output"].to<JsonObject>();
+            output["gamma"] = ledController->getGamma();
+            const CRGB& balance = ledController->getWhiteBalance();
+            JsonArray wb = output["white_balance"].to<JsonArray>();
+            wb.add(balance.r);
+            wb.add(balance.g);
+            wb.add(balance.b);
+            output["dither"] = ledController->isDithering();
+            output["table_rebuilds"] = ledController->getOutputRebuilds();
+
+            fillLatencySummary(doc["latency"].to<JsonObject>());
+        }
+
+        String json;
+        serializeJson(doc, json);
+        request->send(200, "application/json", json);
+    });
+
+    // Prometheus text format for fleet scraping
+    server.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!metrics) {
+            request->send(503, "text/plain", "metrics not ready\n");
+            return;
+        }
+        AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+        metrics->write(*response);
+        request->send(response);
+    });
+
+    // Recent log records, oldest first: /api/log?n=50
+    server.on("/api/log", HTTP_GET, [](AsyncWebServerRequest* request) {
+        uint32_t count = 50;
+        if (request->hasParam("n")) {
+            count = request->getParam("n")->value().toInt();
+        }
+
+        JsonDocument doc;
+        doc["level"] = logRing->getLevel();
+        JsonArray records = doc["records"].to<JsonArray>();
+
+        LogRing::Reader reader;
+        logRing->rewind(reader, count);
+        LogRecord record;
+        char line[160];
+        while (logRing->pop(reader, record)) {
+            LogRing::format(record, line, sizeof(line));
+            JsonObject entry = records.add<JsonObject>();
+            entry["t_us"] = record.timeUs;
+            entry["level"] = record.level;
+            entry["msg"] = line;
+        }
+
+        String json;
+        serializeJson(doc, json);
+        request->send(200, "application/json", json);
+    });
+
+    // Recordings as Standard MIDI Files: /api/recordings/export?id=3
+    server.on("/api/recordings/export", HTTP_GET, [](AsyncWebServerRequest* request) {
+        uint32_t id = request->hasParam("id") ? request->getParam("id")->value().toInt() : 0;
+        std::shared_ptr<SmfExport> smf(new SmfExport());
+        if (!smf->open(id)) {
+            request->send(404, "application/json", "{\"error\":\"No such recording\"}");
+            return;
+        }
+        // The response owns the export; the file closes when it is done
+        AsyncWebServerResponse* response = request->beginResponse("audio/midi", smf->size(),
+            [smf](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+                return smf->read(buffer, maxLen, index);
+            });
+        response->addHeader("Content-Disposition", String("attachment; filename=\"pianora-") + id + ".mid\"");
+        request->send(response);
+    });
+
+    server.on("/api/recordings", HTTP_DELETE, [](AsyncWebServerRequest* request) {
+        uint32_t id = request->hasParam("id") ? request->getParam("id")->value().toInt() : 0;
+        if (recorder && recorder->remove(id)) {
+            request->send(200, "application/json", "{\"success\":true}");
+        } else {
+            request->send(404, "application/json", "{\"error\":\"No such recording or still recording\"}");
+        }
+    });
+
+    server.on("/api/recordings", HTTP_GET, [](AsyncWebServerRequest* request) {
+        JsonDocument doc;
+        if (recorder) recorder->fillList(doc["recordings"].to<JsonArray>());
+        doc["fs_total"] = (uint32_t)LittleFS.totalBytes();
+        doc["fs_used"] = (uint32_t)LittleFS.usedBytes();
+
+        String json;
+        serializeJson(doc, json);
+        request->send(200, "application/json", json);
+    });
+
+    // Songs for the player: uploaded to /songs, built-in ones come with the app
+    server.on("/api/songs", HTTP_POST, [](AsyncWebServerRequest* request) {
+        // Upload handler leaves the stored name in _tempObject (freed with the request)
+        if (request->_tempObject) {
+            JsonDocument doc;
+            doc["success"] = true;
+            doc["filename"] = (const char*)request->_tempObject;
+            String json;
+            serializeJson(doc, json);
+            request->send(200, "application/json", json);
+        } else {
+            request->send(400, "application/json", "{\"error\":\"Not a MIDI file, bad name, song playing or no space\"}");
+        }
+    }, [](AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final) {
+        static const char* UPLOAD_TEMP = PLAYER_SONG_DIR "/.upload";
+        if (index == 0) {
+            bool playing = songPlayer->getState() != PLAYER_STOPPED && filename == songPlayer->getFilename();
+            if (!SongPlayer::isValidName(filename.c_str()) || playing || len < 4 || memcmp(data, "MThd", 4) != 0) return;
+            if (!LittleFS.exists(PLAYER_SONG_DIR)) LittleFS.mkdir(PLAYER_SONG_DIR);
+            request->_tempFile = LittleFS.open(UPLOAD_TEMP, "w");
+        }
+        if (!request->_tempFile) return;
+
+        if (request->_tempFile.write(data, len) != len) {
+            LOG_E("Songs: upload failed, LittleFS full?");
+            request->_tempFile.close();
+            LittleFS.remove(UPLOAD_TEMP);
+            return;
+        }
+        if (final) {
+            // Written aside and renamed, so a failed upload never replaces a song
+            request->_tempFile.close();
+            String path = String(PLAYER_SONG_DIR "/") + filename;
+            LittleFS.remove(path);
+            if (LittleFS.rename(UPLOAD_TEMP, path)) {
+                request->_tempObject = strdup(filename.c_str());
+            } else {
+                LittleFS.remove(UPLOAD_TEMP);
+            }
+        }
+    });
+
+    server.on("/api/songs", HTTP_DELETE, [](AsyncWebServerRequest* request) {
+        String name = request->hasParam("name") ? request->getParam("name")->value() : String();
+        bool playing = songPlayer->getState() != PLAYER_STOPPED && name == songPlayer->getFilename();
+        if (SongPlayer::isValidName(name.c_str()) && !playing && LittleFS.remove(String(PLAYER_SONG_DIR "/") + name)) {
+            request->send(200, "application/json", "{\"success\":true}");
+        } else {
+            request->send(404, "application/json", "{\"error\":\"No such song or still playing\"}");
+        }
+    });
+
+    server.on("/api/songs", HTTP_GET, [](AsyncWebServerRequest* request) {
+        JsonDocument doc;
+        JsonArray songs = doc["songs"].to<JsonArray>();
+        const char* const dirs[] = {PLAYER_SONG_DIR, PLAYER_BUILTIN_DIR};
+        for (uint8_t d = 0; d < 2; d++) {
+            File dir = LittleFS.open(dirs[d]);
+            if (!dir || !dir.isDirectory()) continue;
+            for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+                if (file.isDirectory() || file.name()[0] == '.') continue;
+                JsonObject song = songs.add<JsonObject>();
+                song["filename"] = file.name();
+                song["size"] = (uint32_t)file.size();
+                song["builtin"] = d == 1;
+            }
+        }
+        doc["fs_total"] = (uint32_t)LittleFS.totalBytes();
+        doc["fs_used"] = (uint32_t)LittleFS.usedBytes();
 
         String json;
         serializeJson(doc, json);
@@ -673,81 +692,242 @@ void setup() {
     });
 
     server.begin();
-    Serial.println("OK");
-
-    // 7. USB Host
-    Serial.print("7. USB Host... ");
-    const usb_host_config_t hostConfig = {
-        .skip_phy_setup = false,
-        .intr_flags = ESP_INTR_FLAG_LEVEL1,
-    };
+}
 
-    esp_err_t err = usb_host_install(&hostConfig);
-    if (err != ESP_OK) {
-        Serial.printf("FAIL (%d)\n", err);
-    } else {
-        const usb_host_client_config_t clientConfig = {
-            .is_synchronous = false,
-            .max_num_event_msg = 5,
-            .async = {
-                .client_event_callback = usbClientCallback,
-                .callback_arg = nullptr
-            }
-        };
+// Everything the piano does not need to light keys. Runs while the USB
+// and render tasks already play, then deletes itself.
+void networkBootTask(void* arg) {
+    // NimBLE (init only)
+    NimBLEDevice::init("Pianora");
 
-        err = usb_host_client_register(&clientConfig, &usbClientHandle);
-        if (err != ESP_OK) {
-            Serial.printf("FAIL client (%d)\n", err);
-        } else {
-            Serial.println("OK");
+    if (!LittleFS.begin(false)) {
+        LOG_W("LittleFS: Mount failed, formatting");
+        if (!LittleFS.begin(true)) {
+            LOG_E("LittleFS: FAIL even after format");
         }
     }
+    bootTimeline->mark(BOOT_FS);
 
-    // Startup animation (ends with blackout)
-    ledController->playStartupAnimation();
-
-    Serial.println("\n========================================");
-    Serial.println("  READY!");
-    if (wifiIsAP) {
-        Serial.printf("  WiFi AP: %s / %s\n", WIFI_AP_SSID, WIFI_AP_PASSWORD);
-        Serial.printf("  Web: http://%s\n", WiFi.softAPIP().toString().c_str());
-    } else {
-        Serial.printf("  WiFi: Connected to %s\n", WIFI_STA_SSID);
-        Serial.printf("  Web: http://%s\n", WiFi.localIP().toString().c_str());
+    // Stored key map - the factory table lights keys until now
+    if (calibration->begin()) {
+        LOG_I("Calibration: stored map loaded");
     }
-    Serial.printf("  LEDs: %d\n", NUM_LEDS);
-    Serial.printf("  Free Heap: %u\n", ESP.getFreeHeap());
-    Serial.println("========================================\n");
+    if (!recorder->begin()) {
+        LOG_E("Recorder: FAIL");
+    }
+    if (!songPlayer->begin()) {
+        LOG_E("Song player: FAIL");
+    }
+
+    connectWiFi();
+    bootTimeline->mark(BOOT_WIFI);
+
+    startWebServer();
+    networkReady = true;
+    bootTimeline->mark(BOOT_WEB);
+
+    LOG_I("Network ready in %u ms", bootTimeline->getUs(BOOT_WEB) / 1000);
+    sendStatusToClients();
+
+    vTaskDelete(nullptr);
 }
 
-// ============== Loop ==============
+// ============== Tasks ==============
 
-void loop() {
+// Called from command handlers; the chores tick reboots once the deadline passed
+void requestRestart(uint32_t delayMs) {
+    LOG_W("Restart in %u ms", delayMs);
+    restartAtMs = max(millis() + delayMs, 1UL);     // 0 means none
+}
+
+// Periodic work that used to run every loop() pass
+void runHousekeepingChores() {
+    static uint32_t lastRateMs = 0;
+    static uint32_t lastPushed = 0;
     static uint32_t lastPrint = 0;
 
-    // USB Host task
-    if (usbClientHandle != nullptr) {
-        uint32_t eventFlags;
-        usb_host_lib_handle_events(0, &eventFlags);
-        usb_host_client_handle_events(usbClientHandle, 0);
+    ws.cleanupClients();
+
+    if (millis() - lastRateMs >= 1000) {
+        lastRateMs = millis();
+        uint32_t pushed = midiEvents->getPushed();
+        midiEventsPerSecond.set(pushed - lastPushed);
+        lastPushed = pushed;
     }
 
-    // LED Controller update (for fading, animations, etc.)
-    if (ledController) {
-        ledController->update();
+    if (calibration && calibration->poll()) {
+        sendCalibrationStep();
     }
 
-    // WebSocket cleanup
-    ws.cleanupClients();
+    // Song ended (or could not be read) - the app shows the player state
+    if (songPlayer && songPlayer->poll()) {
+        sendStatusToClients();
+    }
+
+    if (restartAtMs && (int32_t)(millis() - restartAtMs) >= 0) {
+        ESP.restart();
+    }
 
-    // Status print
     if (millis() - lastPrint >= 10000) {
         lastPrint = millis();
-        Serial.printf("Uptime: %lus | Heap: %u | USB: %s\n",
+        LOG_I("Uptime: %lus | Heap: %u | USB: %s",
             millis() / 1000,
             ESP.getFreeHeap(),
-            usbMidiReady ? "Ready" : "No");
+            usbMidi->isReady() ? "Ready" : "No");
     }
+}
+
+// Hotkey, lesson, game, network and recording stages plus chores. Sleeps until the USB callback
+// pushes events, the note batch is due or the next chores tick.
+void housekeepingTask(void* arg) {
+    const uint32_t intervalUs = HOUSEKEEPING_INTERVAL_MS * 1000;
+    uint32_t nextTickUs = micros() + intervalUs;
+
+    for (;;) {
+        uint32_t nowUs = micros();
+        int32_t untilTick = (int32_t)(nextTickUs - nowUs);
+        uint32_t waitUs = untilTick > 0 ? (uint32_t)untilTick : 0;
+        if (noteStream) waitUs = min(waitUs, noteStream->getFlushDelayUs());
+        // Round up so we never wake just before the deadline
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((waitUs + 999) / 1000));
+
+        processHotkeyEvents();
+        processLessonEvents();
+        processGameEvents();
+        processNetworkEvents();
+        processRecorderEvents();
+
+        nowUs = micros();
+        if ((int32_t)(nowUs - nextTickUs) >= 0) {
+            housekeepingJitter.observe(nowUs - nextTickUs);
+            nextTickUs = nowUs + intervalUs;
+            runHousekeepingChores();
+        }
+    }
+}
+
+// ============== Setup ==============
+
+void setup() {
+    Serial.begin(115200);
+
+    // MIDI-critical path first (strip, USB host, render task); WiFi, LittleFS
+    // and the web server come up in the background afterwards
+    bootTimeline = new BootTimeline();
+    bootTimeline->mark(BOOT_SETUP);
+
+    // Log ring first - anything logged before the drain task starts is kept
+    logRing = new LogRing();
+
+    Serial.println("\n\n========================================");
+    Serial.printf("  Pianora TEST 11 - Full Features\n");
+    Serial.println("========================================\n");
+
+    // MIDI event ring - must exist before the USB host can deliver anything
+    midiEvents = new MidiEventRing();
+    midiEvents->attach(hotkeyReader);
+    midiEvents->attach(networkReader);
 
-    delay(5);
+    // 1. LED Controller - strip layout from NVS, the single default strip if none is stored
+    Serial.print("1. LED Controller... ");
+    LedLayout layout;
+    bool storedLayout = loadLedLayout(layout);
+    ledController = new LEDController();
+    ledController->begin(layout);
+    bootTimeline->mark(BOOT_LEDS);
+    Serial.printf("OK (%u LEDs on %u segments%s)\n", ledController->getLedCount(),
+                  ledController->getLayout().segmentCount, storedLayout ? "" : ", default layout");
+    PowerConfig power;
+    loadPowerConfig(power, ledController->getLayout());
+    ledController->setPowerConfig(power);
+
+    // 2. Hotkey Handler
+    Serial.print("2. Hotkey Handler... ");
+    hotkeyHandler = new HotkeyHandler();
+    Serial.println("OK");
+
+    // Key map calibration - the stored map is loaded once LittleFS is mounted
+    calibration = new Calibration();
+
+    // Recorder - can start once LittleFS is mounted
+    recorder = new Recorder();
+
+    // Song player - the same
+    songPlayer = new SongPlayer();
+
+    // Learning mode lessons, followed on the housekeeping task
+    lessonFollower = new LessonFollower();
+
+    // Game mode - judged and drawn in the render task
+    gameEngine = new GameEngine();
+
+    // 3. USB Host
+    Serial.print("3. USB Host... ");
+    usbMidi = new USBMidiHost();
+    usbMidi->setConnectionCallback(onUsbMidiConnection);
+    usbMidi->setEventsCallback(onUsbMidiEvents);
+    if (usbMidi->begin(USB_MIDI_IN_TRANSFERS)) {
+        bootTimeline->mark(BOOT_USB_HOST);
+        Serial.printf("OK (%d IN transfers)\n", usbMidi->getInTransferCount());
+    } else {
+        Serial.println("FAIL");
+    }
+
+    // 4. Render task - owns the strip from here on. The boot animation runs
+    // inside the frame loop and ends early on the first note.
+    Serial.print("4. Render Task... ");
+    ledController->startBootAnimation();
+    renderTask = new RenderTask(ledController);
+    renderTask->setFrameHook(GameEngine::frameEntry, gameEngine);
+    if (renderTask->begin(RENDER_DEFAULT_FPS)) {
+        bootTimeline->mark(BOOT_RENDER);
+        Serial.printf("OK (%d fps, core %d)\n", renderTask->getFrameRate(), RENDER_TASK_CORE);
+    } else {
+        Serial.println("FAIL");
+    }
+
+    // WebSocket handlers - the server itself starts with the network
+    noteStream = new WsNoteStream(&ws);
+    wsCommands = new WsCommandDispatcher();
+    wsCommands->begin();
+
+    // Hotkey, lesson, game, network and recording stages
+    if (xTaskCreatePinnedToCore(housekeepingTask, "housekeeping", HOUSEKEEPING_TASK_STACK, nullptr,
+                                HOUSEKEEPING_TASK_PRIORITY, &housekeepingTaskHandle,
+                                HOUSEKEEPING_TASK_CORE) != pdPASS) {
+        Serial.println("Housekeeping task FAIL");
+    }
+
+    // 5. Metrics - every module they read exists by now
+    metrics = new MetricsRegistry();
+    registerMetrics();
+    Serial.printf("5. Metrics... OK (%d)\n", metrics->getCount());
+
+    // 6. Network in the background
+    Serial.print("6. Network task... ");
+    if (xTaskCreatePinnedToCore(networkBootTask, "net_boot", NET_BOOT_TASK_STACK, nullptr,
+                                NET_BOOT_TASK_PRIORITY, nullptr, NET_BOOT_TASK_CORE) == pdPASS) {
+        Serial.println("started");
+    } else {
+        Serial.println("FAIL");
+    }
+
+    Serial.println("\n========================================");
+    Serial.printf("  MIDI READY in %u ms\n", bootTimeline->getUs(BOOT_RENDER) / 1000);
+    Serial.printf("  LEDs: %u\n", ledController->getLedCount());
+    Serial.printf("  Free Heap: %u\n", ESP.getFreeHeap());
+    Serial.println("  WiFi + web server starting in background");
+    Serial.println("========================================\n");
+
+    // Runtime messages go through the log ring from here on
+    if (!logRing->startDrain()) {
+        Serial.println("Log task FAIL");
+    }
+}
+
+// ============== Loop ==============
+
+// All work runs in the tasks above; free the Arduino loop task's stack
+void loop() {
+    vTaskDelete(nullptr);
 }
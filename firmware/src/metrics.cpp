@@ -0,0 +1,170 @@
+#include "metrics.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+MetricsRegistry* metrics = nullptr;
+
+// ============== Histogram ==============
+
+MetricHistogram::MetricHistogram(const uint32_t* bounds, uint8_t boundCount)
+    : _bounds(bounds)
+    , _boundCount(min(boundCount, (uint8_t)METRICS_MAX_BUCKETS))
+    , _mux(portMUX_INITIALIZER_UNLOCKED)
+    , _sum(0)
+    , _count(0)
+    , _max(0)
+{
+    memset(_buckets, 0, sizeof(_buckets));
+}
+
+void MetricHistogram::observe(uint32_t value) {
+    // Few buckets - a linear scan beats a binary search here
+    uint8_t i = 0;
+    while (i < _boundCount && value > _bounds[i]) i++;
+
+    portENTER_CRITICAL_SAFE(&_mux);
+    _buckets[i]++;
+    _sum += value;
+    _count++;
+    if (value > _max) _max = value;
+    portEXIT_CRITICAL_SAFE(&_mux);
+}
+
+void MetricHistogram::reset() {
+    portENTER_CRITICAL_SAFE(&_mux);
+    memset(_buckets, 0, sizeof(_buckets));
+    _sum = 0;
+    _count = 0;
+    _max = 0;
+    portEXIT_CRITICAL_SAFE(&_mux);
+}
+
+void MetricHistogram::snapshot(Snapshot& out) const {
+    memset(&out, 0, sizeof(out));
+    portENTER_CRITICAL_SAFE(&_mux);
+    memcpy(out.buckets, _buckets, (_boundCount + 1) * sizeof(uint32_t));
+    out.sum = _sum;
+    out.count = _count;
+    out.max = _max;
+    portEXIT_CRITICAL_SAFE(&_mux);
+}
+
+uint32_t MetricHistogram::quantile(const Snapshot& snap, uint16_t permille) const {
+    if (snap.count == 0) return 0;
+
+    // Rank of the wanted sample, 1-based
+    uint32_t rank = (uint32_t)(((uint64_t)snap.count * permille + 999) / 1000);
+    if (rank == 0) rank = 1;
+
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b <= _boundCount; b++) {
+        if (seen + snap.buckets[b] < rank) {
+            seen += snap.buckets[b];
+            continue;
+        }
+        if (b == _boundCount) return snap.max;     // +Inf bucket: only the max is known
+
+        uint32_t lower = b == 0 ? 0 : _bounds[b - 1];
+        uint32_t upper = _bounds[b];
+        uint32_t value = lower + (uint32_t)((uint64_t)(upper - lower) * (rank - seen) / snap.buckets[b]);
+        return min(value, snap.max);
+    }
+    return snap.max;
+}
+
+// ============== Registry ==============
+
+MetricsRegistry::MetricsRegistry()
+    : _count(0)
+{
+    memset(_entries, 0, sizeof(_entries));
+}
+
+MetricsRegistry::Entry* MetricsRegistry::add(const char* name, const char* help, MetricType type) {
+    if (_count >= METRICS_MAX_ENTRIES) return nullptr;
+    Entry* entry = &_entries[_count++];
+    entry->name = name;
+    entry->help = help;
+    entry->type = type;
+    return entry;
+}
+
+bool MetricsRegistry::addCounter(const char* name, const char* help, const MetricCounter* counter) {
+    Entry* entry = add(name, help, METRIC_COUNTER);
+    if (entry) entry->counter = counter;
+    return entry != nullptr;
+}
+
+bool MetricsRegistry::addCounter(const char* name, const char* help, MetricReader read) {
+    Entry* entry = add(name, help, METRIC_COUNTER);
+    if (entry) entry->read = read;
+    return entry != nullptr;
+}
+
+bool MetricsRegistry::addGauge(const char* name, const char* help, const MetricGauge* gauge) {
+    Entry* entry = add(name, help, METRIC_GAUGE);
+    if (entry) entry->gauge = gauge;
+    return entry != nullptr;
+}
+
+bool MetricsRegistry::addGauge(const char* name, const char* help, MetricReader read) {
+    Entry* entry = add(name, help, METRIC_GAUGE);
+    if (entry) entry->read = read;
+    return entry != nullptr;
+}
+
+bool MetricsRegistry::addHistogram(const char* name, const char* help, const MetricHistogram* histogram) {
+    Entry* entry = add(name, help, METRIC_HISTOGRAM);
+    if (entry) entry->histogram = histogram;
+    return entry != nullptr;
+}
+
+bool MetricsRegistry::addCollector(const char* name, const char* help, MetricType type, MetricCollector collect) {
+    Entry* entry = add(name, help, type);
+    if (entry) entry->collect = collect;
+    return entry != nullptr;
+}
+
+uint8_t MetricsRegistry::getCount() const {
+    return _count;
+}
+
+// ============== Exposition ==============
+
+void MetricsRegistry::write(Print& out) const {
+    static const char* TYPES[] = { "counter", "gauge", "histogram" };
+
+    for (uint8_t i = 0; i < _count; i++) {
+        const Entry& e = _entries[i];
+        out.printf("# HELP %s %s\n", e.name, e.help);
+        out.printf("# TYPE %s %s\n", e.name, TYPES[e.type]);
+
+        if (e.collect) {
+            e.collect(out, e.name);
+        } else if (e.histogram) {
+            writeHistogram(out, e.name, *e.histogram);
+        } else if (e.counter) {
+            out.printf("%s %u\n", e.name, e.counter->get());
+        } else if (e.gauge) {
+            out.printf("%s %u\n", e.name, e.gauge->get());
+        } else if (e.read) {
+            out.printf("%s %u\n", e.name, e.read());
+        }
+    }
+}
+
+void MetricsRegistry::writeHistogram(Print& out, const char* name, const MetricHistogram& histogram) {
+    MetricHistogram::Snapshot snap;
+    histogram.snapshot(snap);
+
+    // Prometheus buckets are cumulative
+    uint32_t cumulative = 0;
+    const uint32_t* bounds = histogram.getBounds();
+    for (uint8_t b = 0; b < histogram.getBoundCount(); b++) {
+        cumulative += snap.buckets[b];
+        out.printf("%s_bucket{le=\"%u\"} %u\n", name, bounds[b], cumulative);
+    }
+    cumulative += snap.buckets[histogram.getBoundCount()];
+    out.printf("%s_bucket{le=\"+Inf\"} %u\n", name, cumulative);
+    out.printf("%s_sum %llu\n", name, (unsigned long long)snap.sum);
+    out.printf("%s_count %u\n", name, snap.count);
+}
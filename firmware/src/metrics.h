@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include "config.h"
+
+// Monotonic event counter. A relaxed atomic add - safe from the USB
+// transfer callback and any task.
+class MetricCounter {
+public:
+    MetricCounter() : _value(0) {}
+
+    void inc(uint32_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> _value;
+};
+
+// Last written value
+class MetricGauge {
+public:
+    MetricGauge() : _value(0) {}
+
+    void set(uint32_t value) { _value.store(value, std::memory_order_relaxed); }
+    uint32_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> _value;
+};
+
+// Fixed-bucket histogram. Bounds are inclusive upper edges in ascending
+// order; values above the last bound land in the +Inf bucket. observe()
+// takes a short spinlock so sum/max stay consistent with the buckets.
+class MetricHistogram {
+public:
+    struct Snapshot {
+        uint32_t buckets[METRICS_MAX_BUCKETS + 1];  // Not cumulative, +Inf last
+        uint64_t sum;
+        uint32_t count;
+        uint32_t max;
+    };
+
+    MetricHistogram(const uint32_t* bounds, uint8_t boundCount);
+
+    void observe(uint32_t value);
+    void reset();
+    void snapshot(Snapshot& out) const;
+
+    // Estimated value below which permille/1000 of the samples fall,
+    // interpolated inside the bucket and capped at the recorded max
+    uint32_t quantile(const Snapshot& snap, uint16_t permille) const;
+
+    const uint32_t* getBounds() const { return _bounds; }
+    uint8_t getBoundCount() const { return _boundCount; }
+
+private:
+    const uint32_t* _bounds;
+    uint8_t _boundCount;
+    mutable portMUX_TYPE _mux;
+    uint32_t _buckets[METRICS_MAX_BUCKETS + 1];
+    uint64_t _sum;
+    uint32_t _count;
+    uint32_t _max;
+};
+
+// Value read when the metrics are scraped (heap, task statistics ...)
+typedef uint32_t (*MetricReader)();
+
+// Writes the samples of a labelled family, e.g. one line per WS client
+typedef void (*MetricCollector)(Print& out, const char* name);
+
+enum MetricType : uint8_t {
+    METRIC_COUNTER = 0,
+    METRIC_GAUGE = 1,
+    METRIC_HISTOGRAM = 2
+};
+
+// Named metrics exposed at /api/metrics in the Prometheus text format.
+// Registration happens once in setup(); the metrics themselves are owned
+// by the modules that update them.
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+
+    bool addCounter(const char* name, const char* help, const MetricCounter* counter);
+    bool addCounter(const char* name, const char* help, MetricReader read);
+    bool addGauge(const char* name, const char* help, const MetricGauge* gauge);
+    bool addGauge(const char* name, const char* help, MetricReader read);
+    bool addHistogram(const char* name, const char* help, const MetricHistogram* histogram);
+    bool addCollector(const char* name, const char* help, MetricType type, MetricCollector collect);
+
+    void write(Print& out) const;
+
+    uint8_t getCount() const;
+
+private:
+    struct Entry {
+        const char* name;
+        const char* help;
+        MetricType type;
+        const MetricCounter* counter;
+        const MetricGauge* gauge;
+        const MetricHistogram* histogram;
+        MetricReader read;
+        MetricCollector collect;
+    };
+
+    Entry _entries[METRICS_MAX_ENTRIES];
+    uint8_t _count;
+
+    Entry* add(const char* name, const char* help, MetricType type);
+    static void writeHistogram(Print& out, const char* name, const MetricHistogram& histogram);
+};
+
+extern MetricsRegistry* metrics;
+
+#endif // METRICS_H
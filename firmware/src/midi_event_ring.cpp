@@ -0,0 +1,90 @@
+#include "midi_event_ring.h"
+#include <esp_timer.h>
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+MidiEventRing* midiEvents = nullptr;
+
+MidiEventRing::MidiEventRing() : _head(0) {
+    for (uint32_t i = 0; i < MIDI_EVENT_RING_SIZE; i++) {
+        _slots[i].seq.store(0, std::memory_order_relaxed);
+        _slots[i].time.store(0, std::memory_order_relaxed);
+        _slots[i].packed.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t MidiEventRing::now() {
+    return (uint32_t)esp_timer_get_time();
+}
+
+void MidiEventRing::push(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2) {
+    MidiEvent ev = { now(), source, status, data1, data2 };
+    push(ev);
+}
+
+void MidiEventRing::push(const MidiEvent& ev) {
+    // Reserve a slot; fetch_add keeps this lock-free with several producers
+    uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[index & MASK];
+
+    // Mark the slot as being written, then publish with index + 1
+    slot.seq.store(index, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(ev.timeUs, std::memory_order_relaxed);
+    slot.packed.store((uint32_t)ev.source
+                      | ((uint32_t)ev.status << 8)
+                      | ((uint32_t)ev.data1 << 16)
+                      | ((uint32_t)ev.data2 << 24),
+                      std::memory_order_relaxed);
+    slot.seq.store(index + 1, std::memory_order_release);
+}
+
+void MidiEventRing::attach(Reader& reader) const {
+    reader._tail = _head.load(std::memory_order_acquire);
+    reader._overruns = 0;
+}
+
+bool MidiEventRing::pop(Reader& reader, MidiEvent& ev) const {
+    for (;;) {
+        uint32_t tail = reader._tail;
+        const Slot& slot = _slots[tail & MASK];
+
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == tail + 1) {
+            uint32_t time = slot.time.load(std::memory_order_relaxed);
+            uint32_t packed = slot.packed.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq) {
+                ev.timeUs = time;
+                ev.source = packed & 0xFF;
+                ev.status = (packed >> 8) & 0xFF;
+                ev.data1 = (packed >> 16) & 0xFF;
+                ev.data2 = (packed >> 24) & 0xFF;
+                reader._tail = tail + 1;
+                return true;
+            }
+            // Overwritten while we were copying - fall through and resync
+        }
+
+        uint32_t head = _head.load(std::memory_order_acquire);
+        uint32_t behind = head - tail;
+        if (behind == 0 || behind > 0x80000000UL) {
+            return false;   // Nothing new
+        }
+        if (behind <= MIDI_EVENT_RING_SIZE) {
+            return false;   // Reserved but not yet published - try next time
+        }
+
+        // Lapped by the producer: skip to the oldest event still in the ring
+        reader._overruns += behind - MIDI_EVENT_RING_SIZE;
+        reader._tail = head - MIDI_EVENT_RING_SIZE;
+    }
+}
+
+uint32_t MidiEventRing::pending(const Reader& reader) const {
+    uint32_t behind = _head.load(std::memory_order_acquire) - reader._tail;
+    return behind > MIDI_EVENT_RING_SIZE ? MIDI_EVENT_RING_SIZE : behind;
+}
+
+uint32_t MidiEventRing::getPushed() const {
+    return _head.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,81 @@
+#ifndef MIDI_EVENT_RING_H
+#define MIDI_EVENT_RING_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+// Where an event entered the firmware
+enum MidiSource : uint8_t {
+    MIDI_SOURCE_USB = 0,    // USB host transfer callback
+    MIDI_SOURCE_BLE = 1,    // BLE MIDI (reserved)
+    MIDI_SOURCE_APP = 2     // play_note from the app
+};
+
+// Compact MIDI event as it travels between pipeline stages (8 bytes)
+struct MidiEvent {
+    uint32_t timeUs;    // esp_timer timestamp, low 32 bits (wraps every ~71 min)
+    uint8_t source;     // MidiSource
+    uint8_t status;     // MIDI status byte, channel in low nibble
+    uint8_t data1;      // Note / controller number
+    uint8_t data2;      // Velocity / value
+
+    uint8_t type() const { return status & 0xF0; }
+    bool isNoteOn() const { return type() == 0x90 && data2 > 0; }
+    bool isNoteOff() const { return type() == 0x80 || (type() == 0x90 && data2 == 0); }
+};
+
+static_assert(sizeof(MidiEvent) == 8, "MidiEvent must stay 8 bytes");
+static_assert((MIDI_EVENT_RING_SIZE & (MIDI_EVENT_RING_SIZE - 1)) == 0,
+              "MIDI_EVENT_RING_SIZE must be a power of two");
+
+// Lock-free broadcast ring between the USB callback and the pipeline stages.
+//
+// push() never blocks and never fails: when a consumer falls a full ring
+// behind, the oldest events are overwritten and that consumer's overrun
+// counter grows. Every consumer owns a Reader and drains at its own pace;
+// reading does not remove the event for the others. Slots are guarded by a
+// sequence number so a reader can detect an event being overwritten under it.
+class MidiEventRing {
+public:
+    class Reader {
+    public:
+        Reader() : _tail(0), _overruns(0) {}
+        uint32_t getOverruns() const { return _overruns; }
+
+    private:
+        friend class MidiEventRing;
+        uint32_t _tail;
+        uint32_t _overruns;
+    };
+
+    MidiEventRing();
+
+    // Producer side - safe from the USB callback and from other tasks
+    void push(const MidiEvent& ev);
+    void push(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2);
+
+    // Consumer side - each Reader must only be used from one task
+    void attach(Reader& reader) const;      // Start at the current head
+    bool pop(Reader& reader, MidiEvent& ev) const;
+    uint32_t pending(const Reader& reader) const;
+
+    uint32_t getPushed() const;
+    static uint32_t now();                  // Timestamp in event units (us)
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;          // Index + 1 when valid, index while writing
+        std::atomic<uint32_t> time;
+        std::atomic<uint32_t> packed;       // source | status << 8 | data1 << 16 | data2 << 24
+    };
+
+    static const uint32_t MASK = MIDI_EVENT_RING_SIZE - 1;
+
+    Slot _slots[MIDI_EVENT_RING_SIZE];
+    std::atomic<uint32_t> _head;
+};
+
+extern MidiEventRing* midiEvents;
+
+#endif // MIDI_EVENT_RING_H
@@ -0,0 +1,51 @@
+#ifndef NOTE_SET_H
+#define NOTE_SET_H
+
+#include <Arduino.h>
+
+// Set of MIDI notes 0-127 as 128 bits: O(1) membership, 16 bytes to copy.
+// Iterate with: for (int16_t n = set.next(0); n >= 0; n = set.next(n + 1))
+struct NoteSet {
+    uint32_t bits[4];
+
+    void clear() {
+        bits[0] = bits[1] = bits[2] = bits[3] = 0;
+    }
+
+    void add(uint8_t note) {
+        bits[(note >> 5) & 3] |= 1u << (note & 31);
+    }
+
+    void remove(uint8_t note) {
+        bits[(note >> 5) & 3] &= ~(1u << (note & 31));
+    }
+
+    void merge(const NoteSet& other) {
+        for (uint8_t i = 0; i < 4; i++) bits[i] |= other.bits[i];
+    }
+
+    bool contains(uint8_t note) const {
+        return (bits[(note >> 5) & 3] >> (note & 31)) & 1;
+    }
+
+    bool isEmpty() const {
+        return (bits[0] | bits[1] | bits[2] | bits[3]) == 0;
+    }
+
+    uint8_t count() const {
+        return __builtin_popcount(bits[0]) + __builtin_popcount(bits[1])
+             + __builtin_popcount(bits[2]) + __builtin_popcount(bits[3]);
+    }
+
+    // Lowest note >= from, -1 if none
+    int16_t next(uint8_t from) const {
+        for (uint8_t word = from >> 5; word < 4; word++) {
+            uint32_t rest = bits[word];
+            if (word == from >> 5) rest &= ~0u << (from & 31);
+            if (rest) return word * 32 + __builtin_ctz(rest);
+        }
+        return -1;
+    }
+};
+
+#endif // NOTE_SET_H
@@ -0,0 +1,137 @@
+#include "output_stage.h"
+#include <math.h>
+
+// Odd step between the dither offsets of neighbouring pixels - any odd
+// value gives 256 pixels 256 different offsets
+static const uint8_t DITHER_PIXEL_STEP = 0x9D;
+
+static uint8_t reverseBits(uint8_t b) {
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+OutputStage::OutputStage()
+    : _brightness(LED_BRIGHTNESS)
+    , _gamma(OUTPUT_DEFAULT_GAMMA)
+    , _whiteBalance(OUTPUT_DEFAULT_WHITE_R, OUTPUT_DEFAULT_WHITE_G, OUTPUT_DEFAULT_WHITE_B)
+    , _dither(OUTPUT_DEFAULT_DITHER)
+    , _stale(true)
+    , _ditherFrame(0)
+    , _rebuilds(0)
+{
+}
+
+// ============== Settings ==============
+
+bool OutputStage::setBrightness(uint8_t brightness) {
+    if (brightness == _brightness) return false;
+    _brightness = brightness;
+    _stale = true;
+    return true;
+}
+
+bool OutputStage::setGamma(float gamma) {
+    gamma = constrain(gamma, OUTPUT_MIN_GAMMA, OUTPUT_MAX_GAMMA);
+    if (gamma == _gamma) return false;
+    _gamma = gamma;
+    _stale = true;
+    return true;
+}
+
+bool OutputStage::setWhiteBalance(const CRGB& balance) {
+    if (balance == _whiteBalance) return false;
+    _whiteBalance = balance;
+    _stale = true;
+    return true;
+}
+
+uint8_t OutputStage::getBrightness() const {
+    return _brightness;
+}
+
+float OutputStage::getGamma() const {
+    return _gamma;
+}
+
+const CRGB& OutputStage::getWhiteBalance() const {
+    return _whiteBalance;
+}
+
+void OutputStage::setDither(bool enabled) {
+    _dither = enabled;
+}
+
+bool OutputStage::isDithering() const {
+    return _dither;
+}
+
+uint32_t OutputStage::getRebuildCount() const {
+    return _rebuilds;
+}
+
+// ============== Tables ==============
+
+void OutputStage::rebuild() {
+    _stale = false;
+    _rebuilds++;
+
+    // Brightness 0 is off, not a fraction the dither could round up
+    if (_brightness == 0) {
+        memset(_lut, 0, sizeof(_lut));
+        return;
+    }
+
+    for (uint16_t v = 0; v < 256; v++) {
+        // Gamma curve in 8.8, then the same (x * (s + 1)) >> 8 scaling as
+        // scale8 for white balance and brightness
+        uint32_t base = _gamma == 1.0f ? v << 8
+                      : (uint32_t)(powf(v / 255.0f, _gamma) * 65280.0f + 0.5f);
+        for (uint8_t ch = 0; ch < 3; ch++) {
+            uint32_t x = (base * (_whiteBalance.raw[ch] + 1)) >> 8;
+            _lut[ch][v] = (x * (_brightness + 1)) >> 8;
+        }
+    }
+}
+
+// ============== Apply ==============
+
+void OutputStage::apply(const CRGB* in, CRGB* out, uint16_t first, uint16_t last) {
+    if (_stale) rebuild();
+
+    const uint16_t* lr = _lut[0];
+    const uint16_t* lg = _lut[1];
+    const uint16_t* lb = _lut[2];
+    for (uint16_t i = first; i <= last; i++) {
+        out[i].r = lr[in[i].r] >> 8;
+        out[i].g = lg[in[i].g] >> 8;
+        out[i].b = lb[in[i].b] >> 8;
+    }
+}
+
+bool OutputStage::applyDithered(const CRGB* in, CRGB* out, uint16_t count) {
+    if (_stale) rebuild();
+
+    const uint16_t* lr = _lut[0];
+    const uint16_t* lg = _lut[1];
+    const uint16_t* lb = _lut[2];
+    uint8_t phase = reverseBits(_ditherFrame++);
+    uint8_t offset = 0;
+    uint16_t fractions = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t r = lr[in[i].r];
+        uint16_t g = lg[in[i].g];
+        uint16_t b = lb[in[i].b];
+        fractions |= r | g | b;
+
+        // Entries top out at 255 << 8, so adding a byte never overflows
+        uint8_t threshold = phase ^ offset;
+        offset += DITHER_PIXEL_STEP;
+        out[i].r = (r + threshold) >> 8;
+        out[i].g = (g + threshold) >> 8;
+        out[i].b = (b + threshold) >> 8;
+    }
+    return (fractions & 0xFF) != 0;
+}
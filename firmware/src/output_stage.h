@@ -0,0 +1,60 @@
+#ifndef OUTPUT_STAGE_H
+#define OUTPUT_STAGE_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include "config.h"
+
+// Last step before the wire: gamma, white balance and global brightness
+// folded into one 256-entry table per channel.
+//
+// Entries are 8.8 fixed point. Without dithering a channel is the high
+// byte of its entry - one lookup, no math. With dithering a threshold is
+// added first that walks through all 256 values over 256 frames (bit
+// reversed, so every short run of frames is spread evenly) and is offset
+// per pixel so neighbours do not blink together. The fraction then shows
+// up as the share of frames that round up, which restores the levels low
+// brightness loses. Worth it at RENDER_MAX_FPS-ish rates only; at 60 fps
+// the slow bits flicker.
+//
+// Tables are rebuilt lazily, only after brightness, gamma or white
+// balance changed. With gamma 1.0 and white balance 255 the result is
+// exactly FastLED's own brightness scaling (scale8).
+class OutputStage {
+public:
+    OutputStage();
+
+    // Each returns true if the tables change (the whole strip must be re-sent)
+    bool setBrightness(uint8_t brightness);
+    bool setGamma(float gamma);                 // Clamped to OUTPUT_MIN_GAMMA..OUTPUT_MAX_GAMMA
+    bool setWhiteBalance(const CRGB& balance);  // Channel scale, 255 = full
+    uint8_t getBrightness() const;
+    float getGamma() const;
+    const CRGB& getWhiteBalance() const;
+
+    void setDither(bool enabled);
+    bool isDithering() const;
+
+    // out[first..last] = LUT(in[first..last])
+    void apply(const CRGB* in, CRGB* out, uint16_t first, uint16_t last);
+
+    // out[0..count) dithered with the next frame's threshold. Returns true
+    // if any channel had a fraction, i.e. the next frame will differ.
+    bool applyDithered(const CRGB* in, CRGB* out, uint16_t count);
+
+    uint32_t getRebuildCount() const;
+
+private:
+    uint16_t _lut[3][256];      // Per channel, 8.8 fixed point
+    uint8_t _brightness;
+    float _gamma;
+    CRGB _whiteBalance;
+    bool _dither;
+    bool _stale;                // Tables need rebuilding before the next apply
+    uint8_t _ditherFrame;
+    uint32_t _rebuilds;
+
+    void rebuild();
+};
+
+#endif // OUTPUT_STAGE_H
@@ -0,0 +1,196 @@
+#include "pixel_kernels.h"
+
+// ============== Word Helpers ==============
+
+static const uint32_t EVEN_BYTES = 0x00FF00FF;
+static const uint32_t HIGH_BITS = 0x80808080;
+
+static inline bool isAligned(const void* p) {
+    return ((uintptr_t)p & 3) == 0;
+}
+
+// memcpy keeps the compiler's aliasing rules happy and still becomes one l32i/s32i
+static inline uint32_t loadWord(const uint8_t* p) {
+    uint32_t w;
+    memcpy(&w, __builtin_assume_aligned(p, 4), sizeof(w));
+    return w;
+}
+
+static inline void storeWord(uint8_t* p, uint32_t w) {
+    memcpy(__builtin_assume_aligned(p, 4), &w, sizeof(w));
+}
+
+// (byte * factor) >> 8 in every byte, factor 0..256. Two bytes per 16-bit
+// lane: 255 * 256 still fits, so lanes never carry into each other.
+static inline uint32_t scaleWord(uint32_t w, uint32_t factor) {
+    uint32_t even = (((w & EVEN_BYTES) * factor) >> 8) & EVEN_BYTES;
+    uint32_t odd = (((w >> 8) & EVEN_BYTES) * factor) & ~EVEN_BYTES;
+    return even | odd;
+}
+
+// (a * fa + b * fb) >> 8 in every byte with fa + fb = 257 (blend8); the
+// b products come premultiplied since they are often constant
+static inline uint32_t blendWord(uint32_t a, uint32_t fa, uint32_t bEven, uint32_t bOdd) {
+    uint32_t even = (((a & EVEN_BYTES) * fa + bEven) >> 8) & EVEN_BYTES;
+    uint32_t odd = (((a >> 8) & EVEN_BYTES) * fa + bOdd) & ~EVEN_BYTES;
+    return even | odd;
+}
+
+// qadd8 in every byte: add the low 7 bits, then saturate the bytes that
+// carried out of bit 7
+static inline uint32_t addWord(uint32_t a, uint32_t b) {
+    uint32_t sum = (a & ~HIGH_BITS) + (b & ~HIGH_BITS);
+    uint32_t carry = ((a & b) | ((a | b) & sum)) & HIGH_BITS;
+    return (sum ^ ((a ^ b) & HIGH_BITS)) | ((carry >> 7) * 0xFF);
+}
+
+// Per-byte unsigned max: borrow out of bit 7 of a - b marks the bytes where b wins
+static inline uint32_t maxWord(uint32_t a, uint32_t b) {
+    uint32_t low = (a | HIGH_BITS) - (b & ~HIGH_BITS);     // Bit 7 set = no borrow from the low 7 bits
+    uint32_t less = ((~a & b) | (~(a ^ b) & ~low)) & HIGH_BITS;
+    uint32_t mask = (less >> 7) * 0xFF;
+    return (a & ~mask) | (b & mask);
+}
+
+// Byte versions for the unaligned head and the tail
+static inline uint8_t scaleByte(uint8_t v, uint16_t factor) {
+    return (uint8_t)((v * factor) >> 8);
+}
+
+static inline uint8_t blendByte(uint8_t a, uint8_t b, uint16_t fa, uint16_t fb) {
+    return (uint8_t)((a * fa + b * fb) >> 8);
+}
+
+// ============== Single Span ==============
+
+static void scaleBytes(uint8_t* p, size_t n, uint16_t factor) {
+    while (n > 0 && !isAligned(p)) {
+        *p = scaleByte(*p, factor);
+        p++;
+        n--;
+    }
+    for (; n >= 4; n -= 4, p += 4) {
+        storeWord(p, scaleWord(loadWord(p), factor));
+    }
+    for (; n > 0; n--, p++) {
+        *p = scaleByte(*p, factor);
+    }
+}
+
+void scaleSpan(CRGB* px, uint16_t count, uint8_t scale) {
+    scaleBytes(px->raw, count * 3, scale + 1);     // FASTLED_SCALE8_FIXED
+}
+
+void scaleSpanScalar(CRGB* px, uint16_t count, uint8_t scale) {
+    for (uint16_t i = 0; i < count; i++) px[i].nscale8(scale);
+}
+
+void fadeToBlackSpan(CRGB* px, uint16_t count, uint8_t amount) {
+    scaleBytes(px->raw, count * 3, 256 - amount);  // nscale8(255 - amount)
+}
+
+void fadeToBlackSpanScalar(CRGB* px, uint16_t count, uint8_t amount) {
+    for (uint16_t i = 0; i < count; i++) px[i].fadeToBlackBy(amount);
+}
+
+void blendTowardSpan(CRGB* px, uint16_t count, const CRGB& color, uint8_t amount) {
+    // blend8 with FASTLED_BLEND_FIXED: (a * (256 - amount) + b * (amount + 1)) >> 8
+    uint16_t fa = 256 - amount;
+    uint16_t fb = amount + 1;
+    uint8_t* p = px->raw;
+    size_t n = count * 3;
+    uint8_t phase = 0;      // Channel of *p
+
+    while (n > 0 && !isAligned(p)) {
+        *p = blendByte(*p, color.raw[phase], fa, fb);
+        p++;
+        n--;
+        phase = phase == 2 ? 0 : phase + 1;
+    }
+
+    // The colour repeats every 3 words; premultiply each of them once
+    uint32_t colorEven[3];
+    uint32_t colorOdd[3];
+    alignas(4) uint8_t pattern[12];
+    for (uint8_t i = 0; i < 12; i++) pattern[i] = color.raw[(phase + i) % 3];
+    for (uint8_t k = 0; k < 3; k++) {
+        uint32_t w = loadWord(pattern + k * 4);
+        colorEven[k] = (w & EVEN_BYTES) * fb;
+        colorOdd[k] = ((w >> 8) & EVEN_BYTES) * fb;
+    }
+
+    uint8_t k = 0;
+    for (; n >= 4; n -= 4, p += 4) {
+        storeWord(p, blendWord(loadWord(p), fa, colorEven[k], colorOdd[k]));
+        k = k == 2 ? 0 : k + 1;
+        phase = phase == 2 ? 0 : phase + 1;     // 4 bytes advance the channel by one
+    }
+    for (; n > 0; n--, p++) {
+        *p = blendByte(*p, color.raw[phase], fa, fb);
+        phase = phase == 2 ? 0 : phase + 1;
+    }
+}
+
+void blendTowardSpanScalar(CRGB* px, uint16_t count, const CRGB& color, uint8_t amount) {
+    for (uint16_t i = 0; i < count; i++) nblend(px[i], color, amount);
+}
+
+// ============== Two Spans ==============
+
+void addSpan(CRGB* dst, const CRGB* src, uint16_t count) {
+    uint8_t* d = dst->raw;
+    const uint8_t* s = src->raw;
+    size_t n = count * 3;
+    if (((uintptr_t)d ^ (uintptr_t)s) & 3) {
+        addSpanScalar(dst, src, count);
+        return;
+    }
+
+    while (n > 0 && !isAligned(d)) {
+        *d = qadd8(*d, *s);
+        d++;
+        s++;
+        n--;
+    }
+    for (; n >= 4; n -= 4, d += 4, s += 4) {
+        storeWord(d, addWord(loadWord(d), loadWord(s)));
+    }
+    for (; n > 0; n--, d++, s++) {
+        *d = qadd8(*d, *s);
+    }
+}
+
+void addSpanScalar(CRGB* dst, const CRGB* src, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) dst[i] += src[i];
+}
+
+void maxSpan(CRGB* dst, const CRGB* src, uint16_t count) {
+    uint8_t* d = dst->raw;
+    const uint8_t* s = src->raw;
+    size_t n = count * 3;
+    if (((uintptr_t)d ^ (uintptr_t)s) & 3) {
+        maxSpanScalar(dst, src, count);
+        return;
+    }
+
+    while (n > 0 && !isAligned(d)) {
+        if (*s > *d) *d = *s;
+        d++;
+        s++;
+        n--;
+    }
+    for (; n >= 4; n -= 4, d += 4, s += 4) {
+        storeWord(d, maxWord(loadWord(d), loadWord(s)));
+    }
+    for (; n > 0; n--, d++, s++) {
+        if (*s > *d) *d = *s;
+    }
+}
+
+void maxSpanScalar(CRGB* dst, const CRGB* src, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        if (src[i].r > dst[i].r) dst[i].r = src[i].r;
+        if (src[i].g > dst[i].g) dst[i].g = src[i].g;
+        if (src[i].b > dst[i].b) dst[i].b = src[i].b;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+// Span kernels over packed RGB bytes (count = pixels).
+//
+// Every operation here is byte-wise, so a span is processed as one run of
+// 3 * count bytes, four channels per 32-bit word (SWAR): 16-bit lanes for
+// the multiplies, 7-bit lanes plus a fix-up for add/max. Results are
+// bit-identical to the FastLED per-pixel calls named below - the *Scalar
+// versions are exactly those loops, kept as the reference and for bench/.
+//
+// Words are only used on 4-byte aligned addresses (ESP32 faults on
+// unaligned l32i); the unaligned head and the tail go byte by byte. Two-span
+// kernels need both spans at the same alignment, otherwise they fall back
+// to the scalar loop - keep buffers alignas(4) and index them alike.
+
+// px[i].nscale8(scale)
+void scaleSpan(CRGB* px, uint16_t count, uint8_t scale);
+void scaleSpanScalar(CRGB* px, uint16_t count, uint8_t scale);
+
+// px[i].fadeToBlackBy(amount)
+void fadeToBlackSpan(CRGB* px, uint16_t count, uint8_t amount);
+void fadeToBlackSpanScalar(CRGB* px, uint16_t count, uint8_t amount);
+
+// nblend(px[i], color, amount)
+void blendTowardSpan(CRGB* px, uint16_t count, const CRGB& color, uint8_t amount);
+void blendTowardSpanScalar(CRGB* px, uint16_t count, const CRGB& color, uint8_t amount);
+
+// dst[i] += src[i] (qadd8 per channel)
+void addSpan(CRGB* dst, const CRGB* src, uint16_t count);
+void addSpanScalar(CRGB* dst, const CRGB* src, uint16_t count);
+
+// Per-channel maximum of dst[i] and src[i]
+void maxSpan(CRGB* dst, const CRGB* src, uint16_t count);
+void maxSpanScalar(CRGB* dst, const CRGB* src, uint16_t count);
+
+#endif // PIXEL_KERNELS_H
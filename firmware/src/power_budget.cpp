@@ -0,0 +1,230 @@
+#include "power_budget.h"
+#include <Preferences.h>
+
+static const char* POWER_KEY = "power";
+
+// Draw of one pixel in units of mA / 255
+static inline uint16_t pixelUnits(const CRGB& c) {
+    return c.r * POWER_RED_MA + c.g * POWER_GREEN_MA + c.b * POWER_BLUE_MA;
+}
+
+// ============== PowerConfig ==============
+
+PowerConfig PowerConfig::defaults(const LedLayout& layout) {
+    PowerConfig config;
+    memset(&config, 0, sizeof(config));
+    config.totalMa = LED_MAX_POWER_MW / POWER_SUPPLY_VOLTS;
+    for (uint8_t s = 0; s < layout.segmentCount && s < POWER_MAX_ZONES; s++) {
+        config.zones[s].first = layout.segmentStart(s);
+        config.zones[s].count = layout.segments[s].count;
+        config.zoneCount++;
+    }
+    return config;
+}
+
+bool PowerConfig::isValid(uint16_t ledCount) const {
+    if (totalMa == 0 || zoneCount > POWER_MAX_ZONES) return false;
+
+    uint32_t next = 0;  // Zones in order, no overlap
+    for (uint8_t z = 0; z < zoneCount; z++) {
+        if (zones[z].count == 0 || zones[z].first < next) return false;
+        next = (uint32_t)zones[z].first + zones[z].count;
+        if (next > ledCount) return false;
+    }
+    return true;
+}
+
+// ============== Storage ==============
+
+bool loadPowerConfig(PowerConfig& config, const LedLayout& layout) {
+    Preferences prefs;
+    bool ok = false;
+    if (prefs.begin(SETTINGS_NVS_NAMESPACE, true)) {
+        // Zones are checked against the active layout - a shorter strip drops them
+        ok = prefs.getBytesLength(POWER_KEY) == sizeof(PowerConfig)
+            && prefs.getBytes(POWER_KEY, &config, sizeof(PowerConfig)) == sizeof(PowerConfig)
+            && config.isValid(layout.totalLeds());
+        prefs.end();
+    }
+    if (!ok) config = PowerConfig::defaults(layout);
+    return ok;
+}
+
+bool savePowerConfig(const PowerConfig& config, const LedLayout& layout) {
+    if (!config.isValid(layout.totalLeds())) return false;
+
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NVS_NAMESPACE, false)) return false;
+    bool ok = prefs.putBytes(POWER_KEY, &config, sizeof(PowerConfig)) == sizeof(PowerConfig);
+    prefs.end();
+    return ok;
+}
+
+// ============== PowerBudget ==============
+
+PowerBudget::PowerBudget()
+    : _ledCount(0)
+    , _limitedUnits(0)
+    , _limiting(false)
+    , _limitedFrames(0)
+{
+    configure(PowerConfig::defaults(LedLayout::defaults()), LED_DEFAULT_COUNT);
+}
+
+void PowerBudget::configure(const PowerConfig& config, uint16_t ledCount) {
+    _config = config;
+    _ledCount = ledCount;
+
+    memset(_zoneOf, NO_ZONE, sizeof(_zoneOf));
+    for (uint8_t z = 0; z < _config.zoneCount; z++) {
+        memset(_zoneOf + _config.zones[z].first, z, _config.zones[z].count);
+    }
+    memset(_draw, 0, sizeof(_draw));
+    memset(_sum, 0, sizeof(_sum));
+    for (uint8_t z = 0; z <= POWER_MAX_ZONES; z++) {
+        _factor[z][0] = FULL;
+        _factor[z][1] = FULL;
+    }
+    _limitedUnits = 0;
+    _limiting = false;
+}
+
+const PowerConfig& PowerBudget::getConfig() const {
+    return _config;
+}
+
+void PowerBudget::account(const CRGB* wire, uint16_t first, uint16_t last) {
+    for (uint16_t i = first; i <= last; i++) {
+        uint16_t cached = _draw[i];
+        uint16_t held = cached >> 15;
+        uint16_t units = pixelUnits(wire[i]);
+        // Unsigned wrap is fine - every sum stays the true, non-negative total
+        _sum[_zoneOf[i]][held] += units - (cached & ~HELD_BIT);
+        _draw[i] = units | (cached & HELD_BIT);
+    }
+}
+
+void PowerBudget::setProtected(uint16_t led, bool held) {
+    if (led >= _ledCount || held == ((_draw[led] & HELD_BIT) != 0)) return;
+
+    uint16_t units = _draw[led] & ~HELD_BIT;
+    _sum[_zoneOf[led]][!held] -= units;
+    _sum[_zoneOf[led]][held] += units;
+    _draw[led] = held ? (units | HELD_BIT) : units;
+}
+
+void PowerBudget::clearProtected() {
+    for (uint16_t i = 0; i < _ledCount; i++) {
+        _draw[i] &= ~HELD_BIT;
+    }
+    for (uint8_t z = 0; z <= POWER_MAX_ZONES; z++) {
+        _sum[z][0] += _sum[z][1];
+        _sum[z][1] = 0;
+    }
+}
+
+// ============== Limiting ==============
+
+void PowerBudget::fit(uint32_t held, uint32_t other, uint32_t avail, uint16_t& heldFactor, uint16_t& otherFactor) {
+    // Rounded down, so the scaled draw never exceeds avail
+    if (held + other <= avail) {
+        heldFactor = FULL;
+        otherFactor = FULL;
+    } else if (held <= avail) {
+        heldFactor = FULL;
+        otherFactor = (uint16_t)(((uint64_t)(avail - held) * FULL) / other);
+    } else {
+        heldFactor = (uint16_t)(((uint64_t)avail * FULL) / held);
+        otherFactor = 0;
+    }
+}
+
+uint32_t PowerBudget::idleUnits(uint16_t count) const {
+    return (uint32_t)count * POWER_IDLE_MA * 255;
+}
+
+bool PowerBudget::solve() {
+    uint16_t factor[POWER_MAX_ZONES + 1][2];
+    uint32_t held = 0;
+    uint32_t other = 0;
+
+    // Each zone against its own budget
+    for (uint8_t z = 0; z <= POWER_MAX_ZONES; z++) {
+        factor[z][0] = FULL;
+        factor[z][1] = FULL;
+        if (z < _config.zoneCount && _config.zones[z].maxMa > 0) {
+            uint32_t budget = (uint32_t)_config.zones[z].maxMa * 255;
+            uint32_t idle = idleUnits(_config.zones[z].count);
+            fit(_sum[z][1], _sum[z][0], budget > idle ? budget - idle : 0, factor[z][1], factor[z][0]);
+        }
+        held += (uint32_t)(((uint64_t)_sum[z][1] * factor[z][1]) / FULL);
+        other += (uint32_t)(((uint64_t)_sum[z][0] * factor[z][0]) / FULL);
+    }
+
+    // What is left against the whole supply, the same way across all zones
+    uint32_t budget = (uint32_t)_config.totalMa * 255;
+    uint32_t idle = idleUnits(_ledCount);
+    uint16_t heldFactor, otherFactor;
+    fit(held, other, budget > idle ? budget - idle : 0, heldFactor, otherFactor);
+
+    bool changed = false;
+    bool limiting = false;
+    for (uint8_t z = 0; z <= POWER_MAX_ZONES; z++) {
+        uint16_t h = (factor[z][1] * heldFactor) / FULL;
+        uint16_t o = (factor[z][0] * otherFactor) / FULL;
+        changed |= h != _factor[z][1] || o != _factor[z][0];
+        limiting |= h < FULL || o < FULL;
+        _factor[z][1] = h;
+        _factor[z][0] = o;
+    }
+
+    _limitedUnits = (uint32_t)(((uint64_t)held * heldFactor + (uint64_t)other * otherFactor) / FULL);
+    _limiting = limiting;
+    if (limiting) _limitedFrames++;
+    return changed;
+}
+
+bool PowerBudget::isLimiting() const {
+    return _limiting;
+}
+
+void PowerBudget::limit(const CRGB* in, CRGB* out, uint16_t first, uint16_t last) const {
+    if (!_limiting) {
+        memcpy(out + first, in + first, (last - first + 1) * sizeof(CRGB));
+        return;
+    }
+
+    for (uint16_t i = first; i <= last; i++) {
+        uint16_t f = _factor[_zoneOf[i]][_draw[i] >> 15];
+        out[i].r = (in[i].r * f) >> 8;
+        out[i].g = (in[i].g * f) >> 8;
+        out[i].b = (in[i].b * f) >> 8;
+    }
+}
+
+// ============== Statistics ==============
+
+uint32_t PowerBudget::getEstimatedMa() const {
+    uint32_t units = idleUnits(_ledCount);
+    for (uint8_t z = 0; z <= POWER_MAX_ZONES; z++) {
+        units += _sum[z][0] + _sum[z][1];
+    }
+    return units / 255;
+}
+
+uint32_t PowerBudget::getLimitedMa() const {
+    return (idleUnits(_ledCount) + _limitedUnits) / 255;
+}
+
+uint32_t PowerBudget::getZoneEstimatedMa(uint8_t zone) const {
+    if (zone >= _config.zoneCount) return 0;
+    return (idleUnits(_config.zones[zone].count) + _sum[zone][0] + _sum[zone][1]) / 255;
+}
+
+uint16_t PowerBudget::getZoneFactor(uint8_t zone, bool held) const {
+    return zone < _config.zoneCount ? _factor[zone][held] : FULL;
+}
+
+uint32_t PowerBudget::getLimitedFrames() const {
+    return _limitedFrames;
+}
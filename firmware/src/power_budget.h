@@ -0,0 +1,95 @@
+#ifndef POWER_BUDGET_H
+#define POWER_BUDGET_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include "config.h"
+#include "led_layout.h"
+
+// LEDs fed from one supply point - a segment, or the stretch around one
+// power injection on a long segment
+struct PowerZone {
+    uint16_t first;
+    uint16_t count;
+    uint16_t maxMa;     // 0 = no limit of its own, only the total
+};
+
+// Current limits of the strip. Zones are disjoint LED ranges in order;
+// LEDs outside every zone count towards the total only.
+struct PowerConfig {
+    uint16_t totalMa;   // Whole supply
+    uint8_t zoneCount;
+    PowerZone zones[POWER_MAX_ZONES];
+
+    // LED_MAX_POWER_MW in total, one zone per segment without a limit of its own
+    static PowerConfig defaults(const LedLayout& layout);
+
+    bool isValid(uint16_t ledCount) const;
+};
+
+// Stored in NVS. load returns false and the defaults if nothing valid is stored.
+bool loadPowerConfig(PowerConfig& config, const LedLayout& layout);
+bool savePowerConfig(const PowerConfig& config, const LedLayout& layout);
+
+// Current estimate of the wire buffer, kept up to date per changed pixel.
+//
+// Every pixel's draw (FastLED's WS2812 model: POWER_*_MA per channel at
+// full scale) is cached, so account() only touches the range that changed
+// and the per-zone sums follow - no full-buffer scan per frame. Pixels are
+// either held (lit keys - protected) or other (ambient, splash, guide).
+//
+// solve() turns the sums into scale factors. A zone over its budget scales
+// its other pixels first and its held pixels only if they alone exceed it;
+// the total budget is then applied the same way across all zones. Factors
+// follow the estimate exactly instead of FastLED's uniform dimming, so one
+// bright splash no longer dims every held key.
+class PowerBudget {
+public:
+    PowerBudget();
+
+    // Zones and budgets; every cached pixel is dropped (account them again)
+    void configure(const PowerConfig& config, uint16_t ledCount);
+    const PowerConfig& getConfig() const;
+
+    // Re-cost wire[first..last] after it changed
+    void account(const CRGB* wire, uint16_t first, uint16_t last);
+
+    // Move a pixel between held and other; its cached draw moves along
+    void setProtected(uint16_t led, bool held);
+    void clearProtected();
+
+    // Recompute the scale factors. Returns true if any factor changed -
+    // every pixel must then be limited again, not just the changed range.
+    bool solve();
+    bool isLimiting() const;
+
+    // out[first..last] = in[first..last] scaled by the factor of its zone and class
+    void limit(const CRGB* in, CRGB* out, uint16_t first, uint16_t last) const;
+
+    // Estimates in mA, idle draw included
+    uint32_t getEstimatedMa() const;        // As requested
+    uint32_t getLimitedMa() const;          // After limiting
+    uint32_t getZoneEstimatedMa(uint8_t zone) const;
+    uint16_t getZoneFactor(uint8_t zone, bool held) const;   // 256 = full
+    uint32_t getLimitedFrames() const;      // solve() calls that had to limit
+
+private:
+    static const uint8_t NO_ZONE = POWER_MAX_ZONES;     // Bucket of LEDs outside every zone
+    static const uint16_t HELD_BIT = 0x8000;
+    static const uint16_t FULL = 256;
+
+    PowerConfig _config;
+    uint16_t _ledCount;
+    uint8_t _zoneOf[LED_MAX_COUNT];
+    uint16_t _draw[LED_MAX_COUNT];          // Cached draw units, HELD_BIT for held pixels
+    uint32_t _sum[POWER_MAX_ZONES + 1][2];  // [zone][held] draw units
+    uint16_t _factor[POWER_MAX_ZONES + 1][2];
+    uint32_t _limitedUnits;
+    bool _limiting;
+    uint32_t _limitedFrames;
+
+    static void fit(uint32_t held, uint32_t other, uint32_t avail, uint16_t& heldFactor, uint16_t& otherFactor);
+    uint32_t idleUnits(uint16_t count) const;
+};
+
+#endif // POWER_BUDGET_H
@@ -0,0 +1,422 @@
+#include "recorder.h"
+#include <LittleFS.h>
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+Recorder* recorder = nullptr;
+
+static const uint8_t STORE_VERSION = 1;
+static const char STORE_MAGIC[4] = { 'P', 'N', 'R', 'C' };
+static const char* STORE_SUFFIX = ".rec";
+
+static const uint32_t MAX_DELTA_MS = 0x0FFFFFFF;    // Four VLQ bytes, ~74 hours
+static const uint8_t MAX_EVENT_SIZE = 4 + 3;        // Delta + status + two data bytes
+
+// Recording id from a file name like "12.rec", 0 if it is not one
+static uint32_t idFromName(const char* name) {
+    const char* base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    char* end = nullptr;
+    uint32_t id = strtoul(base, &end, 10);
+    return end != base && strcmp(end, STORE_SUFFIX) == 0 ? id : 0;
+}
+
+static bool readHeader(File& file, RecordingHeader& header) {
+    return file.read((uint8_t*)&header, sizeof(header)) == sizeof(header)
+        && memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0
+        && header.version == STORE_VERSION;
+}
+
+static void putBigEndian(uint8_t* out, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        out[i] = value >> (8 * (bytes - 1 - i));
+    }
+}
+
+Recorder::Recorder()
+    : _mutex(nullptr)
+    , _task(nullptr)
+    , _state(RECORDER_IDLE)
+    , _nextId(1)
+    , _currentId(0)
+    , _lastUs(0)
+    , _elapsedUs(0)
+    , _writtenMs(0)
+    , _runningStatus(0)
+    , _events(0)
+    , _notes(0)
+    , _durationMs(0)
+    , _dropped(0)
+    , _active(0)
+    , _writeBlock(0)
+    , _fill(0)
+    , _blockStartMs(0)
+    , _writeFailed(false)
+    , _bytesWritten(0)
+{
+    _sealed[0] = 0;
+    _sealed[1] = 0;
+}
+
+bool Recorder::begin() {
+    if (_task != nullptr) return true;
+
+    if (!LittleFS.exists(RECORDER_DIR) && !LittleFS.mkdir(RECORDER_DIR)) {
+        LOG_E("Recorder: cannot create " RECORDER_DIR);
+        return false;
+    }
+
+    // New ids continue after the highest stored one
+    File dir = LittleFS.open(RECORDER_DIR);
+    if (dir && dir.isDirectory()) {
+        for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+            uint32_t id = idFromName(file.name());
+            if (id >= _nextId) _nextId = id + 1;
+        }
+    }
+
+    _mutex = xSemaphoreCreateMutex();
+    if (_mutex == nullptr) return false;
+
+    BaseType_t ok = xTaskCreatePinnedToCore(
+        taskEntry, "recorder", RECORDER_TASK_STACK, this,
+        RECORDER_TASK_PRIORITY, &_task, RECORDER_TASK_CORE);
+    return ok == pdPASS;
+}
+
+String Recorder::pathFor(uint32_t id) {
+    return String(RECORDER_DIR "/") + id + STORE_SUFFIX;
+}
+
+// ============== Control ==============
+
+bool Recorder::start() {
+    if (_task == nullptr) return false;     // LittleFS not mounted yet
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool ok = false;
+    if (_state == RECORDER_IDLE) {
+        // Header with zero counts until stop() - a cut-off recording still reads
+        RecordingHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header.version = STORE_VERSION;
+
+        _file = LittleFS.open(pathFor(_nextId), FILE_WRITE);
+        ok = _file && _file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+        if (ok) {
+            _currentId = _nextId++;
+            midiEvents->attach(_reader);
+            _lastUs = MidiEventRing::now();
+            _elapsedUs = 0;
+            _writtenMs = 0;
+            _runningStatus = 0;
+            _events = 0;
+            _notes = 0;
+            _durationMs = 0;
+            _dropped = 0;
+            _active = 0;
+            _writeBlock = 0;
+            _fill = 0;
+            _writeFailed = false;
+            _state = RECORDER_RECORDING;
+        } else if (_file) {
+            _file.close();
+        }
+    }
+    xSemaphoreGive(_mutex);
+
+    if (ok) {
+        LOG_I("Recorder: recording %u started", _currentId);
+    } else {
+        LOG_W("Recorder: cannot start (busy or storage full)");
+    }
+    return ok;
+}
+
+bool Recorder::stop() {
+    if (_task == nullptr) return false;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool ok = _state == RECORDER_RECORDING;
+    if (ok) {
+        advance(MidiEventRing::now());
+        _durationMs = _elapsedUs / 1000;
+        // The last block goes out even if the other one still waits - the
+        // writer alternates, so it is stored second
+        if (_fill > 0) seal();
+        _state = RECORDER_FINISHING;
+    }
+    xSemaphoreGive(_mutex);
+
+    if (ok) {
+        xTaskNotifyGive(_task);
+        LOG_I("Recorder: recording %u stopped, %u events", _currentId, _events);
+    }
+    return ok;
+}
+
+// ============== Encoder ==============
+
+void Recorder::poll() {
+    if (_state != RECORDER_RECORDING) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state != RECORDER_RECORDING) {
+        xSemaphoreGive(_mutex);
+        return;
+    }
+
+    MidiEvent ev;
+    while (midiEvents->pop(_reader, ev)) {
+        if (ev.source == MIDI_SOURCE_APP || ev.status >= 0xF0) continue;
+        if (_hotkeys.filter(ev)) continue;
+        encode(ev);
+    }
+    // Long silences would otherwise wrap the 32-bit event clock
+    advance(MidiEventRing::now());
+
+    if (_fill > 0 && _sealed[_active ^ 1] == 0 && millis() - _blockStartMs >= RECORDER_FLUSH_MS) {
+        seal();
+    }
+    bool failed = _writeFailed;
+    xSemaphoreGive(_mutex);
+
+    if (failed) {
+        LOG_E("Recorder: write failed, recording stopped");
+        stop();
+    }
+}
+
+void Recorder::advance(uint32_t nowUs) {
+    // Events queued before an earlier advance() are a little older - count them as now
+    int32_t delta = (int32_t)(nowUs - _lastUs);
+    if (delta > 0) {
+        _elapsedUs += delta;
+        _lastUs = nowUs;
+    }
+}
+
+void Recorder::encode(const MidiEvent& ev) {
+    if (_fill + MAX_EVENT_SIZE > RECORDER_BLOCK_SIZE) {
+        if (_sealed[_active ^ 1] != 0) {
+            // Writer a whole block behind - the time of the drop goes into the next delta
+            _dropped++;
+            return;
+        }
+        seal();
+    }
+    if (_fill == 0) _blockStartMs = millis();
+
+    advance(ev.timeUs);
+    uint32_t ms = _elapsedUs / 1000;
+    uint32_t delta = min(ms - _writtenMs, MAX_DELTA_MS);
+    _writtenMs = ms;
+
+    // Variable-length quantity, 7 bits per byte, most significant first
+    uint8_t* out = _blocks[_active] + _fill;
+    uint8_t bytes = 1;
+    while (bytes < 4 && (delta >> (7 * bytes)) != 0) bytes++;
+    for (uint8_t i = bytes; i-- > 1; ) {
+        *out++ = 0x80 | ((delta >> (7 * i)) & 0x7F);
+    }
+    *out++ = delta & 0x7F;
+
+    if (ev.status != _runningStatus) {
+        *out++ = ev.status;
+        _runningStatus = ev.status;
+    }
+    *out++ = ev.data1 & 0x7F;
+    // Program change and channel pressure carry one data byte
+    if (ev.type() != 0xC0 && ev.type() != 0xD0) {
+        *out++ = ev.data2 & 0x7F;
+    }
+    _fill = out - _blocks[_active];
+
+    _events++;
+    if (ev.isNoteOn()) _notes++;
+}
+
+void Recorder::seal() {
+    _sealed[_active] = _fill;
+    _active ^= 1;
+    _fill = 0;
+    xTaskNotifyGive(_task);
+}
+
+// ============== Writer ==============
+
+void Recorder::taskEntry(void* arg) {
+    static_cast<Recorder*>(arg)->writer();
+}
+
+void Recorder::writer() {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Sealed blocks in order, then the end of the recording if stop() was called
+        for (;;) {
+            xSemaphoreTake(_mutex, portMAX_DELAY);
+            uint8_t block = _writeBlock;
+            uint16_t length = _sealed[block];
+            bool finishing = _state == RECORDER_FINISHING;
+            xSemaphoreGive(_mutex);
+
+            if (length > 0) {
+                bool ok = _file.write(_blocks[block], length) == length;
+                _file.flush();
+
+                xSemaphoreTake(_mutex, portMAX_DELAY);
+                _sealed[block] = 0;
+                _writeBlock = block ^ 1;
+                _bytesWritten += length;
+                _writeFailed |= !ok;
+                xSemaphoreGive(_mutex);
+                continue;
+            }
+
+            if (finishing) {
+                finalize();
+                xSemaphoreTake(_mutex, portMAX_DELAY);
+                _currentId = 0;
+                _state = RECORDER_IDLE;
+                xSemaphoreGive(_mutex);
+            }
+            break;
+        }
+    }
+}
+
+void Recorder::finalize() {
+    RecordingHeader header;
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    header.flags = RECORDING_COMPLETE;
+    header.reserved = 0;
+    header.events = _events;
+    header.notes = _notes;
+    header.durationMs = _durationMs;
+
+    if (!_file.seek(0) || _file.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+        LOG_E("Recorder: cannot finish recording %u", _currentId);
+    }
+    _file.close();
+}
+
+// ============== Status ==============
+
+RecorderState Recorder::getState() const {
+    return _state;
+}
+
+bool Recorder::isRecording() const {
+    return _state == RECORDER_RECORDING;
+}
+
+uint32_t Recorder::getCurrentId() const {
+    return _currentId;
+}
+
+uint32_t Recorder::getEventCount() const {
+    return _events;
+}
+
+uint32_t Recorder::getNoteCount() const {
+    return _notes;
+}
+
+uint32_t Recorder::getDurationMs() const {
+    return _state == RECORDER_RECORDING ? (uint32_t)(_elapsedUs / 1000) : _durationMs;
+}
+
+uint32_t Recorder::getDroppedEvents() const {
+    return _dropped;
+}
+
+uint32_t Recorder::getBytesWritten() const {
+    return _bytesWritten;
+}
+
+// ============== Stored Recordings ==============
+
+void Recorder::fillList(JsonArray out) const {
+    File dir = LittleFS.open(RECORDER_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+        uint32_t id = idFromName(file.name());
+        RecordingHeader header;
+        if (id == 0 || !readHeader(file, header)) continue;
+
+        JsonObject entry = out.add<JsonObject>();
+        entry["id"] = id;
+        entry["bytes"] = (uint32_t)file.size();
+        if (id == _currentId) {
+            // Counts in the file are only written at the end
+            entry["active"] = true;
+            entry["events"] = _events;
+            entry["notes"] = _notes;
+            entry["duration_ms"] = getDurationMs();
+        } else {
+            entry["complete"] = (header.flags & RECORDING_COMPLETE) != 0;
+            entry["events"] = header.events;
+            entry["notes"] = header.notes;
+            entry["duration_ms"] = header.durationMs;
+        }
+    }
+}
+
+bool Recorder::remove(uint32_t id) {
+    if (id == 0 || id == _currentId) return false;
+    return LittleFS.remove(pathFor(id).c_str());
+}
+
+// ============== SMF Export ==============
+
+bool SmfExport::open(uint32_t id) {
+    if (id == 0 || (recorder && id == recorder->getCurrentId())) return false;
+
+    _file = LittleFS.open(Recorder::pathFor(id), FILE_READ);
+    RecordingHeader header;
+    if (!_file || !readHeader(_file, header)) return false;
+    _body = _file.size() - sizeof(RecordingHeader);
+
+    static const uint8_t HEAD[HEAD_SIZE] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        0, 0,                   // Format 0
+        0, 1,                   // One track
+        0x01, 0xF4,             // 500 ticks per quarter
+        'M', 'T', 'r', 'k', 0, 0, 0, 0,
+        0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20    // Tempo 500000 us per quarter
+    };
+    memcpy(_head, HEAD, HEAD_SIZE);
+    putBigEndian(_head + 18, 7 + _body + TAIL_SIZE, 4);
+    return true;
+}
+
+uint32_t SmfExport::size() const {
+    return HEAD_SIZE + _body + TAIL_SIZE;
+}
+
+size_t SmfExport::read(uint8_t* buffer, size_t maxLen, size_t index) {
+    static const uint8_t TAIL[TAIL_SIZE] = { 0x00, 0xFF, 0x2F, 0x00 };
+    size_t written = 0;
+
+    while (written < maxLen && index < size()) {
+        size_t n;
+        if (index < HEAD_SIZE) {
+            n = min(maxLen - written, (size_t)(HEAD_SIZE - index));
+            memcpy(buffer + written, _head + index, n);
+        } else if (index < HEAD_SIZE + _body) {
+            n = min(maxLen - written, (size_t)(HEAD_SIZE + _body - index));
+            n = _file.read(buffer + written, n);
+            if (n == 0) break;  // File shorter than it was - end the response early
+        } else {
+            n = min(maxLen - written, (size_t)(size() - index));
+            memcpy(buffer + written, TAIL + (index - HEAD_SIZE - _body), n);
+        }
+        written += n;
+        index += n;
+    }
+    return written;
+}
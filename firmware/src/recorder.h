@@ -0,0 +1,137 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include "config.h"
+#include "midi_event_ring.h"
+#include "../include/hotkey_handler.h"
+
+enum RecorderState : uint8_t {
+    RECORDER_IDLE = 0,
+    RECORDER_RECORDING = 1,
+    RECORDER_FINISHING = 2      // Stopped, the writer is emptying the blocks
+};
+
+// Start of every recording file. Little endian, as the ESP32 stores it.
+struct RecordingHeader {
+    char magic[4];          // "PNRC"
+    uint8_t version;
+    uint8_t flags;          // RECORDING_COMPLETE once stopped cleanly
+    uint16_t reserved;
+    uint32_t events;
+    uint32_t notes;         // Note-ons among the events
+    uint32_t durationMs;
+};
+
+static_assert(sizeof(RecordingHeader) == 20, "RecordingHeader is stored as is");
+
+static const uint8_t RECORDING_COMPLETE = 0x01;
+
+// Played MIDI streamed to LittleFS (SPECIFICATION.md 2.4).
+//
+// The recorder is one more consumer of the event ring, drained by the
+// housekeeping task. Events are encoded straight into a Standard MIDI File
+// track: a variable-length delta in ms, then the message with running
+// status - 2-4 bytes per note instead of a fixed record, pedals, other
+// controllers, program changes and pitch bend included. Export only puts
+// the MThd/MTrk headers around the stored bytes.
+//
+// Encoding fills one RAM block while a writer task stores the other, so
+// the flash never stalls the MIDI path. A block is handed over when full
+// or RECORDER_FLUSH_MS after its first byte, which bounds what a power
+// cut can lose. If the writer falls a whole block behind, events are
+// dropped and counted instead of blocking. There is no length limit - a
+// recording ends with stop() or when LittleFS is full.
+class Recorder {
+public:
+    Recorder();
+
+    // LittleFS must be mounted: finds the next id, starts the writer task
+    bool begin();
+
+    // From command handlers. start() fails while the last recording is still being stored.
+    bool start();
+    bool stop();
+
+    // Housekeeping task: encode new events, hand over a block that waited long enough
+    void poll();
+
+    RecorderState getState() const;
+    bool isRecording() const;
+    uint32_t getCurrentId() const;      // Recording being written, 0 = none
+    uint32_t getEventCount() const;     // Current (or last) recording
+    uint32_t getNoteCount() const;
+    uint32_t getDurationMs() const;
+    uint32_t getDroppedEvents() const;
+    uint32_t getBytesWritten() const;   // Since boot
+
+    // Stored recordings, oldest first
+    void fillList(JsonArray out) const;
+    bool remove(uint32_t id);
+
+    static String pathFor(uint32_t id);
+
+private:
+    SemaphoreHandle_t _mutex;
+    TaskHandle_t _task;
+    volatile RecorderState _state;
+    File _file;
+    uint32_t _nextId;
+    uint32_t _currentId;
+
+    // Encoder - housekeeping task, under _mutex
+    MidiEventRing::Reader _reader;
+    HotkeyFilter _hotkeys;
+    uint32_t _lastUs;           // Event clock, wraps
+    uint64_t _elapsedUs;        // Since start, does not
+    uint32_t _writtenMs;        // Time of the last encoded event
+    uint8_t _runningStatus;
+    uint32_t _events;
+    uint32_t _notes;
+    uint32_t _durationMs;
+    uint32_t _dropped;
+
+    // Double buffer: the encoder fills _active, the writer stores _writeBlock
+    uint8_t _blocks[2][RECORDER_BLOCK_SIZE];
+    uint16_t _sealed[2];        // Bytes waiting for the writer, 0 = free
+    uint8_t _active;
+    uint8_t _writeBlock;
+    uint16_t _fill;
+    uint32_t _blockStartMs;
+    bool _writeFailed;
+    uint32_t _bytesWritten;
+
+    void advance(uint32_t nowUs);
+    void encode(const MidiEvent& ev);
+    void seal();
+
+    static void taskEntry(void* arg);
+    void writer();
+    void finalize();
+};
+
+// Standard MIDI File view of a stored recording, produced piecewise for
+// a chunked HTTP response: format 0, 500 ticks per quarter at 120 bpm,
+// so one tick is one ms.
+class SmfExport {
+public:
+    bool open(uint32_t id);
+    uint32_t size() const;
+
+    // Bytes [index, index + maxLen) of the file; reads must be sequential
+    size_t read(uint8_t* buffer, size_t maxLen, size_t index);
+
+private:
+    static const uint8_t HEAD_SIZE = 29;    // MThd + MTrk header + tempo
+    static const uint8_t TAIL_SIZE = 4;     // End of track
+
+    File _file;
+    uint8_t _head[HEAD_SIZE];
+    uint32_t _body;
+};
+
+extern Recorder* recorder;
+
+#endif // RECORDER_H
@@ -0,0 +1,232 @@
+#include "render_task.h"
+#include "led_controller.h"
+#include "boot_timeline.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+RenderTask* renderTask = nullptr;
+
+// Budget at 60 fps is 16.7 ms; finer steps where frames normally land
+static const uint32_t FRAME_TIME_BUCKETS_US[] = {
+    100, 250, 500, 1000, 2000, 4000, 6000, 8000, 12000, 16667, 33333
+};
+
+// Key-to-light: USB poll + wait for the next frame + frame + show() ~ 6-25 ms
+static const uint32_t LATENCY_BUCKETS_US[] = {
+    2000, 4000, 6000, 8000, 10000, 12000, 14000, 16000,
+    18000, 20000, 25000, 30000, 40000, 60000, 100000, 250000
+};
+
+RenderTask::RenderTask(LEDController* controller)
+    : _controller(controller)
+    , _task(nullptr)
+    , _mutex(nullptr)
+    , _frameHook(nullptr)
+    , _frameHookArg(nullptr)
+    , _hookAnimating(false)
+    , _fps(RENDER_DEFAULT_FPS)
+    , _lastFrameUs(0)
+    , _maxFrameUs(0)
+    , _avgFrameUs(0)
+    , _frameCount(0)
+    , _overruns(0)
+    , _droppedBase(0)
+    , _frameTime(FRAME_TIME_BUCKETS_US, sizeof(FRAME_TIME_BUCKETS_US) / sizeof(uint32_t))
+    , _latency(LATENCY_BUCKETS_US, sizeof(LATENCY_BUCKETS_US) / sizeof(uint32_t))
+{
+}
+
+bool RenderTask::begin(uint16_t fps) {
+    if (_task != nullptr) return true;
+
+    setFrameRate(fps);
+
+    _mutex = xSemaphoreCreateRecursiveMutex();
+    if (_mutex == nullptr || midiEvents == nullptr) {
+        return false;
+    }
+    midiEvents->attach(_reader);
+
+    BaseType_t ok = xTaskCreatePinnedToCore(
+        taskEntry, "render", RENDER_TASK_STACK, this,
+        RENDER_TASK_PRIORITY, &_task, RENDER_TASK_CORE);
+    return ok == pdPASS;
+}
+
+bool RenderTask::isRunning() const {
+    return _task != nullptr;
+}
+
+void RenderTask::setFrameRate(uint16_t fps) {
+    _fps = constrain(fps, RENDER_MIN_FPS, RENDER_MAX_FPS);
+}
+
+uint16_t RenderTask::getFrameRate() const {
+    return _fps;
+}
+
+void RenderTask::lock() {
+    if (_mutex) xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+}
+
+void RenderTask::unlock() {
+    if (_mutex) xSemaphoreGiveRecursive(_mutex);
+}
+
+void RenderTask::wake() {
+    if (_task) xTaskNotifyGive(_task);
+}
+
+void RenderTask::setFrameHook(RenderFrameHook hook, void* arg) {
+    _frameHook = hook;
+    _frameHookArg = arg;
+}
+
+// ============== Statistics ==============
+
+uint32_t RenderTask::getFrameBudgetUs() const {
+    return 1000000UL / _fps;
+}
+
+uint32_t RenderTask::getLastFrameUs() const {
+    return _lastFrameUs;
+}
+
+uint32_t RenderTask::getMaxFrameUs() const {
+    return _maxFrameUs;
+}
+
+uint32_t RenderTask::getAvgFrameUs() const {
+    return _avgFrameUs;
+}
+
+uint32_t RenderTask::getFrameCount() const {
+    return _frameCount;
+}
+
+uint32_t RenderTask::getOverrunCount() const {
+    return _overruns;
+}
+
+uint32_t RenderTask::getDroppedEvents() const {
+    return _reader.getOverruns() - _droppedBase;
+}
+
+const MetricHistogram& RenderTask::getFrameTimeHistogram() const {
+    return _frameTime;
+}
+
+const MetricHistogram& RenderTask::getLatencyHistogram() const {
+    return _latency;
+}
+
+void RenderTask::resetLatency() {
+    _latency.reset();
+}
+
+void RenderTask::resetStats() {
+    _lastFrameUs = 0;
+    _maxFrameUs = 0;
+    _avgFrameUs = 0;
+    _frameCount = 0;
+    _overruns = 0;
+    _droppedBase = _reader.getOverruns();
+}
+
+// ============== Frame Loop ==============
+
+void RenderTask::taskEntry(void* arg) {
+    static_cast<RenderTask*>(arg)->run();
+}
+
+void RenderTask::run() {
+    TickType_t lastWake = xTaskGetTickCount();
+
+    for (;;) {
+        // Wake-ups that arrived up to here are served by this frame
+        ulTaskNotifyTake(pdTRUE, 0);
+
+        uint32_t start = micros();
+        renderFrame();
+        uint32_t elapsed = micros() - start;
+
+        _lastFrameUs = elapsed;
+        if (elapsed > _maxFrameUs) _maxFrameUs = elapsed;
+        // EMA with 1/8 weight keeps the average stable but responsive
+        _avgFrameUs = _frameCount == 0 ? elapsed : (_avgFrameUs * 7 + elapsed) / 8;
+        _frameCount++;
+        if (elapsed > getFrameBudgetUs()) _overruns++;
+        _frameTime.observe(elapsed);
+
+        if (!_controller->isAnimating() && !_hookAnimating) {
+            // Static frame: sleep until a note or a drawing call, or until
+            // the keep-alive push is due
+            uint16_t keepAlive = _controller->getKeepAliveMs();
+            ulTaskNotifyTake(pdTRUE, keepAlive > 0 ? pdMS_TO_TICKS(keepAlive) : portMAX_DELAY);
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+
+        TickType_t period = pdMS_TO_TICKS(1000 / _fps);
+        if (period == 0) period = 1;
+        // If we fell behind, resynchronise instead of bursting frames
+        if (xTaskGetTickCount() - lastWake >= period) {
+            lastWake = xTaskGetTickCount();
+            vTaskDelay(1);
+        } else {
+            vTaskDelayUntil(&lastWake, period);
+        }
+    }
+}
+
+void RenderTask::renderFrame() {
+    lock();
+
+    // Apply every note that arrived since the previous frame. Key presses
+    // keep their transfer timestamp until the frame is latched.
+    uint32_t pressed[RENDER_LATENCY_MAX_NOTES];
+    uint8_t pressedCount = 0;
+
+    MidiEvent ev;
+    while (midiEvents->pop(_reader, ev)) {
+        if (ev.source != MIDI_SOURCE_APP && _hotkeys.filter(ev)) {
+            continue;
+        }
+        if (ev.isNoteOn()) {
+            _controller->noteOn(ev.data1, ev.data2);
+            if (ev.source == MIDI_SOURCE_USB && pressedCount < RENDER_LATENCY_MAX_NOTES) {
+                pressed[pressedCount++] = ev.timeUs;
+            }
+        } else if (ev.isNoteOff()) {
+            _controller->noteOff(ev.data1);
+        }
+    }
+
+    _controller->update();
+    _hookAnimating = _frameHook != nullptr && _frameHook(_frameHookArg);
+    uint32_t pushedBefore = _controller->getFramesPushed();
+    _controller->show();
+
+    // show() returns once the last pixel is clocked out - that is the latch
+    if (pressedCount > 0 && _controller->getFramesPushed() != pushedBefore) {
+        uint32_t latched = MidiEventRing::now();
+        for (uint8_t i = 0; i < pressedCount; i++) {
+            _latency.observe(latched - pressed[i]);
+        }
+        if (bootTimeline) bootTimeline->mark(BOOT_FIRST_LIGHT);
+    }
+
+    unlock();
+}
+
+// ============== RenderLock ==============
+
+RenderLock::RenderLock() {
+    if (renderTask) renderTask->lock();
+}
+
+RenderLock::~RenderLock() {
+    if (renderTask) {
+        renderTask->unlock();
+        renderTask->wake();     // Whatever was drawn needs a frame
+    }
+}
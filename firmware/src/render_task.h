@@ -0,0 +1,103 @@
+#ifndef RENDER_TASK_H
+#define RENDER_TASK_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "config.h"
+#include "midi_event_ring.h"
+#include "hotkey_handler.h"
+#include "metrics.h"
+
+class LEDController;
+
+// Drawing that moves with time rather than with notes (game mode), run in
+// every frame after the controller's update(), under the render lock.
+// Returns true while it animates - the loop keeps its frame rate then.
+typedef bool (*RenderFrameHook)(void* arg);
+
+// Fixed-rate render loop for the LED strip.
+//
+// While nothing animates the task sleeps until wake() - called by the USB
+// callback after pushing events and by every RenderLock release - so an
+// idle strip costs no frames and the first note is drawn immediately.
+//
+// The task owns the frame buffer of the LEDController. It is one consumer of
+// the MIDI event ring: every note that arrived since the previous frame is
+// applied at the start of the next one, so a chord costs one FastLED.show()
+// instead of one per note. Code that needs to draw outside the frame loop
+// (blocking flashes) must hold RenderLock.
+class RenderTask {
+public:
+    explicit RenderTask(LEDController* controller);
+
+    bool begin(uint16_t fps = RENDER_DEFAULT_FPS);
+    bool isRunning() const;
+
+    // Frame rate (clamped to RENDER_MIN_FPS..RENDER_MAX_FPS)
+    void setFrameRate(uint16_t fps);
+    uint16_t getFrameRate() const;
+
+    // Exclusive access to the controller's frame buffer
+    void lock();
+    void unlock();
+
+    // Render a frame now if the task is sleeping idle (any task context)
+    void wake();
+
+    // One hook; set it before begin()
+    void setFrameHook(RenderFrameHook hook, void* arg);
+
+    // Frame-time budget and statistics (microseconds)
+    uint32_t getFrameBudgetUs() const;
+    uint32_t getLastFrameUs() const;
+    uint32_t getMaxFrameUs() const;
+    uint32_t getAvgFrameUs() const;
+    uint32_t getFrameCount() const;
+    uint32_t getOverrunCount() const;   // Frames that exceeded the budget
+    uint32_t getDroppedEvents() const;  // Events overwritten before this stage read them
+    const MetricHistogram& getFrameTimeHistogram() const;   // Compute time per frame, us
+    const MetricHistogram& getLatencyHistogram() const;     // USB transfer to LED latch, us
+    void resetLatency();
+    void resetStats();
+
+private:
+    LEDController* _controller;
+    TaskHandle_t _task;
+    SemaphoreHandle_t _mutex;
+    MidiEventRing::Reader _reader;
+    HotkeyFilter _hotkeys;      // Hotkey action presses are not drawn
+    RenderFrameHook _frameHook;
+    void* _frameHookArg;
+    bool _hookAnimating;        // The hook's answer in the last frame
+
+    volatile uint16_t _fps;
+    volatile uint32_t _lastFrameUs;
+    volatile uint32_t _maxFrameUs;
+    volatile uint32_t _avgFrameUs;      // Exponential moving average
+    volatile uint32_t _frameCount;
+    volatile uint32_t _overruns;
+    uint32_t _droppedBase;      // Reader overruns at last resetStats()
+    MetricHistogram _frameTime;
+    MetricHistogram _latency;
+
+    static void taskEntry(void* arg);
+    void run();
+    void renderFrame();
+};
+
+// Scoped lock for drawing outside the render loop (no-op before begin())
+class RenderLock {
+public:
+    RenderLock();
+    ~RenderLock();
+
+private:
+    RenderLock(const RenderLock&);
+    RenderLock& operator=(const RenderLock&);
+};
+
+extern RenderTask* renderTask;
+
+#endif // RENDER_TASK_H
@@ -0,0 +1,679 @@
+#include "song_player.h"
+#include <LittleFS.h>
+#include "midi_event_ring.h"
+#include "render_task.h"
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+SongPlayer* songPlayer = nullptr;
+
+static const uint32_t DEFAULT_TEMPO = 500000;       // us per quarter note, 120 bpm
+static const uint32_t SMPTE_TEMPO = 1000000;        // Division is ticks per second
+static const uint8_t DRUM_CHANNEL = 9;              // GM percussion - not keys
+
+static const uint32_t LATENESS_BUCKETS_US[] = {
+    50, 100, 250, 500, 1000, 2000, 5000, 10000, 50000
+};
+
+static_assert((PLAYER_QUEUE_SIZE & (PLAYER_QUEUE_SIZE - 1)) == 0,
+              "PLAYER_QUEUE_SIZE must be a power of two");
+static_assert(PLAYER_QUEUE_SIZE <= 128, "PLAYER_QUEUE_SIZE must fit the 8-bit queue indices");
+
+static uint32_t readBigEndian(const uint8_t* in, uint8_t bytes) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+SongPlayer::SongPlayer()
+    : _mutex(nullptr)
+    , _timer(nullptr)
+    , _task(nullptr)
+    , _state(PLAYER_STOPPED)
+    , _request(REQ_NONE)
+    , _generation(0)
+    , _targetUs(0)
+    , _queueHead(0)
+    , _queueCount(0)
+    , _loading(false)
+    , _parsed(false)
+    , _ended(false)
+    , _originUs(0)
+    , _originSongUs(0)
+    , _endUs(0)
+    , _durationUs(0)
+    , _speed(PLAYER_DEFAULT_SPEED)
+    , _loop(false)
+    , _notesPlayed(0)
+    , _underruns(0)
+    , _lateness(LATENESS_BUCKETS_US, sizeof(LATENESS_BUCKETS_US) / sizeof(uint32_t))
+    , _songDurationUs(0)
+    , _division(1)
+    , _smpte(false)
+    , _trackCount(0)
+    , _tick(0)
+    , _tempo(DEFAULT_TEMPO)
+    , _songUs(0)
+    , _remainder(0)
+    , _passUs(0)
+{
+    _filename[0] = '\0';
+    _openName[0] = '\0';
+    memset(_sounding, 0, sizeof(_sounding));
+}
+
+bool SongPlayer::begin() {
+    if (_task != nullptr) return true;
+
+    _mutex = xSemaphoreCreateMutex();
+    if (_mutex == nullptr) return false;
+
+    esp_timer_create_args_t args = {};
+    args.callback = timerEntry;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "song";
+    if (esp_timer_create(&args, &_timer) != ESP_OK) return false;
+
+    BaseType_t ok = xTaskCreatePinnedToCore(
+        taskEntry, "player", PLAYER_TASK_STACK, this,
+        PLAYER_TASK_PRIORITY, &_task, PLAYER_TASK_CORE);
+    return ok == pdPASS;
+}
+
+bool SongPlayer::isValidName(const char* name) {
+    size_t length = name ? strlen(name) : 0;
+    return length > 0 && length <= PLAYER_MAX_NAME
+        && strchr(name, '/') == nullptr && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+File SongPlayer::openSong(const char* name) {
+    String path = String(PLAYER_SONG_DIR "/") + name;
+    if (LittleFS.exists(path)) return LittleFS.open(path, FILE_READ);
+    path = String(PLAYER_BUILTIN_DIR "/") + name;
+    if (LittleFS.exists(path)) return LittleFS.open(path, FILE_READ);
+    return File();
+}
+
+// ============== Control ==============
+
+bool SongPlayer::play(const char* filename, uint32_t positionMs) {
+    if (_task == nullptr || !isValidName(filename)) return false;
+
+    // Only the header here - the player task scans the rest
+    File file = openSong(filename);
+    uint8_t magic[4];
+    bool ok = file && file.read(magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, "MThd", 4) == 0;
+    file.close();
+    if (!ok) {
+        // No name in the log: records keep the pointer, not the string
+        LOG_W("Player: MIDI file not found");
+        return false;
+    }
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    esp_timer_stop(_timer);
+    clearQueue();
+    releaseNotes();
+    strncpy(_filename, filename, PLAYER_MAX_NAME);
+    _filename[PLAYER_MAX_NAME] = '\0';
+    _generation++;
+    _request = REQ_LOAD;
+    _targetUs = (uint64_t)positionMs * 1000;
+    _durationUs = 0;
+    _loading = true;
+    _ended = false;
+    _originSongUs = _targetUs;
+    _originUs = esp_timer_get_time();
+    _state = PLAYER_PLAYING;
+    xSemaphoreGive(_mutex);
+
+    xTaskNotifyGive(_task);
+    LOG_I("Player: started at %u ms", positionMs);
+    return true;
+}
+
+void SongPlayer::stop() {
+    if (_task == nullptr) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state != PLAYER_STOPPED) {
+        esp_timer_stop(_timer);
+        rebase(esp_timer_get_time());
+        clearQueue();
+        releaseNotes();
+        _generation++;
+        _request = REQ_CLOSE;
+        _loading = false;
+        _state = PLAYER_STOPPED;
+    }
+    xSemaphoreGive(_mutex);
+
+    xTaskNotifyGive(_task);
+}
+
+void SongPlayer::pause() {
+    if (_task == nullptr) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state == PLAYER_PLAYING) {
+        esp_timer_stop(_timer);
+        rebase(esp_timer_get_time());
+        _state = PLAYER_PAUSED;
+        releaseNotes();
+    }
+    xSemaphoreGive(_mutex);
+}
+
+void SongPlayer::resume() {
+    if (_task == nullptr) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state == PLAYER_PAUSED) {
+        _originUs = esp_timer_get_time();
+        _state = PLAYER_PLAYING;
+        if (!_loading) arm();
+    }
+    xSemaphoreGive(_mutex);
+}
+
+void SongPlayer::seek(uint32_t positionMs) {
+    if (_task == nullptr) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state != PLAYER_STOPPED) {
+        esp_timer_stop(_timer);
+        clearQueue();
+        releaseNotes();
+        _generation++;
+        // A load still pending has to open the file first
+        if (_request != REQ_LOAD) _request = REQ_SEEK;
+        _targetUs = (uint64_t)positionMs * 1000;
+        _loading = true;
+        _originSongUs = _targetUs;
+        _originUs = esp_timer_get_time();
+    }
+    xSemaphoreGive(_mutex);
+
+    xTaskNotifyGive(_task);
+}
+
+void SongPlayer::setSpeed(uint16_t percent) {
+    if (_task == nullptr) {
+        _speed = constrain(percent, PLAYER_MIN_SPEED, PLAYER_MAX_SPEED);
+        return;
+    }
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    rebase(esp_timer_get_time());
+    _speed = constrain(percent, PLAYER_MIN_SPEED, PLAYER_MAX_SPEED);
+    if (_state == PLAYER_PLAYING && !_loading) arm();
+    xSemaphoreGive(_mutex);
+}
+
+void SongPlayer::setLoop(bool loop) {
+    if (_task == nullptr) {
+        _loop = loop;
+        return;
+    }
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _loop = loop;
+    // The parser already stopped at the end - let it start the next pass
+    bool restart = loop && _parsed && _state != PLAYER_STOPPED;
+    if (restart) _parsed = false;
+    xSemaphoreGive(_mutex);
+
+    if (restart) xTaskNotifyGive(_task);
+}
+
+bool SongPlayer::poll() {
+    if (_mutex == nullptr) return false;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool ended = _ended;
+    _ended = false;
+    xSemaphoreGive(_mutex);
+    return ended;
+}
+
+// ============== Song Clock ==============
+
+uint64_t SongPlayer::songPosition(int64_t nowUs) const {
+    if (_state != PLAYER_PLAYING || _loading || nowUs <= _originUs) return _originSongUs;
+    return _originSongUs + (uint64_t)(nowUs - _originUs) * _speed / 100;
+}
+
+int64_t SongPlayer::wallTime(uint64_t songUs) const {
+    if (songUs <= _originSongUs) return _originUs;
+    return _originUs + (int64_t)((songUs - _originSongUs) * 100 / _speed);
+}
+
+void SongPlayer::rebase(int64_t nowUs) {
+    _originSongUs = songPosition(nowUs);
+    _originUs = nowUs;
+}
+
+// Timer to the first queued note, or to the end once everything is queued
+void SongPlayer::arm() {
+    esp_timer_stop(_timer);
+    if (_queueCount == 0 && !_parsed) return;   // The next fill arms it
+
+    uint64_t next = _queueCount > 0 ? _queue[_queueHead].atUs : _endUs;
+    int64_t delay = wallTime(next) - esp_timer_get_time();
+    esp_timer_start_once(_timer, delay > 0 ? delay : 1);
+}
+
+void SongPlayer::releaseNotes() {
+    for (uint8_t word = 0; word < 4; word++) {
+        while (_sounding[word]) {
+            uint8_t bit = __builtin_ctz(_sounding[word]);
+            _sounding[word] &= _sounding[word] - 1;
+            midiEvents->push(MIDI_SOURCE_APP, 0x80, word * 32 + bit, 0);
+        }
+    }
+    if (renderTask) renderTask->wake();
+}
+
+void SongPlayer::clearQueue() {
+    _queueHead = 0;
+    _queueCount = 0;
+    _parsed = false;
+}
+
+// ============== Timer ==============
+
+void SongPlayer::timerEntry(void* arg) {
+    static_cast<SongPlayer*>(arg)->onTimer();
+}
+
+// esp_timer task: everything due goes to the ring, then the timer is re-armed
+void SongPlayer::onTimer() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_state != PLAYER_PLAYING || _loading) {
+        xSemaphoreGive(_mutex);
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint64_t position = songPosition(now);
+    bool emitted = false;
+
+    while (_queueCount > 0 && _queue[_queueHead].atUs <= position) {
+        const QueuedNote& note = _queue[_queueHead];
+        _lateness.observe((uint32_t)(now - wallTime(note.atUs)));
+        midiEvents->push(MIDI_SOURCE_APP, note.status, note.note, note.velocity);
+
+        uint32_t bit = 1u << (note.note & 31);
+        if ((note.status & 0xF0) == 0x90 && note.velocity > 0) {
+            _sounding[note.note >> 5] |= bit;
+            _notesPlayed++;
+        } else {
+            _sounding[note.note >> 5] &= ~bit;
+        }
+        _queueHead = (_queueHead + 1) & (PLAYER_QUEUE_SIZE - 1);
+        _queueCount--;
+        emitted = true;
+    }
+
+    if (_queueCount == 0 && _parsed && position >= _endUs) {
+        // Song over
+        _state = PLAYER_STOPPED;
+        _ended = true;
+        releaseNotes();
+    } else {
+        if (_queueCount == 0 && !_parsed) _underruns++;
+        arm();
+    }
+    bool refill = !_parsed && _queueCount <= PLAYER_QUEUE_SIZE / 2;
+    xSemaphoreGive(_mutex);
+
+    if (emitted && renderTask) renderTask->wake();
+    if (refill) xTaskNotifyGive(_task);
+}
+
+// ============== Player Task ==============
+
+void SongPlayer::taskEntry(void* arg) {
+    static_cast<SongPlayer*>(arg)->run();
+}
+
+void SongPlayer::run() {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Requests first; with none left, keep the queue ahead of the timer
+        for (;;) {
+            char name[PLAYER_MAX_NAME + 1];
+            xSemaphoreTake(_mutex, portMAX_DELAY);
+            Request request = _request;
+            _request = REQ_NONE;
+            uint32_t generation = _generation;
+            uint64_t target = _targetUs;
+            memcpy(name, _filename, sizeof(name));
+            xSemaphoreGive(_mutex);
+
+            if (request == REQ_CLOSE) {
+                _file.close();
+                _openName[0] = '\0';
+                continue;
+            }
+            if (request == REQ_NONE) {
+                fill(generation);
+                break;
+            }
+
+            // Load or seek: parse up to the target, keep the first note from there
+            bool ok = (request == REQ_SEEK && _file) || load(name);
+            QueuedNote first;
+            bool hasFirst = false;
+            if (ok) {
+                _passUs = 0;
+                ok = rewind();
+                while (ok && (hasFirst = nextNote(first)) && first.atUs < target) {
+                }
+            }
+
+            xSemaphoreTake(_mutex, portMAX_DELAY);
+            if (generation == _generation) {
+                if (!ok) {
+                    LOG_E("Player: song file unreadable");
+                    _state = PLAYER_STOPPED;
+                    _ended = true;
+                } else {
+                    _durationUs = _songDurationUs;
+                    _endUs = _songDurationUs;
+                    if (hasFirst) {
+                        _queue[0] = first;
+                        _queueCount = 1;
+                    } else {
+                        _parsed = !_loop;   // Seek past the end
+                    }
+                    _loading = false;
+                    _originSongUs = min(target, _endUs);
+                    _originUs = esp_timer_get_time();
+                    if (_state == PLAYER_PLAYING) arm();
+                }
+            }
+            xSemaphoreGive(_mutex);
+        }
+    }
+}
+
+// Queue notes until the queue is full, the song is parsed or a request waits
+void SongPlayer::fill(uint32_t generation) {
+    for (;;) {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool go = generation == _generation && _request == REQ_NONE && !_loading
+               && _state != PLAYER_STOPPED && !_parsed && _queueCount < PLAYER_QUEUE_SIZE;
+        bool loop = _loop;
+        xSemaphoreGive(_mutex);
+        if (!go || !_file) return;
+
+        QueuedNote note;
+        if (!nextNote(note)) {
+            if (loop && _songDurationUs > 0) {
+                // Next pass continues the song clock
+                _passUs += _songDurationUs;
+                if (rewind()) {
+                    xSemaphoreTake(_mutex, portMAX_DELAY);
+                    if (generation == _generation) _endUs = _passUs + _songDurationUs;
+                    xSemaphoreGive(_mutex);
+                    continue;
+                }
+            }
+            xSemaphoreTake(_mutex, portMAX_DELAY);
+            if (generation == _generation) {
+                _parsed = true;
+                if (_state == PLAYER_PLAYING && _queueCount == 0) arm();
+            }
+            xSemaphoreGive(_mutex);
+            return;
+        }
+
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        if (generation == _generation) {
+            _queue[(_queueHead + _queueCount) & (PLAYER_QUEUE_SIZE - 1)] = note;
+            _queueCount++;
+            if (_queueCount == 1 && _state == PLAYER_PLAYING) arm();
+        }
+        xSemaphoreGive(_mutex);
+    }
+}
+
+// ============== SMF Parser ==============
+
+// Header and track chunks, then one pass for the duration
+bool SongPlayer::load(const char* name) {
+    _file.close();
+    _openName[0] = '\0';
+    _file = openSong(name);
+    if (!_file) return false;
+
+    uint8_t header[14];
+    if (_file.read(header, sizeof(header)) != sizeof(header) || memcmp(header, "MThd", 4) != 0) {
+        return false;
+    }
+    uint32_t headerLen = readBigEndian(header + 4, 4);
+    uint16_t format = readBigEndian(header + 8, 2);
+    uint16_t division = readBigEndian(header + 12, 2);
+    if (headerLen < 6 || format > 1) return false;  // Type 2 holds independent songs
+
+    if (division & 0x8000) {
+        // SMPTE: frames per second (negative) times ticks per frame, no tempo
+        _smpte = true;
+        _division = (uint16_t)(-(int8_t)(division >> 8)) * (division & 0xFF);
+    } else {
+        _smpte = false;
+        _division = division;
+    }
+    if (_division == 0) return false;
+
+    // Track chunks; chunks of other types are skipped
+    _trackCount = 0;
+    uint32_t offset = 8 + headerLen;
+    uint32_t size = _file.size();
+    uint8_t chunk[8];
+    while (offset + 8 <= size && _file.seek(offset) && _file.read(chunk, 8) == 8) {
+        uint32_t length = readBigEndian(chunk + 4, 4);
+        if (memcmp(chunk, "MTrk", 4) == 0) {
+            if (_trackCount == PLAYER_MAX_TRACKS) {
+                LOG_W("Player: only the first %u tracks are played", PLAYER_MAX_TRACKS);
+                break;
+            }
+            Track& track = _tracks[_trackCount++];
+            track.start = offset + 8;
+            track.end = min(offset + 8 + length, size);
+        }
+        offset += 8 + length;
+    }
+    if (_trackCount == 0) return false;
+
+    _passUs = 0;
+    if (!rewind()) return false;
+    QueuedNote note;
+    while (nextNote(note)) {
+    }
+    _songDurationUs = _songUs;
+
+    strncpy(_openName, name, PLAYER_MAX_NAME);
+    _openName[PLAYER_MAX_NAME] = '\0';
+    return true;
+}
+
+// Every track back to its first event; song time starts at _passUs
+bool SongPlayer::rewind() {
+    _tick = 0;
+    _tempo = _smpte ? SMPTE_TEMPO : DEFAULT_TEMPO;
+    _songUs = _passUs;
+    _remainder = 0;
+    for (uint8_t t = 0; t < _trackCount; t++) {
+        Track& track = _tracks[t];
+        track.pos = track.start;
+        track.tick = 0;
+        track.runningStatus = 0;
+        track.bufferLen = 0;
+        track.bufferPos = 0;
+        uint32_t delta;
+        track.done = !readVarLen(track, delta);
+        track.tick = delta;
+    }
+    return (bool)_file;
+}
+
+bool SongPlayer::readByte(Track& track, uint8_t& out) {
+    if (track.bufferPos == track.bufferLen) {
+        if (track.pos >= track.end) return false;
+        uint8_t n = min(track.end - track.pos, (uint32_t)PLAYER_TRACK_BUFFER);
+        if (!_file.seek(track.pos) || _file.read(track.buffer, n) != n) return false;
+        track.pos += n;
+        track.bufferLen = n;
+        track.bufferPos = 0;
+    }
+    out = track.buffer[track.bufferPos++];
+    return true;
+}
+
+bool SongPlayer::readVarLen(Track& track, uint32_t& out) {
+    out = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        uint8_t b;
+        if (!readByte(track, b)) return false;
+        out = (out << 7) | (b & 0x7F);
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool SongPlayer::skip(Track& track, uint32_t count) {
+    uint32_t buffered = track.bufferLen - track.bufferPos;
+    if (count <= buffered) {
+        track.bufferPos += count;
+        return true;
+    }
+    track.bufferPos = track.bufferLen;
+    track.pos += count - buffered;
+    return track.pos <= track.end;
+}
+
+// Next note on/off of the merged tracks, tempo changes applied on the way.
+// Returns false at the end of the song.
+bool SongPlayer::nextNote(QueuedNote& out) {
+    for (;;) {
+        Track* track = nullptr;
+        for (uint8_t t = 0; t < _trackCount; t++) {
+            if (!_tracks[t].done && (!track || _tracks[t].tick < track->tick)) track = &_tracks[t];
+        }
+        if (!track) return false;
+
+        // Song time of this tick at the tempo so far
+        uint64_t scaled = (uint64_t)(track->tick - _tick) * _tempo + _remainder;
+        _songUs += scaled / _division;
+        _remainder = scaled % _division;
+        _tick = track->tick;
+
+        bool ok;
+        bool isNote = false;
+        uint8_t status, data1 = 0, data2 = 0;
+        if (!readByte(*track, status)) {
+            ok = false;
+        } else if (status == 0xFF) {
+            uint8_t type;
+            uint32_t length;
+            ok = readByte(*track, type) && readVarLen(*track, length);
+            if (ok && type == 0x51 && length == 3 && !_smpte) {
+                uint8_t b0, b1, b2;
+                ok = readByte(*track, b0) && readByte(*track, b1) && readByte(*track, b2);
+                if (ok) _tempo = max((uint32_t)(b0 << 16 | b1 << 8 | b2), (uint32_t)1);
+            } else if (ok) {
+                ok = skip(*track, length);
+            }
+            if (ok && type == 0x2F) {
+                track->done = true;
+                continue;
+            }
+        } else if (status == 0xF0 || status == 0xF7) {
+            uint32_t length;
+            ok = readVarLen(*track, length) && skip(*track, length);
+        } else if (status > 0xF7) {
+            ok = false;     // System real-time has no place in a file
+        } else {
+            if (status < 0x80) {
+                // Running status: this byte was the first data byte
+                data1 = status;
+                status = track->runningStatus;
+                ok = status != 0;
+            } else {
+                track->runningStatus = status;
+                ok = readByte(*track, data1);
+            }
+            uint8_t type = status & 0xF0;
+            if (ok && type != 0xC0 && type != 0xD0) ok = readByte(*track, data2);
+            isNote = ok && (type == 0x80 || type == 0x90) && (status & 0x0F) != DRUM_CHANNEL;
+        }
+
+        uint32_t delta;
+        if (!ok || !readVarLen(*track, delta)) {
+            track->done = true;     // Truncated track - what was read still plays
+        } else {
+            track->tick += delta;
+        }
+
+        if (isNote) {
+            out.atUs = _songUs;
+            out.status = status;
+            out.note = data1 & 0x7F;
+            out.velocity = data2 & 0x7F;
+            return true;
+        }
+    }
+}
+
+// ============== Status ==============
+
+PlayerState SongPlayer::getState() const {
+    return _state;
+}
+
+const char* SongPlayer::getFilename() const {
+    return _filename;
+}
+
+uint32_t SongPlayer::getPositionMs() const {
+    if (_mutex == nullptr) return 0;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    uint64_t position = songPosition(esp_timer_get_time());
+    uint64_t duration = _durationUs;
+    xSemaphoreGive(_mutex);
+
+    // Song time keeps counting over loop passes
+    if (duration > 0) position = _loop ? position % duration : min(position, duration);
+    return position / 1000;
+}
+
+uint32_t SongPlayer::getDurationMs() const {
+    return _durationUs / 1000;
+}
+
+uint16_t SongPlayer::getSpeed() const {
+    return _speed;
+}
+
+bool SongPlayer::isLooping() const {
+    return _loop;
+}
+
+uint32_t SongPlayer::getNotesPlayed() const {
+    return _notesPlayed;
+}
+
+uint32_t SongPlayer::getUnderruns() const {
+    return _underruns;
+}
+
+const MetricHistogram& SongPlayer::getLatenessHistogram() const {
+    return _lateness;
+}
@@ -0,0 +1,162 @@
+#ifndef SONG_PLAYER_H
+#define SONG_PLAYER_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <esp_timer.h>
+#include "config.h"
+#include "metrics.h"
+
+enum PlayerState : uint8_t {
+    PLAYER_STOPPED = 0,
+    PLAYER_PLAYING = 1,
+    PLAYER_PAUSED = 2
+};
+
+// Standard MIDI File (type 0 or 1) played on the device (SPECIFICATION.md 2.3).
+//
+// A player task reads the file from LittleFS through a small read-ahead
+// buffer per track, merges the tracks in tick order, applies tempo
+// changes and queues the notes with their song time in us. A one-shot
+// esp_timer is armed for the first queued note; its callback pushes every
+// note that is due into the MIDI event ring (as MIDI_SOURCE_APP, like
+// play_note) and re-arms itself for the next one. Timing therefore does
+// not depend on the task being scheduled, nor on WiFi or the app - only
+// on the queue staying ahead, which the task refills whenever it is half
+// empty.
+//
+// Song time maps to esp_timer time through an origin and a speed, so
+// tempo scaling, pause and resume only move the origin. Seeking re-parses
+// from the start (the tempo map has to be followed) and drops the notes
+// before the target. Looping restarts the parser with the song time
+// carried on, so the clock never jumps.
+//
+// Control methods may be called from any task; they take the player's
+// own mutex and hand file work to the player task.
+class SongPlayer {
+public:
+    SongPlayer();
+
+    // LittleFS must be mounted: creates the timer and the player task
+    bool begin();
+
+    // Start a song from the upload directory or the built-in songs.
+    // Fails if neither has a file with a MIDI header under that name.
+    bool play(const char* filename, uint32_t positionMs = 0);
+    void stop();
+    void pause();
+    void resume();
+    void seek(uint32_t positionMs);
+    void setSpeed(uint16_t percent);    // Clamped to PLAYER_MIN_SPEED..PLAYER_MAX_SPEED
+    void setLoop(bool loop);
+
+    // Housekeeping: returns true once after the song ended or failed to load
+    bool poll();
+
+    PlayerState getState() const;
+    const char* getFilename() const;
+    uint32_t getPositionMs() const;
+    uint32_t getDurationMs() const;     // 0 until the file was scanned
+    uint16_t getSpeed() const;
+    bool isLooping() const;
+    uint32_t getNotesPlayed() const;
+    uint32_t getUnderruns() const;      // Notes the queue did not have in time
+    const MetricHistogram& getLatenessHistogram() const;
+
+    // Song name usable as a file name (no directories)
+    static bool isValidName(const char* name);
+
+private:
+    struct QueuedNote {
+        uint64_t atUs;          // Song time
+        uint8_t status;
+        uint8_t note;
+        uint8_t velocity;
+    };
+
+    struct Track {
+        uint32_t start;         // First event of the track chunk
+        uint32_t pos;           // Next byte in the file
+        uint32_t end;           // End of the track chunk
+        uint32_t tick;          // Of the next event
+        uint8_t runningStatus;
+        bool done;
+        uint8_t buffer[PLAYER_TRACK_BUFFER];
+        uint8_t bufferLen;
+        uint8_t bufferPos;
+    };
+
+    enum Request : uint8_t {
+        REQ_NONE = 0,
+        REQ_LOAD,               // Open _filename, play from _targetUs
+        REQ_SEEK,               // Same file, from _targetUs
+        REQ_CLOSE
+    };
+
+    // Shared - under _mutex
+    SemaphoreHandle_t _mutex;
+    esp_timer_handle_t _timer;
+    TaskHandle_t _task;
+    volatile PlayerState _state;
+    char _filename[PLAYER_MAX_NAME + 1];
+    Request _request;
+    uint32_t _generation;       // Bumped by every load/seek - stale notes are dropped
+    uint64_t _targetUs;
+    QueuedNote _queue[PLAYER_QUEUE_SIZE];
+    uint8_t _queueHead;
+    uint8_t _queueCount;
+    bool _loading;              // Load or seek pending, the clock stands still
+    bool _parsed;               // Parser reached the end, nothing more will be queued
+    bool _ended;
+    int64_t _originUs;          // esp_timer time at _originSongUs
+    uint64_t _originSongUs;
+    uint64_t _endUs;            // Song time the current pass ends
+    uint64_t _durationUs;       // Of the loaded song, 0 until scanned
+    uint16_t _speed;
+    bool _loop;
+    uint32_t _sounding[4];      // Notes switched on and not off yet
+    uint32_t _notesPlayed;
+    uint32_t _underruns;
+    MetricHistogram _lateness;
+
+    // Parser - player task only
+    File _file;
+    char _openName[PLAYER_MAX_NAME + 1];
+    uint64_t _songDurationUs;
+    uint16_t _division;         // Ticks per quarter note (per second for SMPTE)
+    bool _smpte;                // SMPTE time - tempo events do not apply
+    uint8_t _trackCount;
+    Track _tracks[PLAYER_MAX_TRACKS];
+    uint32_t _tick;
+    uint32_t _tempo;            // us per quarter note
+    uint64_t _songUs;           // At _tick
+    uint32_t _remainder;        // Sub-us part of _songUs, in 1/_division us
+    uint64_t _passUs;           // Song time the current pass started
+
+    // Song clock - under _mutex
+    uint64_t songPosition(int64_t nowUs) const;
+    int64_t wallTime(uint64_t songUs) const;
+    void arm();
+    void rebase(int64_t nowUs);
+    void releaseNotes();
+    void clearQueue();
+
+    static void timerEntry(void* arg);
+    void onTimer();
+
+    static void taskEntry(void* arg);
+    void run();
+    bool load(const char* name);
+    bool rewind();
+    bool nextNote(QueuedNote& out);
+    bool readByte(Track& track, uint8_t& out);
+    bool readVarLen(Track& track, uint32_t& out);
+    bool skip(Track& track, uint32_t count);
+    void fill(uint32_t generation);
+
+    static File openSong(const char* name);
+};
+
+extern SongPlayer* songPlayer;
+
+#endif // SONG_PLAYER_H
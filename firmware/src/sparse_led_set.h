@@ -0,0 +1,56 @@
+#ifndef SPARSE_LED_SET_H
+#define SPARSE_LED_SET_H
+
+#include <Arduino.h>
+
+// Set of LED indices with O(1) add/remove/contains and dense iteration.
+// Classic sparse-set layout: _items holds the members packed at the front,
+// _pos maps an index back to its slot. Removing swaps the last member into
+// the hole, so iterate backwards when removing during a walk.
+template <uint16_t CAPACITY>
+class SparseLedSet {
+public:
+    SparseLedSet() : _count(0) {
+        memset(_pos, 0xFF, sizeof(_pos));
+    }
+
+    bool contains(uint16_t index) const {
+        return index < CAPACITY && _pos[index] != NONE;
+    }
+
+    void add(uint16_t index) {
+        if (index >= CAPACITY || _pos[index] != NONE) return;
+        _pos[index] = _count;
+        _items[_count++] = index;
+    }
+
+    void remove(uint16_t index) {
+        if (index >= CAPACITY || _pos[index] == NONE) return;
+        uint16_t slot = _pos[index];
+        uint16_t last = _items[--_count];
+        _items[slot] = last;
+        _pos[last] = slot;
+        _pos[index] = NONE;
+    }
+
+    void addAll(uint16_t count) {
+        for (uint16_t i = 0; i < count && i < CAPACITY; i++) add(i);
+    }
+
+    void clear() {
+        for (uint16_t i = 0; i < _count; i++) _pos[_items[i]] = NONE;
+        _count = 0;
+    }
+
+    uint16_t size() const { return _count; }
+    uint16_t operator[](uint16_t slot) const { return _items[slot]; }
+
+private:
+    static const uint16_t NONE = 0xFFFF;
+
+    uint16_t _items[CAPACITY];
+    uint16_t _pos[CAPACITY];
+    uint16_t _count;
+};
+
+#endif // SPARSE_LED_SET_H
@@ -0,0 +1,493 @@
+#include "usb_midi.h"
+#include "midi_event_ring.h"
+#include "boot_timeline.h"
+#include "log_ring.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+USBMidiHost* usbMidi = nullptr;
+
+// Message class of the channel voice CINs 0x8..0xE
+static const uint16_t CHANNEL_CLASS[7] = {
+    USB_MIDI_NOTE,              // 0x8 note off
+    USB_MIDI_NOTE,              // 0x9 note on
+    USB_MIDI_POLY_PRESSURE,     // 0xA
+    USB_MIDI_CONTROL,           // 0xB
+    USB_MIDI_PROGRAM,           // 0xC
+    USB_MIDI_CHANNEL_PRESSURE,  // 0xD
+    USB_MIDI_PITCH_BEND         // 0xE
+};
+
+USBMidiHost::USBMidiHost()
+    : _clientHandle(nullptr)
+    , _deviceHandle(nullptr)
+    , _inTransfers(0)
+    , _inFlight(0)
+    , _libTask(nullptr)
+    , _clientTask(nullptr)
+    , _interface(0)
+    , _altSetting(0)
+    , _inEndpoint(0)
+    , _inMaxPacket(0)
+    , _isReady(false)
+    , _connected(false)
+    , _interfaceClaimed(false)
+    , _closing(false)
+    , _pendingAddress(0)
+    , _forwardMask(DEFAULT_FORWARD)
+    , _cableMask(0xFFFF)
+    , _sysExOpen(0)
+    , _connectionCb(nullptr)
+    , _eventsCb(nullptr)
+{
+    memset(_midiIn, 0, sizeof(_midiIn));
+}
+
+bool USBMidiHost::begin(uint8_t inTransfers) {
+    if (_clientHandle != nullptr) return true;
+
+    const usb_host_config_t hostConfig = {
+        .skip_phy_setup = false,
+        .intr_flags = ESP_INTR_FLAG_LEVEL1,
+    };
+    esp_err_t err = usb_host_install(&hostConfig);
+    if (err != ESP_OK) {
+        LOG_E("USB: Host install FAIL (%d)", err);
+        return false;
+    }
+
+    // Library daemon - enumeration only progresses while it runs
+    if (xTaskCreatePinnedToCore(libTaskEntry, "usb_lib", USB_LIB_TASK_STACK, this,
+                                USB_LIB_TASK_PRIORITY, &_libTask, USB_LIB_TASK_CORE) != pdPASS) {
+        LOG_E("USB: Library task FAIL");
+        return false;
+    }
+
+    const usb_host_client_config_t clientConfig = {
+        .is_synchronous = false,
+        .max_num_event_msg = USB_MIDI_CLIENT_EVENTS,
+        .async = {
+            .client_event_callback = clientEventCallback,
+            .callback_arg = this
+        }
+    };
+    err = usb_host_client_register(&clientConfig, &_clientHandle);
+    if (err != ESP_OK) {
+        LOG_E("USB: Client register FAIL (%d)", err);
+        _clientHandle = nullptr;
+        return false;
+    }
+
+    // IN buffers are allocated once and reused across reconnects
+    if (inTransfers < 1) inTransfers = 1;
+    if (inTransfers > MIDI_IN_BUFFERS) inTransfers = MIDI_IN_BUFFERS;
+    for (uint8_t i = 0; i < inTransfers; i++) {
+        err = usb_host_transfer_alloc(USB_MIDI_TRANSFER_SIZE, 0, &_midiIn[i]);
+        if (err != ESP_OK) {
+            LOG_E("USB: Transfer alloc %d FAIL (%d)", i, err);
+            _midiIn[i] = nullptr;
+            break;
+        }
+        _midiIn[i]->callback = transferCallback;
+        _midiIn[i]->context = this;
+        _inTransfers = i + 1;
+    }
+    if (_inTransfers == 0) return false;
+
+    return xTaskCreatePinnedToCore(clientTaskEntry, "usb_client", USB_CLIENT_TASK_STACK, this,
+                                   USB_CLIENT_TASK_PRIORITY, &_clientTask, USB_CLIENT_TASK_CORE) == pdPASS;
+}
+
+bool USBMidiHost::isConnected() const {
+    return _connected;
+}
+
+bool USBMidiHost::isReady() const {
+    return _isReady;
+}
+
+void USBMidiHost::setConnectionCallback(MidiConnectionCallback cb) {
+    _connectionCb = cb;
+}
+
+void USBMidiHost::setEventsCallback(MidiEventsCallback cb) {
+    _eventsCb = cb;
+}
+
+// ============== Filtering ==============
+
+void USBMidiHost::setForwardMask(uint16_t mask) {
+    _forwardMask = mask;
+}
+
+uint16_t USBMidiHost::getForwardMask() const {
+    return _forwardMask;
+}
+
+void USBMidiHost::setCableMask(uint16_t mask) {
+    _cableMask = mask;
+}
+
+uint16_t USBMidiHost::getCableMask() const {
+    return _cableMask;
+}
+
+// ============== Tasks ==============
+
+void USBMidiHost::libTaskEntry(void* arg) {
+    for (;;) {
+        uint32_t eventFlags;
+        usb_host_lib_handle_events(portMAX_DELAY, &eventFlags);
+    }
+}
+
+// Device events and transfer callbacks all run here, so the driver state
+// needs no locking
+void USBMidiHost::clientTaskEntry(void* arg) {
+    USBMidiHost* self = static_cast<USBMidiHost*>(arg);
+    for (;;) {
+        usb_host_client_handle_events(self->_clientHandle, portMAX_DELAY);
+    }
+}
+
+void USBMidiHost::clientEventCallback(const usb_host_client_event_msg_t* msg, void* arg) {
+    USBMidiHost* self = static_cast<USBMidiHost*>(arg);
+    switch (msg->event) {
+        case USB_HOST_CLIENT_EVENT_NEW_DEV:
+            LOG_I("USB: New device at address %d", msg->new_dev.address);
+            self->onDeviceConnected(msg->new_dev.address);
+            break;
+        case USB_HOST_CLIENT_EVENT_DEV_GONE:
+            LOG_I("USB: Device disconnected");
+            self->onDeviceDisconnected(msg->dev_gone.dev_hdl);
+            break;
+    }
+}
+
+// ============== Device Handling ==============
+
+// MIDI Streaming interface: audio class, subclass 3
+bool USBMidiHost::checkInterfaceDescriptor(const uint8_t* p) {
+    if (p[5] != 0x01 || p[6] != 0x03) return false;
+    _interface = p[2];
+    _altSetting = p[3];
+    return true;
+}
+
+// First IN endpoint of the MIDI interface - bulk per spec, some keyboards use interrupt
+bool USBMidiHost::prepareEndpoints(const uint8_t* p) {
+    uint8_t address = p[2];
+    uint8_t type = p[3] & 0x03;
+    if (!(address & 0x80) || (type != 0x02 && type != 0x03)) return false;
+
+    _inEndpoint = address;
+    _inMaxPacket = p[4] | (p[5] << 8);
+    return true;
+}
+
+bool USBMidiHost::parseConfigDescriptor(const usb_config_desc_t* configDesc) {
+    const uint8_t* p = &configDesc->val[0];
+    uint16_t offset = 0;
+    bool inMidi = false;
+
+    while (offset + 2 <= configDesc->wTotalLength) {
+        uint8_t bLength = p[0];
+        uint8_t bDescType = p[1];
+        if (bLength == 0) break;
+
+        if (bDescType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+            inMidi = checkInterfaceDescriptor(p);
+        } else if (bDescType == USB_B_DESCRIPTOR_TYPE_ENDPOINT && inMidi && prepareEndpoints(p)) {
+            return true;
+        }
+
+        offset += bLength;
+        p += bLength;
+    }
+    return false;
+}
+
+void USBMidiHost::onDeviceConnected(uint8_t address) {
+    if (_deviceHandle != nullptr) {
+        if (_closing) {
+            _pendingAddress = address;  // Opened as soon as the old device is closed
+        } else {
+            LOG_W("USB: Device %d ignored - one is already open", address);
+        }
+        return;
+    }
+
+    esp_err_t err = usb_host_device_open(_clientHandle, address, &_deviceHandle);
+    if (err != ESP_OK) {
+        LOG_E("USB: Opening device FAIL (%d)", err);
+        _deviceHandle = nullptr;
+        return;
+    }
+    _connected = true;
+
+    const usb_device_desc_t* devDesc;
+    usb_host_get_device_descriptor(_deviceHandle, &devDesc);
+    LOG_I("USB: VID=0x%04X PID=0x%04X", devDesc->idVendor, devDesc->idProduct);
+
+    // A device without MIDI stays open (reported as connected) until it goes
+    const usb_config_desc_t* configDesc;
+    if (usb_host_get_active_config_descriptor(_deviceHandle, &configDesc) != ESP_OK) {
+        LOG_E("USB: Failed to get config descriptor");
+        return;
+    }
+    if (!parseConfigDescriptor(configDesc)) {
+        LOG_W("USB: No MIDI endpoint found");
+        return;
+    }
+    LOG_I("USB: MIDI interface #%d, IN endpoint 0x%02X, maxPacket=%d",
+          _interface, _inEndpoint, _inMaxPacket);
+
+    // Whole packets only; a full-speed MIDI endpoint is at most 64 bytes
+    uint16_t numBytes = _inMaxPacket > 0 ? USB_MIDI_TRANSFER_SIZE / _inMaxPacket * _inMaxPacket : 0;
+    if (numBytes == 0) {
+        LOG_E("USB: maxPacket %d too large", _inMaxPacket);
+        return;
+    }
+
+    err = usb_host_interface_claim(_clientHandle, _deviceHandle, _interface, _altSetting);
+    if (err != ESP_OK) {
+        LOG_E("USB: Claim interface FAIL (%d)", err);
+        return;
+    }
+    _interfaceClaimed = true;
+    _sysExOpen = 0;
+
+    // Completions are handled in this task, so none can run before the loop ends
+    _isReady = true;
+    for (uint8_t i = 0; i < _inTransfers; i++) {
+        _midiIn[i]->device_handle = _deviceHandle;
+        _midiIn[i]->bEndpointAddress = _inEndpoint;
+        _midiIn[i]->num_bytes = numBytes;
+
+        err = usb_host_transfer_submit(_midiIn[i]);
+        if (err != ESP_OK) {
+            LOG_E("USB: Transfer submit %d FAIL (%d)", i, err);
+        } else {
+            _inFlight++;
+        }
+    }
+    if (_inFlight == 0) {
+        _isReady = false;
+        return;
+    }
+
+    _connects.inc();
+    LOG_I("USB: MIDI ready (%d transfers in flight)", _inFlight);
+    if (_connectionCb) _connectionCb(true);
+}
+
+void USBMidiHost::onDeviceDisconnected(usb_device_handle_t handle) {
+    if (_deviceHandle == nullptr || handle != _deviceHandle) return;   // Not the device we opened
+
+    bool wasReady = _isReady;
+    _isReady = false;       // Returning transfers are not resubmitted
+    _closing = true;
+
+    if (_inFlight > 0) {
+        // Hands the queued transfers back through the callback; the last one closes
+        usb_host_endpoint_halt(_deviceHandle, _inEndpoint);
+        usb_host_endpoint_flush(_deviceHandle, _inEndpoint);
+    } else {
+        closeDevice();
+    }
+
+    if (wasReady && _connectionCb) _connectionCb(false);
+}
+
+void USBMidiHost::closeDevice() {
+    if (_interfaceClaimed) {
+        usb_host_interface_release(_clientHandle, _deviceHandle, _interface);
+        _interfaceClaimed = false;
+    }
+    if (_deviceHandle != nullptr) {
+        usb_host_device_close(_clientHandle, _deviceHandle);
+        _deviceHandle = nullptr;
+    }
+
+    _closing = false;
+    _connected = false;
+    _inEndpoint = 0;
+    _sysExOpen = 0;
+
+    if (_pendingAddress != 0) {
+        uint8_t address = _pendingAddress;
+        _pendingAddress = 0;
+        onDeviceConnected(address);
+    }
+}
+
+// ============== Transfers ==============
+
+void USBMidiHost::transferCallback(usb_transfer_t* transfer) {
+    static_cast<USBMidiHost*>(transfer->context)->onTransfer(transfer);
+}
+
+void USBMidiHost::onTransfer(usb_transfer_t* transfer) {
+    // Key-to-light latency starts here; all events of a transfer share it
+    uint32_t timeUs = MidiEventRing::now();
+    bool resubmit = _isReady;
+
+    switch (transfer->status) {
+        case USB_TRANSFER_STATUS_COMPLETED:
+            _transfers.inc();
+            if (transfer->actual_num_bytes > 0 &&
+                processMidiData(transfer->data_buffer, transfer->actual_num_bytes, timeUs) > 0 &&
+                _eventsCb) {
+                _eventsCb();
+            }
+            break;
+        case USB_TRANSFER_STATUS_STALL:
+            _stalls.inc();
+            if (resubmit) usb_host_endpoint_clear(_deviceHandle, _inEndpoint);
+            break;
+        case USB_TRANSFER_STATUS_NO_DEVICE:
+        case USB_TRANSFER_STATUS_CANCELED:
+            resubmit = false;   // Unplugged - DEV_GONE follows
+            break;
+        default:
+            _transferErrors.inc();
+            break;
+    }
+
+    if (resubmit) {
+        if (usb_host_transfer_submit(transfer) == ESP_OK) return;
+        _resubmitErrors.inc();
+    }
+
+    _inFlight--;
+    if (_closing && _inFlight == 0) {
+        closeDevice();
+    } else if (_isReady && _inFlight == 0) {
+        LOG_E("USB: No IN transfer left in flight");
+    }
+}
+
+// ============== Parsing ==============
+
+bool USBMidiHost::forward(uint16_t cls, uint8_t status, uint8_t data1, uint8_t data2, uint32_t timeUs) {
+    if (!(_forwardMask & cls)) {
+        _filtered.inc();
+        return false;
+    }
+    MidiEvent ev = { timeUs, MIDI_SOURCE_USB, status, (uint8_t)(data1 & 0x7F), (uint8_t)(data2 & 0x7F) };
+    midiEvents->push(ev);
+    _forwarded.inc();
+    return true;
+}
+
+// Runs in the transfer callback: decode, timestamp and enqueue only
+uint8_t USBMidiHost::processMidiData(const uint8_t* data, size_t length, uint32_t timeUs) {
+    if (!midiEvents) return 0;
+
+    uint8_t pushed = 0;
+    for (size_t i = 0; i + 4 <= length; i += 4) {
+        const uint8_t* pkt = data + i;
+        uint8_t cin = pkt[0] & 0x0F;
+        uint16_t cableBit = 1 << (pkt[0] >> 4);
+
+        // Reserved CINs - also the all-zero padding some devices send
+        if (cin <= 0x1) continue;
+
+        if (!(_cableMask & cableBit)) {
+            _filtered.inc();
+            continue;
+        }
+
+        if (cin >= 0x8 && cin <= 0xE) {
+            // Channel voice: the status nibble repeats the CIN
+            if ((pkt[1] >> 4) != cin) {
+                _malformed.inc();
+                continue;
+            }
+            if (forward(CHANNEL_CLASS[cin - 0x8], pkt[1], pkt[2], pkt[3], timeUs)) {
+                pushed++;
+                if (cin == 0x9 && pkt[3] > 0 && bootTimeline) bootTimeline->mark(BOOT_FIRST_NOTE);
+            }
+            continue;
+        }
+
+        switch (cin) {
+            case 0x4:   // SysEx starts or continues, 3 bytes
+                _sysExOpen |= cableBit;
+                break;
+            case 0x5:   // SysEx ends with 1 byte, or single-byte system common (tune request)
+                if (pkt[1] == 0xF7) {
+                    _sysEx.inc();
+                    _sysExOpen &= ~cableBit;
+                } else if (forward(USB_MIDI_SYSTEM_COMMON, pkt[1], 0, 0, timeUs)) {
+                    pushed++;
+                }
+                break;
+            case 0x6:   // SysEx ends with 2 bytes
+            case 0x7:   // SysEx ends with 3 bytes
+                _sysEx.inc();
+                _sysExOpen &= ~cableBit;
+                break;
+            case 0x2:   // 2-byte system common (MTC quarter frame, song select)
+            case 0x3:   // 3-byte system common (song position)
+                if (forward(USB_MIDI_SYSTEM_COMMON, pkt[1], pkt[2], cin == 0x3 ? pkt[3] : 0, timeUs)) {
+                    pushed++;
+                }
+                break;
+            case 0xF:   // Single byte: real-time, or SysEx sent unparsed byte by byte
+                if (pkt[1] >= 0xF8) {
+                    if (forward(USB_MIDI_REALTIME, pkt[1], 0, 0, timeUs)) pushed++;
+                } else if (pkt[1] == 0xF0) {
+                    _sysExOpen |= cableBit;
+                } else if (pkt[1] == 0xF7) {
+                    _sysEx.inc();
+                    _sysExOpen &= ~cableBit;
+                } else if (!(_sysExOpen & cableBit)) {
+                    _malformed.inc();
+                }
+                break;
+        }
+    }
+    return pushed;
+}
+
+// ============== Statistics ==============
+
+uint8_t USBMidiHost::getInTransferCount() const {
+    return _inTransfers;
+}
+
+uint32_t USBMidiHost::getTransferCount() const {
+    return _transfers.get();
+}
+
+uint32_t USBMidiHost::getTransferErrorCount() const {
+    return _transferErrors.get();
+}
+
+uint32_t USBMidiHost::getResubmitErrorCount() const {
+    return _resubmitErrors.get();
+}
+
+uint32_t USBMidiHost::getStallCount() const {
+    return _stalls.get();
+}
+
+uint32_t USBMidiHost::getForwardedCount() const {
+    return _forwarded.get();
+}
+
+uint32_t USBMidiHost::getFilteredCount() const {
+    return _filtered.get();
+}
+
+uint32_t USBMidiHost::getSysExCount() const {
+    return _sysEx.get();
+}
+
+uint32_t USBMidiHost::getMalformedCount() const {
+    return _malformed.get();
+}
+
+uint32_t USBMidiHost::getConnectCount() const {
+    return _connects.get();
+}
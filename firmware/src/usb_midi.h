@@ -3,54 +3,133 @@
 
 #include <Arduino.h>
 #include <usb/usb_host.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "config.h"
+#include "metrics.h"
 
-// Callback types for MIDI events
-typedef void (*MidiNoteCallback)(uint8_t channel, uint8_t note, uint8_t velocity);
-typedef void (*MidiControlChangeCallback)(uint8_t channel, uint8_t controller, uint8_t value);
+// Message classes that can be forwarded into the MIDI event ring
+enum UsbMidiClass : uint16_t {
+    USB_MIDI_NOTE             = 1 << 0,     // Note on / note off
+    USB_MIDI_POLY_PRESSURE    = 1 << 1,     // Polyphonic aftertouch
+    USB_MIDI_CONTROL          = 1 << 2,     // Control change (pedals, knobs)
+    USB_MIDI_PROGRAM          = 1 << 3,     // Program change
+    USB_MIDI_CHANNEL_PRESSURE = 1 << 4,     // Channel aftertouch
+    USB_MIDI_PITCH_BEND       = 1 << 5,
+    USB_MIDI_SYSTEM_COMMON    = 1 << 6,     // MTC quarter frame, song position/select, tune request
+    USB_MIDI_REALTIME         = 1 << 7      // Clock, start/stop, active sensing, reset
+};
+
+// Called when a MIDI device becomes ready (true) or a ready one goes away (false)
 typedef void (*MidiConnectionCallback)(bool connected);
 
+// Called after a transfer pushed events into the ring - wakes the consumers
+typedef void (*MidiEventsCallback)();
+
+// USB host driver for class-compliant MIDI devices.
+//
+// begin() installs the host library and runs two tasks: the library daemon
+// (enumeration) and the client, in which device events and transfer
+// callbacks are handled. Incoming USB-MIDI packets are decoded by Code Index
+// Number on every virtual cable; channel and system messages whose class is
+// in the forward mask are timestamped and pushed into midiEvents, everything
+// else (SysEx, aftertouch chatter, clock) is counted and dropped in the
+// callback so it never costs ring slots the notes need.
+//
+// Several IN transfers stay queued on the endpoint so packets arriving while
+// one buffer is being parsed are not NAKed. On disconnect the endpoint is
+// flushed and the device is closed once the last transfer has come back;
+// a device plugged in meanwhile is opened right after.
 class USBMidiHost {
 public:
+    static const uint16_t DEFAULT_FORWARD = USB_MIDI_NOTE | USB_MIDI_CONTROL
+                                          | USB_MIDI_PROGRAM | USB_MIDI_PITCH_BEND;
+
     USBMidiHost();
 
-    void begin();
-    void task();  // Call in loop()
+    // inTransfers: IN transfers kept in flight (1..MIDI_IN_BUFFERS)
+    bool begin(uint8_t inTransfers = USB_MIDI_IN_TRANSFERS);
 
-    bool isConnected() const;
-    bool isReady() const;
+    bool isConnected() const;   // Any device open
+    bool isReady() const;       // MIDI device streaming
 
-    // Set callbacks
-    void setNoteOnCallback(MidiNoteCallback cb);
-    void setNoteOffCallback(MidiNoteCallback cb);
-    void setControlChangeCallback(MidiControlChangeCallback cb);
+    // Callbacks run in the USB client task
     void setConnectionCallback(MidiConnectionCallback cb);
+    void setEventsCallback(MidiEventsCallback cb);
 
-    // Process incoming MIDI data (called from transfer callback)
-    void processMidiData(uint8_t* data, size_t length);
+    // Filtering (UsbMidiClass bits, one bit per cable number)
+    void setForwardMask(uint16_t mask);
+    uint16_t getForwardMask() const;
+    void setCableMask(uint16_t mask);
+    uint16_t getCableMask() const;
 
-    // Handle device events
-    void onDeviceConnected(uint8_t address);
-    void onDeviceDisconnected();
+    // Decode USB-MIDI event packets and push them; returns events pushed
+    uint8_t processMidiData(const uint8_t* data, size_t length, uint32_t timeUs);
+
+    // Statistics
+    uint8_t getInTransferCount() const;
+    uint32_t getTransferCount() const;          // Completed IN transfers
+    uint32_t getTransferErrorCount() const;     // Finished with an error status
+    uint32_t getResubmitErrorCount() const;     // Could not be queued again - buffer lost
+    uint32_t getStallCount() const;
+    uint32_t getForwardedCount() const;         // Events pushed into the ring
+    uint32_t getFilteredCount() const;          // Messages dropped by the forward/cable masks
+    uint32_t getSysExCount() const;             // Complete SysEx messages skipped
+    uint32_t getMalformedCount() const;         // Packets whose status byte does not match the CIN
+    uint32_t getConnectCount() const;
 
 private:
     usb_host_client_handle_t _clientHandle;
     usb_device_handle_t _deviceHandle;
     usb_transfer_t* _midiIn[MIDI_IN_BUFFERS];
-    usb_transfer_t* _midiOut;
+    uint8_t _inTransfers;
+    uint8_t _inFlight;          // Transfers owned by the host stack
+    TaskHandle_t _libTask;
+    TaskHandle_t _clientTask;
+
+    uint8_t _interface;
+    uint8_t _altSetting;
+    uint8_t _inEndpoint;
+    uint16_t _inMaxPacket;
 
-    bool _isMidi;
-    bool _isReady;
-    bool _connected;
+    volatile bool _isReady;
+    volatile bool _connected;
+    bool _interfaceClaimed;
+    bool _closing;              // Waiting for in-flight transfers before close
+    uint8_t _pendingAddress;    // Device that attached while closing, 0 = none
+
+    uint16_t _forwardMask;
+    uint16_t _cableMask;
+    uint16_t _sysExOpen;        // Per cable: inside a SysEx message
 
-    MidiNoteCallback _noteOnCb;
-    MidiNoteCallback _noteOffCb;
-    MidiControlChangeCallback _controlChangeCb;
     MidiConnectionCallback _connectionCb;
+    MidiEventsCallback _eventsCb;
+
+    MetricCounter _transfers;
+    MetricCounter _transferErrors;
+    MetricCounter _resubmitErrors;
+    MetricCounter _stalls;
+    MetricCounter _forwarded;
+    MetricCounter _filtered;
+    MetricCounter _sysEx;
+    MetricCounter _malformed;
+    MetricCounter _connects;
+
+    static void libTaskEntry(void* arg);
+    static void clientTaskEntry(void* arg);
+    static void clientEventCallback(const usb_host_client_event_msg_t* msg, void* arg);
+    static void transferCallback(usb_transfer_t* transfer);
+
+    void onDeviceConnected(uint8_t address);
+    void onDeviceDisconnected(usb_device_handle_t handle);
+    void onTransfer(usb_transfer_t* transfer);
+    void closeDevice();
+
+    bool checkInterfaceDescriptor(const uint8_t* p);
+    bool prepareEndpoints(const uint8_t* p);
+    bool parseConfigDescriptor(const usb_config_desc_t* configDesc);
 
-    void checkInterfaceDescriptor(const void* p);
-    void prepareEndpoints(const void* p);
-    void parseConfigDescriptor(const usb_config_desc_t* config_desc);
+    bool forward(uint16_t cls, uint8_t status, uint8_t data1, uint8_t data2, uint32_t timeUs);
 };
 
 extern USBMidiHost* usbMidi;
@@ -0,0 +1,1082 @@
+#include "ws_commands.h"
+#include "led_controller.h"
+#include "render_task.h"
+#include "midi_event_ring.h"
+#include "ws_note_stream.h"
+#include "log_ring.h"
+#include "calibration.h"
+#include "recorder.h"
+#include "lesson_follower.h"
+#include "game_engine.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+WsCommandDispatcher* wsCommands = nullptr;
+
+// ============== WsArgs ==============
+
+WsArgs::WsArgs(JsonObjectConst payload, const WsField* fields)
+    : _payload(payload)
+    , _fields(fields)
+{
+}
+
+JsonVariantConst WsArgs::operator[](uint8_t field) const {
+    JsonVariantConst value = _payload[_fields[field].name];
+    if (value.isNull() && _fields[field].alias) {
+        value = _payload[_fields[field].alias];
+    }
+    return value;
+}
+
+bool WsArgs::has(uint8_t field) const {
+    return !(*this)[field].isNull();
+}
+
+// ============== Latency ==============
+
+void fillLatencySummary(JsonObject out) {
+    if (!renderTask) return;
+    const MetricHistogram& latency = renderTask->getLatencyHistogram();
+    MetricHistogram::Snapshot snap;
+    latency.snapshot(snap);
+
+    out["count"] = snap.count;
+    out["p50_us"] = latency.quantile(snap, 500);
+    out["p95_us"] = latency.quantile(snap, 950);
+    out["p99_us"] = latency.quantile(snap, 990);
+    out["max_us"] = snap.max;
+}
+
+// ============== LED Layout ==============
+
+void fillPowerBudget(JsonObject out, const PowerBudget& power) {
+    const PowerConfig& config = power.getConfig();
+    out["total_ma"] = config.totalMa;
+    out["estimated_ma"] = power.getEstimatedMa();
+    out["limited_ma"] = power.getLimitedMa();
+    out["limiting"] = power.isLimiting();
+    out["limited_frames"] = power.getLimitedFrames();
+    JsonArray zones = out["zones"].to<JsonArray>();
+    for (uint8_t z = 0; z < config.zoneCount; z++) {
+        JsonObject zone = zones.add<JsonObject>();
+        zone["first"] = config.zones[z].first;
+        zone["count"] = config.zones[z].count;
+        zone["max_ma"] = config.zones[z].maxMa;
+        zone["estimated_ma"] = power.getZoneEstimatedMa(z);
+        zone["held_scale"] = power.getZoneFactor(z, true);
+        zone["other_scale"] = power.getZoneFactor(z, false);
+    }
+}
+
+void fillLedLayout(JsonArray out, const LedLayout& layout) {
+    for (uint8_t s = 0; s < layout.segmentCount; s++) {
+        JsonObject segment = out.add<JsonObject>();
+        segment["pin"] = layout.segments[s].pin;
+        segment["count"] = layout.segments[s].count;
+    }
+}
+
+// ============== Song Player ==============
+
+void fillSongPlayer(JsonObject out, const SongPlayer& player) {
+    static const char* const STATES[] = {"stopped", "playing", "paused"};
+    out["state"] = STATES[player.getState()];
+    out["filename"] = player.getFilename();
+    out["position_ms"] = player.getPositionMs();
+    out["duration_ms"] = player.getDurationMs();
+    out["speed"] = player.getSpeed();
+    out["loop"] = player.isLooping();
+}
+
+// ============== Handlers ==============
+
+// Single-value commands: { value }
+enum { F_VALUE };
+static const WsField VALUE_FIELDS[] = {
+    {"value", nullptr},
+};
+
+static void cmdGetStatus(AsyncWebSocketClient*, const WsArgs&) {
+}
+
+// Capability negotiation - binary midi_note frames are opt-in
+enum { F_HELLO_BINARY_NOTES };
+static const WsField HELLO_FIELDS[] = {
+    {"binary_notes", nullptr},
+};
+
+static void cmdHello(AsyncWebSocketClient* client, const WsArgs& args) {
+    uint8_t wanted = args[F_HELLO_BINARY_NOTES] | 0;
+    bool binary = wanted == WS_NOTE_FRAME_VERSION
+        && noteStream && noteStream->setBinary(client->id(), true);
+
+    JsonDocument reply;
+    reply["type"] = "hello";
+    reply["binary_notes"] = binary ? WS_NOTE_FRAME_VERSION : 0;
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+static void cmdSetBrightness(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t brightness = args[F_VALUE] | 128;
+    ledController->setBrightness(brightness);
+}
+
+// Поддержка обоих форматов: { mode } и { value }
+enum { F_MODE };
+static const WsField MODE_FIELDS[] = {
+    {"mode", "value"},
+};
+
+static void cmdSetMode(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t mode = args[F_MODE] | 0;
+    ledController->setMode((LEDMode)mode);
+}
+
+static void cmdSetHue(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t hue = args[F_VALUE] | 0;
+    ledController->setHue(hue);
+}
+
+static void cmdSetSaturation(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t sat = args[F_VALUE] | 255;
+    ledController->setSaturation(sat);
+}
+
+static void cmdSetFadeRate(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t rate = args[F_VALUE] | 15;
+    ledController->setFadeRate(rate);
+}
+
+enum { F_ENABLED };
+static const WsField ENABLED_FIELDS[] = {
+    {"enabled", nullptr},
+};
+
+static void cmdSetSplash(AsyncWebSocketClient*, const WsArgs& args) {
+    bool enabled = args[F_ENABLED] | false;
+    ledController->setSplashEnabled(enabled);
+}
+
+// Learning mode - set expected notes
+enum { F_NOTES };
+static const WsField EXPECTED_NOTES_FIELDS[] = {
+    {"notes", nullptr},
+};
+
+static void cmdSetExpectedNotes(AsyncWebSocketClient*, const WsArgs& args) {
+    JsonArrayConst notes = args[F_NOTES].as<JsonArrayConst>();
+    if (!notes) return;
+
+    NoteSet set;
+    set.clear();
+    for (JsonVariantConst v : notes) {
+        int note = v | -1;
+        if (note >= 0 && note < 128) set.add(note);
+    }
+    ledController->setExpectedNotes(set);
+}
+
+static void cmdClearExpectedNotes(AsyncWebSocketClient*, const WsArgs&) {
+    ledController->clearExpectedNotes();
+}
+
+// Воспроизведение ноты из приложения (режим Demo/Learning)
+enum { F_PLAY_NOTE, F_PLAY_VELOCITY, F_PLAY_ON };
+static const WsField PLAY_NOTE_FIELDS[] = {
+    {"note", nullptr},
+    {"velocity", nullptr},
+    {"on", nullptr},
+};
+
+static void cmdPlayNote(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t note = args[F_PLAY_NOTE] | 0;
+    uint8_t velocity = args[F_PLAY_VELOCITY] | 100;
+    bool on = args[F_PLAY_ON] | true;
+
+    if (midiEvents) {
+        midiEvents->push(MIDI_SOURCE_APP, (on && velocity > 0) ? 0x90 : 0x80,
+                         note, (on && velocity > 0) ? velocity : 0);
+    }
+}
+
+// Support both camelCase (Angular) and snake_case naming
+enum {
+    F_SPLIT_POINT,
+    F_SPLIT_LEFT_HUE, F_SPLIT_LEFT_SAT, F_SPLIT_LEFT_VAL,
+    F_SPLIT_RIGHT_HUE, F_SPLIT_RIGHT_SAT, F_SPLIT_RIGHT_VAL
+};
+static const WsField SPLIT_FIELDS[] = {
+    {"splitPoint", "position"},
+    {"leftHue", "left_hue"},
+    {"leftSat", "left_sat"},
+    {"leftVal", "left_val"},
+    {"rightHue", "right_hue"},
+    {"rightSat", "right_sat"},
+    {"rightVal", "right_val"},
+};
+
+static void cmdSetSplit(AsyncWebSocketClient*, const WsArgs& args) {
+    if (args.has(F_SPLIT_POINT)) {
+        ledController->setSplitPosition(args[F_SPLIT_POINT].as<uint8_t>());
+    }
+    if (args.has(F_SPLIT_LEFT_HUE)) {
+        ledController->setLeftColor(args[F_SPLIT_LEFT_HUE].as<uint8_t>(),
+                                    args[F_SPLIT_LEFT_SAT] | 255,
+                                    args[F_SPLIT_LEFT_VAL] | 255);
+    }
+    if (args.has(F_SPLIT_RIGHT_HUE)) {
+        ledController->setRightColor(args[F_SPLIT_RIGHT_HUE].as<uint8_t>(),
+                                     args[F_SPLIT_RIGHT_SAT] | 255,
+                                     args[F_SPLIT_RIGHT_VAL] | 255);
+    }
+}
+
+// Accept "saturation" (Angular) or "sat" (legacy)
+enum { F_BG_ENABLED, F_BG_HUE, F_BG_SAT, F_BG_VAL, F_BG_BRIGHTNESS };
+static const WsField BACKGROUND_FIELDS[] = {
+    {"enabled", nullptr},
+    {"hue", nullptr},
+    {"saturation", "sat"},
+    {"val", nullptr},
+    {"brightness", nullptr},
+};
+
+static void cmdSetBackground(AsyncWebSocketClient*, const WsArgs& args) {
+    bool enabled = args[F_BG_ENABLED] | false;
+    ledController->setBackgroundEnabled(enabled);
+    if (args.has(F_BG_HUE)) {
+        ledController->setBackgroundColor(args[F_BG_HUE].as<uint8_t>(),
+                                          args[F_BG_SAT] | 255,
+                                          args[F_BG_VAL] | 32);
+    }
+    if (args.has(F_BG_BRIGHTNESS)) {
+        ledController->setBackgroundBrightness(args[F_BG_BRIGHTNESS].as<uint8_t>());
+    }
+}
+
+enum { F_SHIFT_ENABLED, F_SHIFT_AMOUNT, F_SHIFT_WINDOW };
+static const WsField HUE_SHIFT_FIELDS[] = {
+    {"enabled", nullptr},
+    {"amount", nullptr},
+    {"window_ms", nullptr},
+};
+
+static void cmdSetHueShift(AsyncWebSocketClient*, const WsArgs& args) {
+    bool enabled = args[F_SHIFT_ENABLED] | false;
+    ledController->setHueShiftEnabled(enabled);
+    if (args.has(F_SHIFT_AMOUNT)) {
+        ledController->setHueShiftAmount(args[F_SHIFT_AMOUNT].as<uint8_t>());
+    }
+    if (args.has(F_SHIFT_WINDOW)) {
+        ledController->setChordWindowMs(args[F_SHIFT_WINDOW].as<uint16_t>());
+    }
+}
+
+enum { F_AMBIENT_ANIMATION, F_AMBIENT_SPEED };
+static const WsField AMBIENT_FIELDS[] = {
+    {"animation", nullptr},
+    {"speed", nullptr},
+};
+
+static void cmdSetAmbient(AsyncWebSocketClient*, const WsArgs& args) {
+    uint8_t anim = args[F_AMBIENT_ANIMATION] | 0;
+    uint8_t speed = args[F_AMBIENT_SPEED] | 50;
+    ledController->setAmbientAnimation(anim);
+    ledController->setAnimationSpeed(speed);
+}
+
+// Universal settings handler - accepts multiple parameters at once
+enum {
+    F_SET_BRIGHTNESS, F_SET_HUE, F_SET_SATURATION, F_SET_FADE_RATE, F_SET_FADE_TIME,
+    F_SET_SPLASH, F_SET_MODE, F_SET_COLOR,
+    F_SET_SPLIT_POINT, F_SET_SPLIT_LEFT, F_SET_SPLIT_RIGHT
+};
+static const WsField SETTINGS_FIELDS[] = {
+    {"brightness", nullptr},
+    {"hue", nullptr},
+    {"saturation", nullptr},
+    {"fadeRate", nullptr},
+    {"fadeTime", nullptr},
+    {"splashEnabled", "waveEnabled"},
+    {"mode", nullptr},
+    {"color", nullptr},
+    {"splitPoint", nullptr},
+    {"splitLeftColor", nullptr},
+    {"splitRightColor", nullptr},
+};
+
+// Color as RGB array [r, g, b] - convert to HSV
+static bool rgbField(const WsArgs& args, uint8_t field, CHSV& hsv) {
+    JsonArrayConst c = args[field].as<JsonArrayConst>();
+    if (!c || c.size() < 3) return false;
+    CRGB rgb(c[0].as<uint8_t>(), c[1].as<uint8_t>(), c[2].as<uint8_t>());
+    hsv = rgb2hsv_approximate(rgb);
+    return true;
+}
+
+static void cmdSetSettings(AsyncWebSocketClient*, const WsArgs& args) {
+    // Brightness (0-255)
+    if (args.has(F_SET_BRIGHTNESS)) {
+        ledController->setBrightness(args[F_SET_BRIGHTNESS].as<uint8_t>());
+    }
+    // Hue (0-255)
+    if (args.has(F_SET_HUE)) {
+        ledController->setHue(args[F_SET_HUE].as<uint8_t>());
+    }
+    // Saturation (0-255)
+    if (args.has(F_SET_SATURATION)) {
+        ledController->setSaturation(args[F_SET_SATURATION].as<uint8_t>());
+    }
+    // Fade rate (0-255) - поддержка fadeRate и fadeTime
+    if (args.has(F_SET_FADE_RATE)) {
+        ledController->setFadeRate(args[F_SET_FADE_RATE].as<uint8_t>());
+    } else if (args.has(F_SET_FADE_TIME)) {
+        // Angular отправляет fadeTime в мс, конвертируем в fade rate
+        // fadeTime 0-2000 → fadeRate 255-0 (инвертировано)
+        uint16_t fadeTime = args[F_SET_FADE_TIME].as<uint16_t>();
+        uint8_t fadeRate = fadeTime > 0 ? 255 - min((int)(fadeTime / 8), 255) : 255;
+        ledController->setFadeRate(fadeRate);
+    }
+    // Splash/wave effect - поддержка splashEnabled и waveEnabled
+    if (args.has(F_SET_SPLASH)) {
+        ledController->setSplashEnabled(args[F_SET_SPLASH].as<bool>());
+    }
+    // TODO: waveWidth - добавить setWaveWidth в ledController
+    // Mode (0-9)
+    if (args.has(F_SET_MODE)) {
+        ledController->setMode((LEDMode)args[F_SET_MODE].as<uint8_t>());
+    }
+    CHSV hsv;
+    if (rgbField(args, F_SET_COLOR, hsv)) {
+        ledController->setHue(hsv.hue);
+        ledController->setSaturation(hsv.sat);
+    }
+    // Split settings
+    if (args.has(F_SET_SPLIT_POINT)) {
+        ledController->setSplitPosition(args[F_SET_SPLIT_POINT].as<uint8_t>());
+    }
+    if (rgbField(args, F_SET_SPLIT_LEFT, hsv)) {
+        ledController->setLeftColor(hsv.hue, hsv.sat, hsv.val);
+    }
+    if (rgbField(args, F_SET_SPLIT_RIGHT, hsv)) {
+        ledController->setRightColor(hsv.hue, hsv.sat, hsv.val);
+    }
+}
+
+// LED configuration (direction, frame rate, output calibration)
+enum { F_LED_REVERSED, F_LED_BRIGHTNESS, F_LED_KEEPALIVE, F_LED_FPS, F_LED_GAMMA, F_LED_WHITE_BALANCE, F_LED_DITHER };
+static const WsField LED_CONFIG_FIELDS[] = {
+    {"reversed", nullptr},
+    {"brightness", nullptr},
+    {"keepalive_ms", nullptr},
+    {"fps", nullptr},
+    {"gamma", nullptr},
+    {"white_balance", nullptr},     // [r, g, b]
+    {"dither", nullptr},
+};
+
+static void cmdSetLedConfig(AsyncWebSocketClient*, const WsArgs& args) {
+    if (args.has(F_LED_REVERSED)) {
+        ledController->setReversed(args[F_LED_REVERSED].as<bool>());
+    }
+    if (args.has(F_LED_BRIGHTNESS)) {
+        ledController->setBrightness(args[F_LED_BRIGHTNESS].as<uint8_t>());
+    }
+    if (args.has(F_LED_KEEPALIVE)) {
+        ledController->setKeepAliveMs(args[F_LED_KEEPALIVE].as<uint16_t>());
+    }
+    if (renderTask && args.has(F_LED_FPS)) {
+        renderTask->setFrameRate(args[F_LED_FPS].as<uint16_t>());
+    }
+    if (args.has(F_LED_GAMMA)) {
+        ledController->setGamma(args[F_LED_GAMMA].as<float>());
+    }
+    JsonArrayConst balance = args[F_LED_WHITE_BALANCE].as<JsonArrayConst>();
+    if (balance.size() == 3) {
+        ledController->setWhiteBalance(CRGB(balance[0].as<uint8_t>(), balance[1].as<uint8_t>(), balance[2].as<uint8_t>()));
+    }
+    if (args.has(F_LED_DITHER)) {
+        ledController->setDither(args[F_LED_DITHER].as<bool>());
+    }
+}
+
+// Network configuration (note batching window)
+enum { F_NET_BATCH_MS };
+static const WsField NETWORK_CONFIG_FIELDS[] = {
+    {"note_batch_ms", nullptr},
+};
+
+static void cmdSetNetworkConfig(AsyncWebSocketClient*, const WsArgs& args) {
+    if (noteStream && args.has(F_NET_BATCH_MS)) {
+        noteStream->setBatchWindowMs(args[F_NET_BATCH_MS].as<uint8_t>());
+    }
+}
+
+// Runtime log level (LOG_LVL_*); levels above LOG_COMPILE_LEVEL stay silent
+enum { F_LOG_LEVEL };
+static const WsField LOG_LEVEL_FIELDS[] = {
+    {"level", "value"},
+};
+
+static void cmdSetLogLevel(AsyncWebSocketClient*, const WsArgs& args) {
+    if (logRing && args.has(F_LOG_LEVEL)) {
+        logRing->setLevel(args[F_LOG_LEVEL].as<uint8_t>());
+    }
+}
+
+// Strip layout: get_led_layout reports the active one, set_led_layout stores
+// a new one in NVS. FastLED cannot drop controllers, so it takes effect on
+// the next boot - pass restart to reboot right away.
+static const uint16_t LAYOUT_RESTART_DELAY_MS = 500;   // Let the reply go out first
+
+static void sendLedLayout(AsyncWebSocketClient* client, const char* error, bool saved) {
+    const LedLayout& active = ledController->getLayout();
+
+    JsonDocument reply;
+    reply["type"] = "led_layout";
+    fillLedLayout(reply["segments"].to<JsonArray>(), active);
+    reply["led_count"] = ledController->getLedCount();
+    reply["key_led_count"] = ledController->getKeyLedCount();
+    reply["max_leds"] = LED_MAX_COUNT;
+    reply["max_segments"] = LED_MAX_SEGMENTS;
+    JsonArray pins = reply["pins"].to<JsonArray>();
+#define LED_PIN_ADD(p) pins.add(p);
+    LED_SEGMENT_PINS(LED_PIN_ADD)
+#undef LED_PIN_ADD
+    if (saved) reply["saved"] = true;
+    if (error) reply["error"] = error;
+
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+static void cmdGetLedLayout(AsyncWebSocketClient* client, const WsArgs&) {
+    sendLedLayout(client, nullptr, false);
+}
+
+enum { F_LAYOUT_SEGMENTS, F_LAYOUT_RESTART };
+static const WsField LED_LAYOUT_FIELDS[] = {
+    {"segments", nullptr},
+    {"restart", nullptr},
+};
+
+static void cmdSetLedLayout(AsyncWebSocketClient* client, const WsArgs& args) {
+    JsonArrayConst segments = args[F_LAYOUT_SEGMENTS].as<JsonArrayConst>();
+    if (!segments || segments.size() == 0 || segments.size() > LED_MAX_SEGMENTS) {
+        sendLedLayout(client, "segments: 1 to max_segments {pin, count} expected", false);
+        return;
+    }
+
+    LedLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    for (JsonVariantConst segment : segments) {
+        layout.segments[layout.segmentCount].pin = segment["pin"] | 0;
+        layout.segments[layout.segmentCount].count = segment["count"] | 0;
+        layout.segmentCount++;
+    }
+    if (!layout.isValid()) {
+        sendLedLayout(client, "invalid layout (pins, counts or total)", false);
+        return;
+    }
+    if (!saveLedLayout(layout)) {
+        sendLedLayout(client, "could not store layout", false);
+        return;
+    }
+
+    LOG_I("LED layout stored: %u segments, %u LEDs", layout.segmentCount, layout.totalLeds());
+    sendLedLayout(client, nullptr, true);
+    if (args[F_LAYOUT_RESTART] | false) {
+        requestRestart(LAYOUT_RESTART_DELAY_MS);
+    }
+}
+
+// Current limits: get_power_budget reports them with the live estimate,
+// set_power_budget applies and stores new ones. Zones are LED ranges fed
+// from one supply point; max_ma 0 leaves a zone to the total only.
+static void sendPowerBudget(AsyncWebSocketClient* client, const char* error, bool saved) {
+    JsonDocument reply;
+    reply["type"] = "power_budget";
+    fillPowerBudget(reply.as<JsonObject>(), ledController->getPowerBudget());
+    reply["max_zones"] = POWER_MAX_ZONES;
+    if (saved) reply["saved"] = true;
+    if (error) reply["error"] = error;
+
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+static void cmdGetPowerBudget(AsyncWebSocketClient* client, const WsArgs&) {
+    sendPowerBudget(client, nullptr, false);
+}
+
+enum { F_POWER_TOTAL, F_POWER_ZONES };
+static const WsField POWER_BUDGET_FIELDS[] = {
+    {"total_ma", nullptr},
+    {"zones", nullptr},
+};
+
+static void cmdSetPowerBudget(AsyncWebSocketClient* client, const WsArgs& args) {
+    PowerConfig config = ledController->getPowerBudget().getConfig();
+    if (args.has(F_POWER_TOTAL)) {
+        config.totalMa = args[F_POWER_TOTAL].as<uint16_t>();
+    }
+    if (args.has(F_POWER_ZONES)) {
+        JsonArrayConst zones = args[F_POWER_ZONES].as<JsonArrayConst>();
+        if (zones.size() > POWER_MAX_ZONES) {
+            sendPowerBudget(client, "zones: up to max_zones {first, count, max_ma} expected", false);
+            return;
+        }
+        config.zoneCount = 0;
+        for (JsonVariantConst zone : zones) {
+            config.zones[config.zoneCount].first = zone["first"] | 0;
+            config.zones[config.zoneCount].count = zone["count"] | 0;
+            config.zones[config.zoneCount].maxMa = zone["max_ma"] | 0;
+            config.zoneCount++;
+        }
+    }
+
+    if (!ledController->setPowerConfig(config)) {
+        sendPowerBudget(client, "invalid budget (total, or zones out of order or past the strip)", false);
+        return;
+    }
+    bool saved = savePowerConfig(config, ledController->getLayout());
+    LOG_I("Power budget: %u mA total, %u zones", config.totalMa, config.zoneCount);
+    sendPowerBudget(client, saved ? nullptr : "could not store budget", saved);
+}
+
+// Calibration: start_calibration opens a session, calibration_input feeds
+// it from the app. Both answer with calibration_step to every client, the
+// same message key presses during the session produce.
+static CalibrationType parseCalibrationType(const char* type) {
+    return type && strcmp(type, "detailed") == 0 ? CALIB_TYPE_DETAILED : CALIB_TYPE_QUICK;
+}
+
+enum { F_CALIB_TYPE };
+static const WsField START_CALIBRATION_FIELDS[] = {
+    {"type", nullptr},
+};
+
+static void cmdStartCalibration(AsyncWebSocketClient*, const WsArgs& args) {
+    if (!calibration) return;
+    calibration->start(parseCalibrationType(args[F_CALIB_TYPE] | "quick"));
+    sendCalibrationStep();
+}
+
+enum { F_CALIB_NOTE, F_CALIB_LED, F_CALIB_DELTA, F_CALIB_ACTION };
+static const WsField CALIBRATION_INPUT_FIELDS[] = {
+    {"note", nullptr},
+    {"led", nullptr},
+    {"delta", nullptr},
+    {"action", nullptr},
+};
+
+static void cmdCalibrationInput(AsyncWebSocketClient*, const WsArgs& args) {
+    if (!calibration) return;
+
+    const char* action = args[F_CALIB_ACTION] | "";
+    if (strcmp(action, "done") == 0 || strcmp(action, "save") == 0) {
+        calibration->finish();
+    } else if (strcmp(action, "cancel") == 0) {
+        calibration->cancel();
+    } else if (strcmp(action, "reset") == 0) {
+        calibration->reset();
+    } else if (args.has(F_CALIB_LED)) {
+        int32_t led = args[F_CALIB_LED] | -1;
+        calibration->inputLed(args[F_CALIB_NOTE] | 0, led < 0 ? KeyMap::NONE : (uint16_t)led);
+    } else if (args.has(F_CALIB_DELTA)) {
+        calibration->inputDelta(args[F_CALIB_DELTA] | 0);
+    } else if (args.has(F_CALIB_NOTE)) {
+        calibration->inputNote(args[F_CALIB_NOTE] | 0);
+    }
+    sendCalibrationStep();
+}
+
+// Recording: the status broadcast after each carries is_recording and the
+// counts; stored recordings are listed and exported over HTTP
+static void cmdStartRecording(AsyncWebSocketClient*, const WsArgs&) {
+    if (recorder) recorder->start();
+}
+
+static void cmdStopRecording(AsyncWebSocketClient*, const WsArgs&) {
+    if (recorder) recorder->stop();
+}
+
+// Song playback (SPECIFICATION.md 2.3): the device plays the file itself and
+// the notes light the keys like play_note. State goes out with the status
+// broadcast; a song that cannot be played is answered with an error.
+static void sendSongError(AsyncWebSocketClient* client, const char* error) {
+    JsonDocument reply;
+    reply["type"] = "song";
+    fillSongPlayer(reply.as<JsonObject>(), *songPlayer);
+    reply["error"] = error;
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+enum { F_SONG_FILENAME, F_SONG_POSITION, F_SONG_SPEED, F_SONG_LOOP };
+static const WsField SONG_FIELDS[] = {
+    {"filename", "name"},
+    {"position_ms", "positionMs"},
+    {"speed", nullptr},
+    {"loop", nullptr},
+};
+
+static void applySongOptions(const WsArgs& args) {
+    if (args.has(F_SONG_SPEED)) songPlayer->setSpeed(args[F_SONG_SPEED] | PLAYER_DEFAULT_SPEED);
+    if (args.has(F_SONG_LOOP)) songPlayer->setLoop(args[F_SONG_LOOP] | false);
+}
+
+static void cmdPlaySong(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (!songPlayer) return;
+    applySongOptions(args);
+    if (!songPlayer->play(args[F_SONG_FILENAME] | "", args[F_SONG_POSITION] | 0)) {
+        sendSongError(client, "song not found");
+    }
+}
+
+static void cmdStopSong(AsyncWebSocketClient*, const WsArgs&) {
+    if (songPlayer) songPlayer->stop();
+}
+
+static void cmdPauseSong(AsyncWebSocketClient*, const WsArgs&) {
+    if (songPlayer) songPlayer->pause();
+}
+
+static void cmdResumeSong(AsyncWebSocketClient*, const WsArgs&) {
+    if (songPlayer) songPlayer->resume();
+}
+
+static void cmdSeekSong(AsyncWebSocketClient*, const WsArgs& args) {
+    if (songPlayer) songPlayer->seek(args[F_SONG_POSITION] | 0);
+}
+
+static void cmdSetSongOptions(AsyncWebSocketClient*, const WsArgs& args) {
+    if (songPlayer) applySongOptions(args);
+}
+
+// Lesson on the device: load_lesson (in pieces, append), then start_lesson.
+// The follower reports lesson_progress / lesson_error / lesson_complete by
+// itself; these commands answer with the lesson state.
+static void sendLesson(AsyncWebSocketClient* client, const char* error) {
+    JsonDocument reply;
+    reply["type"] = "lesson";
+    lessonFollower->fillStatus(reply.as<JsonObject>());
+    reply["max_steps"] = LESSON_MAX_STEPS;
+    if (error) reply["error"] = error;
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+static uint8_t readNotes(JsonVariantConst notes, uint8_t* out) {
+    uint8_t count = 0;
+    for (JsonVariantConst v : notes.as<JsonArrayConst>()) {
+        if (count == 128) break;
+        int note = v | -1;
+        out[count++] = note >= 0 && note < 128 ? note : 0xFF;    // Skipped by addStep()
+    }
+    return count;
+}
+
+enum { F_LESSON_STEPS, F_LESSON_APPEND };
+static const WsField LOAD_LESSON_FIELDS[] = {
+    {"steps", nullptr},
+    {"append", nullptr},
+};
+
+// Step: {"time_ms": 0, "left": [48], "right": [60, 64]} ("notes" = right),
+// or the compact [time_ms, [left...], [right...]]
+static void cmdLoadLesson(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (!lessonFollower) return;
+    if (!(args[F_LESSON_APPEND] | false)) lessonFollower->clear();
+
+    uint8_t left[128];
+    uint8_t right[128];
+    for (JsonVariantConst step : args[F_LESSON_STEPS].as<JsonArrayConst>()) {
+        uint32_t timeMs;
+        uint8_t leftCount, rightCount;
+        if (step.is<JsonArrayConst>()) {
+            timeMs = step[0] | 0;
+            leftCount = readNotes(step[1], left);
+            rightCount = readNotes(step[2], right);
+        } else {
+            timeMs = step["time_ms"] | 0;
+            leftCount = readNotes(step["left"], left);
+            rightCount = readNotes(step["right"].isNull() ? step["notes"] : step["right"], right);
+        }
+        if (!lessonFollower->addStep(timeMs, left, leftCount, right, rightCount)) {
+            sendLesson(client, "lesson too long or steps out of time order");
+            return;
+        }
+    }
+    sendLesson(client, nullptr);
+}
+
+enum { F_LESSON_HANDS, F_LESSON_LOOK_AHEAD, F_LESSON_STEP };
+static const WsField LESSON_FIELDS[] = {
+    {"hands", nullptr},
+    {"look_ahead", "lookAhead"},
+    {"step", nullptr},
+};
+
+static void cmdStartLesson(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (!lessonFollower) return;
+    LessonHands hands = LessonFollower::parseHands(args[F_LESSON_HANDS] | "both");
+    if (!lessonFollower->start(hands, args[F_LESSON_LOOK_AHEAD] | LESSON_DEFAULT_LOOKAHEAD, args[F_LESSON_STEP] | 0)) {
+        sendLesson(client, "no lesson loaded or step out of range");
+    }
+}
+
+static void cmdStopLesson(AsyncWebSocketClient*, const WsArgs&) {
+    if (lessonFollower) lessonFollower->stop();
+}
+
+static void cmdSeekLesson(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (lessonFollower && !lessonFollower->seek(args[F_LESSON_STEP] | 0)) {
+        sendLesson(client, "no lesson running or step out of range");
+    }
+}
+
+// Game mode: load_game (in pieces, append), then start_game. The engine
+// reports game_hit / game_miss / game_wrong / game_complete by itself;
+// these commands answer with the game state.
+static void sendGame(AsyncWebSocketClient* client, const char* error) {
+    JsonDocument reply;
+    reply["type"] = "game";
+    gameEngine->fillStatus(reply.as<JsonObject>());
+    reply["max_notes"] = GAME_MAX_NOTES;
+    if (error) reply["error"] = error;
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+enum { F_GAME_NOTES, F_GAME_APPEND };
+static const WsField LOAD_GAME_FIELDS[] = {
+    {"notes", nullptr},
+    {"append", nullptr},
+};
+
+// Note: {"time_ms": 0, "note": 60} or the compact [time_ms, note]
+static void cmdLoadGame(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (!gameEngine) return;
+    if (!(args[F_GAME_APPEND] | false)) gameEngine->clear();
+
+    for (JsonVariantConst note : args[F_GAME_NOTES].as<JsonArrayConst>()) {
+        uint32_t timeMs;
+        int midiNote;
+        if (note.is<JsonArrayConst>()) {
+            timeMs = note[0] | 0;
+            midiNote = note[1] | -1;
+        } else {
+            timeMs = note["time_ms"] | 0;
+            midiNote = note["note"] | -1;
+        }
+        if (midiNote < 0 || midiNote > 127) continue;
+        if (!gameEngine->addNote(timeMs, midiNote)) {
+            sendGame(client, "song too long or notes out of time order");
+            return;
+        }
+    }
+    sendGame(client, nullptr);
+}
+
+// Fall time from speed 1-10 (spec), or exactly with look_ahead_ms
+enum { F_GAME_DIFFICULTY, F_GAME_SPEED, F_GAME_LOOK_AHEAD };
+static const WsField GAME_FIELDS[] = {
+    {"difficulty", nullptr},
+    {"speed", nullptr},
+    {"look_ahead_ms", "lookAheadMs"},
+};
+
+static void cmdStartGame(AsyncWebSocketClient* client, const WsArgs& args) {
+    if (!gameEngine) return;
+    if (lessonFollower) lessonFollower->stop();     // Both would judge the same keys
+    GameDifficulty difficulty = GameEngine::parseDifficulty(args[F_GAME_DIFFICULTY] | "medium");
+    uint16_t lookAheadMs = args.has(F_GAME_LOOK_AHEAD)
+        ? args[F_GAME_LOOK_AHEAD].as<uint16_t>()
+        : GameEngine::speedToLookAhead(args[F_GAME_SPEED] | GAME_DEFAULT_SPEED);
+    if (!gameEngine->start(difficulty, lookAheadMs)) {
+        sendGame(client, "no song loaded");
+    }
+}
+
+static void cmdStopGame(AsyncWebSocketClient*, const WsArgs&) {
+    if (gameEngine) gameEngine->stop();
+}
+
+// Key-to-light latency: get_latency reports, reset_latency starts a new run
+static void sendLatency(AsyncWebSocketClient* client) {
+    JsonDocument reply;
+    JsonObject root = reply.to<JsonObject>();
+    root["type"] = "latency";
+    fillLatencySummary(root);
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+static void cmdGetLatency(AsyncWebSocketClient* client, const WsArgs&) {
+    sendLatency(client);
+}
+
+static void cmdResetLatency(AsyncWebSocketClient* client, const WsArgs&) {
+    if (renderTask) renderTask->resetLatency();
+    sendLatency(client);
+}
+
+// ============== Command Table ==============
+
+#define WS_FIELDS(f) f, (uint8_t)(sizeof(f) / sizeof(f[0]))
+#define WS_NO_FIELDS nullptr, 0
+
+static constexpr WsCommand COMMANDS[] = {
+    // hash                             name                    handler                 schema                              status
+    {wsHash("get_status"),              "get_status",           cmdGetStatus,           WS_NO_FIELDS,                       true},
+    {wsHash("hello"),                   "hello",                cmdHello,               WS_FIELDS(HELLO_FIELDS),            false},
+    {wsHash("set_brightness"),          "set_brightness",       cmdSetBrightness,       WS_FIELDS(VALUE_FIELDS),            true},
+    {wsHash("set_mode"),                "set_mode",             cmdSetMode,             WS_FIELDS(MODE_FIELDS),             true},
+    {wsHash("set_hue"),                 "set_hue",              cmdSetHue,              WS_FIELDS(VALUE_FIELDS),            true},
+    {wsHash("set_saturation"),          "set_saturation",       cmdSetSaturation,       WS_FIELDS(VALUE_FIELDS),            false},
+    {wsHash("set_fade_rate"),           "set_fade_rate",        cmdSetFadeRate,         WS_FIELDS(VALUE_FIELDS),            false},
+    {wsHash("set_splash"),              "set_splash",           cmdSetSplash,           WS_FIELDS(ENABLED_FIELDS),          false},
+    {wsHash("set_expected_notes"),      "set_expected_notes",   cmdSetExpectedNotes,    WS_FIELDS(EXPECTED_NOTES_FIELDS),   false},
+    {wsHash("clear_expected_notes"),    "clear_expected_notes", cmdClearExpectedNotes,  WS_NO_FIELDS,                       false},
+    {wsHash("play_note"),               "play_note",            cmdPlayNote,            WS_FIELDS(PLAY_NOTE_FIELDS),        false},
+    {wsHash("set_split"),               "set_split",            cmdSetSplit,            WS_FIELDS(SPLIT_FIELDS),            false},
+    {wsHash("set_background"),          "set_background",       cmdSetBackground,       WS_FIELDS(BACKGROUND_FIELDS),       false},
+    {wsHash("set_hue_shift"),           "set_hue_shift",        cmdSetHueShift,         WS_FIELDS(HUE_SHIFT_FIELDS),        false},
+    {wsHash("set_ambient"),             "set_ambient",          cmdSetAmbient,          WS_FIELDS(AMBIENT_FIELDS),          false},
+    {wsHash("set_settings"),            "set_settings",         cmdSetSettings,         WS_FIELDS(SETTINGS_FIELDS),         true},
+    {wsHash("set_led_config"),          "set_led_config",       cmdSetLedConfig,        WS_FIELDS(LED_CONFIG_FIELDS),       true},
+    {wsHash("get_led_layout"),          "get_led_layout",       cmdGetLedLayout,        WS_NO_FIELDS,                       false},
+    {wsHash("set_led_layout"),          "set_led_layout",       cmdSetLedLayout,        WS_FIELDS(LED_LAYOUT_FIELDS),       false},
+    {wsHash("get_power_budget"),        "get_power_budget",     cmdGetPowerBudget,      WS_NO_FIELDS,                       false},
+    {wsHash("set_power_budget"),        "set_power_budget",     cmdSetPowerBudget,      WS_FIELDS(POWER_BUDGET_FIELDS),     false},
+    {wsHash("start_calibration"),       "start_calibration",    cmdStartCalibration,    WS_FIELDS(START_CALIBRATION_FIELDS),true},
+    {wsHash("calibration_input"),       "calibration_input",    cmdCalibrationInput,    WS_FIELDS(CALIBRATION_INPUT_FIELDS),true},
+    {wsHash("start_recording"),         "start_recording",      cmdStartRecording,      WS_NO_FIELDS,                       true},
+    {wsHash("stop_recording"),          "stop_recording",       cmdStopRecording,       WS_NO_FIELDS,                       true},
+    {wsHash("play_song"),               "play_song",            cmdPlaySong,            WS_FIELDS(SONG_FIELDS),             true},
+    {wsHash("stop_song"),               "stop_song",            cmdStopSong,            WS_NO_FIELDS,                       true},
+    {wsHash("pause_song"),              "pause_song",           cmdPauseSong,           WS_NO_FIELDS,                       true},
+    {wsHash("resume_song"),             "resume_song",          cmdResumeSong,          WS_NO_FIELDS,                       true},
+    {wsHash("seek_song"),               "seek_song",            cmdSeekSong,            WS_FIELDS(SONG_FIELDS),             true},
+    {wsHash("set_song_options"),        "set_song_options",     cmdSetSongOptions,      WS_FIELDS(SONG_FIELDS),             true},
+    {wsHash("load_lesson"),             "load_lesson",          cmdLoadLesson,          WS_FIELDS(LOAD_LESSON_FIELDS),      false},
+    {wsHash("start_lesson"),            "start_lesson",         cmdStartLesson,         WS_FIELDS(LESSON_FIELDS),           true},
+    {wsHash("stop_lesson"),             "stop_lesson",          cmdStopLesson,          WS_NO_FIELDS,                       false},
+    {wsHash("seek_lesson"),             "seek_lesson",          cmdSeekLesson,          WS_FIELDS(LESSON_FIELDS),           false},
+    {wsHash("load_game"),               "load_game",            cmdLoadGame,            WS_FIELDS(LOAD_GAME_FIELDS),        false},
+    {wsHash("start_game"),              "start_game",           cmdStartGame,           WS_FIELDS(GAME_FIELDS),             true},
+    {wsHash("stop_game"),               "stop_game",            cmdStopGame,            WS_NO_FIELDS,                       false},
+    {wsHash("set_network_config"),      "set_network_config",   cmdSetNetworkConfig,    WS_FIELDS(NETWORK_CONFIG_FIELDS),   false},
+    {wsHash("set_log_level"),           "set_log_level",        cmdSetLogLevel,         WS_FIELDS(LOG_LEVEL_FIELDS),        false},
+    {wsHash("get_latency"),             "get_latency",          cmdGetLatency,          WS_NO_FIELDS,                       false},
+    {wsHash("reset_latency"),           "reset_latency",        cmdResetLatency,        WS_NO_FIELDS,                       false},
+};
+
+static const uint8_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+// Perfect hash over the table: the top WS_SLOT_BITS bits of hash * WS_SLOT_SEED
+// give every command a slot of its own, so a lookup is one table read and
+// one strcmp. A new command that lands on a taken slot fails the build below;
+// pick another odd seed then (any that passes the check will do).
+static constexpr uint8_t WS_SLOT_BITS = 7;
+static constexpr uint32_t WS_SLOT_SEED = 6139;
+static constexpr uint16_t WS_SLOT_COUNT = 1 << WS_SLOT_BITS;
+
+static_assert(COMMAND_COUNT < WS_SLOT_COUNT, "More WebSocket commands than slots - raise WS_SLOT_BITS");
+
+constexpr uint8_t commandSlot(uint32_t hash) {
+    return (uint32_t)(hash * WS_SLOT_SEED) >> (32 - WS_SLOT_BITS);
+}
+
+// Every pair (i, j > i) must differ - recursive for C++11 constexpr, one
+// level per command rather than per pair to stay inside the compiler's depth limit
+constexpr bool slotUniqueFrom(uint8_t i, uint8_t j) {
+    return j >= COMMAND_COUNT ? true
+         : commandSlot(COMMANDS[i].hash) != commandSlot(COMMANDS[j].hash) && slotUniqueFrom(i, j + 1);
+}
+
+constexpr bool slotsUnique(uint8_t i) {
+    return i >= COMMAND_COUNT ? true
+         : slotUniqueFrom(i, i + 1) && slotsUnique(i + 1);
+}
+
+static_assert(slotsUnique(0), "WebSocket command slot collision - change WS_SLOT_SEED");
+
+// Command index + 1 per slot, 0 = empty; filled by begin()
+static uint8_t commandBySlot[WS_SLOT_COUNT];
+
+static const WsCommand* findCommand(const char* type) {
+    uint32_t hash = wsHash(type);
+    uint8_t entry = commandBySlot[commandSlot(hash)];
+    if (entry == 0) return nullptr;
+
+    // Unknown strings can still land on a command's slot
+    const WsCommand& command = COMMANDS[entry - 1];
+    return command.hash == hash && strcmp(command.name, type) == 0 ? &command : nullptr;
+}
+
+// ============== WsCommandDispatcher ==============
+
+WsCommandDispatcher::WsCommandDispatcher()
+    : _commands(0)
+    , _unknown(0)
+    , _parseErrors(0)
+    , _oversized(0)
+{
+    memset(_partials, 0, sizeof(_partials));
+}
+
+void WsCommandDispatcher::begin() {
+    // Slot index of the perfect hash
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        commandBySlot[commandSlot(COMMANDS[i].hash)] = i + 1;
+    }
+
+    // Only the type and the fields some command declares are ever stored
+    _filter["type"] = true;
+    JsonObject payload = _filter["payload"].to<JsonObject>();
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        for (uint8_t f = 0; f < COMMANDS[i].fieldCount; f++) {
+            payload[COMMANDS[i].fields[f].name] = true;
+            if (COMMANDS[i].fields[f].alias) {
+                payload[COMMANDS[i].fields[f].alias] = true;
+            }
+        }
+    }
+}
+
+uint32_t WsCommandDispatcher::getCommandCount() const {
+    return _commands;
+}
+
+uint32_t WsCommandDispatcher::getUnknownCount() const {
+    return _unknown;
+}
+
+uint32_t WsCommandDispatcher::getParseErrors() const {
+    return _parseErrors;
+}
+
+uint32_t WsCommandDispatcher::getOversizedCount() const {
+    return _oversized;
+}
+
+// Oversized messages are dropped unparsed; say so, or a bulk load would
+// leave the app waiting for its reply
+static void sendMessageTooLarge(AsyncWebSocketClient* client) {
+    JsonDocument reply;
+    reply["type"] = "error";
+    reply["error"] = "message too large";
+    reply["max_bytes"] = WS_MAX_MESSAGE_SIZE;
+    String json;
+    serializeJson(reply, json);
+    client->text(json);
+}
+
+void WsCommandDispatcher::handleData(AsyncWebSocketClient* client, AwsFrameInfo* info,
+                                     const uint8_t* data, size_t len) {
+    // Whole message in one frame and one packet - parse in place
+    if (info->final && info->index == 0 && info->len == len) {
+        if (info->opcode == WS_TEXT) {
+            dispatch(client, (const char*)data, len);
+        }
+        return;
+    }
+
+    if (info->message_opcode != WS_TEXT) return;
+
+    // First packet of the first frame starts a new message
+    bool start = info->index == 0 && info->num == 0;
+    Partial* partial = findPartial(client->id(), start);
+    if (!partial) return;  // Tail of a message we never saw the start of
+    if (start) {
+        partial->length = 0;
+        partial->overflow = false;
+    }
+
+    if (!partial->overflow) {
+        if (partial->length + len > WS_MAX_MESSAGE_SIZE) {
+            partial->overflow = true;
+        } else {
+            memcpy(partial->buffer + partial->length, data, len);
+            partial->length += len;
+        }
+    }
+
+    // Last packet of the last frame completes it
+    if (info->final && info->index + len == info->len) {
+        if (partial->overflow) {
+            _oversized++;
+            sendMessageTooLarge(client);
+        } else {
+            dispatch(client, partial->buffer, partial->length);
+        }
+        releasePartial(partial);
+    }
+}
+
+void WsCommandDispatcher::onDisconnect(uint32_t clientId) {
+    Partial* partial = findPartial(clientId, false);
+    if (partial) releasePartial(partial);
+}
+
+WsCommandDispatcher::Partial* WsCommandDispatcher::findPartial(uint32_t clientId, bool create) {
+    Partial* freeSlot = nullptr;
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (_partials[i].buffer && _partials[i].clientId == clientId) {
+            return &_partials[i];
+        }
+        if (!_partials[i].buffer && !freeSlot) {
+            freeSlot = &_partials[i];
+        }
+    }
+    if (!create || !freeSlot) return nullptr;
+
+    freeSlot->buffer = (char*)malloc(WS_MAX_MESSAGE_SIZE);
+    if (!freeSlot->buffer) return nullptr;
+    freeSlot->clientId = clientId;
+    freeSlot->length = 0;
+    freeSlot->overflow = false;
+    return freeSlot;
+}
+
+void WsCommandDispatcher::releasePartial(Partial* partial) {
+    free(partial->buffer);
+    partial->buffer = nullptr;
+    partial->length = 0;
+}
+
+void WsCommandDispatcher::dispatch(AsyncWebSocketClient* client, const char* json, size_t len) {
+    JsonDocument doc;
+    if (deserializeJson(doc, json, len, DeserializationOption::Filter(_filter))) {
+        _parseErrors++;
+        return;
+    }
+
+    const char* type = doc["type"];
+    const WsCommand* cmd = type ? findCommand(type) : nullptr;
+    if (!cmd) {
+        _unknown++;
+        return;
+    }
+    _commands++;
+
+    if (ledController) {
+        // Handlers change LEDController state the render task is using
+        RenderLock lock;
+        WsArgs args(doc["payload"].as<JsonObjectConst>(), cmd->fields);
+        cmd->handler(client, args);
+    }
+    if (cmd->sendsStatus) {
+        sendStatusToClients();
+    }
+}
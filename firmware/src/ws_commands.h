@@ -0,0 +1,110 @@
+#ifndef WS_COMMANDS_H
+#define WS_COMMANDS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include "config.h"
+#include "led_layout.h"
+#include "power_budget.h"
+#include "song_player.h"
+
+// FNV-1a, usable in constant expressions (single return for C++11)
+constexpr uint32_t wsHash(const char* s, uint32_t h = 2166136261u) {
+    return *s ? wsHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+// One payload field of a command. The app and older clients disagree on
+// naming (camelCase vs snake_case), so a field may have an alias.
+struct WsField {
+    const char* name;
+    const char* alias;  // nullptr if none
+};
+
+// Payload of one command, addressed by index into its field schema
+class WsArgs {
+public:
+    WsArgs(JsonObjectConst payload, const WsField* fields);
+
+    bool has(uint8_t field) const;
+    JsonVariantConst operator[](uint8_t field) const;  // Name first, then alias
+
+private:
+    JsonObjectConst _payload;
+    const WsField* _fields;
+};
+
+typedef void (*WsHandler)(AsyncWebSocketClient* client, const WsArgs& args);
+
+struct WsCommand {
+    uint32_t hash;          // wsHash(name)
+    const char* name;
+    WsHandler handler;
+    const WsField* fields;
+    uint8_t fieldCount;
+    bool sendsStatus;       // Broadcast status after the handler ran
+};
+
+// Routes {"type": ..., "payload": {...}} text messages to their handlers.
+//
+// Commands live in a constant table keyed by the hash of the type, looked
+// up through a perfect hash whose slots are checked for collisions at
+// compile time. Payloads are parsed
+// through a filter built from the field schemas, so fields no command
+// reads are skipped by the parser instead of being stored. Messages split
+// over several frames or TCP packets are reassembled per client.
+class WsCommandDispatcher {
+public:
+    WsCommandDispatcher();
+
+    void begin();   // Build the parse filter from the command table
+
+    // WS_EVT_DATA / WS_EVT_DISCONNECT from the WebSocket event handler
+    void handleData(AsyncWebSocketClient* client, AwsFrameInfo* info, const uint8_t* data, size_t len);
+    void onDisconnect(uint32_t clientId);
+
+    uint32_t getCommandCount() const;
+    uint32_t getUnknownCount() const;
+    uint32_t getParseErrors() const;
+    uint32_t getOversizedCount() const;
+
+private:
+    struct Partial {
+        uint32_t clientId;
+        char* buffer;       // WS_MAX_MESSAGE_SIZE, allocated while in use
+        size_t length;
+        bool overflow;
+    };
+    Partial _partials[WS_MAX_CLIENTS];
+    JsonDocument _filter;
+
+    uint32_t _commands;
+    uint32_t _unknown;
+    uint32_t _parseErrors;
+    uint32_t _oversized;
+
+    Partial* findPartial(uint32_t clientId, bool create);
+    void releasePartial(Partial* partial);
+    void dispatch(AsyncWebSocketClient* client, const char* json, size_t len);
+};
+
+extern WsCommandDispatcher* wsCommands;
+
+// Key-to-light latency percentiles (us) for status replies
+void fillLatencySummary(JsonObject out);
+
+// Segments as [{pin, count}, ...]
+void fillLedLayout(JsonArray out, const LedLayout& layout);
+
+// Budget, live estimate and zones ({first, count, max_ma, estimated_ma, held_scale, other_scale})
+void fillPowerBudget(JsonObject out, const PowerBudget& power);
+
+// Song player state ({state, filename, position_ms, duration_ms, speed, loop})
+void fillSongPlayer(JsonObject out, const SongPlayer& player);
+
+// Defined in main.cpp - handlers report state changes to the app
+extern void sendStatusToClients();
+extern void requestRestart(uint32_t delayMs);  // Reboot from the housekeeping task
+extern void sendCalibrationStep();              // calibration_step to every client
+
+#endif // WS_COMMANDS_H
@@ -0,0 +1,199 @@
+#include "ws_note_stream.h"
+
+// Global pointer - initialized in setup() to avoid static initialization issues
+WsNoteStream* noteStream = nullptr;
+
+WsNoteStream::WsNoteStream(AsyncWebSocket* ws)
+    : _ws(ws)
+    , _mux(portMUX_INITIALIZER_UNLOCKED)
+    , _pending(0)
+    , _batchStartUs(0)
+    , _batchWindowMs(WS_NOTE_BATCH_MS)
+    , _binaryFramesSent(0)
+    , _jsonMessagesSent(0)
+    , _batchesSent(0)
+    , _notesSent(0)
+    , _fullBatches(0)
+{
+    memset(_clients, 0, sizeof(_clients));
+    memset(_frame, 0, sizeof(_frame));
+    _frame[0] = 'P';
+    _frame[1] = 'N';
+    _frame[2] = WS_NOTE_FRAME_VERSION;
+}
+
+// ============== Clients ==============
+
+void WsNoteStream::onConnect(uint32_t clientId) {
+    portENTER_CRITICAL(&_mux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (!_clients[i].used) {
+            _clients[i].id = clientId;
+            _clients[i].used = true;
+            _clients[i].binary = false;  // JSON until the client says hello
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+void WsNoteStream::onDisconnect(uint32_t clientId) {
+    portENTER_CRITICAL(&_mux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (_clients[i].used && _clients[i].id == clientId) {
+            _clients[i].used = false;
+            _clients[i].binary = false;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+bool WsNoteStream::setBinary(uint32_t clientId, bool enabled) {
+    bool found = false;
+    portENTER_CRITICAL(&_mux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (_clients[i].used && _clients[i].id == clientId) {
+            _clients[i].binary = enabled;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+    return found;
+}
+
+uint8_t WsNoteStream::getBinaryClientCount() const {
+    uint8_t count = 0;
+    portENTER_CRITICAL(&_mux);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (_clients[i].used && _clients[i].binary) count++;
+    }
+    portEXIT_CRITICAL(&_mux);
+    return count;
+}
+
+uint32_t WsNoteStream::getBinaryFramesSent() const {
+    return _binaryFramesSent;
+}
+
+uint32_t WsNoteStream::getJsonMessagesSent() const {
+    return _jsonMessagesSent;
+}
+
+uint32_t WsNoteStream::getBatchesSent() const {
+    return _batchesSent;
+}
+
+uint32_t WsNoteStream::getNotesSent() const {
+    return _notesSent;
+}
+
+uint32_t WsNoteStream::getFullBatches() const {
+    return _fullBatches;
+}
+
+void WsNoteStream::setBatchWindowMs(uint8_t ms) {
+    _batchWindowMs = min(ms, (uint8_t)WS_NOTE_BATCH_MAX_MS);
+}
+
+uint8_t WsNoteStream::getBatchWindowMs() const {
+    return _batchWindowMs;
+}
+
+// ============== Sending ==============
+
+void WsNoteStream::encodeRecord(uint8_t* out, const MidiEvent& ev) {
+    bool on = ev.isNoteOn();
+    out[0] = ev.data1;
+    out[1] = on ? ev.data2 : 0;
+    out[2] = on ? FLAG_NOTE_ON : 0;
+    out[3] = ev.source;
+    out[4] = ev.timeUs & 0xFF;
+    out[5] = (ev.timeUs >> 8) & 0xFF;
+    out[6] = (ev.timeUs >> 16) & 0xFF;
+    out[7] = (ev.timeUs >> 24) & 0xFF;
+}
+
+int WsNoteStream::formatJson(const uint8_t* record) {
+    bool on = record[2] & FLAG_NOTE_ON;
+    return snprintf(_json, sizeof(_json),
+                    "{\"type\":\"midi_note\",\"note\":%u,\"velocity\":%u,\"on\":%s}",
+                    record[0], record[1], on ? "true" : "false");
+}
+
+void WsNoteStream::queueNote(const MidiEvent& ev) {
+    if (_pending == 0) {
+        _batchStartUs = micros();
+    }
+    encodeRecord(_frame + HEADER_SIZE + _pending * RECORD_SIZE, ev);
+    _pending++;
+
+    if (_pending >= WS_NOTE_BATCH_MAX) {
+        _fullBatches++;
+        flush();
+    } else if (_batchWindowMs == 0) {
+        flush();
+    }
+}
+
+void WsNoteStream::poll() {
+    if (_pending > 0 && micros() - _batchStartUs >= (uint32_t)_batchWindowMs * 1000) {
+        flush();
+    }
+}
+
+uint32_t WsNoteStream::getFlushDelayUs() const {
+    if (_pending == 0) return UINT32_MAX;
+    uint32_t age = micros() - _batchStartUs;
+    uint32_t window = (uint32_t)_batchWindowMs * 1000;
+    return age >= window ? 0 : window - age;
+}
+
+void WsNoteStream::flush() {
+    if (_pending == 0) return;
+
+    // Snapshot so the AsyncTCP task can connect/disconnect while we send
+    Client clients[WS_MAX_CLIENTS];
+    portENTER_CRITICAL(&_mux);
+    memcpy(clients, _clients, sizeof(clients));
+    portEXIT_CRITICAL(&_mux);
+
+    bool anyBinary = false;
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (clients[i].used && clients[i].binary) anyBinary = true;
+    }
+
+    _frame[3] = _pending;
+    size_t frameLen = HEADER_SIZE + _pending * RECORD_SIZE;
+
+    for (uint8_t r = 0; r < _pending; r++) {
+        const uint8_t* record = _frame + HEADER_SIZE + r * RECORD_SIZE;
+
+        // Nobody negotiated binary - one broadcast per note, as before
+        if (!anyBinary) {
+            _ws->textAll(_json, formatJson(record));
+            _jsonMessagesSent++;
+            continue;
+        }
+
+        int jsonLen = -1;
+        for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+            if (!clients[i].used || clients[i].binary) continue;
+            if (jsonLen < 0) jsonLen = formatJson(record);
+            _ws->text(clients[i].id, _json, jsonLen);
+            _jsonMessagesSent++;
+        }
+    }
+
+    if (anyBinary) {
+        for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+            if (clients[i].used && clients[i].binary) {
+                _ws->binary(clients[i].id, _frame, frameLen);
+                _binaryFramesSent++;
+            }
+        }
+    }
+
+    _batchesSent++;
+    _notesSent += _pending;
+    _pending = 0;
+}
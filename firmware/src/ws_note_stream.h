@@ -0,0 +1,85 @@
+#ifndef WS_NOTE_STREAM_H
+#define WS_NOTE_STREAM_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "config.h"
+#include "midi_event_ring.h"
+
+// Sends played notes to WebSocket clients.
+//
+// Clients that opt in with {"type":"hello","payload":{"binary_notes":1}}
+// receive binary frames instead of the JSON midi_note message. All fields
+// are little-endian:
+//
+//   header (4 bytes)   'P' 'N' version count
+//   record (8 bytes)   note velocity flags source timeUs[4]
+//
+// flags bit 0 = note on. timeUs is the MidiEvent timestamp.
+//
+// Notes are coalesced: the network stage queues them and a batch goes out
+// once the oldest queued note is WS_NOTE_BATCH_MS old, or as soon as it
+// holds WS_NOTE_BATCH_MAX records. Binary clients get one frame per batch
+// with the records in arrival order. Clients that never send hello keep
+// getting one JSON midi_note message per note, sent together at the flush.
+// Both formats are built in preallocated buffers.
+class WsNoteStream {
+public:
+    static const uint8_t HEADER_SIZE = 4;
+    static const uint8_t RECORD_SIZE = 8;
+    static const uint8_t FLAG_NOTE_ON = 0x01;
+
+    explicit WsNoteStream(AsyncWebSocket* ws);
+
+    // Client bookkeeping - called from the WebSocket event handler
+    void onConnect(uint32_t clientId);
+    void onDisconnect(uint32_t clientId);
+    bool setBinary(uint32_t clientId, bool enabled);  // false if the client is not tracked
+
+    // Network stage - queue a note on/off, then poll() until the batch is sent
+    void queueNote(const MidiEvent& ev);
+    void poll();
+    void flush();       // Send the queued batch now
+    uint32_t getFlushDelayUs() const;   // Until poll() sends the batch, UINT32_MAX if empty
+
+    void setBatchWindowMs(uint8_t ms);
+    uint8_t getBatchWindowMs() const;
+
+    uint8_t getBinaryClientCount() const;
+    uint32_t getBinaryFramesSent() const;
+    uint32_t getJsonMessagesSent() const;
+    uint32_t getBatchesSent() const;
+    uint32_t getNotesSent() const;
+    uint32_t getFullBatches() const;    // Flushed early by WS_NOTE_BATCH_MAX
+
+    static void encodeRecord(uint8_t* out, const MidiEvent& ev);
+
+private:
+    struct Client {
+        uint32_t id;
+        bool used;
+        bool binary;
+    };
+
+    AsyncWebSocket* _ws;
+    Client _clients[WS_MAX_CLIENTS];
+    mutable portMUX_TYPE _mux;       // Clients change on the AsyncTCP task
+
+    uint8_t _frame[HEADER_SIZE + WS_NOTE_BATCH_MAX * RECORD_SIZE];
+    uint8_t _pending;                // Records queued in _frame
+    uint32_t _batchStartUs;          // When the oldest queued record arrived
+    uint8_t _batchWindowMs;
+    char _json[80];
+
+    uint32_t _binaryFramesSent;
+    uint32_t _jsonMessagesSent;
+    uint32_t _batchesSent;
+    uint32_t _notesSent;
+    uint32_t _fullBatches;
+
+    int formatJson(const uint8_t* record);
+};
+
+extern WsNoteStream* noteStream;
+
+#endif // WS_NOTE_STREAM_H